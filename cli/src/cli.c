@@ -1,8 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
 #include "binary_format.h"
+#include "codecache.h"
 #include "executor.h"
+#include "snapshot.h"
 
 static void print_help()
 {
@@ -11,6 +15,16 @@ static void print_help()
     printf("./litenvm --help - to see the help menu\n");
     printf("./litenvm --print <lvm-file> - to print information about the program such as constant pool and instruction stream\n");
     printf("./litenvm <lvm-file> - to run the program stored inside the lvm file\n");
+    printf("./litenvm --huge-pages <lvm-file> - to run the program with the heap, stacks and code backed by 2 MB pages where available\n");
+    printf("./litenvm --lazy <lvm-file> - to run the program and only decode the classes and methods that it uses\n");
+    printf("./litenvm --cache <directory> <lvm-file> - to run the program from a linked image in the directory, linking and storing it on the first run\n");
+    printf("./litenvm --heap-limit <bytes> <lvm-file> - to stop the program if it keeps more than the given number of bytes alive\n");
+    printf("./litenvm --convert <v1|v2> <v1|v2> <lvm-file> <output-file> - to convert a program between versions of the binary format\n");
+    printf("./litenvm --link <lvm-file> <output-file> - to store the program as a linked image that starts without linking\n");
+    printf("./litenvm --compact <lvm-file> <output-file> - to store the program with compact code of 1 to 5 bytes per instruction\n");
+    printf("./litenvm --compress <lvm-file> <output-file> - to store a version 2 program with every section compressed\n");
+    printf("./litenvm --snapshot <address> <lvm-file> <snapshot-file> - to run the program up to the instruction at the address and store its state\n");
+    printf("./litenvm --restore <lvm-file> <snapshot-file> - to run the program from the state stored in a snapshot\n");
 }
 
 static void print_version()
@@ -18,16 +32,349 @@ static void print_version()
     printf("LitenVM VERSION %s\n", LITENVM_VERSION);
 }
 
-static FILE *open_file(const char *filename)
+// Set by --lazy, the constant pool is then only indexed at start and its entries are decoded when first used.
+static bool lazy_constants = false;
+
+// The program is parsed in place, so the file stays mapped for as long as the program runs.
+static bool load_file(const char *filename, ConstantPool **constpool, InstructionStream **inststream)
 {
-    FILE *file = fopen(filename, "rb");
+    MappedFile *file = binform_map_file(filename);
 
     if (!file)
     {
         printf("Could not open the file: %s\n", filename);
+        return false;
+    }
+
+    *constpool = lazy_constants ? binform_map_constantpool_lazy(file) : binform_map_constantpool(file);
+    *inststream = *constpool ? binform_map_instructions(file) : NULL;
+
+    if (!*inststream)
+    {
+        printf("Could not read the program in the file: %s\n", filename);
+        return false;
+    }
+
+    return true;
+}
+
+static Executor *new_executor(ConstantPool *constpool, InstructionStream *inststream)
+{
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    constantpool_create_strings(constpool);
+    Executor *executor = executor_new(constpool, inststream);
+    if (!executor)
+    {
+        printf("Could not reserve %zu frames for the stacks of the program\n", config.max_stack_depth);
+        exit(1);
+    }
+    return executor;
+}
+
+static int report_error(Executor *executor)
+{
+    if (executor->error == EXECUTOR_STACK_OVERFLOW)
+    {
+        printf("Stack overflow at instruction %u\n", (unsigned)executor->inststream->current);
+        return 1;
+    }
+    if (executor->error == EXECUTOR_OUT_OF_MEMORY)
+    {
+        printf("Out of memory: %zu bytes live with a heap limit of %zu bytes\n", executor_live_bytes(executor), config.heap_limit);
+        return 1;
+    }
+    return 0;
+}
+
+static int run_file(const char *filename)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+
+    if (load_file(filename, &constpool, &inststream))
+    {
+        Executor *executor = new_executor(constpool, inststream);
+        executor_step_all(executor);
+        return report_error(executor);
+    }
+
+    return 1;
+}
+
+// Images of every program run with --cache take at most this much of the cache directory.
+#define CACHE_MAX_SIZE (256 * 1024 * 1024)
+
+static int run_cached_file(const char *directory, const char *filename)
+{
+    CodeCache *cache = codecache_new(directory, LITENVM_VERSION, CACHE_MAX_SIZE);
+    MappedFile *program = binform_map_file(filename);
+
+    if (!cache)
+    {
+        printf("Could not create the cache directory: %s\n", directory);
+        if (program)
+        {
+            binform_unmap_file(program);
+        }
+        return run_file(filename);
+    }
+    if (!program)
+    {
+        printf("Could not open the file: %s\n", filename);
+        codecache_free(cache);
+        return 1;
+    }
+
+    uint64_t key = codecache_key(cache, program->data, program->size, 0);
+    binform_unmap_file(program);
+
+    MappedFile *file;
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    Executor *executor = NULL;
+
+    if (codecache_load(cache, key, &file, &constpool, &inststream))
+    {
+        executor = new_executor(constpool, inststream);
+    }
+    else if (load_file(filename, &constpool, &inststream))
+    {
+        // Stored before running, so the image holds the program as it was linked and not as the run left it.
+        executor = new_executor(constpool, inststream);
+        codecache_store(cache, key, constpool, inststream);
+    }
+
+    codecache_free(cache);
+    if (executor)
+    {
+        executor_step_all(executor);
+        return report_error(executor);
+    }
+    return 1;
+}
+
+static int snapshot_file(const char *address, const char *filename, const char *output)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+
+    if (!load_file(filename, &constpool, &inststream))
+    {
+        return 1;
+    }
+
+    Executor *executor = new_executor(constpool, inststream);
+
+    if (!executor_step_until(executor, strtoul(address, NULL, 10)))
+    {
+        if (!report_error(executor))
+        {
+            printf("The program finished before reaching instruction %s\n", address);
+        }
+        return 1;
+    }
+
+    FILE *out = fopen(output, "wb");
+
+    if (!out)
+    {
+        printf("Could not open the file: %s\n", output);
+        return 1;
+    }
+
+    bool written = snapshot_write(executor, out);
+    fclose(out);
+
+    if (!written)
+    {
+        printf("Could not write the snapshot: %s\n", output);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int restore_file(const char *filename, const char *snapshot)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+
+    if (!load_file(filename, &constpool, &inststream))
+    {
+        return 1;
+    }
+
+    Executor *executor = new_executor(constpool, inststream);
+
+    switch (snapshot_restore(executor, snapshot))
+    {
+    case SNAPSHOT_CANNOT_OPEN:
+        printf("Could not open the file: %s\n", snapshot);
+        return 1;
+    case SNAPSHOT_INVALID:
+        printf("Could not read the snapshot in the file: %s\n", snapshot);
+        return 1;
+    case SNAPSHOT_WRONG_PROGRAM:
+        printf("The snapshot was not taken from this program: %s\n", snapshot);
+        return 1;
     }
 
-    return file;
+    executor_step_all(executor);
+    return report_error(executor);
+}
+
+static uint32_t parse_version(const char *version)
+{
+    if (strcmp(version, "v1") == 0)
+    {
+        return BINFORM_VERSION_1;
+    }
+    if (strcmp(version, "v2") == 0)
+    {
+        return BINFORM_VERSION_2;
+    }
+    return 0;
+}
+
+static int convert_file(const char *from, const char *to, const char *filename, const char *output)
+{
+    uint32_t from_version = parse_version(from);
+    uint32_t to_version = parse_version(to);
+
+    if (!from_version || !to_version)
+    {
+        printf("Unknown binary format version, use v1 or v2\n");
+        return 1;
+    }
+
+    MappedFile *file = binform_map_file(filename);
+
+    if (!file)
+    {
+        printf("Could not open the file: %s\n", filename);
+        return 1;
+    }
+    if (binform_version(file) != from_version)
+    {
+        printf("The file is not a %s program: %s\n", from, filename);
+        binform_unmap_file(file);
+        return 1;
+    }
+
+    ConstantPool *constpool = binform_map_constantpool(file);
+    InstructionStream *inststream = constpool ? binform_map_instructions(file) : NULL;
+    FILE *out = inststream ? fopen(output, "wb") : NULL;
+
+    if (!inststream)
+    {
+        printf("Could not read the program in the file: %s\n", filename);
+    }
+    else if (!out)
+    {
+        printf("Could not open the file: %s\n", output);
+    }
+    else
+    {
+        binform_write_program(out, constpool, inststream, to_version);
+        fclose(out);
+    }
+
+    if (constpool)
+    {
+        constantpool_free(constpool);
+    }
+    if (inststream)
+    {
+        inststream_free(inststream);
+    }
+    binform_unmap_file(file);
+    return out ? 0 : 1;
+}
+
+static int link_file(const char *filename, const char *output)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+
+    if (!load_file(filename, &constpool, &inststream))
+    {
+        return 1;
+    }
+
+    FILE *out = fopen(output, "wb");
+
+    if (!out)
+    {
+        printf("Could not open the file: %s\n", output);
+        return 1;
+    }
+
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    binform_write_image(out, constpool, inststream);
+    fclose(out);
+    return 0;
+}
+
+static int compact_file(const char *filename, const char *output)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+
+    if (!load_file(filename, &constpool, &inststream))
+    {
+        return 1;
+    }
+
+    FILE *out = fopen(output, "wb");
+
+    if (!out)
+    {
+        printf("Could not open the file: %s\n", output);
+        return 1;
+    }
+
+    binform_write_compact(out, constpool, inststream);
+    fclose(out);
+    return 0;
+}
+
+static int compress_file(const char *filename, const char *output)
+{
+    MappedFile *file = binform_map_file(filename);
+
+    if (!file)
+    {
+        printf("Could not open the file: %s\n", filename);
+        return 1;
+    }
+
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    uint32_t result = binform_compress(&buffer, file->data, file->size);
+    binform_unmap_file(file);
+    FILE *out = result == BINFORM_OK ? fopen(output, "wb") : NULL;
+
+    if (result == BINFORM_ERROR_VERSION)
+    {
+        printf("Only version 2 programs can be compressed, convert the file first: %s\n", filename);
+    }
+    else if (result != BINFORM_OK)
+    {
+        printf("Could not read the program in the file: %s\n", filename);
+    }
+    else if (!out)
+    {
+        printf("Could not open the file: %s\n", output);
+    }
+    else
+    {
+        fwrite(buffer.data, buffer.size, 1, out);
+        fclose(out);
+    }
+
+    binform_buffer_free(&buffer);
+    return out ? 0 : 1;
 }
 
 int main(int argc, char *argv[])
@@ -42,27 +389,60 @@ int main(int argc, char *argv[])
     }
     else if (argc == 3 && strcmp(argv[1], "--print") == 0)
     {
-        FILE *file = open_file(argv[2]);
+        ConstantPool *constpool;
+        InstructionStream *inststream;
 
-        if (file)
+        if (load_file(argv[2], &constpool, &inststream))
         {
-            ConstantPool *constpool = binform_read_constantpool(file);
-            InstructionStream *inststream = binform_read_instructions(file);
             binform_print(constpool, inststream);
         }
     }
+    else if (argc == 3 && strcmp(argv[1], "--huge-pages") == 0)
+    {
+        config.huge_pages = true;
+        return run_file(argv[2]);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--lazy") == 0)
+    {
+        lazy_constants = true;
+        return run_file(argv[2]);
+    }
+    else if (argc == 4 && strcmp(argv[1], "--cache") == 0)
+    {
+        return run_cached_file(argv[2], argv[3]);
+    }
+    else if (argc == 4 && strcmp(argv[1], "--heap-limit") == 0)
+    {
+        config.heap_limit = strtoull(argv[2], NULL, 10);
+        return run_file(argv[3]);
+    }
+    else if (argc == 4 && strcmp(argv[1], "--link") == 0)
+    {
+        return link_file(argv[2], argv[3]);
+    }
+    else if (argc == 4 && strcmp(argv[1], "--compact") == 0)
+    {
+        return compact_file(argv[2], argv[3]);
+    }
+    else if (argc == 4 && strcmp(argv[1], "--compress") == 0)
+    {
+        return compress_file(argv[2], argv[3]);
+    }
+    else if (argc == 5 && strcmp(argv[1], "--snapshot") == 0)
+    {
+        return snapshot_file(argv[2], argv[3], argv[4]);
+    }
+    else if (argc == 4 && strcmp(argv[1], "--restore") == 0)
+    {
+        return restore_file(argv[2], argv[3]);
+    }
+    else if (argc == 6 && strcmp(argv[1], "--convert") == 0)
+    {
+        return convert_file(argv[2], argv[3], argv[4], argv[5]);
+    }
     else if (argc == 2)
     {
-        FILE *file = open_file(argv[1]);
-
-        if (file)
-        {
-            ConstantPool *constpool = binform_read_constantpool(file);
-            InstructionStream *inststream = binform_read_instructions(file);
-            constantpool_compute_vtables(constpool);
-            Executor *executor = executor_new(constpool, inststream);
-            executor_step_all(executor);
-        }
+        return run_file(argv[1]);
     }
     else
     {
@@ -0,0 +1,173 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "codecache.h"
+
+#define FILE_NAME "cache_bench.lvm"
+#define DIRECTORY "cache_bench"
+#define ENTRIES_PER_CLASS 10
+#define METHODS_PER_CLASS 6
+#define HIERARCHY_DEPTH 4
+#define INSTRUCTIONS_PER_METHOD 8
+#define ROUNDS 5
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static const char *method_names[] = {"get", "set", "size", "visit", "equals", "hash"};
+
+// Small class hierarchies with a body for every method, so linking has vtables and layouts to compute for every class.
+static void write_program(uint32_t classes)
+{
+    ConstantPool *constpool = constantpool_new(classes * ENTRIES_PER_CLASS);
+    InstructionStream *inststream = inststream_new(classes * METHODS_PER_CLASS * INSTRUCTIONS_PER_METHOD);
+    for (uint32_t k = 0; k < classes; k++)
+    {
+        uint32_t base = 1 + k * ENTRIES_PER_CLASS;
+        uint32_t depth = k % HIERARCHY_DEPTH + 1;
+        uint32_t parent = depth > 1 ? base - ENTRIES_PER_CLASS : 0;
+        constantpool_add(constpool, base, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Generated", .fields = 2, .methods = METHODS_PER_CLASS * depth, .parent = parent}});
+        constantpool_add(constpool, base + 1, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "left", ._class = base, .index = 2 * depth - 2}});
+        constantpool_add(constpool, base + 2, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "right", ._class = base, .index = 2 * depth - 1}});
+        for (uint32_t m = 0; m < METHODS_PER_CLASS; m++)
+        {
+            uint32_t address = (k * METHODS_PER_CLASS + m) * INSTRUCTIONS_PER_METHOD;
+            constantpool_add(constpool, base + 3 + m, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = (char *)method_names[m], ._class = base, .address = address, .args = 2, .locals = 1}});
+            Instruction *code = inststream->instructions + address;
+            code[0] = (Instruction){PUSH_VAR, 0};
+            code[1] = (Instruction){PUSH_FIELD, base + 1};
+            code[2] = (Instruction){PUSH_VAR, 1};
+            code[3] = (Instruction){ADD, 0};
+            code[4] = (Instruction){PUSH, address % 1000};
+            code[5] = (Instruction){ADD, 0};
+            code[6] = (Instruction){POP_FIELD, base + 2};
+            code[7] = (Instruction){RETURN, 0};
+        }
+        constantpool_add(constpool, base + 3 + METHODS_PER_CLASS, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "generated"}});
+    }
+
+    FILE *file = fopen(FILE_NAME, "wb");
+    binform_write_program(file, constpool, inststream, BINFORM_VERSION_2);
+    fclose(file);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+static void remove_directory()
+{
+    DIR *directory = opendir(DIRECTORY);
+    if (directory)
+    {
+        for (struct dirent *entry = readdir(directory); entry; entry = readdir(directory))
+        {
+            if (entry->d_name[0] != '.')
+            {
+                unlinkat(dirfd(directory), entry->d_name, 0);
+            }
+        }
+        closedir(directory);
+    }
+    rmdir(DIRECTORY);
+}
+
+static void check(bool loaded)
+{
+    if (!loaded)
+    {
+        printf("The program could not be loaded\n");
+        exit(1);
+    }
+}
+
+// Everything a run does before its first instruction, in milliseconds: hashing the program, then either loading its
+// image or decoding, linking and storing it.
+static double start(CodeCache *cache, bool *hit)
+{
+    uint64_t begin = now_ns();
+    MappedFile *program = binform_map_file(FILE_NAME);
+    check(program != NULL);
+    uint64_t key = codecache_key(cache, program->data, program->size, 0);
+
+    MappedFile *file;
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    *hit = codecache_load(cache, key, &file, &constpool, &inststream);
+    if (!*hit)
+    {
+        file = program;
+        program = NULL;
+        constpool = binform_map_constantpool(file);
+        inststream = binform_map_instructions(file);
+        check(constpool && inststream);
+        constantpool_compute_vtables(constpool);
+        constantpool_compute_layouts(constpool, inststream);
+        check(codecache_store(cache, key, constpool, inststream));
+    }
+    double time = (now_ns() - begin) / 1e6;
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+    if (program)
+    {
+        binform_unmap_file(program);
+    }
+    return time;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t classes = argc > 1 ? (uint32_t)atol(argv[1]) : 100000;
+    write_program(classes);
+    remove_directory();
+    CodeCache *cache = codecache_new(DIRECTORY, "bench", (size_t)1 << 32);
+
+    MappedFile *program = binform_map_file(FILE_NAME);
+    double hashing = 0;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        uint64_t begin = now_ns();
+        volatile uint64_t key = codecache_key(cache, program->data, program->size, 0);
+        (void)key;
+        double time = (now_ns() - begin) / 1e9;
+        hashing = i == 0 || time < hashing ? time : hashing;
+    }
+    printf("%u entries, %.2f MB program, key hashed at %.0f MB/s\n", classes * ENTRIES_PER_CLASS, program->size / 1e6, program->size / 1e6 / hashing);
+    binform_unmap_file(program);
+
+    double cold = 0;
+    double warm = 0;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        // Emptying the directory makes every cold start a miss.
+        remove_directory();
+        codecache_free(cache);
+        cache = codecache_new(DIRECTORY, "bench", (size_t)1 << 32);
+
+        bool hit;
+        double time = start(cache, &hit);
+        check(!hit);
+        cold = i == 0 || time < cold ? time : cold;
+        time = start(cache, &hit);
+        check(hit);
+        warm = i == 0 || time < warm ? time : warm;
+    }
+
+    printf("start        time (ms)\n");
+    printf("%-12s %9.2f\n", "miss", cold);
+    printf("%-12s %9.2f\n", "hit", warm);
+    printf("speedup      %8.2fx\n", cold / warm);
+
+    codecache_free(cache);
+    remove_directory();
+    remove(FILE_NAME);
+    return 0;
+}
\ No newline at end of file
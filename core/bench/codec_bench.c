@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "binary_format.h"
+
+#define FILE_NAME "codec_bench.lvm"
+#define ROUNDS 5
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void free_program(ConstantPool *constpool, InstructionStream *inststream)
+{
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        config._free(constantpool_get(constpool, i)->data.method.name);
+    }
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+static double encode(ConstantPool *constpool, InstructionStream *inststream, uint32_t version, BinformBuffer *buffer)
+{
+    uint64_t start = now_ns();
+    binform_write_to_buffer(buffer, constpool, inststream, version);
+    return (now_ns() - start) / 1e9;
+}
+
+static double decode(BinformBuffer *buffer)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    uint64_t start = now_ns();
+    binform_read_from_buffer(buffer->data, buffer->size, &constpool, &inststream);
+    double elapsed = (now_ns() - start) / 1e9;
+    free_program(constpool, inststream);
+    return elapsed;
+}
+
+static double write_file(ConstantPool *constpool, InstructionStream *inststream, uint32_t version)
+{
+    FILE *file = fopen(FILE_NAME, "wb");
+    uint64_t start = now_ns();
+    binform_write_program(file, constpool, inststream, version);
+    fflush(file);
+    double elapsed = (now_ns() - start) / 1e9;
+    fclose(file);
+    return elapsed;
+}
+
+static double read_file()
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    FILE *file = fopen(FILE_NAME, "rb");
+    uint64_t start = now_ns();
+    binform_read_program(file, &constpool, &inststream);
+    double elapsed = (now_ns() - start) / 1e9;
+    fclose(file);
+    free_program(constpool, inststream);
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t instructions = argc > 1 ? (uint32_t)atol(argv[1]) : 4000000;
+    uint32_t constants = instructions / 20;
+
+    // Mostly code with a constant pool of methods, the shape of a large compiled program.
+    ConstantPool *constpool = constantpool_new(constants);
+    for (uint32_t i = 1; i <= constants; i++)
+    {
+        constantpool_add(constpool, i, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "someMethodName", ._class = 1, .address = i, .args = 1, .locals = 2}});
+    }
+    InstructionStream *inststream = inststream_new(instructions);
+    for (uint32_t i = 0; i < instructions; i++)
+    {
+        inststream->instructions[i] = (Instruction){.opcode = i % (DUP + 1), .operand = i};
+    }
+
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    printf("version    size (MB)    encode (MB/s)    decode (MB/s)    file write (MB/s)    file read (MB/s)\n");
+    for (uint32_t version = BINFORM_VERSION_1; version <= BINFORM_VERSION_2; version++)
+    {
+        double encoding = encode(constpool, inststream, version, &buffer);
+        double decoding = decode(&buffer);
+        double writing = write_file(constpool, inststream, version);
+        double reading = read_file();
+        for (int i = 1; i < ROUNDS; i++)
+        {
+            double time = encode(constpool, inststream, version, &buffer);
+            encoding = time < encoding ? time : encoding;
+            time = decode(&buffer);
+            decoding = time < decoding ? time : decoding;
+            time = write_file(constpool, inststream, version);
+            writing = time < writing ? time : writing;
+            time = read_file();
+            reading = time < reading ? time : reading;
+        }
+        double size = buffer.size / 1e6;
+        printf("%7u %12.1f %16.0f %16.0f %20.0f %19.0f\n", version, size, size / encoding, size / decoding, size / writing, size / reading);
+    }
+
+    binform_buffer_free(&buffer);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    remove(FILE_NAME);
+    return 0;
+}
\ No newline at end of file
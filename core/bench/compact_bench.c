@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "binary_format.h"
+#include "executor.h"
+
+#define FILE_NAME "compact_bench.lvm"
+#define ITERATIONS 20
+#define ROUNDS 5
+
+// Instructions of the method that are not part of its body.
+#define LOOP_START 4
+#define LOOP_INSTRUCTIONS 13
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// A single large method that runs its straight-line body in a loop, its immediates are small like those of compiled code.
+static void new_program(uint32_t blocks, ConstantPool **constpool, InstructionStream **inststream)
+{
+    *constpool = constantpool_new(2);
+    constantpool_add(*constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(*constpool, 2, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = 1, .address = 2, .args = 1, .locals = 2}});
+
+    uint32_t length = LOOP_INSTRUCTIONS + 10 * blocks;
+    *inststream = inststream_new(length);
+    Instruction *code = (*inststream)->instructions;
+    uint32_t i = 0;
+    code[i++] = (Instruction){NEW, 1};
+    code[i++] = (Instruction){CALL, 2};
+    code[i++] = (Instruction){PUSH, 0};
+    code[i++] = (Instruction){POP_VAR, 1};
+    code[i++] = (Instruction){PUSH_VAR, 1};
+    code[i++] = (Instruction){PUSH, ITERATIONS};
+    code[i++] = (Instruction){JUMP_GE, length - 1};
+    for (uint32_t k = 0; k < blocks; k++)
+    {
+        uint32_t small = k % 200 + 1;
+        uint32_t large = 1000 + k % 60000;
+        code[i++] = (Instruction){PUSH_VAR, 2};
+        code[i++] = (Instruction){PUSH, small};
+        code[i++] = (Instruction){ADD, 0};
+        code[i++] = (Instruction){DUP, 0};
+        code[i++] = (Instruction){POP, 0};
+        code[i++] = (Instruction){PUSH, large};
+        code[i++] = (Instruction){SUB, 0};
+        code[i++] = (Instruction){PUSH, large - small};
+        code[i++] = (Instruction){ADD, 0};
+        code[i++] = (Instruction){POP_VAR, 2};
+    }
+    code[i++] = (Instruction){PUSH_VAR, 1};
+    code[i++] = (Instruction){PUSH, 1};
+    code[i++] = (Instruction){ADD, 0};
+    code[i++] = (Instruction){POP_VAR, 1};
+    code[i++] = (Instruction){JUMP, LOOP_START};
+    code[i++] = (Instruction){RETURN, 0};
+}
+
+static void write_file(ConstantPool *constpool, InstructionStream *inststream, int format)
+{
+    FILE *file = fopen(FILE_NAME, "wb");
+    if (format == 3)
+    {
+        binform_write_compact(file, constpool, inststream);
+    }
+    else
+    {
+        binform_write_program(file, constpool, inststream, format);
+    }
+    fclose(file);
+}
+
+// Loads the program the way litenvm does and then runs it, the returned times are in milliseconds.
+static void load_and_run(double *loading, double *running)
+{
+    uint64_t start = now_ns();
+    MappedFile *file = binform_map_file(FILE_NAME);
+    ConstantPool *constpool = binform_map_constantpool(file);
+    InstructionStream *inststream = binform_map_instructions(file);
+    uint64_t loaded = now_ns();
+
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    Executor *executor = executor_new(constpool, inststream);
+    uint64_t started = now_ns();
+    executor_step_all(executor);
+    uint64_t finished = now_ns();
+
+    *loading = (loaded - start) / 1e6;
+    *running = (finished - started) / 1e6;
+    executor_free(executor);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t blocks = argc > 1 ? (uint32_t)atol(argv[1]) : 100000;
+    const char *formats[] = {"", "version 1", "version 2", "compact"};
+
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    new_program(blocks, &constpool, &inststream);
+    double executed = (double)ITERATIONS * 10 * blocks;
+
+    printf("%u instructions in one method\n", inststream->length);
+    printf("format       code (bytes/instruction)    file (MB)    load (ms)    run (M instructions/s)\n");
+    for (int format = 1; format <= 3; format++)
+    {
+        write_file(constpool, inststream, format);
+        MappedFile *file = binform_map_file(FILE_NAME);
+        double size = file->size / 1e6;
+        binform_unmap_file(file);
+
+        double loading, running;
+        load_and_run(&loading, &running);
+        for (int i = 1; i < ROUNDS; i++)
+        {
+            double load_time, run_time;
+            load_and_run(&load_time, &run_time);
+            loading = load_time < loading ? load_time : loading;
+            running = run_time < running ? run_time : running;
+        }
+
+        // Everything in the file besides the code is a few hundred bytes.
+        printf("%-12s %26.2f %12.2f %12.2f %25.0f\n", formats[format], size * 1e6 / inststream->length, size, loading, executed / running / 1e3);
+    }
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    remove(FILE_NAME);
+    return 0;
+}
\ No newline at end of file
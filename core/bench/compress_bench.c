@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "binary_format.h"
+
+#define FILE_NAME "compress_bench.lvm"
+#define COMPRESSED_FILE_NAME "compress_bench.lvmz"
+#define ENTRIES_PER_CLASS 8
+#define METHODS_PER_CLASS 6
+#define ROUNDS 5
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static const char *method_names[] = {"get", "set", "size", "visit", "equals", "hash"};
+
+// Generated classes with the usual few method names and a method body for each, in the shape of compiled code.
+static void new_program(uint32_t classes, ConstantPool **constpool, InstructionStream **inststream)
+{
+    *constpool = constantpool_new(2 + classes * ENTRIES_PER_CLASS);
+    constantpool_add(*constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0}});
+    constantpool_add(*constpool, 2, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = 1, .address = 2, .args = 1, .locals = 0}});
+
+    uint32_t body = 8;
+    *inststream = inststream_new(4 + classes * METHODS_PER_CLASS * body);
+    Instruction *code = (*inststream)->instructions;
+    code[0] = (Instruction){NEW, 1};
+    code[1] = (Instruction){CALL, 2};
+    code[2] = (Instruction){PUSH, 1};
+    code[3] = (Instruction){RETURN, 0};
+
+    for (uint32_t k = 0; k < classes; k++)
+    {
+        uint32_t base = 3 + k * ENTRIES_PER_CLASS;
+        constantpool_add(*constpool, base, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Generated", .fields = 1, .methods = METHODS_PER_CLASS, .parent = 0}});
+        constantpool_add(*constpool, base + 1, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "value", ._class = base, .index = 0}});
+        for (uint32_t m = 0; m < METHODS_PER_CLASS; m++)
+        {
+            uint32_t address = 4 + (k * METHODS_PER_CLASS + m) * body;
+            constantpool_add(*constpool, base + 2 + m, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = (char *)method_names[m], ._class = base, .address = address, .args = 2, .locals = 1}});
+            code[address] = (Instruction){PUSH_VAR, 0};
+            code[address + 1] = (Instruction){PUSH_FIELD, base + 1};
+            code[address + 2] = (Instruction){PUSH_VAR, 1};
+            code[address + 3] = (Instruction){ADD, 0};
+            code[address + 4] = (Instruction){DUP, 0};
+            code[address + 5] = (Instruction){POP_VAR, 2};
+            code[address + 6] = (Instruction){POP, 0};
+            code[address + 7] = (Instruction){RETURN, 0};
+        }
+    }
+}
+
+static void write_file(const char *name, const char *data, size_t size)
+{
+    FILE *file = fopen(name, "wb");
+    fwrite(data, size, 1, file);
+    fclose(file);
+}
+
+// Maps the program, decodes its constant pool and code and frees them again, in milliseconds.
+static double load(const char *name)
+{
+    double best = 0;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        uint64_t start = now_ns();
+        MappedFile *file = binform_map_file(name);
+        ConstantPool *constpool = binform_map_constantpool(file);
+        InstructionStream *inststream = binform_map_instructions(file);
+        uint64_t loaded = now_ns();
+        if (!constpool || !inststream)
+        {
+            printf("The program could not be loaded\n");
+            exit(1);
+        }
+        constantpool_free(constpool);
+        inststream_free(inststream);
+        binform_unmap_file(file);
+
+        double time = (loaded - start) / 1e6;
+        best = i == 0 || time < best ? time : best;
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t classes = argc > 1 ? (uint32_t)atol(argv[1]) : 20000;
+    const char *kinds[] = {"version 2", "compact", "image"};
+
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    new_program(classes, &constpool, &inststream);
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+
+    printf("%u entries, %u instructions\n", constpool->length, inststream->length);
+    printf("kind         size (MB)    compressed (MB)    ratio    compress (MB/s)    load (ms)    compressed load (ms)\n");
+    for (int kind = 0; kind < 3; kind++)
+    {
+        FILE *file = fopen(FILE_NAME, "wb");
+        if (kind == 0)
+        {
+            binform_write_program(file, constpool, inststream, BINFORM_VERSION_2);
+        }
+        else if (kind == 1)
+        {
+            binform_write_compact(file, constpool, inststream);
+        }
+        else
+        {
+            binform_write_image(file, constpool, inststream);
+        }
+        fclose(file);
+
+        MappedFile *mapped = binform_map_file(FILE_NAME);
+        BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+        double compressing = 0;
+        for (int i = 0; i < ROUNDS; i++)
+        {
+            uint64_t start = now_ns();
+            binform_compress(&buffer, mapped->data, mapped->size);
+            double time = (now_ns() - start) / 1e9;
+            compressing = i == 0 || time < compressing ? time : compressing;
+        }
+        write_file(COMPRESSED_FILE_NAME, buffer.data, buffer.size);
+
+        printf("%-12s %9.2f %18.2f %8.2f %18.0f %12.2f %23.2f\n", kinds[kind], mapped->size / 1e6, buffer.size / 1e6, (double)mapped->size / buffer.size,
+               mapped->size / 1e6 / compressing, load(FILE_NAME), load(COMPRESSED_FILE_NAME));
+        binform_buffer_free(&buffer);
+        binform_unmap_file(mapped);
+    }
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    remove(FILE_NAME);
+    remove(COMPRESSED_FILE_NAME);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "executor.h"
+
+#define CLASS_MAIN 1
+#define METHOD_MAIN 2
+#define CLASS_NODE 3
+#define FIELD_NEXT 4
+#define FIELD_VALUE 5
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Builds rounds linked lists of nodes elements each, the previous list becomes garbage when the next round starts.
+static InstructionStream *build_program(uint32_t nodes, uint32_t rounds)
+{
+    Instruction program[] = {
+        {NEW, CLASS_MAIN},
+        {CALL, METHOD_MAIN},
+        // round = 0
+        {PUSH, 0},
+        {POP_VAR, 3},
+        // list = null, i = 0
+        {PUSH, 0},
+        {POP_VAR, 1},
+        {PUSH, 0},
+        {POP_VAR, 2},
+        // list = new Node(list, i)
+        {NEW, CLASS_NODE},
+        {DUP, 0},
+        {PUSH_VAR, 1},
+        {POP_FIELD, FIELD_NEXT},
+        {DUP, 0},
+        {PUSH_VAR, 2},
+        {POP_FIELD, FIELD_VALUE},
+        {POP_VAR, 1},
+        // while (++i < nodes)
+        {PUSH_VAR, 2},
+        {PUSH, 1},
+        {ADD, 0},
+        {DUP, 0},
+        {POP_VAR, 2},
+        {PUSH, nodes},
+        {JUMP_LT, 8},
+        // while (++round < rounds)
+        {PUSH_VAR, 3},
+        {PUSH, 1},
+        {ADD, 0},
+        {DUP, 0},
+        {POP_VAR, 3},
+        {PUSH, rounds},
+        {JUMP_LT, 4},
+        {RETURN, 0},
+    };
+
+    uint32_t length = sizeof(program) / sizeof(Instruction);
+    InstructionStream *inststream = inststream_new(length);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        inststream->instructions[i] = program[i];
+    }
+    return inststream;
+}
+
+static ConstantPool *build_constpool()
+{
+    ConstantPool *constpool = constantpool_new(5);
+    constantpool_add(constpool, CLASS_MAIN, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, METHOD_MAIN, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = CLASS_MAIN, .address = 2, .args = 1, .locals = 3}});
+    constantpool_add(constpool, CLASS_NODE, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Node", .fields = 2, .methods = 0, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, FIELD_NEXT, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "next", ._class = CLASS_NODE, .index = 0}});
+    constantpool_add(constpool, FIELD_VALUE, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "value", ._class = CLASS_NODE, .index = 1}});
+    constantpool_compute_vtables(constpool);
+    return constpool;
+}
+
+static void run(const char *name, size_t increment_size, uint32_t nodes, uint32_t rounds)
+{
+    config.gc_increment_size = increment_size;
+    ConstantPool *constpool = build_constpool();
+    InstructionStream *inststream = build_program(nodes, rounds);
+    Executor *executor = executor_new(constpool, inststream);
+
+    uint64_t start = now_ns();
+    executor_step_all(executor);
+    uint64_t elapsed = now_ns() - start;
+
+    HeapStats *stats = &executor->heap->stats;
+    printf("%s (increment size %zu)\n", name, increment_size);
+    printf("  total time:        %.1f ms\n", elapsed / 1e6);
+    printf("  major collections: %zu\n", stats->collections);
+    printf("  minor collections: %zu\n", stats->minor_collections);
+    printf("  total pause:       %.1f ms\n", stats->total_pause_ns / 1e6);
+    printf("  max pause:         %.1f us\n", stats->max_pause_ns / 1e3);
+    printf("  pause histogram:\n");
+    for (int i = 0; i < HEAP_PAUSE_BUCKETS; i++)
+    {
+        if (stats->pause_histogram[i])
+        {
+            printf("    %s %6llu us: %zu\n", i == HEAP_PAUSE_BUCKETS - 1 ? ">=" : "< ", i == HEAP_PAUSE_BUCKETS - 1 ? 1ULL << (i - 1) : 1ULL << i, stats->pause_histogram[i]);
+        }
+    }
+
+    executor_free(executor);
+    inststream_free(inststream);
+    constantpool_free(constpool);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t nodes = argc > 1 ? (uint32_t)atoi(argv[1]) : 500000;
+    uint32_t rounds = argc > 2 ? (uint32_t)atoi(argv[2]) : 10;
+
+    size_t increment_size = config.gc_increment_size;
+    run("stop-the-world", 0, nodes, rounds);
+    run("incremental", increment_size, nodes, rounds);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "object.h"
+#include "heap.h"
+
+#define CHILDREN 4
+#define CROSS_EDGES 2
+#define REPEATS 3
+
+static ConstantPoolEntryClass node_class = {.index = 1, .instance_fields = CHILDREN + CROSS_EDGES, .instance_size = OBJECT_INSTANCE_SIZE(CHILDREN + CROSS_EDGES)};
+
+static void no_roots(Heap *heap, HeapSlotVisitor visit, void *context)
+{
+}
+
+// Builds a tree with CHILDREN children per node and CROSS_EDGES extra references to random nodes, so that the graph is
+// wide enough to keep every worker busy and the cross edges make workers race for the same objects.
+static void *build_graph(Heap *heap, size_t objects)
+{
+    void **nodes = config._malloc(objects * sizeof(void *));
+
+    for (size_t i = 0; i < objects; i++)
+    {
+        nodes[i] = object_new(heap, &node_class);
+        // Leaves keep plain integers in the fields that do not get a child.
+        for (uint32_t j = 0; j < CHILDREN + CROSS_EDGES; j++)
+        {
+            object_get_field(nodes[i], j)->integer = 0;
+        }
+    }
+    for (size_t i = 1; i < objects; i++)
+    {
+        object_set_field(heap, nodes[(i - 1) / CHILDREN], (i - 1) % CHILDREN, (EvalStackElement){.pointer = nodes[i]}, true);
+    }
+    for (size_t i = 0; i < objects; i++)
+    {
+        for (uint32_t j = 0; j < CROSS_EDGES; j++)
+        {
+            object_set_field(heap, nodes[i], CHILDREN + j, (EvalStackElement){.pointer = nodes[rand() % objects]}, true);
+        }
+    }
+
+    void *root = nodes[0];
+    config._free(nodes);
+    return root;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t objects = argc > 1 ? (size_t)atol(argv[1]) : 2000000;
+    uint32_t max_threads = argc > 2 ? (uint32_t)atoi(argv[2]) : (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Allocate everything in the old generation and only collect when asked to.
+    config.nursery_size = 0;
+    config.gc_threshold = 0;
+    Heap *heap = heap_new();
+    void *root = build_graph(heap, objects);
+    heap_push_root(heap, &root);
+
+    printf("%zu objects, %d references each\n", objects, CHILDREN + CROSS_EDGES);
+    printf("threads    mark ms    sweep ms    Mobjects/s (mark)    speedup\n");
+
+    double base = 0;
+    for (uint32_t threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+    {
+        config.gc_threads = threads;
+        uint64_t best_mark = UINT64_MAX;
+        uint64_t best_sweep = UINT64_MAX;
+
+        for (int i = 0; i < REPEATS; i++)
+        {
+            uint64_t mark = heap->stats.mark_ns;
+            uint64_t sweep = heap->stats.sweep_ns;
+            heap_collect(heap, no_roots, NULL, true);
+            best_mark = heap->stats.mark_ns - mark < best_mark ? heap->stats.mark_ns - mark : best_mark;
+            best_sweep = heap->stats.sweep_ns - sweep < best_sweep ? heap->stats.sweep_ns - sweep : best_sweep;
+        }
+
+        double throughput = objects / (best_mark / 1e3);
+        base = threads == 1 ? throughput : base;
+        printf("%7u %10.1f %11.1f %20.1f %10.2fx\n", threads, best_mark / 1e6, best_sweep / 1e6, throughput, throughput / base);
+
+        if (threads >= max_threads)
+        {
+            break;
+        }
+    }
+
+    heap_pop_root(heap);
+    heap_free(heap);
+    return 0;
+}
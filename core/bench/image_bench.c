@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "binary_format.h"
+
+#define PROGRAM_FILE "image_bench.lvm"
+#define IMAGE_FILE "image_bench_image.lvm"
+#define ROUNDS 5
+#define METHODS 8
+#define FIELDS 4
+#define DEPTH 4
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Writes both a plain version 2 program and its linked image. Classes come in chains of DEPTH, every subclass overrides
+// half of the methods of its parent and adds fields of its own.
+static void write_program(uint32_t classes)
+{
+    uint32_t per_class = 1 + FIELDS + METHODS;
+    ConstantPool *constpool = constantpool_new(classes * per_class);
+    char name[32];
+
+    for (uint32_t c = 0; c < classes; c++)
+    {
+        uint32_t index = 1 + c * per_class;
+        snprintf(name, sizeof(name), "Class%u", c);
+        uint32_t parent = c % DEPTH ? index - per_class : 0;
+        // The method count sizes the vtable, so it includes the inherited methods that are not overridden.
+        uint32_t methods = METHODS + (c % DEPTH) * METHODS / 2;
+        constantpool_add(constpool, index, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = strdup(name), .parent = parent, .fields = FIELDS, .methods = methods}});
+        for (uint32_t f = 0; f < FIELDS; f++)
+        {
+            snprintf(name, sizeof(name), "field%u_%u", c % DEPTH, f);
+            constantpool_add(constpool, index + 1 + f, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = strdup(name), ._class = index, .index = (c % DEPTH) * FIELDS + f, .type = f % 2 ? FIELD_TYPE_INT : FIELD_TYPE_ANY}});
+        }
+        for (uint32_t m = 0; m < METHODS; m++)
+        {
+            snprintf(name, sizeof(name), "method%u", c % DEPTH && m < METHODS / 2 ? m : (c % DEPTH) * METHODS + m);
+            constantpool_add(constpool, index + 1 + FIELDS + m, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = strdup(name), ._class = index, .address = 0, .args = 1, .locals = 0}});
+        }
+    }
+
+    InstructionStream *inststream = inststream_new(1);
+    inststream->instructions[0] = (Instruction){.opcode = RETURN, .operand = 0};
+
+    FILE *file = fopen(PROGRAM_FILE, "wb");
+    binform_write_program(file, constpool, inststream, BINFORM_VERSION_2);
+    fclose(file);
+
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    file = fopen(IMAGE_FILE, "wb");
+    binform_write_image(file, constpool, inststream);
+    fclose(file);
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        free(constantpool_get(constpool, i)->data.method.name);
+    }
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+// Times everything a process does before it can start running the program.
+static double start(const char *filename)
+{
+    uint64_t start = now_ns();
+    MappedFile *file = binform_map_file(filename);
+    ConstantPool *constpool = binform_map_constantpool(file);
+    InstructionStream *inststream = binform_map_instructions(file);
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    uint64_t elapsed = now_ns() - start;
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+    return elapsed / 1e6;
+}
+
+static double best(const char *filename)
+{
+    double fastest = start(filename);
+    for (int i = 1; i < ROUNDS; i++)
+    {
+        double time = start(filename);
+        fastest = time < fastest ? time : fastest;
+    }
+    return fastest;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_classes = argc > 1 ? (uint32_t)atol(argv[1]) : 64 * 1024;
+
+    printf("classes    entries    link at start (ms)    linked image (ms)    speedup\n");
+    for (uint32_t classes = 1024; classes <= max_classes; classes *= 4)
+    {
+        write_program(classes);
+        double linking = best(PROGRAM_FILE);
+        double image = best(IMAGE_FILE);
+        printf("%7u %10u %21.2f %20.2f %9.1fx\n", classes, classes * (1 + FIELDS + METHODS), linking, image, linking / image);
+    }
+
+    remove(PROGRAM_FILE);
+    remove(IMAGE_FILE);
+    return 0;
+}
\ No newline at end of file
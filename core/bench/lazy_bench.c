@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "binary_format.h"
+#include "executor.h"
+
+#define FILE_NAME "lazy_bench.lvm"
+#define ENTRIES_PER_CLASS 10
+#define METHODS_PER_CLASS 6
+#define HIERARCHY_DEPTH 4
+#define USED_CLASSES 10
+#define ROUNDS 5
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static const char *method_names[] = {"get", "set", "size", "visit", "equals", "hash"};
+
+// A generated program with many small class hierarchies, of which a run only instantiates a few classes and calls one method on each.
+static void write_program(uint32_t classes, uint32_t version)
+{
+    uint32_t length = 2 + classes * ENTRIES_PER_CLASS;
+    ConstantPool *constpool = constantpool_new(length);
+    constantpool_add(constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0}});
+    constantpool_add(constpool, 2, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = 1, .address = 2, .args = 1, .locals = 0}});
+
+    for (uint32_t k = 0; k < classes; k++)
+    {
+        uint32_t base = 3 + k * ENTRIES_PER_CLASS;
+        uint32_t parent = k % HIERARCHY_DEPTH ? base - ENTRIES_PER_CLASS : 0;
+        uint32_t depth = k % HIERARCHY_DEPTH + 1;
+        constantpool_add(constpool, base, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Generated", .fields = 2, .methods = METHODS_PER_CLASS * depth, .parent = parent}});
+        constantpool_add(constpool, base + 1, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "left", ._class = base, .index = 2 * depth - 2}});
+        constantpool_add(constpool, base + 2, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "right", ._class = base, .index = 2 * depth - 1}});
+        for (uint32_t m = 0; m < METHODS_PER_CLASS; m++)
+        {
+            constantpool_add(constpool, base + 3 + m, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = (char *)method_names[m], ._class = base, .address = 3 + 3 * USED_CLASSES, .args = 1, .locals = 0}});
+        }
+        constantpool_add(constpool, base + 3 + METHODS_PER_CLASS, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "generated"}});
+    }
+
+    // Every used class is instantiated and one of its methods is called, all methods share one body.
+    InstructionStream *inststream = inststream_new(5 + 3 * USED_CLASSES);
+    Instruction *code = inststream->instructions;
+    uint32_t i = 0;
+    code[i++] = (Instruction){NEW, 1};
+    code[i++] = (Instruction){CALL, 2};
+    for (uint32_t k = 0; k < USED_CLASSES; k++)
+    {
+        uint32_t used = (k * (classes / USED_CLASSES)) | (HIERARCHY_DEPTH - 1);
+        code[i++] = (Instruction){NEW, 3 + used * ENTRIES_PER_CLASS};
+        code[i++] = (Instruction){CALL, 3 + used * ENTRIES_PER_CLASS + 3 + k % METHODS_PER_CLASS};
+        code[i++] = (Instruction){POP, 0};
+    }
+    code[i++] = (Instruction){RETURN, 0};
+    code[i++] = (Instruction){PUSH, 1};
+    code[i++] = (Instruction){RETURN, 0};
+
+    FILE *file = fopen(FILE_NAME, "wb");
+    binform_write_program(file, constpool, inststream, version);
+    fclose(file);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+// Times everything from mapping the file until the executor is ready, and then the run, in milliseconds.
+static void start_and_run(bool lazy, double *starting, double *running)
+{
+    uint64_t start = now_ns();
+    MappedFile *file = binform_map_file(FILE_NAME);
+    ConstantPool *constpool = lazy ? binform_map_constantpool_lazy(file) : binform_map_constantpool(file);
+    InstructionStream *inststream = binform_map_instructions(file);
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    constantpool_create_strings(constpool);
+    Executor *executor = executor_new(constpool, inststream);
+    uint64_t started = now_ns();
+    executor_step_all(executor);
+    uint64_t finished = now_ns();
+
+    if (executor->error || executor->evalstack->length != 0)
+    {
+        printf("The program did not run to its end\n");
+        exit(1);
+    }
+
+    *starting = (started - start) / 1e6;
+    *running = (finished - started) / 1e6;
+    executor_free(executor);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t entries = argc > 1 ? (uint32_t)atol(argv[1]) : 1000000;
+    uint32_t classes = entries / ENTRIES_PER_CLASS;
+
+    printf("%u entries, %u classes, %u used\n", 2 + classes * ENTRIES_PER_CLASS, classes, USED_CLASSES);
+    printf("version    mode     start (ms)    run (ms)\n");
+    for (uint32_t version = BINFORM_VERSION_1; version <= BINFORM_VERSION_2; version++)
+    {
+        write_program(classes, version);
+        for (int lazy = 0; lazy <= 1; lazy++)
+        {
+            double starting, running;
+            start_and_run(lazy, &starting, &running);
+            for (int i = 1; i < ROUNDS; i++)
+            {
+                double start_time, run_time;
+                start_and_run(lazy, &start_time, &run_time);
+                starting = start_time < starting ? start_time : starting;
+                running = run_time < running ? run_time : running;
+            }
+            printf("%7u    %-5s %13.2f %11.3f\n", version, lazy ? "lazy" : "eager", starting, running);
+        }
+    }
+
+    remove(FILE_NAME);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "binary_format.h"
+
+#define FILE_NAME "load_scaling_bench.lvm"
+#define ENTRIES_PER_CLASS 10
+#define METHODS_PER_CLASS 6
+#define HIERARCHY_DEPTH 4
+#define INSTRUCTIONS_PER_METHOD 8
+#define ROUNDS 3
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static const char *method_names[] = {"get", "set", "size", "visit", "equals", "hash"};
+
+// Small class hierarchies with a body for every method, so the constant pool, the code and the vtables all grow with
+// the number of classes.
+static void write_program(uint32_t classes, int format)
+{
+    ConstantPool *constpool = constantpool_new(classes * ENTRIES_PER_CLASS);
+    InstructionStream *inststream = inststream_new(classes * METHODS_PER_CLASS * INSTRUCTIONS_PER_METHOD);
+    for (uint32_t k = 0; k < classes; k++)
+    {
+        uint32_t base = 1 + k * ENTRIES_PER_CLASS;
+        uint32_t depth = k % HIERARCHY_DEPTH + 1;
+        uint32_t parent = depth > 1 ? base - ENTRIES_PER_CLASS : 0;
+        constantpool_add(constpool, base, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Generated", .fields = 2, .methods = METHODS_PER_CLASS * depth, .parent = parent}});
+        constantpool_add(constpool, base + 1, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "left", ._class = base, .index = 2 * depth - 2}});
+        constantpool_add(constpool, base + 2, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "right", ._class = base, .index = 2 * depth - 1}});
+        for (uint32_t m = 0; m < METHODS_PER_CLASS; m++)
+        {
+            uint32_t address = (k * METHODS_PER_CLASS + m) * INSTRUCTIONS_PER_METHOD;
+            constantpool_add(constpool, base + 3 + m, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = (char *)method_names[m], ._class = base, .address = address, .args = 2, .locals = 1}});
+            Instruction *code = inststream->instructions + address;
+            code[0] = (Instruction){PUSH_VAR, 0};
+            code[1] = (Instruction){PUSH_FIELD, base + 1};
+            code[2] = (Instruction){PUSH_VAR, 1};
+            code[3] = (Instruction){ADD, 0};
+            code[4] = (Instruction){PUSH, address % 1000};
+            code[5] = (Instruction){ADD, 0};
+            code[6] = (Instruction){POP_FIELD, base + 2};
+            code[7] = (Instruction){RETURN, 0};
+        }
+        constantpool_add(constpool, base + 3 + METHODS_PER_CLASS, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "generated"}});
+    }
+
+    FILE *file = fopen(FILE_NAME, "wb");
+    if (format == 3)
+    {
+        binform_write_compact(file, constpool, inststream);
+    }
+    else
+    {
+        binform_write_program(file, constpool, inststream, format);
+    }
+    fclose(file);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+// Times decoding the constant pool and the code and building the vtables, in milliseconds.
+static void load(double *decoding, double *linking)
+{
+    uint64_t start = now_ns();
+    MappedFile *file = binform_map_file(FILE_NAME);
+    ConstantPool *constpool = binform_map_constantpool(file);
+    InstructionStream *inststream = binform_map_instructions(file);
+    uint64_t decoded = now_ns();
+    constantpool_compute_vtables(constpool);
+    uint64_t linked = now_ns();
+
+    if (!constpool || !inststream)
+    {
+        printf("The program could not be loaded\n");
+        exit(1);
+    }
+    *decoding = (decoded - start) / 1e6;
+    *linking = (linked - decoded) / 1e6;
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t classes = argc > 1 ? (uint32_t)atol(argv[1]) : 200000;
+    uint32_t max_threads = argc > 2 ? (uint32_t)atoi(argv[2]) : (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *formats[] = {"", "version 1", "version 2", "compact"};
+
+    printf("%u entries, %u instructions, %ld processors\n", classes * ENTRIES_PER_CLASS, classes * METHODS_PER_CLASS * INSTRUCTIONS_PER_METHOD, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("format       threads    decode (ms)    vtables (ms)    total (ms)    speedup\n");
+    for (int format = 1; format <= 3; format++)
+    {
+        write_program(classes, format);
+        double base = 0;
+        for (uint32_t threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+        {
+            config.load_threads = threads;
+            double decoding, linking;
+            load(&decoding, &linking);
+            for (int i = 1; i < ROUNDS; i++)
+            {
+                double decode_time, link_time;
+                load(&decode_time, &link_time);
+                decoding = decode_time < decoding ? decode_time : decoding;
+                linking = link_time < linking ? link_time : linking;
+            }
+
+            base = threads == 1 ? decoding + linking : base;
+            printf("%-12s %7u %14.2f %15.2f %13.2f %9.2fx\n", formats[format], threads, decoding, linking, decoding + linking, base / (decoding + linking));
+            if (threads >= max_threads)
+            {
+                break;
+            }
+        }
+    }
+
+    remove(FILE_NAME);
+    return 0;
+}
\ No newline at end of file
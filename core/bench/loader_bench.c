@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "binary_format.h"
+
+#define FILE_NAME "loader_bench.lvm"
+#define ROUNDS 5
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Writes a program with one class per hundred methods, a string per method and a long instruction stream.
+static size_t write_program(uint32_t methods, uint32_t instructions)
+{
+    uint32_t classes = methods / 100 + 1;
+    ConstantPool *constpool = constantpool_new(classes + 2 * methods);
+    char name[32];
+
+    for (uint32_t i = 1; i <= classes; i++)
+    {
+        snprintf(name, sizeof(name), "Class%u", i);
+        constantpool_add(constpool, i, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = strdup(name), .parent = 0, .fields = 0, .methods = 100}});
+    }
+    for (uint32_t i = 0; i < methods; i++)
+    {
+        snprintf(name, sizeof(name), "method%u", i);
+        constantpool_add(constpool, classes + 1 + 2 * i, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = strdup(name), ._class = 1 + i / 100, .address = i, .args = 1, .locals = 1}});
+        snprintf(name, sizeof(name), "A string constant %u", i);
+        constantpool_add(constpool, classes + 2 + 2 * i, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = strdup(name)}});
+    }
+
+    InstructionStream *inststream = inststream_new(instructions);
+    for (uint32_t i = 0; i < instructions; i++)
+    {
+        inststream->instructions[i] = (Instruction){.opcode = i % 8 ? PUSH : CALL, .operand = i};
+    }
+
+    FILE *file = fopen(FILE_NAME, "wb");
+    binform_write_constantpool(file, constpool);
+    binform_write_instructions(file, inststream);
+    size_t size = (size_t)ftell(file);
+    fclose(file);
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        free(entry->type == TYPE_STRING ? entry->data.string.value : entry->data.method.name);
+    }
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    return size;
+}
+
+static void free_names(ConstantPool *constpool)
+{
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        config._free(entry->type == TYPE_STRING ? entry->data.string.value : entry->data.method.name);
+    }
+}
+
+static double load_read()
+{
+    uint64_t start = now_ns();
+    FILE *file = fopen(FILE_NAME, "rb");
+    ConstantPool *constpool = binform_read_constantpool(file);
+    InstructionStream *inststream = binform_read_instructions(file);
+    fclose(file);
+    uint64_t elapsed = now_ns() - start;
+
+    free_names(constpool);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    return elapsed / 1e6;
+}
+
+static double load_map()
+{
+    uint64_t start = now_ns();
+    MappedFile *file = binform_map_file(FILE_NAME);
+    ConstantPool *constpool = binform_map_constantpool(file);
+    InstructionStream *inststream = binform_map_instructions(file);
+    uint64_t elapsed = now_ns() - start;
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+    return elapsed / 1e6;
+}
+
+// Both loaders are run a few times and the fastest run is reported, so that the file is in the page cache for both.
+static double best(double (*load)())
+{
+    double fastest = load();
+    for (int i = 1; i < ROUNDS; i++)
+    {
+        double time = load();
+        fastest = time < fastest ? time : fastest;
+    }
+    return fastest;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_instructions = argc > 1 ? (uint32_t)atol(argv[1]) : 16 * 1024 * 1024;
+
+    printf("entries    instructions    file (MB)    read (ms)    read (MB/s)    map (ms)    map (MB/s)\n");
+    for (uint32_t instructions = 256 * 1024; instructions <= max_instructions; instructions *= 4)
+    {
+        uint32_t methods = instructions / 16;
+        size_t size = write_program(methods, instructions);
+        double mb = size / (1024.0 * 1024.0);
+        double read = best(load_read);
+        double map = best(load_map);
+        printf("%7u %15u %12.1f %12.2f %14.0f %11.2f %13.0f\n", methods / 100 + 1 + 2 * methods, instructions, mb, read, mb / (read / 1e3), map, mb / (map / 1e3));
+    }
+
+    remove(FILE_NAME);
+    return 0;
+}
\ No newline at end of file
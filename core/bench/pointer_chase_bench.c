@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "pages.h"
+#include "object.h"
+#include "heap.h"
+
+#define HOPS 20000000
+
+static ConstantPoolEntryClass node_class = {.index = 1, .instance_fields = 2, .instance_size = OBJECT_INSTANCE_SIZE(2)};
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Reports how much anonymous memory the kernel currently backs with transparent huge pages, -1 if it does not say.
+static long anon_huge_kb()
+{
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+
+    while (file && fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, "AnonHugePages:", 14) == 0)
+        {
+            kb = atol(line + 14);
+        }
+    }
+    if (file)
+    {
+        fclose(file);
+    }
+    return kb;
+}
+
+// Allocates the nodes one after the other in the nursery and links them in a random cycle, so that every hop lands
+// on an unrelated page and the walk is bound by cache and TLB misses.
+static double run(size_t objects, bool huge_pages, long *huge_kb)
+{
+    config.huge_pages = huge_pages;
+    config.nursery_size = 2 * objects * (OBJECT_INSTANCE_SIZE(2) + sizeof(ObjectHeader) + 8);
+    Heap *heap = heap_new();
+
+    void **nodes = malloc(objects * sizeof(void *));
+    for (size_t i = 0; i < objects; i++)
+    {
+        nodes[i] = object_new(heap, &node_class);
+        object_get_field(nodes[i], 1)->integer = (int32_t)i;
+    }
+
+    srand(1);
+    for (size_t i = objects - 1; i > 0; i--)
+    {
+        size_t j = (size_t)rand() % (i + 1);
+        void *node = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = node;
+    }
+    for (size_t i = 0; i < objects; i++)
+    {
+        object_get_field(nodes[i], 0)->pointer = nodes[(i + 1) % objects];
+    }
+
+    void *node = nodes[0];
+    free(nodes);
+
+    uint64_t start = now_ns();
+    int64_t sum = 0;
+    for (size_t i = 0; i < HOPS; i++)
+    {
+        sum += object_get_field(node, 1)->integer;
+        node = object_get_field(node, 0)->pointer;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    *huge_kb = anon_huge_kb();
+    heap_free(heap);
+    config.huge_pages = false;
+
+    // Keeps the walk from being optimized away.
+    if (sum == -1)
+    {
+        printf("%lld\n", (long long)sum);
+    }
+    return (double)elapsed / HOPS;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_objects = argc > 1 ? (size_t)atol(argv[1]) : 4 * 1024 * 1024;
+
+    printf("objects    heap (MB)    4 KB pages (ns/hop)    huge pages (ns/hop)    huge pages backed (MB)\n");
+    for (size_t objects = 64 * 1024; objects <= max_objects; objects *= 4)
+    {
+        long small_kb;
+        long huge_kb;
+        double small = run(objects, false, &small_kb);
+        double huge = run(objects, true, &huge_kb);
+        size_t heap_mb = objects * (OBJECT_INSTANCE_SIZE(2) + sizeof(ObjectHeader) + 8) / (1024 * 1024);
+        printf("%7zu %12zu %22.1f %22.1f %25ld\n", objects, heap_mb, small, huge, huge_kb < 0 ? -1 : huge_kb / 1024);
+    }
+
+    PagesStats stats = pages_stats();
+    printf("hugetlb: %zu MB, advised: %zu MB\n", stats.hugetlb_bytes / (1024 * 1024), stats.advised_bytes / (1024 * 1024));
+    return 0;
+}
\ No newline at end of file
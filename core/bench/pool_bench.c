@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "pool.h"
+#include "executor.h"
+
+#define CLASS_MAIN 1
+#define METHOD_MAIN 2
+#define METHOD_FIB 3
+#define CLASS_NODE 4
+#define FIELD_NEXT 5
+
+#define WINDOW 4096
+
+typedef struct
+{
+    const char *name;
+    void *(*_malloc)(size_t);
+    void *(*_calloc)(size_t, size_t);
+    void *(*_realloc)(void *, size_t);
+    void (*_free)(void *);
+} Allocator;
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Replays the allocation sizes of the VM: call frames of 1 to 6 variables, objects of 1 to 4 fields and short strings.
+// Each allocation replaces a random block of a window of live blocks.
+static void build_trace(size_t *sizes, size_t *slots, size_t operations)
+{
+    srand(1);
+    for (size_t i = 0; i < operations; i++)
+    {
+        switch (rand() % 3)
+        {
+        case 0:
+            sizes[i] = (1 + rand() % 6) * (sizeof(EvalStackElement) + sizeof(bool));
+            break;
+        case 1:
+            sizes[i] = 16 + 16 + sizeof(uint32_t) + (1 + rand() % 4) * sizeof(EvalStackElement) + 1;
+            break;
+        default:
+            sizes[i] = 16 + 1 + rand() % 32;
+            break;
+        }
+        slots[i] = rand() % WINDOW;
+    }
+}
+
+static double run_trace(Allocator *allocator, size_t *sizes, size_t *slots, size_t operations)
+{
+    void *window[WINDOW] = {0};
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < operations; i++)
+    {
+        allocator->_free(window[slots[i]]);
+        window[slots[i]] = allocator->_malloc(sizes[i]);
+    }
+    for (size_t i = 0; i < WINDOW; i++)
+    {
+        allocator->_free(window[i]);
+    }
+    return (now_ns() - start) / 1e6;
+}
+
+// fib(n) is called recursively, which allocates and frees a frame per call, and main builds a linked list that is
+// promoted to the old generation by a small nursery.
+static InstructionStream *build_program(int32_t n, uint32_t nodes)
+{
+    Instruction program[] = {
+        {NEW, CLASS_MAIN},
+        {CALL, METHOD_MAIN},
+        // main: fib(n)
+        {PUSH_VAR, 0},
+        {PUSH, n},
+        {CALL, METHOD_FIB},
+        {POP, 0},
+        // list = new Node(list) while ++i < nodes
+        {PUSH, 0},
+        {NEW, CLASS_NODE},
+        {DUP, 0},
+        {PUSH_VAR, 1},
+        {POP_FIELD, FIELD_NEXT},
+        {POP_VAR, 1},
+        {PUSH, 1},
+        {ADD, 0},
+        {DUP, 0},
+        {PUSH, nodes},
+        {JUMP_LT, 7},
+        {POP, 0},
+        {RETURN, 0},
+        // fib: n < 2 ? n : fib(n - 1) + fib(n - 2)
+        {PUSH_VAR, 1},
+        {PUSH, 2},
+        {JUMP_LT, 34},
+        {PUSH_VAR, 0},
+        {PUSH_VAR, 1},
+        {PUSH, 1},
+        {SUB, 0},
+        {CALL, METHOD_FIB},
+        {PUSH_VAR, 0},
+        {PUSH_VAR, 1},
+        {PUSH, 2},
+        {SUB, 0},
+        {CALL, METHOD_FIB},
+        {ADD, 0},
+        {RETURN, 0},
+        {PUSH_VAR, 1},
+        {RETURN, 0},
+    };
+
+    uint32_t length = sizeof(program) / sizeof(Instruction);
+    InstructionStream *inststream = inststream_new(length);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        inststream->instructions[i] = program[i];
+    }
+    return inststream;
+}
+
+static double run_program(Allocator *allocator, int32_t n, uint32_t nodes)
+{
+    set_config(allocator->_malloc, allocator->_calloc, allocator->_realloc, allocator->_free, config.min_stack_capacity);
+
+    ConstantPool *constpool = constantpool_new(5);
+    constantpool_add(constpool, CLASS_MAIN, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 2, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, METHOD_MAIN, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = CLASS_MAIN, .address = 2, .args = 1, .locals = 1}});
+    constantpool_add(constpool, METHOD_FIB, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "fib", ._class = CLASS_MAIN, .address = 19, .args = 2, .locals = 0}});
+    constantpool_add(constpool, CLASS_NODE, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Node", .fields = 1, .methods = 0, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, FIELD_NEXT, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "next", ._class = CLASS_NODE, .index = 0}});
+    constantpool_compute_vtables(constpool);
+    InstructionStream *inststream = build_program(n, nodes);
+    Executor *executor = executor_new(constpool, inststream);
+
+    uint64_t start = now_ns();
+    executor_step_all(executor);
+    double elapsed = (now_ns() - start) / 1e6;
+
+    executor_free(executor);
+    inststream_free(inststream);
+    constantpool_free(constpool);
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t operations = argc > 1 ? (size_t)atol(argv[1]) : 20000000;
+    int32_t n = argc > 2 ? atoi(argv[2]) : 27;
+    uint32_t nodes = argc > 3 ? (uint32_t)atoi(argv[3]) : 1000000;
+
+    Allocator allocators[] = {
+        {"malloc", malloc, calloc, realloc, free},
+        {"pool", pool_malloc, pool_calloc, pool_realloc, pool_free},
+    };
+
+    // A small nursery makes most of the list reach the old generation, which is allocated through config._malloc.
+    config.nursery_size = 64 * 1024;
+
+    size_t *sizes = malloc(operations * sizeof(size_t));
+    size_t *slots = malloc(operations * sizeof(size_t));
+    build_trace(sizes, slots, operations);
+
+    printf("allocator    trace ms    program ms\n");
+    for (int i = 0; i < 2; i++)
+    {
+        double trace = run_trace(&allocators[i], sizes, slots, operations);
+        double program = run_program(&allocators[i], n, nodes);
+        printf("%-9s %11.1f %13.1f\n", allocators[i].name, trace, program);
+    }
+
+    size_t allocations = 0;
+    for (int i = 0; i < POOL_SIZE_CLASSES; i++)
+    {
+        allocations += pool_stats.classes[i].allocations;
+    }
+    printf("pool: %zu pooled allocations, %zu large allocations, %zu pages\n", allocations, pool_stats.large_allocations, pool_stats.pages);
+
+    free(sizes);
+    free(slots);
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_FILE "snapshot_bench.lvms"
+#define SNAPSHOT_ADDRESS 28
+#define ROUNDS 5
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Builds a lookup table of entries, each with a key string built at runtime, before reaching the snapshot address.
+static void new_program(uint32_t entries, ConstantPool **constpool, InstructionStream **inststream)
+{
+    *constpool = constantpool_new(7);
+    constantpool_add(*constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(*constpool, 2, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = 1, .address = 2, .args = 1, .locals = 2}});
+    constantpool_add(*constpool, 3, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Entry", .fields = 3, .methods = 0, .parent = 0, .vtable = NULL}});
+    constantpool_add(*constpool, 4, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "key", ._class = 3, .index = 0}});
+    constantpool_add(*constpool, 5, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "value", ._class = 3, .index = 1}});
+    constantpool_add(*constpool, 6, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "next", ._class = 3, .index = 2}});
+    constantpool_add(*constpool, 7, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "key"}});
+
+    Instruction code[] = {
+        {NEW, 1},
+        {CALL, 2},
+        {PUSH, 0},
+        {POP_VAR, 2},
+        {PUSH_VAR, 2},
+        {PUSH, entries},
+        {JUMP_GE, SNAPSHOT_ADDRESS},
+        {NEW, 3},
+        {DUP, 0},
+        {NEW, CONSTPOOL_CLASS_STRING_BUILDER},
+        {PUSH_STRING, 7},
+        {CALL, CONSTPOOL_METHOD_STRING_BUILDER_APPEND_STRING},
+        {PUSH_VAR, 2},
+        {CALL, CONSTPOOL_METHOD_STRING_BUILDER_APPEND_INT},
+        {CALL, CONSTPOOL_METHOD_STRING_BUILDER_TO_STRING},
+        {POP_FIELD, 4},
+        {DUP, 0},
+        {PUSH_VAR, 2},
+        {POP_FIELD, 5},
+        {DUP, 0},
+        {PUSH_VAR, 1},
+        {POP_FIELD, 6},
+        {POP_VAR, 1},
+        {PUSH_VAR, 2},
+        {PUSH, 1},
+        {ADD, 0},
+        {POP_VAR, 2},
+        {JUMP, 4},
+        {PUSH, 0},
+        {RETURN, 0},
+    };
+    *inststream = inststream_new(sizeof(code) / sizeof(Instruction));
+    for (size_t i = 0; i < (*inststream)->length; i++)
+    {
+        (*inststream)->instructions[i] = code[i];
+    }
+
+    constantpool_compute_vtables(*constpool);
+    constantpool_compute_layouts(*constpool, *inststream);
+    constantpool_create_strings(*constpool);
+}
+
+static double initialize(ConstantPool *constpool, InstructionStream *inststream)
+{
+    inststream->current = 0;
+    uint64_t start = now_ns();
+    Executor *executor = executor_new(constpool, inststream);
+    executor_step_until(executor, SNAPSHOT_ADDRESS);
+    uint64_t elapsed = now_ns() - start;
+    executor_free(executor);
+    return elapsed / 1e6;
+}
+
+static double restore(ConstantPool *constpool, InstructionStream *inststream)
+{
+    uint64_t start = now_ns();
+    Executor *executor = executor_new(constpool, inststream);
+    if (snapshot_restore(executor, SNAPSHOT_FILE) != SNAPSHOT_OK)
+    {
+        printf("Could not restore the snapshot\n");
+        exit(1);
+    }
+    uint64_t elapsed = now_ns() - start;
+    executor_free(executor);
+    return elapsed / 1e6;
+}
+
+static double best(double (*run)(ConstantPool *, InstructionStream *), ConstantPool *constpool, InstructionStream *inststream)
+{
+    double fastest = run(constpool, inststream);
+    for (int i = 1; i < ROUNDS; i++)
+    {
+        double time = run(constpool, inststream);
+        fastest = time < fastest ? time : fastest;
+    }
+    return fastest;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_entries = argc > 1 ? (uint32_t)atol(argv[1]) : 1000000;
+
+    printf("entries    snapshot (MB)    initialize (ms)    restore (ms)    speedup\n");
+    for (uint32_t entries = 10000; entries <= max_entries; entries *= 10)
+    {
+        ConstantPool *constpool;
+        InstructionStream *inststream;
+        new_program(entries, &constpool, &inststream);
+
+        Executor *executor = executor_new(constpool, inststream);
+        executor_step_until(executor, SNAPSHOT_ADDRESS);
+        FILE *file = fopen(SNAPSHOT_FILE, "wb");
+        snapshot_write(executor, file);
+        double size = ftell(file) / 1e6;
+        fclose(file);
+        executor_free(executor);
+
+        double initializing = best(initialize, constpool, inststream);
+        double restoring = best(restore, constpool, inststream);
+        printf("%7u %16.1f %18.2f %15.2f %9.1fx\n", entries, size, initializing, restoring, initializing / restoring);
+
+        constantpool_free(constpool);
+        inststream_free(inststream);
+    }
+
+    remove(SNAPSHOT_FILE);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "string_class.h"
+#include "executor.h"
+
+#define CLASS_MAIN 1
+#define METHOD_MAIN 2
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Appends the same number to one string builder n times and calls toString at the end.
+static InstructionStream *build_program(int32_t n)
+{
+    Instruction program[] = {
+        {NEW, CLASS_MAIN},
+        {CALL, METHOD_MAIN},
+        {NEW, CONSTPOOL_CLASS_STRING_BUILDER},
+        {POP_VAR, 1},
+        {PUSH, 0},
+        {PUSH_VAR, 1},
+        {PUSH, 12345},
+        {CALL, CONSTPOOL_METHOD_STRING_BUILDER_APPEND_INT},
+        {POP, 0},
+        {PUSH, 1},
+        {ADD, 0},
+        {DUP, 0},
+        {PUSH, n},
+        {JUMP_LT, 5},
+        {POP, 0},
+        {PUSH_VAR, 1},
+        {CALL, CONSTPOOL_METHOD_STRING_BUILDER_TO_STRING},
+        {RETURN, 0},
+    };
+
+    uint32_t length = sizeof(program) / sizeof(Instruction);
+    InstructionStream *inststream = inststream_new(length);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        inststream->instructions[i] = program[i];
+    }
+    return inststream;
+}
+
+int main(int argc, char *argv[])
+{
+    int32_t max_appends = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    ConstantPool *constpool = constantpool_new(2);
+    constantpool_add(constpool, CLASS_MAIN, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, METHOD_MAIN, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = CLASS_MAIN, .address = 2, .args = 1, .locals = 1}});
+    constantpool_compute_vtables(constpool);
+
+    // The time per append stays the same as the number of appends grows if building the string takes linear time.
+    printf("appends         ms    ns/append\n");
+    for (int32_t n = max_appends / 8; n <= max_appends; n *= 2)
+    {
+        InstructionStream *inststream = build_program(n);
+        Executor *executor = executor_new(constpool, inststream);
+
+        uint64_t start = now_ns();
+        executor_step_all(executor);
+        uint64_t elapsed = now_ns() - start;
+
+        if (strlen(string_get_value(evalstack_top(executor->evalstack).pointer)) != (size_t)n * 5)
+        {
+            printf("unexpected result\n");
+        }
+        printf("%7d %10.1f %12.1f\n", n, elapsed / 1e6, (double)elapsed / n);
+
+        executor_free(executor);
+        inststream_free(inststream);
+    }
+
+    constantpool_free(constpool);
+    return 0;
+}
\ No newline at end of file
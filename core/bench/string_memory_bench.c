@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "string_class.h"
+#include "executor.h"
+
+#define CLASS_MAIN 1
+#define METHOD_MAIN 2
+
+// Builds n strings with a string builder each, like a program that formats numbers in a loop.
+static InstructionStream *build_program(int32_t n)
+{
+    Instruction program[] = {
+        {NEW, CLASS_MAIN},
+        {CALL, METHOD_MAIN},
+        {PUSH, 0},
+        {NEW, CONSTPOOL_CLASS_STRING_BUILDER},
+        {PUSH, 1000000},
+        {CALL, CONSTPOOL_METHOD_STRING_BUILDER_APPEND_INT},
+        {CALL, CONSTPOOL_METHOD_STRING_BUILDER_TO_STRING},
+        {POP, 0},
+        {PUSH, 1},
+        {ADD, 0},
+        {DUP, 0},
+        {PUSH, n},
+        {JUMP_LT, 3},
+        {POP, 0},
+        {RETURN, 0},
+    };
+
+    uint32_t length = sizeof(program) / sizeof(Instruction);
+    InstructionStream *inststream = inststream_new(length);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        inststream->instructions[i] = program[i];
+    }
+    return inststream;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t strings = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+
+    // In arena mode nothing is collected, so the arena counts every byte the workload allocates.
+    config.arena_chunk_size = 1024 * 1024;
+
+    printf("workload                      strings    bytes/string\n");
+    for (uint32_t max_length = 8; max_length <= 64; max_length *= 2)
+    {
+        char value[64] = {0};
+        Heap *heap = heap_new();
+        for (uint32_t i = 0; i < strings; i++)
+        {
+            size_t length = i % max_length;
+            memset(value, 'a' + i % 26, length);
+            value[length] = '\0';
+            string_new(heap, value);
+        }
+        printf("string_new, 0-%-2u chars %15u %15.1f\n", max_length - 1, strings, (double)heap->arena->bytes_allocated / strings);
+        heap_free(heap);
+    }
+
+    ConstantPool *constpool = constantpool_new(2);
+    constantpool_add(constpool, CLASS_MAIN, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, METHOD_MAIN, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = CLASS_MAIN, .address = 2, .args = 1, .locals = 0}});
+    constantpool_compute_vtables(constpool);
+    InstructionStream *inststream = build_program(strings);
+    Executor *executor = executor_new(constpool, inststream);
+    executor_step_all(executor);
+    printf("StringBuilder.toString %15u %15.1f\n", strings, (double)executor->heap->arena->bytes_allocated / strings);
+    executor_free(executor);
+    inststream_free(inststream);
+    constantpool_free(constpool);
+    return 0;
+}
\ No newline at end of file
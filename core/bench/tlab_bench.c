@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "object.h"
+#include "string_class.h"
+#include "heap.h"
+
+#define PAGE_SIZE (16 * 1024)
+#define OBJECTS_PER_ROUND 10000
+
+static ConstantPoolEntryClass pair_class = {.index = 1, .instance_fields = 2, .instance_size = OBJECT_INSTANCE_SIZE(2)};
+
+typedef struct
+{
+    uint32_t rounds;
+} Job;
+
+static uint64_t now_ns()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Every thread owns a heap in arena mode and releases it after each round, like an executor serving requests.
+static void *allocate(void *argument)
+{
+    Job *job = argument;
+    Heap *heap = heap_new();
+
+    for (uint32_t round = 0; round < job->rounds; round++)
+    {
+        for (int i = 0; i < OBJECTS_PER_ROUND; i++)
+        {
+            void *object = object_new(heap, &pair_class);
+            object_set_field(heap, object, 0, (EvalStackElement){.pointer = string_new(heap, "LitenVM")}, true);
+        }
+        heap_reset(heap);
+    }
+
+    heap_free(heap);
+    return NULL;
+}
+
+static double run(uint32_t threads, uint32_t rounds)
+{
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    Job job = {.rounds = rounds};
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, allocate, &job);
+    }
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    free(ids);
+    // Every iteration allocates the object, the string and its characters.
+    return 3.0 * OBJECTS_PER_ROUND * rounds * threads / (elapsed / 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : 32;
+    uint32_t rounds = argc > 2 ? (uint32_t)atoi(argv[2]) : 200;
+
+    printf("threads    malloc chunks (Mallocs/s)    page pool (Mallocs/s)\n");
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        config.arena_chunk_size = PAGE_SIZE;
+        config.page_pool = NULL;
+        double chunks = run(threads, rounds);
+
+        // Size the pool so that it never runs out, every thread needs about a megabyte per round.
+        config.page_pool = pagepool_new(PAGE_SIZE, threads * 128);
+        double pool = run(threads, rounds);
+        pagepool_free(config.page_pool);
+
+        printf("%7u %28.1f %24.1f\n", threads, chunks, pool);
+    }
+    return 0;
+}
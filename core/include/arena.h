@@ -0,0 +1,54 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "pagepool.h"
+
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t size;
+} ArenaChunk;
+
+typedef struct
+{
+    size_t chunk_size;
+    PagePool *pool;
+    bool huge_pages;
+    ArenaChunk *chunks;
+    ArenaChunk *current;
+    char *top;
+    char *limit;
+    size_t chunks_count;
+    size_t bytes_allocated;
+} Arena;
+
+Arena *arena_new(size_t chunk_size);
+
+void arena_free(Arena *arena);
+
+void *arena_alloc_slow(Arena *arena, size_t size);
+
+void arena_release(Arena *arena, void *block, size_t size);
+
+void arena_reset(Arena *arena);
+
+// The current chunk works as a thread-local allocation buffer, only refilling it needs to touch shared state.
+static inline void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+
+    if (size <= (size_t)(arena->limit - arena->top))
+    {
+        void *block = arena->top;
+        arena->top += size;
+        arena->bytes_allocated += size;
+        return block;
+    }
+
+    return arena_alloc_slow(arena, size);
+}
+
+#endif
@@ -2,10 +2,155 @@
 #define BINARY_FORMAT_H
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #include "constantpool.h"
 #include "inststream.h"
 
+// A program file mapped into memory. The names and strings of a constant pool read from it, and the code of a version 2
+// file, point into the mapping, so it must outlive the constant pool and the instruction stream.
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t offset;
+    uint32_t error;
+} MappedFile;
+
+#define BINFORM_OK 0
+#define BINFORM_ERROR_TRUNCATED 1
+#define BINFORM_ERROR_MALFORMED 2
+#define BINFORM_ERROR_VERSION 3
+#define BINFORM_ERROR_IO 4
+
+// A growable byte buffer owned by the caller. It keeps its memory between programs, so a loop that encodes or receives
+// many programs only allocates until the largest one fits.
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+} BinformBuffer;
+
+#define BINFORM_VERSION_1 1
+#define BINFORM_VERSION_2 2
+
+// Version 2 files start with "LVM2". Read as the constant pool length of a version 1 file it would need a file of several gigabytes.
+#define BINFORM_MAGIC 0x324D564C
+
+#define BINFORM_SECTION_CONSTANTS 1
+#define BINFORM_SECTION_STRINGS 2
+#define BINFORM_SECTION_CODE 3
+#define BINFORM_SECTION_DEBUG 4
+#define BINFORM_SECTION_METADATA 5
+#define BINFORM_SECTION_CLASSES 6
+#define BINFORM_SECTION_VTABLES 7
+#define BINFORM_SECTION_LAYOUTS 8
+#define BINFORM_SECTION_FIELDS 9
+#define BINFORM_SECTION_LINK 10
+#define BINFORM_SECTION_COMPACT_CODE 11
+
+// Linked images also hold the vtables, layouts and resolved fields, so that loading them needs no linking.
+#define BINFORM_FLAG_LINKED 0x1
+
+// Compact programs hold a compact code section instead of the code section.
+#define BINFORM_FLAG_COMPACT 0x2
+
+// Every instruction of the compact code section takes one byte for its opcode, with the width of its operand in these
+// bits: none for a zero operand, then 1, 2 or 4 bytes. The operands follow the opcodes of all instructions, little-endian.
+#define BINFORM_COMPACT_WIDTH_SHIFT 4
+#define BINFORM_COMPACT_WIDTH_MASK 0x30
+
+// Compressed programs hold every section compressed, with this bit set in its kind. They are expanded back to the exact
+// bytes of the uncompressed program when they are mapped.
+#define BINFORM_FLAG_COMPRESSED 0x4
+#define BINFORM_SECTION_COMPRESSED 0x80000000
+
+// Sections start at offsets that are a multiple of this.
+#define BINFORM_SECTION_ALIGNMENT 8
+
+// All version 2 values are little-endian and every record has a fixed size, so sections can be indexed directly.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sections;
+    uint32_t flags;
+} BinformHeader;
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t count;
+    uint32_t offset;
+    uint32_t size;
+} BinformSection;
+
+// The name is an offset into the string table, the values are the remaining fields of the entry in declaration order.
+typedef struct
+{
+    uint8_t type;
+    uint8_t field_type;
+    uint16_t reserved;
+    uint32_t name;
+    uint32_t values[4];
+} BinformConstant;
+
+// The vtable and layout are the indices of the first slot and field in their sections, classes with the default layout
+// have no layout.
+typedef struct
+{
+    uint32_t constant;
+    uint32_t flags;
+    uint32_t instance_fields;
+    uint32_t instance_size;
+    uint32_t map_offset;
+    uint32_t vtable;
+    uint32_t vtable_length;
+    uint32_t layout;
+} BinformClass;
+
+typedef struct
+{
+    uint32_t offset;
+    uint8_t type;
+    uint8_t reserved[3];
+} BinformLayoutField;
+
+typedef struct
+{
+    uint32_t constant;
+    uint32_t offset;
+    uint8_t storage;
+    uint8_t reserved[3];
+} BinformField;
+
+// The checksum covers every byte of the image before this record.
+typedef struct
+{
+    uint64_t checksum;
+    uint32_t abi;
+    uint32_t reserved;
+} BinformLink;
+
+// Starts every compressed section, followed by the LZ blocks of its data. The offset and size are those of the section
+// in the uncompressed program.
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} BinformCompressed;
+
+// Laid out like Instruction, so that the code section can be used in place on little-endian machines.
+typedef struct
+{
+    uint8_t opcode;
+    uint8_t reserved[3];
+    uint32_t operand;
+} BinformInstruction;
+
 void binform_write_constantpool(FILE *file, ConstantPool *constpool);
 
 void binform_write_instructions(FILE *file, InstructionStream *inststream);
@@ -14,6 +159,49 @@ ConstantPool *binform_read_constantpool(FILE *file);
 
 InstructionStream *binform_read_instructions(FILE *file);
 
+void binform_write_program(FILE *file, ConstantPool *constpool, InstructionStream *inststream, uint32_t version);
+
+// The constant pool must be linked, that is its vtables and layouts must have been computed.
+void binform_write_image(FILE *file, ConstantPool *constpool, InstructionStream *inststream);
+
+// Code is decoded rather than mapped in place, in exchange it takes 1 to 5 bytes per instruction instead of 8.
+void binform_write_compact(FILE *file, ConstantPool *constpool, InstructionStream *inststream);
+
+// Compresses a version 2 program of any kind into the buffer, fails for version 1 and compressed programs.
+uint32_t binform_compress(BinformBuffer *output, const char *data, size_t size);
+
+bool binform_read_program(FILE *file, ConstantPool **constpool, InstructionStream **inststream);
+
+void binform_buffer_free(BinformBuffer *buffer);
+
+// Replaces the contents of the buffer with the encoded program.
+uint32_t binform_write_to_buffer(BinformBuffer *buffer, ConstantPool *constpool, InstructionStream *inststream, uint32_t version);
+
+// Decodes a program of either version. The names and strings are copied, so the data can be released right away.
+uint32_t binform_read_from_buffer(const char *data, size_t size, ConstantPool **constpool, InstructionStream **inststream);
+
+// Pipes and sockets cannot be mapped, the stream is read to its end into the buffer and decoded from there.
+uint32_t binform_read_from_descriptor(int descriptor, BinformBuffer *buffer, ConstantPool **constpool, InstructionStream **inststream);
+
+uint32_t binform_write_to_descriptor(int descriptor, BinformBuffer *buffer, ConstantPool *constpool, InstructionStream *inststream, uint32_t version);
+
+MappedFile *binform_map_file(const char *filename);
+
+void binform_unmap_file(MappedFile *file);
+
+uint32_t binform_version(MappedFile *file);
+
+ConstantPool *binform_map_constantpool(MappedFile *file);
+
+// Checks and indexes every entry in one pass, but only decodes an entry when it is first used. Linked images are decoded
+// as a whole.
+ConstantPool *binform_map_constantpool_lazy(MappedFile *file);
+
+InstructionStream *binform_map_instructions(MappedFile *file);
+
+// The 64-bit hash that linked images are checked with, also fast enough to identify whole programs.
+uint64_t binform_checksum(const char *data, size_t size);
+
 void binform_print(ConstantPool *constpool, InstructionStream *inststream);
 
 #endif
\ No newline at end of file
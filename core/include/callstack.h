@@ -1,6 +1,8 @@
 #ifndef CALLSTACK_H
 #define CALLSTACK_H
 
+#include <stdbool.h>
+
 #include "evalstack.h"
 
 typedef Stack CallStack;
@@ -9,10 +11,11 @@ typedef struct
 {
     size_t vars_count;
     EvalStackElement *vars;
+    bool *refs;
     uint32_t return_address;
 } CallStackFrame;
 
-CallStack *callstack_new();
+CallStack *callstack_new(size_t max_depth);
 
 void callstack_free(CallStack *callstack);
 
@@ -0,0 +1,46 @@
+#ifndef CODECACHE_H
+#define CODECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "binary_format.h"
+
+// Cached programs are stored as linked images named after their key, with this extension.
+#define CODECACHE_EXTENSION ".lvmi"
+
+// Images are written to temporary files with this extension first. Those left behind by a crash are removed once they
+// are this many seconds old.
+#define CODECACHE_TEMPORARY_EXTENSION ".tmp"
+#define CODECACHE_TEMPORARY_MAX_AGE 3600
+
+// A directory of linked images keyed by the content of the programs they were linked from. The images of one directory
+// take at most max_size bytes, the least recently used ones are removed first.
+typedef struct
+{
+    char *directory;
+    char *version;
+    size_t max_size;
+} CodeCache;
+
+// Creates the directory if it does not exist. The version, usually the version of the VM, is part of every key, so
+// every build uses its own images.
+CodeCache *codecache_new(const char *directory, const char *version, size_t max_size);
+
+void codecache_free(CodeCache *cache);
+
+// The key of a program: a hash of its bytes, the version of the cache and the options, which are bits the caller sets for
+// every setting that changes how the program is processed.
+uint64_t codecache_key(CodeCache *cache, const char *data, size_t size, uint32_t options);
+
+// Maps the image stored under the key and decodes it, the file must outlive the program like binform_map_file's. An
+// image that cannot be decoded is removed and counts as a miss.
+bool codecache_load(CodeCache *cache, uint64_t key, MappedFile **file, ConstantPool **constpool, InstructionStream **inststream);
+
+// Stores the program as an image under the key, its vtables and layouts must have been computed. Every call writes the
+// image to a temporary file of its own and renames it into place, so other threads and processes see all of it or none.
+// Then stale temporary files are removed, and images, least recently used first, until the directory fits in its size.
+bool codecache_store(CodeCache *cache, uint64_t key, ConstantPool *constpool, InstructionStream *inststream);
+
+#endif
\ No newline at end of file
@@ -2,6 +2,10 @@
 #define CONFIG_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pagepool.h"
 
 typedef struct
 {
@@ -10,6 +14,19 @@ typedef struct
     void *(*_realloc)(void *, size_t);
     void (*_free)(void *);
     size_t min_stack_capacity;
+    size_t max_stack_depth;
+    size_t gc_threshold;
+    size_t nursery_size;
+    uint32_t gc_promotion_age;
+    size_t gc_increment_size;
+    uint32_t gc_increment_interval;
+    uint32_t gc_threads;
+    uint32_t load_threads;
+    size_t arena_chunk_size;
+    // Arena chunks are taken from the pool, it requires arena_chunk_size to be set and is not used by collected heaps.
+    PagePool *page_pool;
+    bool huge_pages;
+    size_t heap_limit;
 } Config;
 
 extern Config config;
@@ -2,8 +2,11 @@
 #define CONSTANTPOOL_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 
 #include "vtable.h"
+#include "inststream.h"
 
 #define BUILTIN_CONSTPOOL_ENTRIES 8
 #define CONSTPOOL_CLASS_STRING (UINT32_MAX - (BUILTIN_CONSTPOOL_ENTRIES - 1))
@@ -20,6 +23,15 @@
 #define TYPE_METHOD 2
 #define TYPE_STRING 3
 
+#define CLASS_FLAG_NATIVE 0x1
+#define CLASS_FLAG_LINKED 0x2
+
+// Fields without a type are 8 bytes large and may hold references, integer and boolean fields are packed.
+#define FIELD_TYPE_ANY 0
+#define FIELD_TYPE_INT 1
+#define FIELD_TYPE_BOOL 2
+
+// Every object points to the entry of its class, which doubles as the runtime class metadata once the vtables are computed.
 typedef struct
 {
     char *name;
@@ -27,6 +39,13 @@ typedef struct
     uint32_t fields;
     uint32_t methods;
     VTable *vtable;
+    uint32_t index;
+    uint32_t flags;
+    uint32_t instance_fields;
+    uint32_t instance_size;
+    uint32_t *field_offsets;
+    uint8_t *field_types;
+    uint32_t map_offset;
 } ConstantPoolEntryClass;
 
 typedef struct
@@ -34,6 +53,9 @@ typedef struct
     char *name;
     uint32_t _class;
     uint32_t index;
+    uint8_t type;
+    uint8_t storage;
+    uint32_t offset;
 } ConstantPoolEntryField;
 
 typedef struct
@@ -48,6 +70,7 @@ typedef struct
 typedef struct
 {
     char *value;
+    void *object;
 } ConstantPoolEntryString;
 
 typedef struct
@@ -62,14 +85,39 @@ typedef struct
     } data;
 } ConstantPoolEntry;
 
+// Decodes the entry at the index from the source of a lazy constant pool, the source was validated when it was indexed.
+typedef void (*ConstantPoolLoader)(void *source, uint32_t index, ConstantPoolEntry *entry);
+
+// A lazy constant pool decodes each entry on its first access and links each class on its first use, with the default
+// layout. The methods of every class are chained in index order, from first_methods[class] through next_methods[method].
+typedef struct
+{
+    ConstantPoolLoader load;
+    void *source;
+    bool *loaded;
+    uint32_t *first_methods;
+    uint32_t *next_methods;
+    pthread_mutex_t lock;
+} ConstantPoolLazy;
+
+// Once linked, the vtables and layouts have been computed or loaded from a linked image and are not computed again.
 typedef struct
 {
     uint32_t length;
     ConstantPoolEntry *entries;
+    bool linked;
+    ConstantPoolLazy *lazy;
 } ConstantPool;
 
+extern ConstantPoolEntry class_string_entry;
+extern ConstantPoolEntry class_console_entry;
+extern ConstantPoolEntry class_string_builder_entry;
+
 ConstantPool *constantpool_new(uint32_t length);
 
+// Takes over the source and the classes of the methods, indexed by entry with zero for other entries.
+ConstantPool *constantpool_new_lazy(uint32_t length, ConstantPoolLoader load, void *source, uint32_t *method_classes);
+
 void constantpool_free(ConstantPool *constpool);
 
 void constantpool_add(ConstantPool *constpool, uint32_t index, ConstantPoolEntry entry);
@@ -78,4 +126,11 @@ ConstantPoolEntry *constantpool_get(ConstantPool *constpool, uint32_t index);
 
 void constantpool_compute_vtables(ConstantPool *constpool);
 
+// Builds the vtable of a class of a lazy constant pool, after those of its parents. Linked classes are left as they are.
+void constantpool_link_class(ConstantPool *constpool, ConstantPoolEntryClass *_class);
+
+void constantpool_compute_layouts(ConstantPool *constpool, InstructionStream *inststream);
+
+void constantpool_create_strings(ConstantPool *constpool);
+
 #endif
\ No newline at end of file
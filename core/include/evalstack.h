@@ -13,7 +13,7 @@ typedef union
     void *pointer;
 } EvalStackElement;
 
-EvalStack *evalstack_new();
+EvalStack *evalstack_new(size_t max_depth);
 
 void evalstack_free(EvalStack *evalstack);
 
@@ -8,21 +8,45 @@
 #include "evalstack.h"
 #include "callstack.h"
 #include "constantpool.h"
+#include "heap.h"
+
+#define EXECUTOR_OK 0
+#define EXECUTOR_STACK_OVERFLOW 1
+#define EXECUTOR_OUT_OF_MEMORY 2
 
 typedef struct
 {
     ConstantPool *constpool;
     InstructionStream *inststream;
     EvalStack *evalstack;
+    Stack *evalrefs;
     CallStack *callstack;
+    Heap *heap;
+    uint32_t error;
 } Executor;
 
+// Returns NULL when the address space for the stacks cannot be reserved, or when heap_new fails.
 Executor *executor_new(ConstantPool *constpool, InstructionStream *inststream);
 
+Executor *executor_new_with_depth(ConstantPool *constpool, InstructionStream *inststream, size_t max_depth);
+
 void executor_free(Executor *executor);
 
+void executor_reset(Executor *executor);
+
 bool executor_step(Executor *executor);
 
 void executor_step_all(Executor *executor);
 
+// Runs the program until the instruction at the address is about to be executed, returns false if it finished or failed first.
+bool executor_step_until(Executor *executor, uint32_t address);
+
+CallStackFrame *executor_push_frame(Executor *executor, size_t vars_count, uint32_t return_address);
+
+void executor_collect_garbage(Executor *executor);
+
+size_t executor_live_bytes(Executor *executor);
+
+size_t executor_allocated_bytes(Executor *executor);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,192 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "stack.h"
+#include "arena.h"
+
+#define OBJECT_FLAG_MARKED 0x1
+#define OBJECT_FLAG_OLD 0x2
+#define OBJECT_FLAG_REMEMBERED 0x4
+#define OBJECT_FLAG_FORWARDED 0x8
+#define OBJECT_FLAG_IMMORTAL 0x10
+
+#define HEAP_PAUSE_BUCKETS 16
+
+// The old generation is split into this many lists so that it can be swept in parallel.
+#define HEAP_REGIONS 64
+
+// Objects larger than this are allocated directly in the old generation.
+#define HEAP_LARGE_OBJECT_SIZE 8192
+
+typedef struct
+{
+    uint32_t size;
+    uint32_t fields;
+    uint32_t flags;
+    uint32_t age;
+} ObjectHeader;
+
+typedef struct HeapBlock
+{
+    struct HeapBlock *prev;
+    struct HeapBlock *next;
+} HeapBlock;
+
+typedef struct
+{
+    size_t collections;
+    size_t minor_collections;
+    size_t objects_freed;
+    size_t bytes_freed;
+    size_t bytes_promoted;
+    size_t bytes_allocated;
+    uint64_t last_pause_ns;
+    uint64_t max_pause_ns;
+    uint64_t total_pause_ns;
+    uint64_t mark_ns;
+    uint64_t sweep_ns;
+    size_t pause_histogram[HEAP_PAUSE_BUCKETS];
+} HeapStats;
+
+typedef struct
+{
+    Arena *arena;
+    char *nursery;
+    bool huge_pages;
+    size_t semispace_size;
+    char *from_space;
+    char *to_space;
+    char *nursery_top;
+    char *nursery_limit;
+    char *nursery_mark;
+    bool nursery_full;
+    bool promote_all;
+    bool marking;
+    bool sweeping;
+    uint32_t increment_countdown;
+    HeapBlock old[HEAP_REGIONS];
+    size_t next_region;
+    size_t old_bytes;
+    size_t sweep_region;
+    HeapBlock *sweep_cursors[HEAP_REGIONS];
+    size_t swept_bytes;
+    size_t sweep_start_bytes;
+    size_t next_collection;
+    size_t limit;
+    size_t external_bytes;
+    bool over_limit;
+    Stack *roots;
+    Stack *remembered;
+    Stack *promoted;
+    Stack *mark_stack;
+    HeapStats stats;
+} Heap;
+
+typedef void (*HeapSlotVisitor)(Heap *heap, void **slot);
+
+typedef void (*HeapRootEnumerator)(Heap *heap, HeapSlotVisitor visit, void *context);
+
+// Returns NULL when config.page_pool is set without config.arena_chunk_size.
+Heap *heap_new();
+
+void heap_free(Heap *heap);
+
+void heap_reset(Heap *heap);
+
+void *heap_alloc_slow(Heap *heap, size_t size, uint32_t fields);
+
+// Objects that are known to be long lived, such as those restored from a snapshot, skip the nursery.
+void *heap_alloc_old(Heap *heap, size_t size, uint32_t fields);
+
+void heap_release(Heap *heap, void *object);
+
+void *heap_alloc_immortal(size_t size, uint32_t fields);
+
+void heap_free_immortal(void *object);
+
+void heap_remember(Heap *heap, void *object);
+
+void heap_push_root(Heap *heap, void **slot);
+
+void heap_pop_root(Heap *heap);
+
+bool heap_should_collect(Heap *heap);
+
+// Schedule the next collection as if the old generation only held live objects.
+void heap_reschedule(Heap *heap);
+
+void heap_mark(Heap *heap, void *object);
+
+void heap_collect(Heap *heap, HeapRootEnumerator roots, void *context, bool full);
+
+size_t heap_live_bytes(Heap *heap);
+
+size_t heap_allocated_bytes(Heap *heap);
+
+void heap_check_limit(Heap *heap);
+
+static inline ObjectHeader *heap_get_header(void *object)
+{
+    return (ObjectHeader *)object - 1;
+}
+
+static inline bool heap_in_nursery(Heap *heap, void *object)
+{
+    return (char *)object >= heap->nursery && (char *)object < heap->nursery + 2 * heap->semispace_size;
+}
+
+// Small objects are bump allocated in the nursery, everything else takes the slow path.
+static inline void *heap_alloc(Heap *heap, size_t size, uint32_t fields)
+{
+    size_t total = (sizeof(ObjectHeader) + size + 7) & ~(size_t)7;
+
+    if (total <= HEAP_LARGE_OBJECT_SIZE && total <= (size_t)(heap->nursery_limit - heap->nursery_top))
+    {
+        ObjectHeader *header = (ObjectHeader *)heap->nursery_top;
+        heap->nursery_top += total;
+        *header = (ObjectHeader){.size = total, .fields = fields, .flags = 0, .age = 0};
+        return header + 1;
+    }
+
+    return heap_alloc_slow(heap, size, fields);
+}
+
+// Memory that belongs to the program without being an object, such as call frames, counts against the heap limit as well.
+static inline void heap_account(Heap *heap, size_t size)
+{
+    heap->external_bytes += size;
+    heap->stats.bytes_allocated += size;
+    if (heap->limit)
+    {
+        heap_check_limit(heap);
+    }
+}
+
+static inline void heap_unaccount(Heap *heap, size_t size)
+{
+    heap->external_bytes -= size;
+}
+
+// Must be called whenever a reference is stored into an object so that old objects pointing into the nursery are scanned by minor collections.
+static inline void heap_write_barrier(Heap *heap, void *object, void *value)
+{
+    if (heap_in_nursery(heap, value) && (heap_get_header(object)->flags & (OBJECT_FLAG_OLD | OBJECT_FLAG_REMEMBERED)) == OBJECT_FLAG_OLD)
+    {
+        heap_remember(heap, object);
+    }
+}
+
+// Snapshot-at-the-beginning barrier: must be called with the previous value of a reference field before it is overwritten.
+static inline void heap_deletion_barrier(Heap *heap, void *previous)
+{
+    if (heap->marking)
+    {
+        heap_mark(heap, previous);
+    }
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef INSTSTREAM_H
 #define INSTSTREAM_H
 
+#include <stdbool.h>
+
 #include "instruction.h"
 
 typedef struct
@@ -8,10 +10,14 @@ typedef struct
     uint32_t length;
     uint32_t current;
     Instruction *instructions;
+    bool huge_pages;
+    bool mapped;
 } InstructionStream;
 
 InstructionStream *inststream_new(uint32_t length);
 
+InstructionStream *inststream_new_mapped(Instruction *instructions, uint32_t length);
+
 void inststream_free(InstructionStream *inststream);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Data is split into blocks that are compressed independently, so every match lies within its block and its offset fits
+// in 16 bits.
+#define LZ_BLOCK_SIZE 65536
+
+// Every block starts with its 32-bit little-endian compressed size, with this bit set for a block that is stored as it is.
+#define LZ_BLOCK_STORED 0x80000000
+
+// Matches are at least this long.
+#define LZ_MIN_MATCH 4
+
+// The most that size bytes can take once compressed, incompressible blocks are stored.
+size_t lz_bound(size_t size);
+
+// Returns the compressed size, the destination must hold lz_bound(size) bytes.
+size_t lz_compress(const char *source, size_t size, char *destination);
+
+// Decompresses straight into the destination, fails unless the source decodes to exactly size bytes.
+bool lz_decompress(const char *source, size_t source_size, char *destination, size_t size);
+
+#endif
\ No newline at end of file
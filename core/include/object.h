@@ -2,15 +2,33 @@
 #define OBJECT_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "evalstack.h"
+#include "constantpool.h"
+#include "heap.h"
 
-void *object_new(uint32_t constpool_class, uint32_t fields_length);
+// The header is a pointer, so the fields that follow it are naturally aligned. The reference map comes after the fields.
+typedef struct
+{
+    ConstantPoolEntryClass *_class;
+    EvalStackElement fields[];
+} Object;
 
-void object_free(void *object);
+#define OBJECT_INSTANCE_SIZE(fields) (sizeof(Object) + (fields) * sizeof(EvalStackElement) + ((fields) + 7) / 8)
+
+void *object_new(Heap *heap, ConstantPoolEntryClass *_class);
+
+void object_free(Heap *heap, void *object);
 
 uint32_t object_get_class(void *object);
 
+ConstantPoolEntryClass *object_get_runtime_class(void *object);
+
 EvalStackElement *object_get_field(void *object, uint32_t index);
 
-#endif
\ No newline at end of file
+void object_set_field(Heap *heap, void *object, uint32_t index, EvalStackElement value, bool reference);
+
+bool object_is_reference(void *object, uint32_t index);
+
+#endif
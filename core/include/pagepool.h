@@ -0,0 +1,32 @@
+#ifndef PAGEPOOL_H
+#define PAGEPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// A pool of fixed size pages that any number of threads can take pages from and give them back to without locking.
+typedef struct PagePool
+{
+    size_t page_size;
+    size_t capacity;
+    char *pages;
+    bool huge_pages;
+    _Atomic uint32_t *next;
+    atomic_size_t cursor;
+    atomic_uint_least64_t free_head;
+    atomic_size_t pages_in_use;
+} PagePool;
+
+PagePool *pagepool_new(size_t page_size, size_t capacity);
+
+void pagepool_free(PagePool *pool);
+
+void *pagepool_get(PagePool *pool);
+
+void pagepool_put(PagePool *pool, void *page);
+
+bool pagepool_contains(PagePool *pool, void *block);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PAGES_HUGE_SIZE (2 * 1024 * 1024)
+
+// Bytes that were backed by reserved huge pages and bytes that were only advised to use transparent huge pages.
+typedef struct
+{
+    size_t hugetlb_bytes;
+    size_t advised_bytes;
+} PagesStats;
+
+void *pages_alloc(size_t size);
+
+void pages_free(void *pages, size_t size);
+
+void pages_advise(void *pages, size_t size);
+
+PagesStats pages_stats();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*ParallelBody)(void *context, size_t start, size_t end);
+
+// Splits the items 0 to count - 1 into chunks of the given size and calls the body for every chunk on up to threads
+// threads, the calling thread being one of them. Chunks start at multiples of the chunk size, so a body can keep
+// results per chunk. Returns once every chunk is done.
+void parallel_for(uint32_t threads, size_t count, size_t chunk, ParallelBody body, void *context);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_SIZE_CLASSES 24
+
+// Blocks larger than this, including their 8 byte prefix, are passed on to the system allocator.
+#define POOL_MAX_BLOCK_SIZE 4096
+
+#define POOL_PAGE_SIZE (64 * 1024)
+
+typedef struct
+{
+    size_t allocations;
+    size_t frees;
+    size_t live_blocks;
+} PoolClassStats;
+
+typedef struct
+{
+    size_t pages;
+    size_t large_allocations;
+    size_t large_frees;
+    size_t bytes_in_use;
+    PoolClassStats classes[POOL_SIZE_CLASSES];
+} PoolStats;
+
+extern const uint32_t pool_class_sizes[POOL_SIZE_CLASSES];
+
+extern PoolStats pool_stats;
+
+void *pool_malloc(size_t size);
+
+void *pool_calloc(size_t nitems, size_t size);
+
+void *pool_realloc(void *block, size_t size);
+
+void pool_free(void *block);
+
+void pool_release();
+
+#endif
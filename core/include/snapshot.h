@@ -0,0 +1,47 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "executor.h"
+
+#define SNAPSHOT_OK 0
+#define SNAPSHOT_CANNOT_OPEN 1
+#define SNAPSHOT_INVALID 2
+#define SNAPSHOT_WRONG_PROGRAM 3
+
+// Snapshot files start with "LVMS".
+#define SNAPSHOT_MAGIC 0x534D564C
+
+// The header is followed by the objects, the evaluation stack and the call frames. Objects are stored with their header
+// and in the layout of the running VM, references are replaced by the offset of the object in the objects section or
+// by the constant pool index of a constant string, and class pointers by the constant pool index of the class.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t abi;
+    uint64_t program;
+    uint64_t objects_size;
+    uint32_t current;
+    uint32_t evalstack;
+    uint32_t frames;
+    uint32_t reserved;
+} SnapshotHeader;
+
+// The elements of the evaluation stack and the variables of every frame are followed by their reference tags, padded to 8 bytes.
+typedef struct
+{
+    uint64_t vars_count;
+    uint32_t return_address;
+    uint32_t reserved;
+} SnapshotFrame;
+
+uint64_t snapshot_program_checksum(ConstantPool *constpool, InstructionStream *inststream);
+
+bool snapshot_write(Executor *executor, FILE *file);
+
+uint32_t snapshot_restore(Executor *executor, const char *filename);
+
+#endif
\ No newline at end of file
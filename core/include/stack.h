@@ -2,17 +2,25 @@
 #define STACK_H
 
 #include <stddef.h>
+#include <stdbool.h>
 
+// A reserved stack lives in a mapping that ends in a guard page, it never moves and a push past its capacity faults on the guard page.
 typedef struct
 {
     size_t capacity;
     size_t length;
     size_t elemsize;
     void *elements;
+    char *mapping;
+    size_t mapping_size;
 } Stack;
 
 Stack *stack_new(size_t elemsize);
 
+Stack *stack_new_reserved(size_t elemsize, size_t max_length);
+
+bool stack_in_guard(Stack *stack, void *address);
+
 void stack_free(Stack *stack);
 
 void stack_push(Stack *stack, void *element);
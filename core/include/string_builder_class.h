@@ -3,16 +3,24 @@
 
 #include <stdint.h>
 
-void *string_builder_new();
+#include "heap.h"
 
-void *string_builder_free(void *string_builder_object);
+#define STRING_BUILDER_DEFAULT_CAPACITY 16
 
-void *string_builder_append_string(void *string_builder_object, void *string_object);
+void *string_builder_new(Heap *heap);
 
-void *string_builder_append_int(void *string_builder_object, int32_t int_value);
+void *string_builder_new_with_capacity(Heap *heap, uint32_t capacity);
 
-void *string_builder_append_bool(void *string_builder_object, int32_t bool_value);
+void *string_builder_append_string(Heap *heap, void *string_builder_object, void *string_object);
+
+void *string_builder_append_int(Heap *heap, void *string_builder_object, int32_t int_value);
+
+void *string_builder_append_bool(Heap *heap, void *string_builder_object, int32_t bool_value);
 
 void *string_builder_to_string(void *string_builder_object);
 
-#endif
\ No newline at end of file
+uint32_t string_builder_length(void *string_builder_object);
+
+uint32_t string_builder_capacity(void *string_builder_object);
+
+#endif
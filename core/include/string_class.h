@@ -1,10 +1,33 @@
 #ifndef STRING_CLASS_H
 #define STRING_CLASS_H
 
-void *string_new(const char *value);
+#include <stdint.h>
 
-void *string_free(void *string_object);
+#include "constantpool.h"
+#include "heap.h"
+
+// Strings are a single heap block without fields, the characters follow the length inline.
+typedef struct
+{
+    ConstantPoolEntryClass *_class;
+    uint32_t length;
+    char value[];
+} String;
+
+void *string_new(Heap *heap, const char *value);
+
+void *string_new_with_length(Heap *heap, const char *value, uint32_t length);
+
+void *string_alloc(Heap *heap, uint32_t capacity);
+
+void *string_new_immortal(const char *value);
+
+void string_free_immortal(void *string_object);
 
 const char *string_get_value(void *string_object);
 
-#endif
\ No newline at end of file
+uint32_t string_length(void *string_object);
+
+uint32_t string_hash(void *string_object);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef WORKDEQUE_H
+#define WORKDEQUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// A fixed capacity Chase-Lev deque: the owner pushes and pops at the bottom, other threads steal from the top.
+typedef struct
+{
+    atomic_int_least64_t top;
+    // Keep the top, which thieves write, and the bottom, which the owner writes, on separate cache lines.
+    char padding[64 - sizeof(atomic_int_least64_t)];
+    atomic_int_least64_t bottom;
+    int64_t mask;
+    _Atomic(void *) *elements;
+} WorkDeque;
+
+WorkDeque *workdeque_new(size_t capacity);
+
+void workdeque_free(WorkDeque *deque);
+
+bool workdeque_push(WorkDeque *deque, void *element);
+
+void *workdeque_pop(WorkDeque *deque);
+
+void *workdeque_steal(WorkDeque *deque);
+
+bool workdeque_empty(WorkDeque *deque);
+
+#endif
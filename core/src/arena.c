@@ -0,0 +1,141 @@
+#include "config.h"
+#include "pages.h"
+#include "arena.h"
+
+static size_t align(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+// Regular chunks are pages of the shared page pool if there is one, the system allocator is only used when it runs out.
+static ArenaChunk *new_chunk(Arena *arena, size_t size)
+{
+    ArenaChunk *chunk = NULL;
+
+    if (arena->pool && size == arena->chunk_size)
+    {
+        chunk = pagepool_get(arena->pool);
+    }
+    else if (arena->huge_pages && size == arena->chunk_size)
+    {
+        chunk = pages_alloc(sizeof(ArenaChunk) + size);
+    }
+    if (!chunk)
+    {
+        chunk = (ArenaChunk *)config._malloc(sizeof(ArenaChunk) + size);
+    }
+
+    chunk->size = size;
+    arena->chunks_count++;
+    return chunk;
+}
+
+static void free_chunk(Arena *arena, ArenaChunk *chunk)
+{
+    if (arena->pool && pagepool_contains(arena->pool, chunk))
+    {
+        pagepool_put(arena->pool, chunk);
+    }
+    else if (arena->huge_pages && chunk->size == arena->chunk_size)
+    {
+        pages_free(chunk, sizeof(ArenaChunk) + chunk->size);
+    }
+    else
+    {
+        config._free(chunk);
+    }
+}
+
+static char *chunk_data(ArenaChunk *chunk)
+{
+    return (char *)(chunk + 1);
+}
+
+Arena *arena_new(size_t chunk_size)
+{
+    Arena *arena = (Arena *)config._malloc(sizeof(Arena));
+    // With a page pool every chunk is exactly one page.
+    arena->pool = config.page_pool;
+    arena->chunk_size = arena->pool ? arena->pool->page_size - sizeof(ArenaChunk) : align(chunk_size);
+    // Chunks of at least half a huge page are rounded up to fill whole huge pages.
+    arena->huge_pages = !arena->pool && config.huge_pages && arena->chunk_size >= PAGES_HUGE_SIZE / 2;
+    if (arena->huge_pages)
+    {
+        arena->chunk_size = ((sizeof(ArenaChunk) + arena->chunk_size + PAGES_HUGE_SIZE - 1) & ~(size_t)(PAGES_HUGE_SIZE - 1)) - sizeof(ArenaChunk);
+    }
+    arena->chunks = NULL;
+    arena->current = NULL;
+    arena->top = NULL;
+    arena->limit = NULL;
+    arena->chunks_count = 0;
+    arena->bytes_allocated = 0;
+    return arena;
+}
+
+void arena_free(Arena *arena)
+{
+    while (arena->chunks)
+    {
+        ArenaChunk *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free_chunk(arena, chunk);
+    }
+    config._free(arena);
+}
+
+void *arena_alloc_slow(Arena *arena, size_t size)
+{
+    arena->bytes_allocated += size;
+
+    // Blocks that do not fit in a regular chunk get a chunk of their own, so that the current chunk can still be filled up.
+    if (size > arena->chunk_size)
+    {
+        ArenaChunk *chunk = new_chunk(arena, size);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        return chunk_data(chunk);
+    }
+
+    ArenaChunk *chunk = new_chunk(arena, arena->chunk_size);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->current = chunk;
+    arena->top = chunk_data(chunk) + size;
+    arena->limit = chunk_data(chunk) + chunk->size;
+    return chunk_data(chunk);
+}
+
+void arena_release(Arena *arena, void *block, size_t size)
+{
+    // Only the most recent block can be given back, which covers memory that is used in LIFO order such as call frames.
+    size = align(size);
+
+    if ((char *)block + size == arena->top)
+    {
+        arena->top = block;
+        arena->bytes_allocated -= size;
+    }
+}
+
+void arena_reset(Arena *arena)
+{
+    // Keep the current chunk so that the next run does not have to allocate a chunk straight away.
+    while (arena->chunks)
+    {
+        ArenaChunk *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        if (chunk != arena->current)
+        {
+            free_chunk(arena, chunk);
+            arena->chunks_count--;
+        }
+    }
+
+    if (arena->current)
+    {
+        arena->current->next = NULL;
+        arena->chunks = arena->current;
+        arena->top = chunk_data(arena->current);
+    }
+    arena->bytes_allocated = 0;
+}
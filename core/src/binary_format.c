@@ -1,7 +1,16 @@
+#include <errno.h>
 #include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "config.h"
+#include "object.h"
 #include "binary_format.h"
+#include "lz.h"
+#include "parallel.h"
 
 // We want to use htonl/ntohl to ensure big-endian in the binary format.
 #ifdef __unix__
@@ -10,13 +19,6 @@
 #include <winsock.h>
 #endif
 
-// Write big-endian.
-static void write_uint32_big_endian(FILE *file, uint32_t value)
-{
-    uint32_t big_endian = htonl(value);
-    fwrite(&big_endian, sizeof(uint32_t), 1, file);
-}
-
 // Read big-endian and convert back to the host-endianness.
 static void read_uint32_big_endian(FILE *file, uint32_t *value)
 {
@@ -25,71 +27,6 @@ static void read_uint32_big_endian(FILE *file, uint32_t *value)
     *value = ntohl(big_endian);
 }
 
-void binform_write_constantpool(FILE *file, ConstantPool *constpool)
-{
-    write_uint32_big_endian(file, constpool->length);
-    for (uint32_t i = 1; i <= constpool->length; i++)
-    {
-        uint8_t entry_type = constpool->entries[i - 1].type;
-        fwrite(&entry_type, sizeof(uint8_t), 1, file);
-
-        switch (entry_type)
-        {
-        case TYPE_CLASS:
-        {
-            ConstantPoolEntryClass _class = constpool->entries[i - 1].data._class;
-            uint32_t name_len = strlen(_class.name) + 1;
-            write_uint32_big_endian(file, name_len);
-            fwrite(_class.name, name_len, 1, file);
-            write_uint32_big_endian(file, _class.parent);
-            write_uint32_big_endian(file, _class.fields);
-            write_uint32_big_endian(file, _class.methods);
-        }
-        break;
-        case TYPE_FIELD:
-        {
-            ConstantPoolEntryField field = constpool->entries[i - 1].data.field;
-            uint32_t name_len = strlen(field.name) + 1;
-            write_uint32_big_endian(file, name_len);
-            fwrite(field.name, name_len, 1, file);
-            write_uint32_big_endian(file, field._class);
-            write_uint32_big_endian(file, field.index);
-        }
-        break;
-        case TYPE_METHOD:
-        {
-            ConstantPoolEntryMethod method = constpool->entries[i - 1].data.method;
-            uint32_t name_len = strlen(method.name) + 1;
-            write_uint32_big_endian(file, name_len);
-            fwrite(method.name, name_len, 1, file);
-            write_uint32_big_endian(file, method._class);
-            write_uint32_big_endian(file, method.address);
-            write_uint32_big_endian(file, method.args);
-            write_uint32_big_endian(file, method.locals);
-        }
-        break;
-        case TYPE_STRING:
-        {
-            ConstantPoolEntryString string = constpool->entries[i - 1].data.string;
-            uint32_t value_len = strlen(string.value) + 1;
-            write_uint32_big_endian(file, value_len);
-            fwrite(string.value, value_len, 1, file);
-        }
-        break;
-        }
-    }
-}
-
-void binform_write_instructions(FILE *file, InstructionStream *inststream)
-{
-    write_uint32_big_endian(file, inststream->length);
-    for (uint32_t i = 0; i < inststream->length; i++)
-    {
-        fwrite(&inststream->instructions[i].opcode, sizeof(uint8_t), 1, file);
-        write_uint32_big_endian(file, inststream->instructions[i].operand);
-    }
-}
-
 ConstantPool *binform_read_constantpool(FILE *file)
 {
     uint32_t length;
@@ -106,7 +43,7 @@ ConstantPool *binform_read_constantpool(FILE *file)
         {
         case TYPE_CLASS:
         {
-            ConstantPoolEntryClass _class;
+            ConstantPoolEntryClass _class = {0};
             uint32_t name_len;
             read_uint32_big_endian(file, &name_len);
             _class.name = config._malloc(name_len);
@@ -120,7 +57,7 @@ ConstantPool *binform_read_constantpool(FILE *file)
         break;
         case TYPE_FIELD:
         {
-            ConstantPoolEntryField field;
+            ConstantPoolEntryField field = {0};
             uint32_t name_len;
             read_uint32_big_endian(file, &name_len);
             field.name = config._malloc(name_len);
@@ -146,7 +83,7 @@ ConstantPool *binform_read_constantpool(FILE *file)
         break;
         case TYPE_STRING:
         {
-            ConstantPoolEntryString string;
+            ConstantPoolEntryString string = {.object = NULL};
             uint32_t value_len;
             read_uint32_big_endian(file, &value_len);
             string.value = config._malloc(value_len);
@@ -175,6 +112,1663 @@ InstructionStream *binform_read_instructions(FILE *file)
     return inststream;
 }
 
+_Static_assert(sizeof(BinformConstant) == 24, "constant records are 24 bytes");
+_Static_assert(sizeof(BinformInstruction) == sizeof(Instruction) && offsetof(BinformInstruction, operand) == offsetof(Instruction, operand), "code records must match Instruction");
+
+// Images hold object layouts, so they only fit a VM with the same object header and field size. The low byte is
+// bumped whenever the way classes are linked changes.
+#define BINFORM_IMAGE_ABI ((uint32_t)sizeof(Object) << 16 | (uint32_t)sizeof(EvalStackElement) << 8 | 1)
+
+#define BINFORM_IMAGE_SECTIONS 8
+
+#define BINFORM_NO_LAYOUT UINT32_MAX
+
+// Constant pools and code are decoded in chunks of this many entries or instructions on config.load_threads threads.
+#define BINFORM_LOAD_CHUNK 16384
+
+// Values are stored little-endian one byte at a time, so that files are the same on every host.
+static void store_uint32_little_endian(char *data, uint32_t value)
+{
+    uint8_t *bytes = (uint8_t *)data;
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+}
+
+static uint32_t load_uint32_little_endian(const char *data)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint32_t align_section(uint32_t offset)
+{
+    return (offset + BINFORM_SECTION_ALIGNMENT - 1) & ~(uint32_t)(BINFORM_SECTION_ALIGNMENT - 1);
+}
+
+// FNV-1a over eight bytes at a time with a rotation to mix the high bits back down, fast enough to verify a whole image
+// on every start.
+uint64_t binform_checksum(const char *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        hash = (hash ^ word) * 0x100000001b3;
+        hash = hash << 29 | hash >> 35;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Every entry type has exactly one string, the name or, for string entries, the value.
+static char **entry_string(ConstantPoolEntry *entry)
+{
+    switch (entry->type)
+    {
+    case TYPE_CLASS:
+        return &entry->data._class.name;
+    case TYPE_FIELD:
+        return &entry->data.field.name;
+    case TYPE_METHOD:
+        return &entry->data.method.name;
+    default:
+        return &entry->data.string.value;
+    }
+}
+
+static void entry_values(ConstantPoolEntry *entry, uint32_t values[4])
+{
+    switch (entry->type)
+    {
+    case TYPE_CLASS:
+        values[0] = entry->data._class.parent;
+        values[1] = entry->data._class.fields;
+        values[2] = entry->data._class.methods;
+        break;
+    case TYPE_FIELD:
+        values[0] = entry->data.field._class;
+        values[1] = entry->data.field.index;
+        break;
+    case TYPE_METHOD:
+        values[0] = entry->data.method._class;
+        values[1] = entry->data.method.address;
+        values[2] = entry->data.method.args;
+        values[3] = entry->data.method.locals;
+        break;
+    }
+}
+
+static bool entry_is(ConstantPool *constpool, uint32_t index, uint8_t type)
+{
+    return index >= 1 && index <= constpool->length && constpool->entries[index - 1].type == type;
+}
+
+static char *output_reserve(BinformBuffer *output, size_t size)
+{
+    if (output->size + size > output->capacity)
+    {
+        output->capacity = output->capacity ? output->capacity : 4096;
+        while (output->size + size > output->capacity)
+        {
+            output->capacity *= 2;
+        }
+        output->data = config._realloc(output->data, output->capacity);
+    }
+    char *data = output->data + output->size;
+    memset(data, 0, size);
+    output->size += size;
+    return data;
+}
+
+// The returned records are zeroed and only valid until the next section is added.
+static char *output_section(BinformBuffer *output, BinformSection *section, uint32_t kind, uint32_t count, size_t size)
+{
+    output_reserve(output, align_section(output->size) - output->size);
+    *section = (BinformSection){.kind = kind, .count = count, .offset = output->size, .size = size};
+    return output_reserve(output, size);
+}
+
+static uint32_t name_hash(const char *string)
+{
+    uint32_t hash = 2166136261u;
+    while (*string)
+    {
+        hash = (hash ^ (uint8_t)*string++) * 16777619u;
+    }
+    return hash;
+}
+
+// Equal names and strings are stored once, so they share their offset in the string table.
+static uint32_t *intern_strings(ConstantPool *constpool, BinformBuffer *table)
+{
+    uint32_t *offsets = config._malloc((constpool->length + 1) * sizeof(uint32_t));
+    uint32_t capacity = 16;
+    while (capacity < 2 * constpool->length)
+    {
+        capacity *= 2;
+    }
+    uint32_t *slots = config._calloc(capacity, sizeof(uint32_t));
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        char *string = *entry_string(constantpool_get(constpool, i));
+        uint32_t slot = name_hash(string) & (capacity - 1);
+
+        while (slots[slot] && strcmp(*entry_string(constantpool_get(constpool, slots[slot])), string) != 0)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (slots[slot])
+        {
+            offsets[i - 1] = offsets[slots[slot] - 1];
+        }
+        else
+        {
+            slots[slot] = i;
+            offsets[i - 1] = table->size;
+            size_t length = strlen(string) + 1;
+            memcpy(output_reserve(table, length), string, length);
+        }
+    }
+
+    config._free(slots);
+    return offsets;
+}
+
+// Stores the vtables, layouts and resolved fields that constantpool_compute_vtables and constantpool_compute_layouts produced.
+static void output_link_sections(BinformBuffer *output, BinformSection *sections, ConstantPool *constpool)
+{
+    uint32_t classes = 0, slots = 0, layouts = 0, fields = 0;
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        if (entry->type == TYPE_CLASS)
+        {
+            classes++;
+            slots += entry->data._class.vtable->length;
+            layouts += entry->data._class.field_offsets ? entry->data._class.instance_fields : 0;
+        }
+        fields += entry->type == TYPE_FIELD;
+    }
+
+    char *records = output_section(output, &sections[0], BINFORM_SECTION_CLASSES, classes, classes * sizeof(BinformClass));
+    for (uint32_t i = 1, slot = 0, layout = 0; i <= constpool->length; i++)
+    {
+        ConstantPoolEntryClass *_class = &constantpool_get(constpool, i)->data._class;
+        if (constantpool_get(constpool, i)->type != TYPE_CLASS)
+        {
+            continue;
+        }
+        uint32_t values[] = {i, _class->flags, _class->instance_fields, _class->instance_size, _class->map_offset, slot, _class->vtable->length,
+                             _class->field_offsets ? layout : BINFORM_NO_LAYOUT};
+        for (uint32_t j = 0; j < sizeof(values) / sizeof(uint32_t); j++)
+        {
+            store_uint32_little_endian(records + j * sizeof(uint32_t), values[j]);
+        }
+        records += sizeof(BinformClass);
+        slot += _class->vtable->length;
+        layout += _class->field_offsets ? _class->instance_fields : 0;
+    }
+
+    // The slots are stored in hash table order, so the tables are copied instead of being rebuilt.
+    records = output_section(output, &sections[1], BINFORM_SECTION_VTABLES, slots, slots * sizeof(uint32_t));
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        if (constantpool_get(constpool, i)->type != TYPE_CLASS)
+        {
+            continue;
+        }
+        VTable *vtable = constantpool_get(constpool, i)->data._class.vtable;
+        for (uint32_t j = 0; j < vtable->length; j++)
+        {
+            store_uint32_little_endian(records, vtable->table[j].const_index);
+            records += sizeof(uint32_t);
+        }
+    }
+
+    records = output_section(output, &sections[2], BINFORM_SECTION_LAYOUTS, layouts, layouts * sizeof(BinformLayoutField));
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntryClass *_class = &constantpool_get(constpool, i)->data._class;
+        if (constantpool_get(constpool, i)->type != TYPE_CLASS || !_class->field_offsets)
+        {
+            continue;
+        }
+        for (uint32_t j = 0; j < _class->instance_fields; j++)
+        {
+            store_uint32_little_endian(records + offsetof(BinformLayoutField, offset), _class->field_offsets[j]);
+            records[offsetof(BinformLayoutField, type)] = _class->field_types[j];
+            records += sizeof(BinformLayoutField);
+        }
+    }
+
+    records = output_section(output, &sections[3], BINFORM_SECTION_FIELDS, fields, fields * sizeof(BinformField));
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntryField *field = &constantpool_get(constpool, i)->data.field;
+        if (constantpool_get(constpool, i)->type == TYPE_FIELD)
+        {
+            store_uint32_little_endian(records + offsetof(BinformField, constant), i);
+            store_uint32_little_endian(records + offsetof(BinformField, offset), field->offset);
+            records[offsetof(BinformField, storage)] = field->storage;
+            records += sizeof(BinformField);
+        }
+    }
+}
+
+static void store_uint32_big_endian(char *data, uint32_t value)
+{
+    uint32_t big_endian = htonl(value);
+    memcpy(data, &big_endian, sizeof(uint32_t));
+}
+
+// Version 1 files are encoded in memory as well and written with a single call, rather than one stdio call per field.
+static void output_constantpool_v1(BinformBuffer *output, ConstantPool *constpool)
+{
+    static const uint32_t value_counts[] = {[TYPE_CLASS] = 3, [TYPE_FIELD] = 2, [TYPE_METHOD] = 4, [TYPE_STRING] = 0};
+
+    store_uint32_big_endian(output_reserve(output, sizeof(uint32_t)), constpool->length);
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        const char *string = *entry_string(entry);
+        uint32_t length = strlen(string) + 1;
+        uint32_t values[4] = {0};
+        entry_values(entry, values);
+
+        char *data = output_reserve(output, 1 + sizeof(uint32_t) + length + value_counts[entry->type] * sizeof(uint32_t));
+        *data++ = entry->type;
+        store_uint32_big_endian(data, length);
+        memcpy(data + sizeof(uint32_t), string, length);
+        data += sizeof(uint32_t) + length;
+        for (uint32_t j = 0; j < value_counts[entry->type]; j++, data += sizeof(uint32_t))
+        {
+            store_uint32_big_endian(data, values[j]);
+        }
+    }
+}
+
+static void output_instructions_v1(BinformBuffer *output, InstructionStream *inststream)
+{
+    store_uint32_big_endian(output_reserve(output, sizeof(uint32_t)), inststream->length);
+    char *data = output_reserve(output, (size_t)inststream->length * 5);
+    for (uint32_t i = 0; i < inststream->length; i++, data += 5)
+    {
+        data[0] = inststream->instructions[i].opcode;
+        store_uint32_big_endian(data + 1, inststream->instructions[i].operand);
+    }
+}
+
+void binform_write_constantpool(FILE *file, ConstantPool *constpool)
+{
+    BinformBuffer output = {.data = NULL, .size = 0, .capacity = 0};
+    output_constantpool_v1(&output, constpool);
+    fwrite(output.data, output.size, 1, file);
+    binform_buffer_free(&output);
+}
+
+void binform_write_instructions(FILE *file, InstructionStream *inststream)
+{
+    BinformBuffer output = {.data = NULL, .size = 0, .capacity = 0};
+    output_instructions_v1(&output, inststream);
+    fwrite(output.data, output.size, 1, file);
+    binform_buffer_free(&output);
+}
+
+// Operand widths by the width bits of a compact opcode.
+static const uint8_t compact_widths[] = {0, 1, 2, 4};
+
+static uint8_t compact_width(uint32_t operand)
+{
+    return operand == 0 ? 0 : operand <= UINT8_MAX ? 1 : operand <= UINT16_MAX ? 2 : 3;
+}
+
+// Opcodes and operands are stored apart, so the opcodes are one byte each and the operands take only the bytes they need.
+static void output_compact_code(BinformBuffer *output, BinformSection *section, InstructionStream *inststream)
+{
+    size_t size = inststream->length;
+    for (uint32_t i = 0; i < inststream->length; i++)
+    {
+        size += compact_widths[compact_width(inststream->instructions[i].operand)];
+    }
+
+    uint8_t *opcodes = (uint8_t *)output_section(output, section, BINFORM_SECTION_COMPACT_CODE, inststream->length, size);
+    uint8_t *operands = opcodes + inststream->length;
+    for (uint32_t i = 0; i < inststream->length; i++)
+    {
+        uint32_t operand = inststream->instructions[i].operand;
+        uint8_t width = compact_width(operand);
+        opcodes[i] = inststream->instructions[i].opcode | width << BINFORM_COMPACT_WIDTH_SHIFT;
+        for (uint8_t j = 0; j < compact_widths[width]; j++)
+        {
+            *operands++ = (uint8_t)(operand >> 8 * j);
+        }
+    }
+}
+
+// A version 2 file is assembled in memory, so that the directory and the checksum can be filled in last.
+static void output_program_v2(BinformBuffer *output, ConstantPool *constpool, InstructionStream *inststream, uint32_t flags)
+{
+    bool linked = flags & BINFORM_FLAG_LINKED;
+    BinformSection sections[BINFORM_IMAGE_SECTIONS];
+    uint32_t section_count = linked ? BINFORM_IMAGE_SECTIONS : 3;
+    output->size = 0;
+    output_reserve(output, sizeof(BinformHeader) + section_count * sizeof(BinformSection));
+
+    BinformBuffer table = {.data = NULL, .size = 0, .capacity = 0};
+    uint32_t *names = intern_strings(constpool, &table);
+
+    char *records = output_section(output, &sections[0], BINFORM_SECTION_CONSTANTS, constpool->length, constpool->length * sizeof(BinformConstant));
+    for (uint32_t i = 1; i <= constpool->length; i++, records += sizeof(BinformConstant))
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        uint32_t values[4] = {0};
+        entry_values(entry, values);
+        records[offsetof(BinformConstant, type)] = entry->type;
+        records[offsetof(BinformConstant, field_type)] = entry->type == TYPE_FIELD ? entry->data.field.type : 0;
+        store_uint32_little_endian(records + offsetof(BinformConstant, name), names[i - 1]);
+        for (int j = 0; j < 4; j++)
+        {
+            store_uint32_little_endian(records + offsetof(BinformConstant, values) + j * sizeof(uint32_t), values[j]);
+        }
+    }
+    config._free(names);
+
+    memcpy(output_section(output, &sections[1], BINFORM_SECTION_STRINGS, constpool->length, table.size), table.data, table.size);
+    config._free(table.data);
+
+    if (flags & BINFORM_FLAG_COMPACT)
+    {
+        output_compact_code(output, &sections[2], inststream);
+    }
+    else
+    {
+        records = output_section(output, &sections[2], BINFORM_SECTION_CODE, inststream->length, inststream->length * sizeof(BinformInstruction));
+        for (uint32_t i = 0; i < inststream->length; i++, records += sizeof(BinformInstruction))
+        {
+            records[offsetof(BinformInstruction, opcode)] = inststream->instructions[i].opcode;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            memcpy(records + offsetof(BinformInstruction, operand), &inststream->instructions[i].operand, sizeof(uint32_t));
+#else
+            store_uint32_little_endian(records + offsetof(BinformInstruction, operand), inststream->instructions[i].operand);
+#endif
+        }
+    }
+
+    if (linked)
+    {
+        output_link_sections(output, sections + 3, constpool);
+        output_section(output, &sections[7], BINFORM_SECTION_LINK, 1, sizeof(BinformLink));
+    }
+
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, magic), BINFORM_MAGIC);
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, version), BINFORM_VERSION_2);
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, sections), section_count);
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, flags), flags);
+    for (uint32_t i = 0; i < section_count; i++)
+    {
+        char *record = output->data + sizeof(BinformHeader) + i * sizeof(BinformSection);
+        store_uint32_little_endian(record + offsetof(BinformSection, kind), sections[i].kind);
+        store_uint32_little_endian(record + offsetof(BinformSection, count), sections[i].count);
+        store_uint32_little_endian(record + offsetof(BinformSection, offset), sections[i].offset);
+        store_uint32_little_endian(record + offsetof(BinformSection, size), sections[i].size);
+    }
+
+    if (linked)
+    {
+        char *link = output->data + sections[7].offset;
+        uint64_t checksum = binform_checksum(output->data, sections[7].offset);
+        store_uint32_little_endian(link + offsetof(BinformLink, checksum), (uint32_t)checksum);
+        store_uint32_little_endian(link + offsetof(BinformLink, checksum) + sizeof(uint32_t), (uint32_t)(checksum >> 32));
+        store_uint32_little_endian(link + offsetof(BinformLink, abi), BINFORM_IMAGE_ABI);
+    }
+}
+
+void binform_write_program(FILE *file, ConstantPool *constpool, InstructionStream *inststream, uint32_t version)
+{
+    BinformBuffer output = {.data = NULL, .size = 0, .capacity = 0};
+    binform_write_to_buffer(&output, constpool, inststream, version);
+    fwrite(output.data, output.size, 1, file);
+    binform_buffer_free(&output);
+}
+
+void binform_write_image(FILE *file, ConstantPool *constpool, InstructionStream *inststream)
+{
+    BinformBuffer output = {.data = NULL, .size = 0, .capacity = 0};
+    output_program_v2(&output, constpool, inststream, BINFORM_FLAG_LINKED);
+    fwrite(output.data, output.size, 1, file);
+    binform_buffer_free(&output);
+}
+
+void binform_write_compact(FILE *file, ConstantPool *constpool, InstructionStream *inststream)
+{
+    BinformBuffer output = {.data = NULL, .size = 0, .capacity = 0};
+    output_program_v2(&output, constpool, inststream, BINFORM_FLAG_COMPACT);
+    fwrite(output.data, output.size, 1, file);
+    binform_buffer_free(&output);
+}
+
+// Records why decoding stopped, only the first error is kept since the callers that fail after it only see its effect.
+static bool fail(MappedFile *file, uint32_t error)
+{
+    if (file->error == BINFORM_OK)
+    {
+        file->error = error;
+    }
+    return false;
+}
+
+uint32_t binform_compress(BinformBuffer *output, const char *data, size_t size)
+{
+    if (size < sizeof(BinformHeader) || load_uint32_little_endian(data + offsetof(BinformHeader, magic)) != BINFORM_MAGIC ||
+        load_uint32_little_endian(data + offsetof(BinformHeader, version)) != BINFORM_VERSION_2)
+    {
+        return BINFORM_ERROR_VERSION;
+    }
+    uint32_t flags = load_uint32_little_endian(data + offsetof(BinformHeader, flags));
+    uint32_t sections = load_uint32_little_endian(data + offsetof(BinformHeader, sections));
+    if (flags & BINFORM_FLAG_COMPRESSED)
+    {
+        return BINFORM_ERROR_VERSION;
+    }
+    if (sections > (size - sizeof(BinformHeader)) / sizeof(BinformSection))
+    {
+        return BINFORM_ERROR_TRUNCATED;
+    }
+
+    output->size = 0;
+    output_reserve(output, sizeof(BinformHeader) + sections * sizeof(BinformSection));
+    for (uint32_t i = 0; i < sections; i++)
+    {
+        const char *record = data + sizeof(BinformHeader) + (size_t)i * sizeof(BinformSection);
+        uint32_t kind = load_uint32_little_endian(record + offsetof(BinformSection, kind));
+        uint32_t offset = load_uint32_little_endian(record + offsetof(BinformSection, offset));
+        uint32_t section_size = load_uint32_little_endian(record + offsetof(BinformSection, size));
+        if (offset > size || section_size > size - offset)
+        {
+            return BINFORM_ERROR_TRUNCATED;
+        }
+        if (kind & BINFORM_SECTION_COMPRESSED)
+        {
+            return BINFORM_ERROR_MALFORMED;
+        }
+
+        output_reserve(output, align_section(output->size) - output->size);
+        size_t start = output->size;
+        char *payload = output_reserve(output, sizeof(BinformCompressed) + lz_bound(section_size));
+        store_uint32_little_endian(payload + offsetof(BinformCompressed, offset), offset);
+        store_uint32_little_endian(payload + offsetof(BinformCompressed, size), section_size);
+        output->size = start + sizeof(BinformCompressed) + lz_compress(data + offset, section_size, payload + sizeof(BinformCompressed));
+
+        char *compressed = output->data + sizeof(BinformHeader) + (size_t)i * sizeof(BinformSection);
+        store_uint32_little_endian(compressed + offsetof(BinformSection, kind), kind | BINFORM_SECTION_COMPRESSED);
+        store_uint32_little_endian(compressed + offsetof(BinformSection, count), load_uint32_little_endian(record + offsetof(BinformSection, count)));
+        store_uint32_little_endian(compressed + offsetof(BinformSection, offset), start);
+        store_uint32_little_endian(compressed + offsetof(BinformSection, size), output->size - start);
+    }
+
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, magic), BINFORM_MAGIC);
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, version), BINFORM_VERSION_2);
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, sections), sections);
+    store_uint32_little_endian(output->data + offsetof(BinformHeader, flags), flags | BINFORM_FLAG_COMPRESSED);
+    return BINFORM_OK;
+}
+
+static bool is_compressed(MappedFile *file)
+{
+    return file->size >= sizeof(BinformHeader) && load_uint32_little_endian(file->data + offsetof(BinformHeader, magic)) == BINFORM_MAGIC &&
+           load_uint32_little_endian(file->data + offsetof(BinformHeader, version)) == BINFORM_VERSION_2 &&
+           load_uint32_little_endian(file->data + offsetof(BinformHeader, flags)) & BINFORM_FLAG_COMPRESSED;
+}
+
+// Checks the directory of a compressed program and returns how large it is once expanded, which is where its last
+// section ends.
+static bool expanded_size(MappedFile *file, size_t *size)
+{
+    uint32_t sections = load_uint32_little_endian(file->data + offsetof(BinformHeader, sections));
+    if (sections > (file->size - sizeof(BinformHeader)) / sizeof(BinformSection))
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+
+    size_t directory = sizeof(BinformHeader) + (size_t)sections * sizeof(BinformSection);
+    *size = directory;
+    for (uint32_t i = 0; i < sections; i++)
+    {
+        const char *record = file->data + sizeof(BinformHeader) + (size_t)i * sizeof(BinformSection);
+        uint32_t kind = load_uint32_little_endian(record + offsetof(BinformSection, kind));
+        uint32_t offset = load_uint32_little_endian(record + offsetof(BinformSection, offset));
+        uint32_t section_size = load_uint32_little_endian(record + offsetof(BinformSection, size));
+        if (!(kind & BINFORM_SECTION_COMPRESSED) || offset % BINFORM_SECTION_ALIGNMENT != 0)
+        {
+            return fail(file, BINFORM_ERROR_MALFORMED);
+        }
+        if (offset > file->size || section_size > file->size - offset)
+        {
+            return fail(file, BINFORM_ERROR_TRUNCATED);
+        }
+
+        // A byte of LZ data never expands to more than 255 bytes, which keeps a damaged size from reserving gigabytes.
+        const char *payload = file->data + offset;
+        uint32_t expanded_offset = section_size >= sizeof(BinformCompressed) ? load_uint32_little_endian(payload + offsetof(BinformCompressed, offset)) : 0;
+        uint32_t expanded = section_size >= sizeof(BinformCompressed) ? load_uint32_little_endian(payload + offsetof(BinformCompressed, size)) : 0;
+        if (section_size < sizeof(BinformCompressed) || expanded_offset < directory || expanded_offset % BINFORM_SECTION_ALIGNMENT != 0 ||
+            expanded / 255 > section_size)
+        {
+            return fail(file, BINFORM_ERROR_MALFORMED);
+        }
+        if ((size_t)expanded_offset + expanded > *size)
+        {
+            *size = (size_t)expanded_offset + expanded;
+        }
+    }
+    return true;
+}
+
+// Restores the header, the directory and every section, the destination must hold the expanded size and be zeroed so
+// that the padding between sections matches too.
+static bool expand_program(MappedFile *file, char *destination)
+{
+    uint32_t sections = load_uint32_little_endian(file->data + offsetof(BinformHeader, sections));
+    memcpy(destination, file->data, sizeof(BinformHeader));
+    store_uint32_little_endian(destination + offsetof(BinformHeader, flags), load_uint32_little_endian(file->data + offsetof(BinformHeader, flags)) & ~BINFORM_FLAG_COMPRESSED);
+
+    for (uint32_t i = 0; i < sections; i++)
+    {
+        const char *record = file->data + sizeof(BinformHeader) + (size_t)i * sizeof(BinformSection);
+        char *expanded = destination + sizeof(BinformHeader) + (size_t)i * sizeof(BinformSection);
+        uint32_t offset = load_uint32_little_endian(record + offsetof(BinformSection, offset));
+        uint32_t size = load_uint32_little_endian(record + offsetof(BinformSection, size));
+        const char *payload = file->data + offset;
+        uint32_t expanded_offset = load_uint32_little_endian(payload + offsetof(BinformCompressed, offset));
+        uint32_t expanded_size = load_uint32_little_endian(payload + offsetof(BinformCompressed, size));
+
+        store_uint32_little_endian(expanded + offsetof(BinformSection, kind), load_uint32_little_endian(record + offsetof(BinformSection, kind)) & ~BINFORM_SECTION_COMPRESSED);
+        store_uint32_little_endian(expanded + offsetof(BinformSection, count), load_uint32_little_endian(record + offsetof(BinformSection, count)));
+        store_uint32_little_endian(expanded + offsetof(BinformSection, offset), expanded_offset);
+        store_uint32_little_endian(expanded + offsetof(BinformSection, size), expanded_size);
+        if (!lz_decompress(payload + sizeof(BinformCompressed), size - sizeof(BinformCompressed), destination + expanded_offset, expanded_size))
+        {
+            return fail(file, BINFORM_ERROR_MALFORMED);
+        }
+    }
+    return true;
+}
+
+// Every section is decompressed straight to its place in an anonymous mapping, which then replaces the file. A program
+// that cannot be expanded stays mapped as it is, no section can be found in it and the reason is kept in the error.
+static void expand_mapping(MappedFile *file)
+{
+    size_t size;
+    if (!expanded_size(file, &size))
+    {
+        return;
+    }
+    char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        fail(file, BINFORM_ERROR_IO);
+        return;
+    }
+    if (!expand_program(file, data))
+    {
+        munmap(data, size);
+        return;
+    }
+    munmap(file->data, file->size);
+    file->data = data;
+    file->size = size;
+}
+
+MappedFile *binform_map_file(const char *filename)
+{
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor < 0)
+    {
+        return NULL;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+    {
+        close(descriptor);
+        return NULL;
+    }
+
+    // A private writable mapping is copy-on-write, so the names in the constant pool can still be modified like copies.
+    char *data = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+    madvise(data, status.st_size, MADV_SEQUENTIAL);
+
+    MappedFile *file = (MappedFile *)config._malloc(sizeof(MappedFile));
+    file->data = data;
+    file->size = status.st_size;
+    file->offset = 0;
+    file->error = BINFORM_OK;
+    if (is_compressed(file))
+    {
+        expand_mapping(file);
+    }
+    return file;
+}
+
+void binform_unmap_file(MappedFile *file)
+{
+    munmap(file->data, file->size);
+    file->data = NULL;
+    config._free(file);
+}
+
+uint32_t binform_version(MappedFile *file)
+{
+    if (file->size >= sizeof(BinformHeader) && load_uint32_little_endian(file->data) == BINFORM_MAGIC)
+    {
+        return load_uint32_little_endian(file->data + offsetof(BinformHeader, version));
+    }
+    return BINFORM_VERSION_1;
+}
+
+static bool map_uint32_big_endian(MappedFile *file, uint32_t *value)
+{
+    if (file->size - file->offset < sizeof(uint32_t))
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+    uint32_t big_endian;
+    memcpy(&big_endian, file->data + file->offset, sizeof(uint32_t));
+    file->offset += sizeof(uint32_t);
+    *value = ntohl(big_endian);
+    return true;
+}
+
+// Names and strings are stored null-terminated, so they are used in place instead of being copied.
+static bool map_string(MappedFile *file, char **string)
+{
+    uint32_t length;
+    if (!map_uint32_big_endian(file, &length))
+    {
+        return false;
+    }
+    if (file->size - file->offset < length)
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+    if (length == 0 || file->data[file->offset + length - 1] != '\0')
+    {
+        return fail(file, BINFORM_ERROR_MALFORMED);
+    }
+    *string = file->data + file->offset;
+    file->offset += length;
+    return true;
+}
+
+static bool map_uint32s(MappedFile *file, uint32_t **values, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!map_uint32_big_endian(file, values[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Only the entries before the one that failed have been filled in.
+static ConstantPool *discard_constantpool(ConstantPool *constpool, uint32_t filled)
+{
+    constpool->length = filled;
+    constantpool_free(constpool);
+    return NULL;
+}
+
+// Maps the entry at the current offset, its names and strings point into the mapping.
+static bool map_constant_v1(MappedFile *file, ConstantPoolEntry *entry)
+{
+    if (file->offset == file->size)
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+    uint8_t type = file->data[file->offset++];
+    *entry = (ConstantPoolEntry){.type = type};
+    bool valid = false;
+
+    switch (type)
+    {
+    case TYPE_CLASS:
+    {
+        ConstantPoolEntryClass *_class = &entry->data._class;
+        valid = map_string(file, &_class->name) && map_uint32s(file, (uint32_t *[]){&_class->parent, &_class->fields, &_class->methods}, 3);
+    }
+    break;
+    case TYPE_FIELD:
+    {
+        ConstantPoolEntryField *field = &entry->data.field;
+        valid = map_string(file, &field->name) && map_uint32s(file, (uint32_t *[]){&field->_class, &field->index}, 2);
+    }
+    break;
+    case TYPE_METHOD:
+    {
+        ConstantPoolEntryMethod *method = &entry->data.method;
+        valid = map_string(file, &method->name) && map_uint32s(file, (uint32_t *[]){&method->_class, &method->address, &method->args, &method->locals}, 4);
+    }
+    break;
+    case TYPE_STRING:
+        valid = map_string(file, &entry->data.string.value);
+        break;
+    }
+
+    return valid || fail(file, BINFORM_ERROR_MALFORMED);
+}
+
+static bool map_constantpool_length_v1(MappedFile *file, uint32_t *length)
+{
+    // Every entry takes at least five bytes, which also rejects lengths that cannot be allocated.
+    if (!map_uint32_big_endian(file, length) || *length > (file->size - file->offset) / 5)
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+    return true;
+}
+
+// Skips the entry at the current offset, with the same checks and errors as map_constant_v1.
+static bool skip_constant_v1(MappedFile *file)
+{
+    if (file->offset == file->size)
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+    size_t values;
+    switch (file->data[file->offset++])
+    {
+    case TYPE_CLASS:
+        values = 3;
+        break;
+    case TYPE_FIELD:
+        values = 2;
+        break;
+    case TYPE_METHOD:
+        values = 4;
+        break;
+    case TYPE_STRING:
+        values = 0;
+        break;
+    default:
+        return fail(file, BINFORM_ERROR_MALFORMED);
+    }
+
+    char *string;
+    if (!map_string(file, &string))
+    {
+        return false;
+    }
+    if (file->size - file->offset < values * sizeof(uint32_t))
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+    file->offset += values * sizeof(uint32_t);
+    return true;
+}
+
+// What the threads decoding a program share. Version 1 entries are found through their offsets, version 2 records and
+// instructions of either version from their index.
+typedef struct
+{
+    MappedFile *file;
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    const size_t *offsets;
+    const char *records;
+    const char *table;
+    uint32_t table_size;
+    // The first entry that failed in every chunk, or 0.
+    uint32_t *failed;
+    // Where the operands of every chunk of compact code start.
+    size_t *operands;
+} ParallelDecoder;
+
+static void decode_constants_v1(void *context, size_t start, size_t end)
+{
+    ParallelDecoder *decoder = context;
+    MappedFile file = *decoder->file;
+    for (size_t i = start; i < end; i++)
+    {
+        ConstantPoolEntry entry;
+        file.offset = decoder->offsets[i];
+        map_constant_v1(&file, &entry);
+        constantpool_add(decoder->constpool, i + 1, entry);
+    }
+}
+
+// Entries vary in size, so one pass finds where every entry starts and checks it, then the threads decode the entries,
+// which cannot fail anymore.
+static ConstantPool *map_constantpool_parallel_v1(MappedFile *file, uint32_t length)
+{
+    size_t *offsets = config._malloc((size_t)length * sizeof(size_t));
+    uint32_t checked = 0;
+    for (; checked < length; checked++)
+    {
+        offsets[checked] = file->offset;
+        if (!skip_constant_v1(file))
+        {
+            break;
+        }
+    }
+
+    ConstantPool *constpool = constantpool_new(length);
+    ParallelDecoder decoder = {.file = file, .constpool = constpool, .offsets = offsets};
+    parallel_for(config.load_threads, checked, BINFORM_LOAD_CHUNK, decode_constants_v1, &decoder);
+    config._free(offsets);
+    return checked < length ? discard_constantpool(constpool, checked) : constpool;
+}
+
+static ConstantPool *map_constantpool_v1(MappedFile *file)
+{
+    uint32_t length;
+    if (!map_constantpool_length_v1(file, &length))
+    {
+        return NULL;
+    }
+    if (config.load_threads > 1 && length > BINFORM_LOAD_CHUNK)
+    {
+        return map_constantpool_parallel_v1(file, length);
+    }
+    ConstantPool *constpool = constantpool_new(length);
+
+    for (uint32_t i = 1; i <= length; i++)
+    {
+        ConstantPoolEntry entry;
+        if (!map_constant_v1(file, &entry))
+        {
+            return discard_constantpool(constpool, i - 1);
+        }
+        constantpool_add(constpool, i, entry);
+    }
+
+    return constpool;
+}
+
+// Each instruction is an opcode followed by a big-endian operand.
+static void decode_instructions_v1(void *context, size_t start, size_t end)
+{
+    ParallelDecoder *decoder = context;
+    const unsigned char *bytes = (const unsigned char *)decoder->records + start * 5;
+    Instruction *instructions = decoder->inststream->instructions;
+    for (size_t i = start; i < end; i++, bytes += 5)
+    {
+        instructions[i].opcode = bytes[0];
+        instructions[i].operand = (uint32_t)bytes[1] << 24 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 8 | bytes[4];
+    }
+}
+
+static InstructionStream *map_instructions_v1(MappedFile *file)
+{
+    uint32_t length;
+    if (!map_uint32_big_endian(file, &length) || length > (file->size - file->offset) / 5)
+    {
+        fail(file, BINFORM_ERROR_TRUNCATED);
+        return NULL;
+    }
+    InstructionStream *inststream = inststream_new(length);
+
+    // Decode all instructions in one pass over the mapping, split into chunks when there are several threads.
+    ParallelDecoder decoder = {.inststream = inststream, .records = file->data + file->offset};
+    parallel_for(config.load_threads, length, BINFORM_LOAD_CHUNK, decode_instructions_v1, &decoder);
+    file->offset += (size_t)length * 5;
+
+    return inststream;
+}
+
+// Looks a section up in the directory and checks that it lies within the file.
+static bool find_section(MappedFile *file, uint32_t kind, BinformSection *section)
+{
+    uint32_t sections = load_uint32_little_endian(file->data + offsetof(BinformHeader, sections));
+    if (sections > (file->size - sizeof(BinformHeader)) / sizeof(BinformSection))
+    {
+        return fail(file, BINFORM_ERROR_TRUNCATED);
+    }
+
+    for (uint32_t i = 0; i < sections; i++)
+    {
+        const char *record = file->data + sizeof(BinformHeader) + (size_t)i * sizeof(BinformSection);
+        if (load_uint32_little_endian(record + offsetof(BinformSection, kind)) == kind)
+        {
+            section->kind = kind;
+            section->count = load_uint32_little_endian(record + offsetof(BinformSection, count));
+            section->offset = load_uint32_little_endian(record + offsetof(BinformSection, offset));
+            section->size = load_uint32_little_endian(record + offsetof(BinformSection, size));
+            if (section->offset % BINFORM_SECTION_ALIGNMENT != 0)
+            {
+                return fail(file, BINFORM_ERROR_MALFORMED);
+            }
+            if (section->offset > file->size || section->size > file->size - section->offset)
+            {
+                return fail(file, BINFORM_ERROR_TRUNCATED);
+            }
+            return true;
+        }
+    }
+    return fail(file, BINFORM_ERROR_MALFORMED);
+}
+
+// The checksum is checked before anything in the image is trusted, images of another build of the VM are rejected.
+static bool verify_image(MappedFile *file)
+{
+    BinformSection link;
+    if (!find_section(file, BINFORM_SECTION_LINK, &link))
+    {
+        return false;
+    }
+    if (link.size < sizeof(BinformLink))
+    {
+        return fail(file, BINFORM_ERROR_MALFORMED);
+    }
+    const char *record = file->data + link.offset;
+    uint64_t checksum = load_uint32_little_endian(record + offsetof(BinformLink, checksum)) |
+                        (uint64_t)load_uint32_little_endian(record + offsetof(BinformLink, checksum) + sizeof(uint32_t)) << 32;
+    if (load_uint32_little_endian(record + offsetof(BinformLink, abi)) != BINFORM_IMAGE_ABI || checksum != binform_checksum(file->data, link.offset))
+    {
+        return fail(file, BINFORM_ERROR_MALFORMED);
+    }
+    return true;
+}
+
+static bool find_records(MappedFile *file, uint32_t kind, size_t record_size, BinformSection *section)
+{
+    return find_section(file, kind, section) && (section->size / record_size >= section->count || fail(file, BINFORM_ERROR_MALFORMED));
+}
+
+static uint32_t field_width(uint8_t type)
+{
+    return type == FIELD_TYPE_INT ? sizeof(int32_t) : type == FIELD_TYPE_BOOL ? sizeof(uint8_t) : sizeof(EvalStackElement);
+}
+
+// Classes without a layout keep every field in an 8-byte slot in the order of the indices.
+static void field_slot(ConstantPoolEntryClass *_class, uint32_t index, uint32_t *offset, uint8_t *type)
+{
+    *offset = _class->field_offsets ? _class->field_offsets[index] : sizeof(Object) + index * sizeof(EvalStackElement);
+    *type = _class->field_offsets ? _class->field_types[index] : FIELD_TYPE_ANY;
+}
+
+// Fields are accessed at their offsets without further checks, so every field must lie between the header and the
+// reference map, and the map must end within the instance.
+static bool valid_layout(ConstantPoolEntryClass *_class)
+{
+    if (!_class->field_offsets)
+    {
+        return OBJECT_INSTANCE_SIZE((uint64_t)_class->instance_fields) <= _class->instance_size;
+    }
+    for (uint32_t i = 0; i < _class->instance_fields; i++)
+    {
+        uint32_t offset = _class->field_offsets[i];
+        uint8_t type = _class->field_types[i];
+        if (type > FIELD_TYPE_BOOL || offset < sizeof(Object) || offset % field_width(type) != 0 || (uint64_t)offset + field_width(type) > _class->map_offset)
+        {
+            return false;
+        }
+    }
+    return (uint64_t)_class->map_offset + (_class->instance_fields + 7) / 8 <= _class->instance_size;
+}
+
+// Installs the vtables, layouts and resolved fields of a linked image, classes that are not filled in keep no vtable
+// and no layout, so the constant pool can still be freed if the image turns out to be invalid.
+static bool link_image(MappedFile *file, ConstantPool *constpool)
+{
+    BinformSection classes, slots, layouts, fields;
+    if (!find_records(file, BINFORM_SECTION_CLASSES, sizeof(BinformClass), &classes) || !find_records(file, BINFORM_SECTION_VTABLES, sizeof(uint32_t), &slots) ||
+        !find_records(file, BINFORM_SECTION_LAYOUTS, sizeof(BinformLayoutField), &layouts) || !find_records(file, BINFORM_SECTION_FIELDS, sizeof(BinformField), &fields))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < classes.count; i++)
+    {
+        const char *record = file->data + classes.offset + (size_t)i * sizeof(BinformClass);
+        uint32_t values[sizeof(BinformClass) / sizeof(uint32_t)];
+        for (uint32_t j = 0; j < sizeof(values) / sizeof(uint32_t); j++)
+        {
+            values[j] = load_uint32_little_endian(record + j * sizeof(uint32_t));
+        }
+        BinformClass linked = {values[0], values[1], values[2], values[3], values[4], values[5], values[6], values[7]};
+
+        if (!entry_is(constpool, linked.constant, TYPE_CLASS) || constantpool_get(constpool, linked.constant)->data._class.vtable ||
+            linked.vtable > slots.count || linked.vtable_length > slots.count - linked.vtable ||
+            (linked.layout != BINFORM_NO_LAYOUT && (linked.layout > layouts.count || linked.instance_fields > layouts.count - linked.layout)))
+        {
+            return false;
+        }
+
+        ConstantPoolEntryClass *_class = &constantpool_get(constpool, linked.constant)->data._class;
+        _class->index = linked.constant;
+        _class->flags = linked.flags;
+        _class->instance_fields = linked.instance_fields;
+        _class->instance_size = linked.instance_size;
+        _class->map_offset = linked.map_offset;
+        _class->vtable = vtable_new(linked.vtable_length);
+
+        const char *slot = file->data + slots.offset + (size_t)linked.vtable * sizeof(uint32_t);
+        for (uint32_t j = 0; j < linked.vtable_length; j++, slot += sizeof(uint32_t))
+        {
+            uint32_t method = load_uint32_little_endian(slot);
+            if (method && !entry_is(constpool, method, TYPE_METHOD))
+            {
+                return false;
+            }
+            _class->vtable->table[j] = (VTableEntry){.method_name = method ? constantpool_get(constpool, method)->data.method.name : NULL, .const_index = method};
+        }
+
+        if (linked.layout != BINFORM_NO_LAYOUT)
+        {
+            // The field types share the allocation of the offsets, like in constantpool_compute_layouts.
+            _class->field_offsets = config._malloc(_class->instance_fields * (sizeof(uint32_t) + sizeof(uint8_t)));
+            _class->field_types = (uint8_t *)(_class->field_offsets + _class->instance_fields);
+            const char *layout = file->data + layouts.offset + (size_t)linked.layout * sizeof(BinformLayoutField);
+            for (uint32_t j = 0; j < _class->instance_fields; j++, layout += sizeof(BinformLayoutField))
+            {
+                _class->field_offsets[j] = load_uint32_little_endian(layout + offsetof(BinformLayoutField, offset));
+                _class->field_types[j] = layout[offsetof(BinformLayoutField, type)];
+            }
+        }
+        if (!valid_layout(_class))
+        {
+            return false;
+        }
+    }
+
+    // The methods of a parent access its fields at the same offsets in instances of its subclasses.
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntryClass *_class = &constantpool_get(constpool, i)->data._class;
+        if (!entry_is(constpool, i, TYPE_CLASS) || !entry_is(constpool, _class->parent, TYPE_CLASS))
+        {
+            continue;
+        }
+        ConstantPoolEntryClass *parent = &constantpool_get(constpool, _class->parent)->data._class;
+        if (!_class->vtable || !parent->vtable || parent->instance_fields > _class->instance_fields)
+        {
+            return false;
+        }
+        for (uint32_t j = 0; j < parent->instance_fields; j++)
+        {
+            uint32_t offset, inherited_offset;
+            uint8_t type, inherited_type;
+            field_slot(_class, j, &offset, &type);
+            field_slot(parent, j, &inherited_offset, &inherited_type);
+            if (offset != inherited_offset || type != inherited_type)
+            {
+                return false;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < fields.count; i++)
+    {
+        const char *record = file->data + fields.offset + (size_t)i * sizeof(BinformField);
+        uint32_t constant = load_uint32_little_endian(record + offsetof(BinformField, constant));
+        if (!entry_is(constpool, constant, TYPE_FIELD))
+        {
+            return false;
+        }
+        ConstantPoolEntryField *field = &constantpool_get(constpool, constant)->data.field;
+        field->offset = load_uint32_little_endian(record + offsetof(BinformField, offset));
+        field->storage = record[offsetof(BinformField, storage)];
+
+        // Fields resolve to the slot that the layout of their class gives them, like in constantpool_compute_layouts.
+        uint32_t offset = sizeof(Object) + field->index * sizeof(EvalStackElement);
+        uint8_t storage = FIELD_TYPE_ANY;
+        if (entry_is(constpool, field->_class, TYPE_CLASS) && field->index < constantpool_get(constpool, field->_class)->data._class.instance_fields)
+        {
+            field_slot(&constantpool_get(constpool, field->_class)->data._class, field->index, &offset, &storage);
+        }
+        if (field->offset != offset || field->storage != storage)
+        {
+            return false;
+        }
+    }
+
+    constpool->linked = true;
+    return true;
+}
+
+// Finds the constants and the string table and checks that every record fits and every name is terminated.
+static bool find_constants_v2(MappedFile *file, BinformSection *constants, BinformSection *strings)
+{
+    if (!find_section(file, BINFORM_SECTION_CONSTANTS, constants) || !find_section(file, BINFORM_SECTION_STRINGS, strings) ||
+        constants->size / sizeof(BinformConstant) < constants->count)
+    {
+        return fail(file, BINFORM_ERROR_MALFORMED);
+    }
+    // With a terminated string table every offset into it is a valid string.
+    const char *table = file->data + strings->offset;
+    if (constants->count > 0 && (strings->size == 0 || table[strings->size - 1] != '\0'))
+    {
+        return fail(file, BINFORM_ERROR_MALFORMED);
+    }
+    return true;
+}
+
+static bool decode_constant_v2(const char *record, const char *table, uint32_t table_size, ConstantPoolEntry *entry)
+{
+    uint8_t type = record[offsetof(BinformConstant, type)];
+    uint8_t field_type = record[offsetof(BinformConstant, field_type)];
+    uint32_t name = load_uint32_little_endian(record + offsetof(BinformConstant, name));
+    uint32_t values[4];
+    for (int j = 0; j < 4; j++)
+    {
+        values[j] = load_uint32_little_endian(record + offsetof(BinformConstant, values) + j * sizeof(uint32_t));
+    }
+
+    if (type > TYPE_STRING || field_type > FIELD_TYPE_BOOL || name >= table_size)
+    {
+        return false;
+    }
+
+    *entry = (ConstantPoolEntry){.type = type};
+    char *string = (char *)table + name;
+    switch (type)
+    {
+    case TYPE_CLASS:
+        entry->data._class = (ConstantPoolEntryClass){.name = string, .parent = values[0], .fields = values[1], .methods = values[2]};
+        break;
+    case TYPE_FIELD:
+        entry->data.field = (ConstantPoolEntryField){.name = string, ._class = values[0], .index = values[1], .type = field_type};
+        break;
+    case TYPE_METHOD:
+        entry->data.method = (ConstantPoolEntryMethod){.name = string, ._class = values[0], .address = values[1], .args = values[2], .locals = values[3]};
+        break;
+    case TYPE_STRING:
+        entry->data.string = (ConstantPoolEntryString){.value = string};
+        break;
+    }
+    return true;
+}
+
+static void decode_constants_v2(void *context, size_t start, size_t end)
+{
+    ParallelDecoder *decoder = context;
+    for (size_t i = start; i < end; i++)
+    {
+        ConstantPoolEntry entry;
+        if (!decode_constant_v2(decoder->records + i * sizeof(BinformConstant), decoder->table, decoder->table_size, &entry))
+        {
+            decoder->failed[start / BINFORM_LOAD_CHUNK] = i + 1;
+            return;
+        }
+        constantpool_add(decoder->constpool, i + 1, entry);
+    }
+}
+
+static ConstantPool *map_constantpool_v2(MappedFile *file)
+{
+    BinformSection constants;
+    BinformSection strings;
+    if (!find_constants_v2(file, &constants, &strings))
+    {
+        return NULL;
+    }
+    bool linked = load_uint32_little_endian(file->data + offsetof(BinformHeader, flags)) & BINFORM_FLAG_LINKED;
+    if (linked && !verify_image(file))
+    {
+        fail(file, BINFORM_ERROR_MALFORMED);
+        return NULL;
+    }
+    ConstantPool *constpool = constantpool_new(constants.count);
+
+    // Every chunk stops at its first invalid record, the entries before the first of them are all filled in.
+    uint32_t chunks = (constants.count + BINFORM_LOAD_CHUNK - 1) / BINFORM_LOAD_CHUNK;
+    ParallelDecoder decoder = {.constpool = constpool, .records = file->data + constants.offset, .table = file->data + strings.offset, .table_size = strings.size,
+                               .failed = config._calloc(chunks ? chunks : 1, sizeof(uint32_t))};
+    parallel_for(config.load_threads, constants.count, BINFORM_LOAD_CHUNK, decode_constants_v2, &decoder);
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < chunks && failed == 0; i++)
+    {
+        failed = decoder.failed[i];
+    }
+    config._free(decoder.failed);
+    if (failed != 0)
+    {
+        fail(file, BINFORM_ERROR_MALFORMED);
+        return discard_constantpool(constpool, failed - 1);
+    }
+
+    if (linked && !link_image(file, constpool))
+    {
+        fail(file, BINFORM_ERROR_MALFORMED);
+        return discard_constantpool(constpool, constpool->length);
+    }
+    return constpool;
+}
+
+// Where the entries of a lazy constant pool are decoded from. Version 1 entries vary in size, so the offset of each one
+// is indexed, version 2 records are found from their index.
+typedef struct
+{
+    MappedFile file;
+    const char *records;
+    const char *table;
+    uint32_t table_size;
+    size_t offsets[];
+} LazySource;
+
+static void load_constant_v1(void *source, uint32_t index, ConstantPoolEntry *entry)
+{
+    LazySource *lazy = source;
+    lazy->file.offset = lazy->offsets[index];
+    map_constant_v1(&lazy->file, entry);
+}
+
+static void load_constant_v2(void *source, uint32_t index, ConstantPoolEntry *entry)
+{
+    LazySource *lazy = source;
+    decode_constant_v2(lazy->records + (size_t)(index - 1) * sizeof(BinformConstant), lazy->table, lazy->table_size, entry);
+}
+
+// The index pass checks every entry like the eager decoder does, so loading an entry later cannot fail.
+static ConstantPool *map_constantpool_lazy_v1(MappedFile *file)
+{
+    uint32_t length;
+    if (!map_constantpool_length_v1(file, &length))
+    {
+        return NULL;
+    }
+    LazySource *source = config._malloc(sizeof(LazySource) + ((size_t)length + 1) * sizeof(size_t));
+    uint32_t *method_classes = config._malloc(((size_t)length + 1) * sizeof(uint32_t));
+    source->file = *file;
+
+    for (uint32_t i = 1; i <= length; i++)
+    {
+        ConstantPoolEntry entry;
+        source->offsets[i] = file->offset;
+        if (!map_constant_v1(file, &entry))
+        {
+            config._free(source);
+            config._free(method_classes);
+            return NULL;
+        }
+        method_classes[i] = entry.type == TYPE_METHOD ? entry.data.method._class : 0;
+    }
+
+    return constantpool_new_lazy(length, load_constant_v1, source, method_classes);
+}
+
+static ConstantPool *map_constantpool_lazy_v2(MappedFile *file)
+{
+    BinformSection constants;
+    BinformSection strings;
+    if (!find_constants_v2(file, &constants, &strings))
+    {
+        return NULL;
+    }
+    // Linked images hold their vtables and layouts already, they are decoded as a whole.
+    if (load_uint32_little_endian(file->data + offsetof(BinformHeader, flags)) & BINFORM_FLAG_LINKED)
+    {
+        return map_constantpool_v2(file);
+    }
+    LazySource *source = config._malloc(sizeof(LazySource));
+    uint32_t *method_classes = config._malloc(((size_t)constants.count + 1) * sizeof(uint32_t));
+    source->file = *file;
+    source->records = file->data + constants.offset;
+    source->table = file->data + strings.offset;
+    source->table_size = strings.size;
+
+    for (uint32_t i = 1; i <= constants.count; i++)
+    {
+        ConstantPoolEntry entry;
+        if (!decode_constant_v2(source->records + (size_t)(i - 1) * sizeof(BinformConstant), source->table, source->table_size, &entry))
+        {
+            fail(file, BINFORM_ERROR_MALFORMED);
+            config._free(source);
+            config._free(method_classes);
+            return NULL;
+        }
+        method_classes[i] = entry.type == TYPE_METHOD ? entry.data.method._class : 0;
+    }
+
+    return constantpool_new_lazy(constants.count, load_constant_v2, source, method_classes);
+}
+
+static void count_operand_bytes(void *context, size_t start, size_t end)
+{
+    ParallelDecoder *decoder = context;
+    size_t bytes = 0;
+    for (size_t i = start; i < end; i++)
+    {
+        bytes += compact_widths[((uint8_t)decoder->records[i] & BINFORM_COMPACT_WIDTH_MASK) >> BINFORM_COMPACT_WIDTH_SHIFT];
+    }
+    decoder->operands[start / BINFORM_LOAD_CHUNK + 1] = bytes;
+}
+
+static void decode_compact_code(void *context, size_t start, size_t end)
+{
+    ParallelDecoder *decoder = context;
+    const uint8_t *opcodes = (const uint8_t *)decoder->records;
+    const uint8_t *operands = opcodes + decoder->inststream->length + decoder->operands[start / BINFORM_LOAD_CHUNK];
+    for (size_t i = start; i < end; i++)
+    {
+        uint8_t width = compact_widths[(opcodes[i] & BINFORM_COMPACT_WIDTH_MASK) >> BINFORM_COMPACT_WIDTH_SHIFT];
+        uint32_t operand = 0;
+        for (uint8_t j = 0; j < width; j++)
+        {
+            operand |= (uint32_t)*operands++ << 8 * j;
+        }
+        decoder->inststream->instructions[i] = (Instruction){.opcode = opcodes[i] & ~BINFORM_COMPACT_WIDTH_MASK, .operand = operand};
+    }
+}
+
+// The operands of a chunk start after those of all chunks before it, so the threads first add up the widths of their
+// chunks and then decode them from where their operands start.
+static InstructionStream *map_compact_code_parallel(MappedFile *file, BinformSection *code)
+{
+    uint32_t chunks = (code->count + BINFORM_LOAD_CHUNK - 1) / BINFORM_LOAD_CHUNK;
+    size_t *operands = config._calloc(chunks + 1, sizeof(size_t));
+    ParallelDecoder decoder = {.records = file->data + code->offset, .operands = operands};
+    parallel_for(config.load_threads, code->count, BINFORM_LOAD_CHUNK, count_operand_bytes, &decoder);
+    for (uint32_t i = 1; i <= chunks; i++)
+    {
+        operands[i] += operands[i - 1];
+    }
+
+    // The operands must take exactly the rest of the section.
+    if (operands[chunks] != code->size - code->count)
+    {
+        config._free(operands);
+        fail(file, BINFORM_ERROR_MALFORMED);
+        return NULL;
+    }
+    decoder.inststream = inststream_new(code->count);
+    parallel_for(config.load_threads, code->count, BINFORM_LOAD_CHUNK, decode_compact_code, &decoder);
+    config._free(operands);
+    return decoder.inststream;
+}
+
+// Compact code cannot be used in place, every instruction is widened back to its opcode and a full operand.
+static InstructionStream *map_compact_code(MappedFile *file)
+{
+    BinformSection code;
+    if (!find_section(file, BINFORM_SECTION_COMPACT_CODE, &code) || code.size < code.count)
+    {
+        fail(file, BINFORM_ERROR_MALFORMED);
+        return NULL;
+    }
+    const uint8_t *opcodes = (const uint8_t *)file->data + code.offset;
+    const uint8_t *operands = opcodes + code.count;
+    const uint8_t *end = opcodes + code.size;
+
+    if (config.load_threads > 1 && code.count > BINFORM_LOAD_CHUNK)
+    {
+        return map_compact_code_parallel(file, &code);
+    }
+    InstructionStream *inststream = inststream_new(code.count);
+    uint32_t i;
+    for (i = 0; i < code.count; i++)
+    {
+        uint8_t width = compact_widths[(opcodes[i] & BINFORM_COMPACT_WIDTH_MASK) >> BINFORM_COMPACT_WIDTH_SHIFT];
+        if ((size_t)(end - operands) < width)
+        {
+            break;
+        }
+        uint32_t operand = 0;
+        for (uint8_t j = 0; j < width; j++)
+        {
+            operand |= (uint32_t)*operands++ << 8 * j;
+        }
+        inststream->instructions[i] = (Instruction){.opcode = opcodes[i] & ~BINFORM_COMPACT_WIDTH_MASK, .operand = operand};
+    }
+
+    // The operands must take exactly the rest of the section.
+    if (i < code.count || operands != end)
+    {
+        fail(file, BINFORM_ERROR_MALFORMED);
+        inststream_free(inststream);
+        return NULL;
+    }
+    return inststream;
+}
+
+static InstructionStream *map_instructions_v2(MappedFile *file, bool in_place)
+{
+    if (load_uint32_little_endian(file->data + offsetof(BinformHeader, flags)) & BINFORM_FLAG_COMPACT)
+    {
+        return map_compact_code(file);
+    }
+
+    BinformSection code;
+    if (!find_section(file, BINFORM_SECTION_CODE, &code) || code.size / sizeof(BinformInstruction) < code.count)
+    {
+        fail(file, BINFORM_ERROR_MALFORMED);
+        return NULL;
+    }
+    const char *records = file->data + code.offset;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // The section is aligned and its records match Instruction, so the mapping can be executed as it is.
+    if (in_place && (uintptr_t)records % _Alignof(Instruction) == 0)
+    {
+        return inststream_new_mapped((Instruction *)records, code.count);
+    }
+#endif
+
+    // The records match Instruction, so the section is copied at once and on big-endian machines the operands are then
+    // swapped in one tight pass.
+    InstructionStream *inststream = inststream_new(code.count);
+    memcpy(inststream->instructions, records, (size_t)code.count * sizeof(Instruction));
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    for (uint32_t i = 0; i < code.count; i++)
+    {
+        inststream->instructions[i].operand = load_uint32_little_endian((const char *)&inststream->instructions[i].operand);
+    }
+#endif
+    return inststream;
+}
+
+ConstantPool *binform_map_constantpool(MappedFile *file)
+{
+    switch (binform_version(file))
+    {
+    case BINFORM_VERSION_1:
+        return map_constantpool_v1(file);
+    case BINFORM_VERSION_2:
+        return map_constantpool_v2(file);
+    default:
+        fail(file, BINFORM_ERROR_VERSION);
+        return NULL;
+    }
+}
+
+ConstantPool *binform_map_constantpool_lazy(MappedFile *file)
+{
+    switch (binform_version(file))
+    {
+    case BINFORM_VERSION_1:
+        return map_constantpool_lazy_v1(file);
+    case BINFORM_VERSION_2:
+        return map_constantpool_lazy_v2(file);
+    default:
+        fail(file, BINFORM_ERROR_VERSION);
+        return NULL;
+    }
+}
+
+InstructionStream *binform_map_instructions(MappedFile *file)
+{
+    switch (binform_version(file))
+    {
+    case BINFORM_VERSION_1:
+        return map_instructions_v1(file);
+    case BINFORM_VERSION_2:
+        return map_instructions_v2(file, true);
+    default:
+        fail(file, BINFORM_ERROR_VERSION);
+        return NULL;
+    }
+}
+
+// Decodes a program of either version from memory that is not kept, so every name and string is copied out of it.
+static uint32_t decode_program(MappedFile *buffer, ConstantPool **constpool, InstructionStream **inststream)
+{
+    if (is_compressed(buffer))
+    {
+        size_t size;
+        char *data = expanded_size(buffer, &size) ? config._calloc(size, 1) : NULL;
+        if (data && expand_program(buffer, data))
+        {
+            MappedFile expanded = {.data = data, .size = size, .offset = 0, .error = BINFORM_OK};
+            uint32_t result = decode_program(&expanded, constpool, inststream);
+            config._free(data);
+            return result;
+        }
+        config._free(data);
+        *constpool = NULL;
+        *inststream = NULL;
+        return buffer->error;
+    }
+
+    uint32_t version = binform_version(buffer);
+    *constpool = binform_map_constantpool(buffer);
+    *inststream = NULL;
+    if (*constpool)
+    {
+        *inststream = version == BINFORM_VERSION_2 ? map_instructions_v2(buffer, false) : binform_map_instructions(buffer);
+    }
+    if (*constpool && !*inststream)
+    {
+        discard_constantpool(*constpool, (*constpool)->length);
+        *constpool = NULL;
+    }
+
+    if (*constpool)
+    {
+        for (uint32_t i = 1; i <= (*constpool)->length; i++)
+        {
+            char **string = entry_string(constantpool_get(*constpool, i));
+            size_t length = strlen(*string) + 1;
+            *string = memcpy(config._malloc(length), *string, length);
+        }
+        // The vtables of a linked image point at the names of the methods, which have moved.
+        for (uint32_t i = 1; i <= (*constpool)->length; i++)
+        {
+            VTable *vtable = entry_is(*constpool, i, TYPE_CLASS) ? constantpool_get(*constpool, i)->data._class.vtable : NULL;
+            for (uint32_t j = 0; vtable && j < vtable->length; j++)
+            {
+                if (vtable->table[j].const_index)
+                {
+                    vtable->table[j].method_name = constantpool_get(*constpool, vtable->table[j].const_index)->data.method.name;
+                }
+            }
+        }
+    }
+    return *constpool ? BINFORM_OK : buffer->error;
+}
+
+// Reads a whole program of either version from a stream, the names and strings are copied like binform_read_constantpool does.
+bool binform_read_program(FILE *file, ConstantPool **constpool, InstructionStream **inststream)
+{
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    size_t read;
+    do
+    {
+        if (buffer.size == buffer.capacity)
+        {
+            buffer.capacity = buffer.capacity ? 2 * buffer.capacity : 4096;
+            buffer.data = config._realloc(buffer.data, buffer.capacity);
+        }
+        read = fread(buffer.data + buffer.size, 1, buffer.capacity - buffer.size, file);
+        buffer.size += read;
+    } while (read > 0);
+
+    uint32_t result = binform_read_from_buffer(buffer.data, buffer.size, constpool, inststream);
+    binform_buffer_free(&buffer);
+    return result == BINFORM_OK;
+}
+
+void binform_buffer_free(BinformBuffer *buffer)
+{
+    config._free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+uint32_t binform_write_to_buffer(BinformBuffer *buffer, ConstantPool *constpool, InstructionStream *inststream, uint32_t version)
+{
+    switch (version)
+    {
+    case BINFORM_VERSION_1:
+        buffer->size = 0;
+        output_constantpool_v1(buffer, constpool);
+        output_instructions_v1(buffer, inststream);
+        return BINFORM_OK;
+    case BINFORM_VERSION_2:
+        output_program_v2(buffer, constpool, inststream, 0);
+        return BINFORM_OK;
+    default:
+        return BINFORM_ERROR_VERSION;
+    }
+}
+
+uint32_t binform_read_from_buffer(const char *data, size_t size, ConstantPool **constpool, InstructionStream **inststream)
+{
+    // Nothing writes through the mapping while decoding, the strings are copied before it is gone.
+    MappedFile buffer = {.data = (char *)data, .size = size, .offset = 0, .error = BINFORM_OK};
+    return decode_program(&buffer, constpool, inststream);
+}
+
+uint32_t binform_read_from_descriptor(int descriptor, BinformBuffer *buffer, ConstantPool **constpool, InstructionStream **inststream)
+{
+    buffer->size = 0;
+    while (true)
+    {
+        if (buffer->capacity - buffer->size < 4096)
+        {
+            buffer->capacity = buffer->capacity ? 2 * buffer->capacity : 65536;
+            buffer->data = config._realloc(buffer->data, buffer->capacity);
+        }
+        ssize_t count = read(descriptor, buffer->data + buffer->size, buffer->capacity - buffer->size);
+        if (count == 0)
+        {
+            break;
+        }
+        if (count < 0 && errno != EINTR)
+        {
+            *constpool = NULL;
+            *inststream = NULL;
+            return BINFORM_ERROR_IO;
+        }
+        buffer->size += count > 0 ? count : 0;
+    }
+    return binform_read_from_buffer(buffer->data, buffer->size, constpool, inststream);
+}
+
+uint32_t binform_write_to_descriptor(int descriptor, BinformBuffer *buffer, ConstantPool *constpool, InstructionStream *inststream, uint32_t version)
+{
+    uint32_t result = binform_write_to_buffer(buffer, constpool, inststream, version);
+    for (size_t written = 0; result == BINFORM_OK && written < buffer->size;)
+    {
+        ssize_t count = write(descriptor, buffer->data + written, buffer->size - written);
+        if (count < 0 && errno != EINTR)
+        {
+            result = BINFORM_ERROR_IO;
+        }
+        written += count > 0 ? count : 0;
+    }
+    return result;
+}
+
 void binform_print(ConstantPool *constpool, InstructionStream *inststream)
 {
     if (constpool)
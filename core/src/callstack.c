@@ -1,8 +1,8 @@
 #include "callstack.h"
 
-CallStack *callstack_new()
+CallStack *callstack_new(size_t max_depth)
 {
-    return stack_new(sizeof(CallStackFrame));
+    return stack_new_reserved(sizeof(CallStackFrame), max_depth);
 }
 
 void callstack_free(CallStack *callstack)
@@ -0,0 +1,211 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "codecache.h"
+
+// Numbers the temporary files of this process, so that threads storing the same key never share one.
+static atomic_uint next_temporary;
+
+typedef struct
+{
+    char *name;
+    size_t size;
+    struct timespec used;
+} CachedImage;
+
+static char *copy_string(const char *string)
+{
+    size_t length = strlen(string) + 1;
+    return memcpy(config._malloc(length), string, length);
+}
+
+// The path of the image of a key, or of a temporary file for it that no other call writes to.
+static char *image_path(CodeCache *cache, uint64_t key, bool temporary)
+{
+    size_t length = strlen(cache->directory) + 80;
+    char *path = config._malloc(length);
+    if (temporary)
+    {
+        snprintf(path, length, "%s/%016llx.%ld.%u%s", cache->directory, (unsigned long long)key, (long)getpid(), atomic_fetch_add(&next_temporary, 1),
+                 CODECACHE_TEMPORARY_EXTENSION);
+    }
+    else
+    {
+        snprintf(path, length, "%s/%016llx%s", cache->directory, (unsigned long long)key, CODECACHE_EXTENSION);
+    }
+    return path;
+}
+
+CodeCache *codecache_new(const char *directory, const char *version, size_t max_size)
+{
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+    {
+        return NULL;
+    }
+
+    CodeCache *cache = (CodeCache *)config._malloc(sizeof(CodeCache));
+    cache->directory = copy_string(directory);
+    cache->version = copy_string(version);
+    cache->max_size = max_size;
+    return cache;
+}
+
+void codecache_free(CodeCache *cache)
+{
+    config._free(cache->directory);
+    config._free(cache->version);
+    config._free(cache);
+}
+
+uint64_t codecache_key(CodeCache *cache, const char *data, size_t size, uint32_t options)
+{
+    // The parts are hashed together once more, so that no part can cancel out another.
+    uint64_t parts[3] = {binform_checksum(data, size), binform_checksum(cache->version, strlen(cache->version)), options};
+    return binform_checksum((const char *)parts, sizeof(parts));
+}
+
+bool codecache_load(CodeCache *cache, uint64_t key, MappedFile **file, ConstantPool **constpool, InstructionStream **inststream)
+{
+    char *path = image_path(cache, key, false);
+    *file = binform_map_file(path);
+    *constpool = *file ? binform_map_constantpool(*file) : NULL;
+    *inststream = *constpool ? binform_map_instructions(*file) : NULL;
+
+    // Only linked images are stored, anything else in their place is as good as a broken image.
+    bool loaded = *inststream && (*constpool)->linked;
+    if (loaded)
+    {
+        // The modification time orders the images for eviction, access times are often not kept.
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+    else if (*file)
+    {
+        if (*constpool)
+        {
+            constantpool_free(*constpool);
+        }
+        if (*inststream)
+        {
+            inststream_free(*inststream);
+        }
+        binform_unmap_file(*file);
+        unlink(path);
+        *file = NULL;
+        *constpool = NULL;
+        *inststream = NULL;
+    }
+
+    config._free(path);
+    return loaded;
+}
+
+static int compare_used(const void *a, const void *b)
+{
+    const struct timespec *left = &((const CachedImage *)a)->used;
+    const struct timespec *right = &((const CachedImage *)b)->used;
+    if (left->tv_sec != right->tv_sec)
+    {
+        return left->tv_sec < right->tv_sec ? -1 : 1;
+    }
+    return left->tv_nsec < right->tv_nsec ? -1 : left->tv_nsec > right->tv_nsec;
+}
+
+static bool has_extension(const char *name, const char *extension)
+{
+    size_t length = strlen(name);
+    return length > strlen(extension) && strcmp(name + length - strlen(extension), extension) == 0;
+}
+
+static void evict(CodeCache *cache)
+{
+    DIR *directory = opendir(cache->directory);
+    if (!directory)
+    {
+        return;
+    }
+
+    CachedImage *images = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t total = 0;
+    time_t now = time(NULL);
+    for (struct dirent *entry = readdir(directory); entry; entry = readdir(directory))
+    {
+        struct stat status;
+        bool image = has_extension(entry->d_name, CODECACHE_EXTENSION);
+        if ((!image && !has_extension(entry->d_name, CODECACHE_TEMPORARY_EXTENSION)) || fstatat(dirfd(directory), entry->d_name, &status, 0) != 0)
+        {
+            continue;
+        }
+        // Writers that are still running keep their temporary files recent, older ones were left behind by a crash.
+        if (!image)
+        {
+            if (now - status.st_mtime > CODECACHE_TEMPORARY_MAX_AGE)
+            {
+                unlinkat(dirfd(directory), entry->d_name, 0);
+            }
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 16;
+            images = config._realloc(images, capacity * sizeof(CachedImage));
+        }
+        images[count++] = (CachedImage){.name = copy_string(entry->d_name), .size = status.st_size, .used = status.st_mtim};
+        total += status.st_size;
+    }
+
+    if (total > cache->max_size)
+    {
+        qsort(images, count, sizeof(CachedImage), compare_used);
+        for (size_t i = 0; i < count && total > cache->max_size; i++)
+        {
+            // Another process may have removed it already, it no longer counts either way.
+            unlinkat(dirfd(directory), images[i].name, 0);
+            total -= images[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        config._free(images[i].name);
+    }
+    config._free(images);
+    closedir(directory);
+}
+
+bool codecache_store(CodeCache *cache, uint64_t key, ConstantPool *constpool, InstructionStream *inststream)
+{
+    char *temporary = image_path(cache, key, true);
+    char *path = image_path(cache, key, false);
+    FILE *file = fopen(temporary, "wbx");
+    bool stored = false;
+
+    // There is no fsync, an image that is cut short by a crash fails its checksum and is removed when it is loaded.
+    if (file)
+    {
+        binform_write_image(file, constpool, inststream);
+        stored = fclose(file) == 0 && rename(temporary, path) == 0;
+        if (!stored)
+        {
+            unlink(temporary);
+        }
+    }
+
+    config._free(temporary);
+    config._free(path);
+    if (stored)
+    {
+        evict(cache);
+    }
+    return stored;
+}
\ No newline at end of file
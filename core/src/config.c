@@ -6,6 +6,18 @@ Config config = {
     ._realloc = realloc,
     ._free = free,
     .min_stack_capacity = 128,
+    .max_stack_depth = 1024 * 1024,
+    .gc_threshold = 1024 * 1024,
+    .nursery_size = 512 * 1024,
+    .gc_promotion_age = 2,
+    .gc_increment_size = 1024,
+    .gc_increment_interval = 256,
+    .gc_threads = 1,
+    .load_threads = 1,
+    .arena_chunk_size = 0,
+    .page_pool = NULL,
+    .huge_pages = false,
+    .heap_limit = 0,
 };
 
 void set_config(
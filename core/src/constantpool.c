@@ -1,11 +1,18 @@
+#include <string.h>
+
 #include "config.h"
 #include "object.h"
+#include "parallel.h"
+#include "string_class.h"
 #include "constantpool.h"
 
-ConstantPoolEntry class_console_entry = {.type = TYPE_CLASS, .data._class = {.name = "Console", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}};
+// Strings vary in size, so their class has no instance size.
+ConstantPoolEntry class_string_entry = {.type = TYPE_CLASS, .data._class = {.name = "String", .fields = 0, .methods = 0, .parent = 0, .vtable = NULL, .index = CONSTPOOL_CLASS_STRING, .flags = CLASS_FLAG_NATIVE | CLASS_FLAG_LINKED, .instance_fields = 0, .instance_size = 0}};
+
+ConstantPoolEntry class_console_entry = {.type = TYPE_CLASS, .data._class = {.name = "Console", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL, .index = CONSTPOOL_CLASS_CONSOLE, .flags = CLASS_FLAG_NATIVE | CLASS_FLAG_LINKED, .instance_fields = 0, .instance_size = OBJECT_INSTANCE_SIZE(0)}};
 ConstantPoolEntry method_console_println_entry = {.type = TYPE_METHOD, .data.method = {.name = "println", ._class = CONSTPOOL_CLASS_CONSOLE, .address = 0, .args = 2, .locals = 0}};
 
-ConstantPoolEntry class_string_builder_entry = {.type = TYPE_CLASS, .data._class = {.name = "StringBuilder", .fields = 1, .methods = 4, .parent = 0, .vtable = NULL}};
+ConstantPoolEntry class_string_builder_entry = {.type = TYPE_CLASS, .data._class = {.name = "StringBuilder", .fields = 3, .methods = 4, .parent = 0, .vtable = NULL, .index = CONSTPOOL_CLASS_STRING_BUILDER, .flags = CLASS_FLAG_NATIVE | CLASS_FLAG_LINKED, .instance_fields = 3, .instance_size = OBJECT_INSTANCE_SIZE(3)}};
 ConstantPoolEntry method_string_builder_append_string_entry = {.type = TYPE_METHOD, .data.method = {.name = "appendString", ._class = CONSTPOOL_CLASS_STRING_BUILDER, .address = 0, .args = 2, .locals = 0}};
 ConstantPoolEntry method_string_builder_append_int_entry = {.type = TYPE_METHOD, .data.method = {.name = "appendInt", ._class = CONSTPOOL_CLASS_STRING_BUILDER, .address = 0, .args = 2, .locals = 0}};
 ConstantPoolEntry method_string_builder_append_bool_entry = {.type = TYPE_METHOD, .data.method = {.name = "appendBool", ._class = CONSTPOOL_CLASS_STRING_BUILDER, .address = 0, .args = 2, .locals = 0}};
@@ -16,14 +23,53 @@ ConstantPool *constantpool_new(uint32_t length)
     ConstantPool *constpool = (ConstantPool *)config._malloc(sizeof(ConstantPool));
     constpool->length = length;
     constpool->entries = (ConstantPoolEntry *)config._malloc(length * sizeof(ConstantPoolEntry));
+    constpool->linked = false;
+    constpool->lazy = NULL;
+    return constpool;
+}
+
+ConstantPool *constantpool_new_lazy(uint32_t length, ConstantPoolLoader load, void *source, uint32_t *method_classes)
+{
+    ConstantPool *constpool = constantpool_new(length);
+    ConstantPoolLazy *lazy = (ConstantPoolLazy *)config._malloc(sizeof(ConstantPoolLazy));
+    lazy->load = load;
+    lazy->source = source;
+    lazy->loaded = config._calloc(length + 1, sizeof(bool));
+    lazy->first_methods = config._calloc(length + 1, sizeof(uint32_t));
+
+    // Chaining from the last method to the first keeps every chain in index order, so later methods override earlier ones.
+    lazy->next_methods = method_classes;
+    for (uint32_t i = length; i >= 1; i--)
+    {
+        uint32_t _class = method_classes[i];
+        method_classes[i] = 0;
+        if (_class >= 1 && _class <= length)
+        {
+            method_classes[i] = lazy->first_methods[_class];
+            lazy->first_methods[_class] = i;
+        }
+    }
+
+    // Linking a class loads its parent and methods while the lock is held.
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&lazy->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    constpool->lazy = lazy;
     return constpool;
 }
 
 void constantpool_free(ConstantPool *constpool)
 {
-    // Free all vtables.
+    // Free all vtables and string constants.
     for (uint32_t i = 1; i <= constpool->length; i++)
     {
+        if (constpool->lazy && !constpool->lazy->loaded[i])
+        {
+            continue;
+        }
         ConstantPoolEntry *entry = constantpool_get(constpool, i);
         if (entry->type == TYPE_CLASS)
         {
@@ -32,8 +78,23 @@ void constantpool_free(ConstantPool *constpool)
             {
                 vtable_free(vtable);
             }
+            // The field types share the allocation of the offsets.
+            config._free(entry->data._class.field_offsets);
+        }
+        else if (entry->type == TYPE_STRING && entry->data.string.object)
+        {
+            string_free_immortal(entry->data.string.object);
         }
     }
+    if (constpool->lazy)
+    {
+        pthread_mutex_destroy(&constpool->lazy->lock);
+        config._free(constpool->lazy->source);
+        config._free(constpool->lazy->loaded);
+        config._free(constpool->lazy->first_methods);
+        config._free(constpool->lazy->next_methods);
+        config._free(constpool->lazy);
+    }
     config._free(constpool->entries);
     constpool->entries = NULL;
     config._free(constpool);
@@ -44,10 +105,45 @@ void constantpool_add(ConstantPool *constpool, uint32_t index, ConstantPoolEntry
     constpool->entries[index - 1] = entry;
 }
 
+// Until the layouts are computed, every field takes 8 bytes in the order of the indices.
+static void default_field_layout(ConstantPoolEntryField *field)
+{
+    field->storage = FIELD_TYPE_ANY;
+    field->offset = sizeof(Object) + field->index * sizeof(EvalStackElement);
+}
+
+// Entries are decoded under the lock, so executors on several threads can share a lazy constant pool.
+static void load_entry(ConstantPool *constpool, uint32_t index)
+{
+    ConstantPoolLazy *lazy = constpool->lazy;
+    pthread_mutex_lock(&lazy->lock);
+    if (!lazy->loaded[index])
+    {
+        ConstantPoolEntry *entry = &constpool->entries[index - 1];
+        lazy->load(lazy->source, index, entry);
+        switch (entry->type)
+        {
+        case TYPE_CLASS:
+            entry->data._class.index = index;
+            break;
+        case TYPE_FIELD:
+            default_field_layout(&entry->data.field);
+            break;
+        case TYPE_STRING:
+            entry->data.string.object = string_new_immortal(entry->data.string.value);
+            break;
+        }
+        __atomic_store_n(&lazy->loaded[index], true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lazy->lock);
+}
+
 ConstantPoolEntry *constantpool_get(ConstantPool *constpool, uint32_t index)
 {
     switch (index)
     {
+    case CONSTPOOL_CLASS_STRING:
+        return &class_string_entry;
     case CONSTPOOL_CLASS_CONSOLE:
         return &class_console_entry;
     case CONSTPOOL_METHOD_CONSOLE_PRINTLN:
@@ -63,12 +159,163 @@ ConstantPoolEntry *constantpool_get(ConstantPool *constpool, uint32_t index)
     case CONSTPOOL_METHOD_STRING_BUILDER_TO_STRING:
         return &method_string_builder_to_string_entry;
     default:
+        if (constpool->lazy && !__atomic_load_n(&constpool->lazy->loaded[index], __ATOMIC_ACQUIRE))
+        {
+            load_entry(constpool, index);
+        }
         return &constpool->entries[index - 1];
     }
 }
 
+// Constant pools of this many entries are linked on config.load_threads threads, in chunks of classes of this size.
+#define CONSTPOOL_PARALLEL_LENGTH 65536
+#define CONSTPOOL_LINK_CHUNK 256
+
+// Marks a class whose vtable a subclass has already copied, while the levels are computed.
+#define SUBCLASS_SEEN 0x80000000
+
+typedef struct
+{
+    ConstantPool *constpool;
+    uint32_t *classes;
+    uint32_t *first_methods;
+    uint32_t *next_methods;
+} ParallelLink;
+
+static void link_classes(void *context, size_t start, size_t end)
+{
+    ParallelLink *link = context;
+    for (size_t i = start; i < end; i++)
+    {
+        uint32_t index = link->classes[i];
+        ConstantPoolEntryClass *_class = &constantpool_get(link->constpool, index)->data._class;
+        _class->vtable = vtable_new(_class->methods * 2);
+        _class->index = index;
+        _class->instance_fields = _class->fields;
+
+        if (_class->parent != 0)
+        {
+            ConstantPoolEntryClass *parent_class = &constantpool_get(link->constpool, _class->parent)->data._class;
+            vtable_copy(_class->vtable, parent_class->vtable);
+            _class->instance_fields += parent_class->instance_fields;
+        }
+        _class->instance_size = OBJECT_INSTANCE_SIZE(_class->instance_fields);
+
+        for (uint32_t j = link->first_methods[index]; j != 0; j = link->next_methods[j])
+        {
+            ConstantPoolEntryMethod *method = &constantpool_get(link->constpool, j)->data.method;
+            vtable_put(_class->vtable, (VTableEntry){.method_name = method->name, .const_index = j});
+        }
+        _class->flags |= CLASS_FLAG_LINKED;
+    }
+}
+
+// Links the classes level by level in the hierarchy, a level only reads the vtables of the one before, so its classes
+// are linked in parallel. This gives the same vtables as the sequential pass as long as parents come before their
+// subclasses and classes before their methods, and no class gets a method after a subclass has copied its vtable.
+// Otherwise nothing is linked and false is returned.
+static bool compute_vtables_parallel(ConstantPool *constpool)
+{
+    uint32_t length = constpool->length;
+    uint32_t *levels = config._calloc(length + 1, sizeof(uint32_t));
+    uint32_t depth = 0;
+    uint32_t classes = 0;
+    bool ordered = true;
+
+    for (uint32_t i = 1; ordered && i <= length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        if (entry->type == TYPE_CLASS)
+        {
+            uint32_t parent = entry->data._class.parent;
+            ordered = parent == 0 || (parent < i && constantpool_get(constpool, parent)->type == TYPE_CLASS);
+            if (ordered && parent != 0)
+            {
+                levels[i] = (levels[parent] & ~SUBCLASS_SEEN) + 1;
+                levels[parent] |= SUBCLASS_SEEN;
+                depth = levels[i] > depth ? levels[i] : depth;
+            }
+            classes++;
+        }
+        else if (entry->type == TYPE_FIELD)
+        {
+            default_field_layout(&entry->data.field);
+        }
+        else if (entry->type == TYPE_METHOD)
+        {
+            uint32_t _class = entry->data.method._class;
+            ordered = _class >= 1 && _class < i && constantpool_get(constpool, _class)->type == TYPE_CLASS && !(levels[_class] & SUBCLASS_SEEN);
+        }
+    }
+    if (!ordered)
+    {
+        config._free(levels);
+        return false;
+    }
+
+    // Chaining from the last method to the first keeps every chain in index order, so later methods override earlier ones.
+    uint32_t *first_methods = config._calloc(length + 1, sizeof(uint32_t));
+    uint32_t *next_methods = config._calloc(length + 1, sizeof(uint32_t));
+    for (uint32_t i = length; i >= 1; i--)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        if (entry->type == TYPE_METHOD)
+        {
+            next_methods[i] = first_methods[entry->data.method._class];
+            first_methods[entry->data.method._class] = i;
+        }
+    }
+
+    // Sort the classes by level, every level starts where the previous one ends.
+    uint32_t *starts = config._calloc(depth + 2, sizeof(uint32_t));
+    uint32_t *filled = config._calloc(depth + 1, sizeof(uint32_t));
+    uint32_t *order = config._malloc((classes ? classes : 1) * sizeof(uint32_t));
+    for (uint32_t i = 1; i <= length; i++)
+    {
+        if (constantpool_get(constpool, i)->type == TYPE_CLASS)
+        {
+            starts[(levels[i] & ~SUBCLASS_SEEN) + 1]++;
+        }
+    }
+    for (uint32_t level = 1; level <= depth + 1; level++)
+    {
+        starts[level] += starts[level - 1];
+    }
+    for (uint32_t i = 1; i <= length; i++)
+    {
+        if (constantpool_get(constpool, i)->type == TYPE_CLASS)
+        {
+            uint32_t level = levels[i] & ~SUBCLASS_SEEN;
+            order[starts[level] + filled[level]++] = i;
+        }
+    }
+
+    for (uint32_t level = 0; level <= depth; level++)
+    {
+        ParallelLink link = {.constpool = constpool, .classes = order + starts[level], .first_methods = first_methods, .next_methods = next_methods};
+        parallel_for(config.load_threads, starts[level + 1] - starts[level], CONSTPOOL_LINK_CHUNK, link_classes, &link);
+    }
+
+    config._free(order);
+    config._free(filled);
+    config._free(starts);
+    config._free(next_methods);
+    config._free(first_methods);
+    config._free(levels);
+    return true;
+}
+
 void constantpool_compute_vtables(ConstantPool *constpool)
 {
+    if (constpool->linked || constpool->lazy)
+    {
+        return;
+    }
+    if (config.load_threads > 1 && constpool->length >= CONSTPOOL_PARALLEL_LENGTH && compute_vtables_parallel(constpool))
+    {
+        return;
+    }
+
     // The vtable of the super class must be fully defined in the constant pool before we can construct the vtable of the subclass.
     // Classes must be defined before their methods in the constant pool.
     for (uint32_t i = 1; i <= constpool->length; i++)
@@ -80,13 +327,23 @@ void constantpool_compute_vtables(ConstantPool *constpool)
             // Create a new vtable for the class.
             ConstantPoolEntryClass *_class = &entry->data._class;
             _class->vtable = vtable_new(_class->methods * 2);
+            _class->index = i;
+            _class->instance_fields = _class->fields;
 
-            // Copy the vtable of the parent.
+            // Copy the vtable of the parent, instances also hold the fields of the parent.
             if (_class->parent != 0)
             {
                 ConstantPoolEntryClass *parent_class = &constantpool_get(constpool, _class->parent)->data._class;
                 vtable_copy(_class->vtable, parent_class->vtable);
+                _class->instance_fields += parent_class->instance_fields;
             }
+
+            _class->instance_size = OBJECT_INSTANCE_SIZE(_class->instance_fields);
+            _class->flags |= CLASS_FLAG_LINKED;
+        }
+        else if (entry->type == TYPE_FIELD)
+        {
+            default_field_layout(&entry->data.field);
         }
         else if (entry->type == TYPE_METHOD)
         {
@@ -96,4 +353,327 @@ void constantpool_compute_vtables(ConstantPool *constpool)
             vtable_put(_class->vtable, (VTableEntry){.method_name = method->name, .const_index = i});
         }
     }
+}
+
+void constantpool_link_class(ConstantPool *constpool, ConstantPoolEntryClass *_class)
+{
+    ConstantPoolLazy *lazy = constpool->lazy;
+    if (!lazy || (__atomic_load_n(&_class->flags, __ATOMIC_ACQUIRE) & CLASS_FLAG_LINKED))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lazy->lock);
+    if (!(_class->flags & CLASS_FLAG_LINKED))
+    {
+        _class->vtable = vtable_new(_class->methods * 2);
+        _class->instance_fields = _class->fields;
+
+        // Parents come before their subclasses, as compute_vtables requires, which also rules out cycles.
+        if (_class->parent != 0 && _class->parent < _class->index)
+        {
+            ConstantPoolEntryClass *parent_class = &constantpool_get(constpool, _class->parent)->data._class;
+            constantpool_link_class(constpool, parent_class);
+            vtable_copy(_class->vtable, parent_class->vtable);
+            _class->instance_fields += parent_class->instance_fields;
+        }
+        _class->instance_size = OBJECT_INSTANCE_SIZE(_class->instance_fields);
+
+        for (uint32_t i = lazy->first_methods[_class->index]; i != 0; i = lazy->next_methods[i])
+        {
+            ConstantPoolEntryMethod *method = &constantpool_get(constpool, i)->data.method;
+            vtable_put(_class->vtable, (VTableEntry){.method_name = method->name, .const_index = i});
+        }
+        __atomic_or_fetch(&_class->flags, CLASS_FLAG_LINKED, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lazy->lock);
+}
+
+void constantpool_create_strings(ConstantPool *constpool)
+{
+    // Lazy constant pools create each string when its entry is loaded.
+    if (constpool->lazy)
+    {
+        return;
+    }
+
+    // String constants are materialized once per program, PUSH_STRING pushes them by pointer and every executor running the program shares them.
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+
+        if (entry->type == TYPE_STRING && !entry->data.string.object)
+        {
+            entry->data.string.object = string_new_immortal(entry->data.string.value);
+        }
+    }
+}
+
+// Marks a slot that no POP_FIELD stores to.
+#define FIELD_TYPE_UNKNOWN 0xFF
+
+typedef struct
+{
+    uint32_t *roots;
+    uint32_t *tree_fields;
+    uint8_t **declared;
+    uint8_t **inferred;
+} SlotTypes;
+
+static bool is_class(ConstantPool *constpool, uint32_t index)
+{
+    return index >= 1 && index <= constpool->length && constpool->entries[index - 1].type == TYPE_CLASS;
+}
+
+static bool is_field(ConstantPool *constpool, uint32_t index)
+{
+    return index >= 1 && index <= constpool->length && constpool->entries[index - 1].type == TYPE_FIELD;
+}
+
+// A slot is shared by every class in a hierarchy, so its types are tracked at the root class. Fields of native classes have no slot.
+static uint32_t find_slot(ConstantPool *constpool, SlotTypes *slots, ConstantPoolEntryField *field, uint8_t **declared, uint8_t **inferred)
+{
+    if (!is_class(constpool, field->_class) || field->index >= slots->tree_fields[slots->roots[field->_class]])
+    {
+        return 0;
+    }
+    uint32_t root = slots->roots[field->_class];
+    *declared = &slots->declared[root][field->index];
+    *inferred = &slots->inferred[root][field->index];
+    return root;
+}
+
+static uint8_t resolve_type(uint8_t declared, uint8_t inferred)
+{
+    // Slots that are never stored to only ever hold their initial value, which is not a reference.
+    if (declared != FIELD_TYPE_UNKNOWN)
+    {
+        return declared;
+    }
+    return inferred == FIELD_TYPE_ANY ? FIELD_TYPE_ANY : FIELD_TYPE_INT;
+}
+
+// The value that a POP_FIELD stores is only known to be an integer if the previous instruction pushed it, and no jump
+// lands between the two.
+static uint8_t stored_type(ConstantPool *constpool, SlotTypes *slots, Instruction *instructions, bool *targets, uint32_t i)
+{
+    if (i == 0 || targets[i])
+    {
+        return FIELD_TYPE_ANY;
+    }
+
+    Instruction previous = instructions[i - 1];
+    switch (previous.opcode)
+    {
+    case PUSH:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        return FIELD_TYPE_INT;
+    case PUSH_FIELD:
+    {
+        uint8_t *declared, *inferred;
+        if (is_field(constpool, previous.operand) && find_slot(constpool, slots, &constantpool_get(constpool, previous.operand)->data.field, &declared, &inferred))
+        {
+            // Booleans are pushed as integers.
+            return resolve_type(*declared, *inferred) == FIELD_TYPE_ANY ? FIELD_TYPE_ANY : FIELD_TYPE_INT;
+        }
+        return FIELD_TYPE_ANY;
+    }
+    default:
+        return FIELD_TYPE_ANY;
+    }
+}
+
+static void infer_types(ConstantPool *constpool, SlotTypes *slots, InstructionStream *inststream)
+{
+    Instruction *instructions = inststream->instructions;
+    bool *targets = config._calloc(inststream->length + 1, sizeof(bool));
+
+    for (uint32_t i = 0; i < inststream->length; i++)
+    {
+        if ((instructions[i].opcode & JUMP_BIT) && instructions[i].operand < inststream->length)
+        {
+            targets[instructions[i].operand] = true;
+        }
+    }
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        if (entry->type == TYPE_METHOD && entry->data.method.address < inststream->length)
+        {
+            targets[entry->data.method.address] = true;
+        }
+    }
+
+    // Stores that copy another field depend on its type, so the types are refined until nothing changes.
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint32_t i = 0; i < inststream->length; i++)
+        {
+            uint8_t *declared, *inferred;
+            if (instructions[i].opcode != POP_FIELD || !is_field(constpool, instructions[i].operand) ||
+                !find_slot(constpool, slots, &constantpool_get(constpool, instructions[i].operand)->data.field, &declared, &inferred))
+            {
+                continue;
+            }
+
+            uint8_t type = stored_type(constpool, slots, instructions, targets, i);
+            if (*inferred != FIELD_TYPE_ANY && *inferred != type)
+            {
+                *inferred = type == FIELD_TYPE_ANY ? FIELD_TYPE_ANY : FIELD_TYPE_INT;
+                changed = true;
+            }
+        }
+    }
+
+    config._free(targets);
+}
+
+static uint32_t field_size(uint8_t type)
+{
+    return type == FIELD_TYPE_INT ? sizeof(int32_t) : type == FIELD_TYPE_BOOL ? sizeof(uint8_t) : sizeof(EvalStackElement);
+}
+
+static void layout_class(ConstantPool *constpool, SlotTypes *slots, uint32_t index)
+{
+    ConstantPoolEntryClass *_class = &constantpool_get(constpool, index)->data._class;
+    ConstantPoolEntryClass *parent = _class->parent ? &constantpool_get(constpool, _class->parent)->data._class : NULL;
+    uint32_t root = slots->roots[index];
+    uint32_t inherited = parent ? parent->instance_fields : 0;
+
+    // Classes with nothing to pack keep the default layout, subclasses of packed classes must extend the packed layout.
+    bool packed = parent && parent->field_offsets;
+    for (uint32_t i = inherited; i < _class->instance_fields; i++)
+    {
+        packed |= resolve_type(slots->declared[root][i], slots->inferred[root][i]) != FIELD_TYPE_ANY;
+    }
+    if (!packed)
+    {
+        return;
+    }
+
+    _class->field_offsets = config._malloc(_class->instance_fields * (sizeof(uint32_t) + sizeof(uint8_t)));
+    _class->field_types = (uint8_t *)(_class->field_offsets + _class->instance_fields);
+
+    // The fields of the parent keep their offsets, so that its methods work on instances of the subclass.
+    uint32_t offset = sizeof(Object);
+    for (uint32_t i = 0; i < inherited; i++)
+    {
+        _class->field_offsets[i] = parent->field_offsets ? parent->field_offsets[i] : sizeof(Object) + i * sizeof(EvalStackElement);
+        _class->field_types[i] = parent->field_offsets ? parent->field_types[i] : FIELD_TYPE_ANY;
+    }
+    if (parent)
+    {
+        offset = parent->field_offsets ? parent->map_offset : sizeof(Object) + inherited * sizeof(EvalStackElement);
+    }
+
+    // The fields of the class itself are sorted by size, which keeps every field naturally aligned.
+    for (uint32_t size = sizeof(EvalStackElement); size >= 1; size /= 2)
+    {
+        for (uint32_t i = inherited; i < _class->instance_fields; i++)
+        {
+            uint8_t type = resolve_type(slots->declared[root][i], slots->inferred[root][i]);
+            if (field_size(type) == size)
+            {
+                offset = (offset + size - 1) & ~(size - 1);
+                _class->field_offsets[i] = offset;
+                _class->field_types[i] = type;
+                offset += size;
+            }
+        }
+    }
+
+    _class->map_offset = offset;
+    _class->instance_size = offset + (_class->instance_fields + 7) / 8;
+}
+
+void constantpool_compute_layouts(ConstantPool *constpool, InstructionStream *inststream)
+{
+    if (constpool->linked || constpool->lazy)
+    {
+        return;
+    }
+
+    // Must be called after the vtables are computed, parents are laid out before their subclasses.
+    SlotTypes slots = {.roots = config._calloc(constpool->length + 1, sizeof(uint32_t)),
+                       .tree_fields = config._calloc(constpool->length + 1, sizeof(uint32_t)),
+                       .declared = config._calloc(constpool->length + 1, sizeof(uint8_t *)),
+                       .inferred = config._calloc(constpool->length + 1, sizeof(uint8_t *))};
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntryClass *_class = &constantpool_get(constpool, i)->data._class;
+        if (is_class(constpool, i))
+        {
+            slots.roots[i] = is_class(constpool, _class->parent) ? slots.roots[_class->parent] : i;
+            if (slots.tree_fields[slots.roots[i]] < _class->instance_fields)
+            {
+                slots.tree_fields[slots.roots[i]] = _class->instance_fields;
+            }
+        }
+    }
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        if (is_class(constpool, i) && slots.roots[i] == i)
+        {
+            slots.declared[i] = config._malloc(slots.tree_fields[i] + 1);
+            slots.inferred[i] = config._malloc(slots.tree_fields[i] + 1);
+            memset(slots.declared[i], FIELD_TYPE_UNKNOWN, slots.tree_fields[i] + 1);
+            memset(slots.inferred[i], FIELD_TYPE_UNKNOWN, slots.tree_fields[i] + 1);
+        }
+    }
+
+    // Declared types win over inferred ones, conflicting declarations fall back to untyped fields.
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        uint8_t *declared, *inferred;
+        ConstantPoolEntryField *field = &constantpool_get(constpool, i)->data.field;
+        if (is_field(constpool, i) && field->type != FIELD_TYPE_ANY && find_slot(constpool, &slots, field, &declared, &inferred))
+        {
+            *declared = *declared == FIELD_TYPE_UNKNOWN || *declared == field->type ? field->type : FIELD_TYPE_ANY;
+        }
+    }
+
+    if (inststream)
+    {
+        infer_types(constpool, &slots, inststream);
+    }
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        if (is_class(constpool, i))
+        {
+            layout_class(constpool, &slots, i);
+        }
+    }
+
+    // Resolve every field to its offset and width, so PUSH_FIELD and POP_FIELD do not have to look at the class.
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntryField *field = &constantpool_get(constpool, i)->data.field;
+        if (is_field(constpool, i) && is_class(constpool, field->_class))
+        {
+            ConstantPoolEntryClass *_class = &constantpool_get(constpool, field->_class)->data._class;
+            if (_class->field_offsets && field->index < _class->instance_fields)
+            {
+                field->storage = _class->field_types[field->index];
+                field->offset = _class->field_offsets[field->index];
+            }
+        }
+    }
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        config._free(slots.declared[i]);
+        config._free(slots.inferred[i]);
+    }
+    config._free(slots.roots);
+    config._free(slots.tree_fields);
+    config._free(slots.declared);
+    config._free(slots.inferred);
+    constpool->linked = true;
 }
\ No newline at end of file
@@ -1,8 +1,8 @@
 #include "evalstack.h"
 
-EvalStack *evalstack_new()
+EvalStack *evalstack_new(size_t max_depth)
 {
-    return stack_new(sizeof(EvalStackElement));
+    return stack_new_reserved(sizeof(EvalStackElement), max_depth);
 }
 
 void evalstack_free(EvalStack *evalstack)
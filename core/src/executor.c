@@ -1,5 +1,8 @@
 #include <string.h>
 #include <stdio.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
 
 #include "object.h"
 #include "string_class.h"
@@ -7,25 +10,158 @@
 #include "config.h"
 #include "executor.h"
 
+// The executor that is running on this thread, used to tell an overflow of its stacks apart from any other fault.
+static _Thread_local Executor *running;
+static _Thread_local sigjmp_buf *overflow_target;
+static struct sigaction previous_action;
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+
+static void handle_segv(int signal, siginfo_t *info, void *context)
+{
+    Executor *executor = running;
+
+    if (executor && (stack_in_guard(executor->evalstack, info->si_addr) || stack_in_guard(executor->evalrefs, info->si_addr) || stack_in_guard(executor->callstack, info->si_addr)))
+    {
+        siglongjmp(*overflow_target, 1);
+    }
+
+    // Any other fault is handed over to the handler that was installed before, the default one crashes on return.
+    if (previous_action.sa_flags & SA_SIGINFO)
+    {
+        previous_action.sa_sigaction(signal, info, context);
+    }
+    else if (previous_action.sa_handler == SIG_DFL || previous_action.sa_handler == SIG_IGN)
+    {
+        sigaction(SIGSEGV, &previous_action, NULL);
+    }
+    else
+    {
+        previous_action.sa_handler(signal);
+    }
+}
+
+static void install_handler()
+{
+    struct sigaction action = {0};
+    action.sa_sigaction = handle_segv;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_action);
+}
+
 Executor *executor_new(ConstantPool *constpool, InstructionStream *inststream)
 {
+    return executor_new_with_depth(constpool, inststream, config.max_stack_depth);
+}
+
+Executor *executor_new_with_depth(ConstantPool *constpool, InstructionStream *inststream, size_t max_depth)
+{
+    pthread_once(&handler_once, install_handler);
+
+    // The stacks reserve their full depth up front, which fails when the system does not overcommit memory.
+    EvalStack *evalstack = evalstack_new(max_depth);
+    Stack *evalrefs = stack_new_reserved(sizeof(bool), max_depth);
+    CallStack *callstack = callstack_new(max_depth);
+    Heap *heap = heap_new();
+    if (!evalstack || !evalrefs || !callstack || !heap)
+    {
+        if (evalstack)
+        {
+            evalstack_free(evalstack);
+        }
+        if (evalrefs)
+        {
+            stack_free(evalrefs);
+        }
+        if (callstack)
+        {
+            callstack_free(callstack);
+        }
+        if (heap)
+        {
+            heap_free(heap);
+        }
+        return NULL;
+    }
+
     Executor *executor = (Executor *)config._malloc(sizeof(Executor));
     executor->constpool = constpool;
     executor->inststream = inststream;
-    executor->evalstack = evalstack_new(),
-    executor->callstack = callstack_new();
+    executor->evalstack = evalstack;
+    executor->evalrefs = evalrefs;
+    executor->callstack = callstack;
+    executor->heap = heap;
+    executor->error = EXECUTOR_OK;
     return executor;
 }
 
+// Frames that are still on the call stack own their variables, unless those live in the arena.
+static void free_frames(Executor *executor)
+{
+    while (executor->callstack->length > 0)
+    {
+        if (!executor->heap->arena)
+        {
+            config._free(callstack_top(executor->callstack).vars);
+        }
+        callstack_pop(executor->callstack);
+    }
+}
+
 void executor_free(Executor *executor)
 {
+    free_frames(executor);
     evalstack_free(executor->evalstack);
     executor->evalstack = NULL;
+    stack_free(executor->evalrefs);
+    executor->evalrefs = NULL;
     callstack_free(executor->callstack);
     executor->callstack = NULL;
+    heap_free(executor->heap);
+    executor->heap = NULL;
     config._free(executor);
 }
 
+void executor_reset(Executor *executor)
+{
+    // Everything the program allocated is released at once, in arena mode that only takes one pass over the chunks.
+    free_frames(executor);
+    executor->evalstack->length = 0;
+    executor->evalrefs->length = 0;
+    executor->error = EXECUTOR_OK;
+    heap_reset(executor->heap);
+    executor->inststream->current = 0;
+}
+
+// The evaluation stack is untagged, so a parallel stack records which elements are references for the garbage collector.
+static void push_value(Executor *executor, EvalStackElement element, bool reference)
+{
+    evalstack_push(executor->evalstack, element);
+    stack_push(executor->evalrefs, &reference);
+}
+
+static void push_integer(Executor *executor, int32_t integer)
+{
+    push_value(executor, (EvalStackElement){.integer = integer}, false);
+}
+
+static void push_reference(Executor *executor, void *pointer)
+{
+    push_value(executor, (EvalStackElement){.pointer = pointer}, true);
+}
+
+static EvalStackElement pop_value(Executor *executor, bool *reference)
+{
+    EvalStackElement element = evalstack_top(executor->evalstack);
+    evalstack_pop(executor->evalstack);
+    if (reference)
+    {
+        *reference = *(bool *)stack_top(executor->evalrefs);
+    }
+    stack_pop(executor->evalrefs);
+    return element;
+}
+
 static EvalStackElement op_add(EvalStackElement left, EvalStackElement right)
 {
     return (EvalStackElement){.integer = left.integer + right.integer};
@@ -76,46 +212,61 @@ static EvalStackElement op_ge(EvalStackElement left, EvalStackElement right)
     return (EvalStackElement){.integer = left.integer >= right.integer};
 }
 
-static void apply_binary_function(EvalStack *evalstack, EvalStackElement (*op)(EvalStackElement left, EvalStackElement right))
+static void apply_binary_function(Executor *executor, EvalStackElement (*op)(EvalStackElement left, EvalStackElement right))
 {
-    EvalStackElement right = evalstack_top(evalstack);
-    evalstack_pop(evalstack);
-    EvalStackElement left = evalstack_top(evalstack);
-    evalstack_pop(evalstack);
-    evalstack_push(evalstack, op(left, right));
+    EvalStackElement right = pop_value(executor, NULL);
+    EvalStackElement left = pop_value(executor, NULL);
+    push_value(executor, op(left, right), false);
 }
 
 static void native_method_console_println(Executor *executor)
 {
     CallStackFrame frame = callstack_top(executor->callstack);
-    printf("%s\n", string_get_value(frame.vars[1].pointer));
+    void *string_object = frame.vars[1].pointer;
+    fwrite(string_get_value(string_object), 1, string_length(string_object), stdout);
+    putchar('\n');
 }
 
 static void native_method_string_builder_append_string(Executor *executor)
 {
     CallStackFrame frame = callstack_top(executor->callstack);
-    string_builder_append_string(frame.vars[0].pointer, frame.vars[1].pointer);
-    evalstack_push(executor->evalstack, (EvalStackElement){.pointer = frame.vars[0].pointer});
+    string_builder_append_string(executor->heap, frame.vars[0].pointer, frame.vars[1].pointer);
+    push_reference(executor, frame.vars[0].pointer);
 }
 
 static void native_method_string_builder_append_bool(Executor *executor)
 {
     CallStackFrame frame = callstack_top(executor->callstack);
-    string_builder_append_bool(frame.vars[0].pointer, frame.vars[1].integer);
-    evalstack_push(executor->evalstack, (EvalStackElement){.pointer = frame.vars[0].pointer});
+    string_builder_append_bool(executor->heap, frame.vars[0].pointer, frame.vars[1].integer);
+    push_reference(executor, frame.vars[0].pointer);
 }
 
 static void native_method_string_builder_append_int(Executor *executor)
 {
     CallStackFrame frame = callstack_top(executor->callstack);
-    string_builder_append_int(frame.vars[0].pointer, frame.vars[1].integer);
-    evalstack_push(executor->evalstack, (EvalStackElement){.pointer = frame.vars[0].pointer});
+    string_builder_append_int(executor->heap, frame.vars[0].pointer, frame.vars[1].integer);
+    push_reference(executor, frame.vars[0].pointer);
 }
 
 static void native_method_string_builder_to_string(Executor *executor)
 {
     CallStackFrame frame = callstack_top(executor->callstack);
-    evalstack_push(executor->evalstack, (EvalStackElement){.pointer = string_builder_to_string(frame.vars[0].pointer)});
+    push_reference(executor, string_builder_to_string(frame.vars[0].pointer));
+}
+
+CallStackFrame *executor_push_frame(Executor *executor, size_t vars_count, uint32_t return_address)
+{
+    // The reference tags of the variables are stored in the same allocation, right after the variables.
+    size_t vars_size = vars_count * (sizeof(EvalStackElement) + sizeof(bool));
+    Arena *arena = executor->heap->arena;
+
+    // The frame is pushed before its variables are allocated, so a call that overflows the call stack leaves nothing behind.
+    callstack_push(executor->callstack, (CallStackFrame){.return_address = return_address, .vars_count = vars_count, .vars = NULL});
+    CallStackFrame *frame = stack_top(executor->callstack);
+    frame->vars = arena ? arena_alloc(arena, vars_size) : config._malloc(vars_size);
+    heap_account(executor->heap, vars_size);
+    frame->refs = (bool *)(frame->vars + vars_count);
+    return frame;
 }
 
 static void enter_method(Executor *executor, uint32_t constpool_method, bool native)
@@ -125,9 +276,8 @@ static void enter_method(Executor *executor, uint32_t constpool_method, bool nat
     // Builtin native methods do not have a vtable.
     if (!native)
     {
-        // Get the runtime class of the object used to call the method in order to find the vtable.
-        uint32_t constpool_class = object_get_class(((EvalStackElement *)executor->evalstack->elements + (executor->evalstack->length - method->args))->pointer);
-        VTable *vtable = constantpool_get(executor->constpool, constpool_class)->data._class.vtable;
+        // The object used to call the method points to its runtime class, which holds the vtable.
+        VTable *vtable = object_get_runtime_class(((EvalStackElement *)executor->evalstack->elements + (executor->evalstack->length - method->args))->pointer)->vtable;
 
         // Find the correct method to call by looking in the vtable (we do this to achieve runtime polymorphism).
         uint32_t constpool_method = vtable_get(vtable, method->name);
@@ -135,21 +285,38 @@ static void enter_method(Executor *executor, uint32_t constpool_method, bool nat
     }
 
     uint32_t vars_count = method->args + method->locals;
-    CallStackFrame frame = {.return_address = executor->inststream->current + 1,
-                            .vars_count = vars_count,
-                            .vars = config._malloc(vars_count * sizeof(EvalStackElement))};
+    CallStackFrame *frame = executor_push_frame(executor, vars_count, executor->inststream->current + 1);
 
     // Load arguments into frame.
     for (int i = method->args - 1; i >= 0; i--)
     {
-        frame.vars[i] = evalstack_top(executor->evalstack);
-        evalstack_pop(executor->evalstack);
+        frame->vars[i] = pop_value(executor, &frame->refs[i]);
+    }
+
+    // Local variables do not hold any references until they are assigned.
+    for (uint32_t i = method->args; i < vars_count; i++)
+    {
+        frame->vars[i] = (EvalStackElement){.pointer = NULL};
+        frame->refs[i] = false;
     }
 
     // Update program counter.
     executor->inststream->current = method->address;
+}
 
-    callstack_push(executor->callstack, frame);
+static void free_frame(Executor *executor, CallStackFrame frame)
+{
+    heap_unaccount(executor->heap, frame.vars_count * (sizeof(EvalStackElement) + sizeof(bool)));
+
+    // Frames are released in LIFO order, so in arena mode their memory can be reused unless an object was allocated since.
+    if (executor->heap->arena)
+    {
+        arena_release(executor->heap->arena, frame.vars, frame.vars_count * (sizeof(EvalStackElement) + sizeof(bool)));
+    }
+    else
+    {
+        config._free(frame.vars);
+    }
 }
 
 static void exit_method(Executor *executor)
@@ -158,7 +325,7 @@ static void exit_method(Executor *executor)
 
     executor->inststream->current = frame.return_address;
 
-    config._free(frame.vars);
+    free_frame(executor, frame);
 
     callstack_pop(executor->callstack);
 }
@@ -203,112 +370,196 @@ static void call_method(Executor *executor, uint32_t constpool_method)
 static void new_object(Executor *executor, uint32_t constpool_class)
 {
     ConstantPoolEntryClass *_class = &constantpool_get(executor->constpool, constpool_class)->data._class;
+
+    // Classes of a lazy constant pool are linked when their first instance is created, every call goes through an instance.
+    constantpool_link_class(executor->constpool, _class);
+
     switch (constpool_class)
     {
     case CONSTPOOL_CLASS_STRING_BUILDER:
-        evalstack_push(executor->evalstack, (EvalStackElement){.pointer = string_builder_new()});
+        push_reference(executor, string_builder_new(executor->heap));
+        break;
+    default:
+        push_reference(executor, object_new(executor->heap, _class));
+        break;
+    }
+}
+
+static void push_field(Executor *executor, uint32_t constpool_field)
+{
+    // The offset and width of the field were resolved when the layouts were computed.
+    ConstantPoolEntryField *field = &constantpool_get(executor->constpool, constpool_field)->data.field;
+    char *object = pop_value(executor, NULL).pointer;
+
+    switch (field->storage)
+    {
+    case FIELD_TYPE_INT:
+        push_integer(executor, *(int32_t *)(object + field->offset));
+        break;
+    case FIELD_TYPE_BOOL:
+        push_integer(executor, *(uint8_t *)(object + field->offset));
         break;
     default:
-        evalstack_push(executor->evalstack, (EvalStackElement){.pointer = object_new(constpool_class, _class->fields)});
+        push_value(executor, *(EvalStackElement *)(object + field->offset), object_is_reference(object, field->index));
         break;
     }
 }
 
-static EvalStackElement *get_field(Executor *executor, void *object, uint32_t constpool_field)
+static void pop_field(Executor *executor, uint32_t constpool_field)
 {
     ConstantPoolEntryField *field = &constantpool_get(executor->constpool, constpool_field)->data.field;
-    return object_get_field(object, field->index);
+    bool reference;
+    EvalStackElement value = pop_value(executor, &reference);
+    char *object = pop_value(executor, NULL).pointer;
+
+    switch (field->storage)
+    {
+    case FIELD_TYPE_INT:
+        *(int32_t *)(object + field->offset) = value.integer;
+        break;
+    case FIELD_TYPE_BOOL:
+        *(uint8_t *)(object + field->offset) = value.integer != 0;
+        break;
+    default:
+        object_set_field(executor->heap, object, field->index, value, reference);
+        break;
+    }
 }
 
-static void push_field(Executor *executor, uint32_t constpool_field)
+static void push_var(Executor *executor, uint32_t index)
 {
-    EvalStack *evalstack = executor->evalstack;
-    void *object = evalstack_top(evalstack).pointer;
-    evalstack_pop(evalstack);
-    evalstack_push(evalstack, *get_field(executor, object, constpool_field));
+    CallStackFrame frame = callstack_top(executor->callstack);
+    push_value(executor, frame.vars[index], frame.refs[index]);
 }
 
-static void pop_field(Executor *executor, uint32_t constpool_field)
+static void pop_var(Executor *executor, uint32_t index)
 {
-    EvalStack *evalstack = executor->evalstack;
-    EvalStackElement value = evalstack_top(evalstack);
-    evalstack_pop(evalstack);
-    void *object = evalstack_top(evalstack).pointer;
-    evalstack_pop(evalstack);
-    *get_field(executor, object, constpool_field) = value;
+    // Store the whole element since a reference does not fit in the integer member.
+    CallStackFrame frame = callstack_top(executor->callstack);
+    frame.vars[index] = pop_value(executor, &frame.refs[index]);
 }
 
 static void push_string(Executor *executor, uint32_t constpool_string)
 {
-    const char *value = constantpool_get(executor->constpool, constpool_string)->data.string.value;
-    void *string_object = string_new(value);
-    evalstack_push(executor->evalstack, (EvalStackElement){.pointer = string_object});
+    push_reference(executor, constantpool_get(executor->constpool, constpool_string)->data.string.object);
 }
 
-bool executor_step(Executor *executor)
+static void visit_roots(Heap *heap, HeapSlotVisitor visit, void *context)
 {
+    Executor *executor = context;
+
+    EvalStackElement *elements = executor->evalstack->elements;
+    bool *refs = executor->evalrefs->elements;
+    for (size_t i = 0; i < executor->evalstack->length; i++)
+    {
+        if (refs[i])
+        {
+            visit(heap, &elements[i].pointer);
+        }
+    }
+
+    CallStackFrame *frames = executor->callstack->elements;
+    for (size_t i = 0; i < executor->callstack->length; i++)
+    {
+        for (size_t j = 0; j < frames[i].vars_count; j++)
+        {
+            if (frames[i].refs[j])
+            {
+                visit(heap, &frames[i].vars[j].pointer);
+            }
+        }
+    }
+}
+
+void executor_collect_garbage(Executor *executor)
+{
+    heap_collect(executor->heap, visit_roots, executor, true);
+}
+
+size_t executor_live_bytes(Executor *executor)
+{
+    return heap_live_bytes(executor->heap);
+}
+
+size_t executor_allocated_bytes(Executor *executor)
+{
+    return heap_allocated_bytes(executor->heap);
+}
+
+static bool step(Executor *executor)
+{
+    // Every reference is on the evaluation stack or in a call frame between two instructions, so this is a safe point to collect.
+    if (heap_should_collect(executor->heap))
+    {
+        heap_collect(executor->heap, visit_roots, executor, false);
+
+        // A program that is still over the heap limit after a full collection is stopped.
+        if (executor->heap->over_limit)
+        {
+            executor->error = EXECUTOR_OUT_OF_MEMORY;
+            return false;
+        }
+    }
+
     size_t current = executor->inststream->current;
     Instruction inst = executor->inststream->instructions[current];
-    EvalStack *evalstack = executor->evalstack;
     CallStack *callstack = executor->callstack;
-    ConstantPool *constpool = executor->constpool;
 
     switch (inst.opcode)
     {
     case PUSH:
-        evalstack_push(evalstack, (EvalStackElement){.integer = inst.operand});
+        push_integer(executor, inst.operand);
         break;
     case PUSH_STRING:
         push_string(executor, inst.operand);
         break;
     case PUSH_VAR:
-        evalstack_push(evalstack, callstack_top(callstack).vars[inst.operand]);
+        push_var(executor, inst.operand);
         break;
     case PUSH_FIELD:
         push_field(executor, inst.operand);
         break;
     case POP:
-        evalstack_pop(evalstack);
+        pop_value(executor, NULL);
         break;
     case POP_VAR:
-        callstack_top(callstack).vars[inst.operand].integer = evalstack_top(evalstack).integer;
-        evalstack_pop(evalstack);
+        pop_var(executor, inst.operand);
         break;
     case POP_FIELD:
         pop_field(executor, inst.operand);
         break;
     case ADD:
-        apply_binary_function(evalstack, op_add);
+        apply_binary_function(executor, op_add);
         break;
     case SUB:
-        apply_binary_function(evalstack, op_sub);
+        apply_binary_function(executor, op_sub);
         break;
     case MUL:
-        apply_binary_function(evalstack, op_mul);
+        apply_binary_function(executor, op_mul);
         break;
     case DIV:
-        apply_binary_function(evalstack, op_div);
+        apply_binary_function(executor, op_div);
         break;
     case JUMP:
-        evalstack_push(evalstack, (EvalStackElement){.integer = 1});
+        push_integer(executor, 1);
         break;
     case JUMP_EQ:
-        apply_binary_function(evalstack, op_eq);
+        apply_binary_function(executor, op_eq);
         break;
     case JUMP_NE:
-        apply_binary_function(evalstack, op_ne);
+        apply_binary_function(executor, op_ne);
         break;
     case JUMP_LT:
-        apply_binary_function(evalstack, op_lt);
+        apply_binary_function(executor, op_lt);
         break;
     case JUMP_LE:
-        apply_binary_function(evalstack, op_le);
+        apply_binary_function(executor, op_le);
         break;
     case JUMP_GT:
-        apply_binary_function(evalstack, op_gt);
+        apply_binary_function(executor, op_gt);
         break;
     case JUMP_GE:
-        apply_binary_function(evalstack, op_ge);
+        apply_binary_function(executor, op_ge);
         break;
     case CALL:
         call_method(executor, inst.operand);
@@ -326,14 +577,18 @@ bool executor_step(Executor *executor)
         new_object(executor, inst.operand);
         break;
     case DUP:
-        evalstack_push(evalstack, evalstack_top(evalstack));
-        break;
+    {
+        bool reference;
+        EvalStackElement element = pop_value(executor, &reference);
+        push_value(executor, element, reference);
+        push_value(executor, element, reference);
+    }
+    break;
     }
 
     if (inst.opcode & JUMP_BIT)
     {
-        int32_t jump = evalstack_top(evalstack).integer;
-        evalstack_pop(evalstack);
+        int32_t jump = pop_value(executor, NULL).integer;
 
         if (jump)
         {
@@ -352,8 +607,61 @@ bool executor_step(Executor *executor)
     return true;
 }
 
+// Pushes do not check the bounds of the stacks, overflowing one of them faults on its guard page and jumps back here.
+static bool run(Executor *executor, bool all, uint32_t stop)
+{
+    if (executor->error)
+    {
+        return false;
+    }
+
+    Executor *previous_running = running;
+    sigjmp_buf *previous_target = overflow_target;
+    sigjmp_buf target;
+    bool result;
+
+    if (sigsetjmp(target, 0) == 0)
+    {
+        running = executor;
+        overflow_target = &target;
+
+        do
+        {
+            result = step(executor);
+        } while (all && result && executor->inststream->current != stop);
+    }
+    else
+    {
+        // SIGSEGV is still blocked since the handler never returned.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGSEGV);
+        pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+        executor->error = EXECUTOR_STACK_OVERFLOW;
+        result = false;
+    }
+
+    running = previous_running;
+    overflow_target = previous_target;
+    return result;
+}
+
+bool executor_step(Executor *executor)
+{
+    return run(executor, false, UINT32_MAX);
+}
+
 void executor_step_all(Executor *executor)
 {
-    while (executor_step(executor))
-        ;
+    run(executor, true, UINT32_MAX);
+}
+
+bool executor_step_until(Executor *executor, uint32_t address)
+{
+    if (executor->inststream->current == address && !executor->error)
+    {
+        return true;
+    }
+    return run(executor, true, address);
 }
\ No newline at end of file
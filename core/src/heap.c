@@ -0,0 +1,894 @@
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "config.h"
+#include "pages.h"
+#include "object.h"
+#include "workdeque.h"
+#include "heap.h"
+
+#define MARK_DEQUE_CAPACITY 16384
+
+typedef struct
+{
+    size_t objects_freed;
+    size_t bytes_freed;
+    size_t live_bytes;
+} SweepTotals;
+
+// State shared by the worker threads of a parallel phase.
+typedef struct
+{
+    Heap *heap;
+    uint32_t threads;
+    WorkDeque **deques;
+    pthread_mutex_t lock;
+    atomic_size_t overflow;
+    atomic_uint idle;
+    atomic_size_t next_region;
+    SweepTotals totals;
+} Workers;
+
+typedef struct
+{
+    Workers *workers;
+    uint32_t index;
+} Worker;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Empty the heap: the nursery is rewound, every old object is freed and a cycle in progress is abandoned.
+static void clear(Heap *heap)
+{
+    heap->from_space = heap->nursery;
+    heap->to_space = heap->nursery + heap->semispace_size;
+    heap->nursery_top = heap->from_space;
+    heap->nursery_limit = heap->from_space + heap->semispace_size;
+    heap->nursery_mark = heap->from_space;
+    heap->nursery_full = false;
+    heap->promote_all = false;
+    heap->marking = false;
+    heap->sweeping = false;
+    heap->increment_countdown = 0;
+    for (size_t i = 0; i < HEAP_REGIONS; i++)
+    {
+        while (heap->old[i].next != &heap->old[i])
+        {
+            HeapBlock *block = heap->old[i].next;
+            heap->old[i].next = block->next;
+            config._free(block);
+        }
+        heap->old[i].prev = &heap->old[i];
+    }
+    heap->next_region = 0;
+    heap->old_bytes = 0;
+    heap->next_collection = config.gc_threshold;
+    heap->external_bytes = 0;
+    heap->over_limit = false;
+}
+
+Heap *heap_new()
+{
+    // The page pool only serves arena chunks, a collected heap would silently bypass it.
+    if (config.page_pool && !config.arena_chunk_size)
+    {
+        return NULL;
+    }
+
+    Heap *heap = (Heap *)config._malloc(sizeof(Heap));
+    // In arena mode nothing is ever collected, objects are bump allocated in the arena and released all at once.
+    heap->arena = config.arena_chunk_size ? arena_new(config.arena_chunk_size) : NULL;
+    // The nursery is split into two semispaces, objects are allocated in one and survivors are copied to the other.
+    heap->semispace_size = heap->arena ? 0 : config.nursery_size / 2 & ~(size_t)7;
+    // The nursery is allocated up front, so under a heap limit it may take at most half of it.
+    heap->limit = config.heap_limit;
+    if (heap->limit && heap->semispace_size > heap->limit / 4)
+    {
+        heap->semispace_size = heap->limit / 4 & ~(size_t)7;
+    }
+    // A large nursery is chased through by every scavenge, with huge pages it needs a fraction of the TLB entries.
+    heap->huge_pages = config.huge_pages && heap->semispace_size;
+    if (heap->huge_pages)
+    {
+        heap->nursery = pages_alloc(2 * heap->semispace_size);
+    }
+    else
+    {
+        heap->nursery = heap->semispace_size ? config._malloc(2 * heap->semispace_size) : NULL;
+    }
+    for (size_t i = 0; i < HEAP_REGIONS; i++)
+    {
+        heap->old[i].next = &heap->old[i];
+    }
+    clear(heap);
+    heap->roots = stack_new(sizeof(void **));
+    heap->remembered = stack_new(sizeof(void *));
+    heap->promoted = stack_new(sizeof(void *));
+    heap->mark_stack = stack_new(sizeof(void *));
+    heap->stats = (HeapStats){0};
+    return heap;
+}
+
+void heap_free(Heap *heap)
+{
+    clear(heap);
+    if (heap->arena)
+    {
+        arena_free(heap->arena);
+        heap->arena = NULL;
+    }
+    if (heap->huge_pages)
+    {
+        pages_free(heap->nursery, 2 * heap->semispace_size);
+    }
+    else
+    {
+        config._free(heap->nursery);
+    }
+    heap->nursery = NULL;
+    stack_free(heap->roots);
+    heap->roots = NULL;
+    stack_free(heap->remembered);
+    heap->remembered = NULL;
+    stack_free(heap->promoted);
+    heap->promoted = NULL;
+    stack_free(heap->mark_stack);
+    heap->mark_stack = NULL;
+    config._free(heap);
+}
+
+void heap_reset(Heap *heap)
+{
+    clear(heap);
+    if (heap->arena)
+    {
+        arena_reset(heap->arena);
+    }
+    heap->roots->length = 0;
+    heap->remembered->length = 0;
+    heap->promoted->length = 0;
+    heap->mark_stack->length = 0;
+}
+
+static ObjectHeader *alloc_old(Heap *heap, size_t total)
+{
+    // Blocks are spread over the regions in turn so that every region holds about the same amount of work.
+    HeapBlock *region = &heap->old[heap->next_region];
+    heap->next_region = (heap->next_region + 1) % HEAP_REGIONS;
+
+    HeapBlock *block = (HeapBlock *)config._malloc(sizeof(HeapBlock) + total);
+    block->prev = region;
+    block->next = region->next;
+    region->next->prev = block;
+    region->next = block;
+    heap->old_bytes += sizeof(HeapBlock) + total;
+    return (ObjectHeader *)(block + 1);
+}
+
+static void *alloc_slow(Heap *heap, size_t size, uint32_t fields, bool tenured)
+{
+    size_t total = (sizeof(ObjectHeader) + size + 7) & ~(size_t)7;
+    heap->stats.bytes_allocated += total;
+
+    // Arena objects are neither young nor old, so the barriers and heap_release leave them alone.
+    if (heap->arena)
+    {
+        ObjectHeader *header = arena_alloc(heap->arena, total);
+        *header = (ObjectHeader){.size = total, .fields = fields, .flags = 0, .age = 0};
+        if (heap->limit)
+        {
+            heap_check_limit(heap);
+        }
+        return header + 1;
+    }
+
+    // A small object only ends up here when the nursery is exhausted, it is then allocated in the old generation and
+    // the next safe point scavenges the nursery.
+    if (!tenured && total <= HEAP_LARGE_OBJECT_SIZE && heap->nursery)
+    {
+        heap->nursery_full = true;
+    }
+
+    ObjectHeader *header = alloc_old(heap, total);
+    *header = (ObjectHeader){.size = total, .fields = fields, .flags = heap->marking ? OBJECT_FLAG_OLD | OBJECT_FLAG_MARKED : OBJECT_FLAG_OLD, .age = 0};
+    // The limit is only checked here, the nursery on its own cannot run over it and is full by the time it ends up here.
+    if (heap->limit)
+    {
+        heap_check_limit(heap);
+    }
+    return header + 1;
+}
+
+void *heap_alloc_slow(Heap *heap, size_t size, uint32_t fields)
+{
+    return alloc_slow(heap, size, fields, false);
+}
+
+void *heap_alloc_old(Heap *heap, size_t size, uint32_t fields)
+{
+    return alloc_slow(heap, size, fields, true);
+}
+
+void heap_release(Heap *heap, void *object)
+{
+    // Young, remembered and marked objects may still be referenced by the collector's own bookkeeping, they are left to the next collection.
+    // So is every object while a sweep is in progress, its cursors may point at the block and its totals may count it.
+    ObjectHeader *header = heap_get_header(object);
+
+    if (!heap->sweeping && (header->flags & (OBJECT_FLAG_OLD | OBJECT_FLAG_REMEMBERED | OBJECT_FLAG_MARKED)) == OBJECT_FLAG_OLD)
+    {
+        HeapBlock *block = (HeapBlock *)header - 1;
+        block->prev->next = block->next;
+        block->next->prev = block->prev;
+        heap->old_bytes -= sizeof(HeapBlock) + header->size;
+        config._free(block);
+    }
+}
+
+void *heap_alloc_immortal(size_t size, uint32_t fields)
+{
+    // Immortal objects live outside of every heap and stay marked, so no collector ever traces, moves or frees them.
+    size_t total = (sizeof(ObjectHeader) + size + 7) & ~(size_t)7;
+    ObjectHeader *header = config._malloc(total);
+    *header = (ObjectHeader){.size = total, .fields = fields, .flags = OBJECT_FLAG_OLD | OBJECT_FLAG_MARKED | OBJECT_FLAG_IMMORTAL, .age = 0};
+    return header + 1;
+}
+
+void heap_free_immortal(void *object)
+{
+    config._free(heap_get_header(object));
+}
+
+void heap_remember(Heap *heap, void *object)
+{
+    heap_get_header(object)->flags |= OBJECT_FLAG_REMEMBERED;
+    stack_push(heap->remembered, &object);
+}
+
+void heap_push_root(Heap *heap, void **slot)
+{
+    stack_push(heap->roots, &slot);
+}
+
+void heap_pop_root(Heap *heap)
+{
+    stack_pop(heap->roots);
+}
+
+bool heap_should_collect(Heap *heap)
+{
+    if (heap->over_limit)
+    {
+        return true;
+    }
+
+    // While a cycle is in progress, an increment is due every gc_increment_interval safe points. A zero threshold disables automatic collections.
+    bool collecting = heap->marking || heap->sweeping;
+
+    if (collecting && (heap->increment_countdown == 0 || --heap->increment_countdown == 0))
+    {
+        return true;
+    }
+    return config.gc_threshold != 0 && (heap->nursery_full || (!collecting && heap->old_bytes >= heap->next_collection));
+}
+
+static bool in_from_space(Heap *heap, void *object)
+{
+    return (char *)object >= heap->from_space && (char *)object < heap->from_space + heap->semispace_size;
+}
+
+// Copy a nursery object to the to-space, or to the old generation once it has survived enough scavenges.
+static void evacuate(Heap *heap, void **slot)
+{
+    void *object = *slot;
+
+    if (!in_from_space(heap, object))
+    {
+        return;
+    }
+
+    ObjectHeader *header = heap_get_header(object);
+
+    if (header->flags & OBJECT_FLAG_FORWARDED)
+    {
+        *slot = *(void **)object;
+        return;
+    }
+
+    ObjectHeader *copy;
+
+    if (heap->promote_all || header->age + 1 >= config.gc_promotion_age)
+    {
+        copy = alloc_old(heap, header->size);
+        memcpy(copy, header, header->size);
+        // Objects promoted while marking are allocated black, they were not part of the snapshot.
+        copy->flags |= heap->marking ? OBJECT_FLAG_OLD | OBJECT_FLAG_MARKED : OBJECT_FLAG_OLD;
+        heap->stats.bytes_promoted += header->size;
+        void *promoted = copy + 1;
+        stack_push(heap->promoted, &promoted);
+    }
+    else
+    {
+        copy = (ObjectHeader *)heap->nursery_top;
+        heap->nursery_top += header->size;
+        memcpy(copy, header, header->size);
+        copy->age++;
+    }
+
+    // Every object is at least 8 bytes large, so the forwarding pointer fits in the old copy.
+    header->flags |= OBJECT_FLAG_FORWARDED;
+    *(void **)object = copy + 1;
+    *slot = copy + 1;
+}
+
+// Evacuate the referents of an object and report if it still points into the nursery afterwards.
+static bool scan(Heap *heap, void *object)
+{
+    bool young = false;
+
+    for (uint32_t i = 0; i < heap_get_header(object)->fields; i++)
+    {
+        if (object_is_reference(object, i))
+        {
+            void **slot = &object_get_field(object, i)->pointer;
+            evacuate(heap, slot);
+            young |= heap_in_nursery(heap, *slot);
+        }
+    }
+
+    return young;
+}
+
+static void scavenge(Heap *heap, HeapRootEnumerator roots, void *context, bool promote)
+{
+    // Cheney's algorithm: survivors are appended to the to-space, which is then scanned as a queue.
+    char *scan_pointer = heap->to_space;
+    // Bump allocations are only added up here, so that the allocation fast path does not have to count them.
+    heap->stats.bytes_allocated += heap->nursery_top - heap->nursery_mark;
+    heap->nursery_top = heap->to_space;
+    heap->promote_all = promote;
+
+    for (size_t i = 0; i < heap->roots->length; i++)
+    {
+        evacuate(heap, ((void ***)heap->roots->elements)[i]);
+    }
+    roots(heap, evacuate, context);
+
+    // Old objects stay remembered only as long as they point into the nursery.
+    void **remembered = heap->remembered->elements;
+    size_t length = heap->remembered->length;
+    heap->remembered->length = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        heap_get_header(remembered[i])->flags &= ~OBJECT_FLAG_REMEMBERED;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if (scan(heap, remembered[i]))
+        {
+            heap_remember(heap, remembered[i]);
+        }
+    }
+
+    while (scan_pointer < heap->nursery_top || heap->promoted->length > 0)
+    {
+        while (scan_pointer < heap->nursery_top)
+        {
+            ObjectHeader *header = (ObjectHeader *)scan_pointer;
+            scan(heap, header + 1);
+            scan_pointer += header->size;
+        }
+
+        while (heap->promoted->length > 0)
+        {
+            void *object = *(void **)stack_top(heap->promoted);
+            stack_pop(heap->promoted);
+            if (scan(heap, object))
+            {
+                heap_remember(heap, object);
+            }
+        }
+    }
+
+    // The to-space holds the survivors and becomes the new allocation space.
+    char *from_space = heap->from_space;
+    heap->from_space = heap->to_space;
+    heap->to_space = from_space;
+    heap->nursery_limit = heap->from_space + heap->semispace_size;
+    heap->nursery_mark = heap->nursery_top;
+    heap->nursery_full = false;
+}
+
+void heap_mark(Heap *heap, void *object)
+{
+    // Only the old generation is marked, young objects are kept alive by scavenges.
+    if (!object || heap_in_nursery(heap, object))
+    {
+        return;
+    }
+
+    ObjectHeader *header = heap_get_header(object);
+
+    if (!(header->flags & OBJECT_FLAG_MARKED))
+    {
+        header->flags |= OBJECT_FLAG_MARKED;
+        stack_push(heap->mark_stack, &object);
+    }
+}
+
+static void mark_slot(Heap *heap, void **slot)
+{
+    heap_mark(heap, *slot);
+}
+
+// Trace at most budget objects (or all of them if budget is zero) and report if marking has finished.
+static bool trace(Heap *heap, size_t budget)
+{
+    // Use an explicit mark stack so that long linked structures cannot overflow the C stack.
+    for (size_t traced = 0; heap->mark_stack->length > 0 && (budget == 0 || traced < budget); traced++)
+    {
+        void *object = *(void **)stack_top(heap->mark_stack);
+        stack_pop(heap->mark_stack);
+
+        for (uint32_t i = 0; i < heap_get_header(object)->fields; i++)
+        {
+            if (object_is_reference(object, i))
+            {
+                heap_mark(heap, object_get_field(object, i)->pointer);
+            }
+        }
+    }
+
+    return heap->mark_stack->length == 0;
+}
+
+// Sweep at most budget blocks (or all of them if budget is zero) of a region and return the number of blocks visited.
+// Blocks allocated while sweeping are linked in front of the cursor, so only blocks that existed when marking finished are
+// visited.
+static size_t sweep_region(Heap *heap, size_t region, size_t budget, SweepTotals *totals)
+{
+    HeapBlock *block = heap->sweep_cursors[region];
+    size_t swept = 0;
+
+    for (; block != &heap->old[region] && (budget == 0 || swept < budget); swept++)
+    {
+        HeapBlock *next = block->next;
+        ObjectHeader *header = (ObjectHeader *)(block + 1);
+
+        if (header->flags & OBJECT_FLAG_MARKED)
+        {
+            header->flags &= ~OBJECT_FLAG_MARKED;
+            totals->live_bytes += sizeof(HeapBlock) + header->size;
+        }
+        else
+        {
+            totals->objects_freed++;
+            totals->bytes_freed += sizeof(HeapBlock) + header->size;
+            block->prev->next = block->next;
+            block->next->prev = block->prev;
+            config._free(block);
+        }
+
+        block = next;
+    }
+
+    heap->sweep_cursors[region] = block;
+    return swept;
+}
+
+static void add_sweep_totals(Heap *heap, SweepTotals *totals)
+{
+    heap->stats.objects_freed += totals->objects_freed;
+    heap->stats.bytes_freed += totals->bytes_freed;
+    heap->swept_bytes += totals->live_bytes;
+}
+
+static void start_sweep(Heap *heap)
+{
+    heap->marking = false;
+    heap->sweeping = true;
+    heap->sweep_region = 0;
+    for (size_t i = 0; i < HEAP_REGIONS; i++)
+    {
+        heap->sweep_cursors[i] = heap->old[i].next;
+    }
+    heap->swept_bytes = 0;
+    heap->sweep_start_bytes = heap->old_bytes;
+}
+
+void heap_reschedule(Heap *heap)
+{
+    // Let the heap grow in proportion to the live data so that large live heaps do not collect constantly.
+    heap->next_collection = heap->old_bytes * 2 > config.gc_threshold ? heap->old_bytes * 2 : config.gc_threshold;
+}
+
+static void finish_sweep(Heap *heap)
+{
+    heap->old_bytes = heap->swept_bytes + (heap->old_bytes - heap->sweep_start_bytes);
+    heap->sweeping = false;
+    heap->stats.collections++;
+    heap_reschedule(heap);
+}
+
+// Sweep at most budget blocks (or all of them if budget is zero) and report if sweeping has finished.
+static bool sweep(Heap *heap, size_t budget)
+{
+    SweepTotals totals = {0};
+    size_t swept = 0;
+
+    while (heap->sweep_region < HEAP_REGIONS && (budget == 0 || swept < budget))
+    {
+        swept += sweep_region(heap, heap->sweep_region, budget == 0 ? 0 : budget - swept, &totals);
+        if (heap->sweep_cursors[heap->sweep_region] != &heap->old[heap->sweep_region])
+        {
+            break;
+        }
+        heap->sweep_region++;
+    }
+
+    add_sweep_totals(heap, &totals);
+    if (heap->sweep_region < HEAP_REGIONS)
+    {
+        return false;
+    }
+
+    finish_sweep(heap);
+    return true;
+}
+
+// Mark an object from a worker thread and report if this thread was the one to mark it.
+static bool mark_shared(Heap *heap, void *object)
+{
+    if (!object || heap_in_nursery(heap, object))
+    {
+        return false;
+    }
+
+    // The flags are only written by the workers during a parallel phase, so it is enough that setting the mark bit is atomic.
+    _Atomic uint32_t *flags = (_Atomic uint32_t *)&heap_get_header(object)->flags;
+
+    if (atomic_load_explicit(flags, memory_order_relaxed) & OBJECT_FLAG_MARKED)
+    {
+        return false;
+    }
+    return !(atomic_fetch_or_explicit(flags, OBJECT_FLAG_MARKED, memory_order_relaxed) & OBJECT_FLAG_MARKED);
+}
+
+// Objects that do not fit in the deque of a worker are pushed to the mark stack of the heap, which is shared.
+static void push_work(Workers *workers, uint32_t index, void *object)
+{
+    if (!workdeque_push(workers->deques[index], object))
+    {
+        pthread_mutex_lock(&workers->lock);
+        stack_push(workers->heap->mark_stack, &object);
+        atomic_store(&workers->overflow, workers->heap->mark_stack->length);
+        pthread_mutex_unlock(&workers->lock);
+    }
+}
+
+static void *find_work(Workers *workers, uint32_t index)
+{
+    void *object = workdeque_pop(workers->deques[index]);
+
+    for (uint32_t i = 1; !object && i < workers->threads; i++)
+    {
+        object = workdeque_steal(workers->deques[(index + i) % workers->threads]);
+    }
+
+    if (!object && atomic_load(&workers->overflow) > 0)
+    {
+        pthread_mutex_lock(&workers->lock);
+        if (workers->heap->mark_stack->length > 0)
+        {
+            object = *(void **)stack_top(workers->heap->mark_stack);
+            stack_pop(workers->heap->mark_stack);
+        }
+        atomic_store(&workers->overflow, workers->heap->mark_stack->length);
+        pthread_mutex_unlock(&workers->lock);
+    }
+
+    return object;
+}
+
+static bool has_work(Workers *workers)
+{
+    for (uint32_t i = 0; i < workers->threads; i++)
+    {
+        if (!workdeque_empty(workers->deques[i]))
+        {
+            return true;
+        }
+    }
+    return atomic_load(&workers->overflow) > 0;
+}
+
+static void *mark_worker(void *argument)
+{
+    Worker *worker = argument;
+    Workers *workers = worker->workers;
+    Heap *heap = workers->heap;
+
+    for (;;)
+    {
+        void *object = find_work(workers, worker->index);
+
+        if (object)
+        {
+            for (uint32_t i = 0; i < heap_get_header(object)->fields; i++)
+            {
+                void *child = object_is_reference(object, i) ? object_get_field(object, i)->pointer : NULL;
+                if (mark_shared(heap, child))
+                {
+                    push_work(workers, worker->index, child);
+                }
+            }
+            continue;
+        }
+
+        // Marking has finished once every worker is idle, since only busy workers can create new work.
+        atomic_fetch_add(&workers->idle, 1);
+        for (;;)
+        {
+            if (atomic_load(&workers->idle) == workers->threads)
+            {
+                return NULL;
+            }
+            if (has_work(workers))
+            {
+                atomic_fetch_sub(&workers->idle, 1);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static void *sweep_worker(void *argument)
+{
+    Workers *workers = ((Worker *)argument)->workers;
+    SweepTotals totals = {0};
+
+    for (size_t region = atomic_fetch_add(&workers->next_region, 1); region < HEAP_REGIONS; region = atomic_fetch_add(&workers->next_region, 1))
+    {
+        sweep_region(workers->heap, region, 0, &totals);
+    }
+
+    pthread_mutex_lock(&workers->lock);
+    workers->totals.objects_freed += totals.objects_freed;
+    workers->totals.bytes_freed += totals.bytes_freed;
+    workers->totals.live_bytes += totals.live_bytes;
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+// Run a phase on config.gc_threads threads, the calling thread acts as the first worker.
+static void run_workers(Workers *workers, void *(*routine)(void *))
+{
+    pthread_t *threads = config._malloc(workers->threads * sizeof(pthread_t));
+    Worker *worker = config._malloc(workers->threads * sizeof(Worker));
+
+    for (uint32_t i = 0; i < workers->threads; i++)
+    {
+        worker[i] = (Worker){.workers = workers, .index = i};
+    }
+    for (uint32_t i = 1; i < workers->threads; i++)
+    {
+        pthread_create(&threads[i], NULL, routine, &worker[i]);
+    }
+    routine(&worker[0]);
+    for (uint32_t i = 1; i < workers->threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    config._free(worker);
+    config._free(threads);
+}
+
+static void parallel_trace(Heap *heap)
+{
+    Workers workers = {.heap = heap, .threads = config.gc_threads};
+    pthread_mutex_init(&workers.lock, NULL);
+    atomic_init(&workers.idle, 0);
+    workers.deques = config._malloc(workers.threads * sizeof(WorkDeque *));
+    for (uint32_t i = 0; i < workers.threads; i++)
+    {
+        workers.deques[i] = workdeque_new(MARK_DEQUE_CAPACITY);
+    }
+
+    // Deal the gray objects out to the workers before they start, whatever does not fit stays in the shared mark stack.
+    for (uint32_t i = 0; heap->mark_stack->length > 0; i = (i + 1) % workers.threads)
+    {
+        if (!workdeque_push(workers.deques[i], *(void **)stack_top(heap->mark_stack)))
+        {
+            break;
+        }
+        stack_pop(heap->mark_stack);
+    }
+    atomic_init(&workers.overflow, heap->mark_stack->length);
+
+    run_workers(&workers, mark_worker);
+
+    for (uint32_t i = 0; i < workers.threads; i++)
+    {
+        workdeque_free(workers.deques[i]);
+    }
+    config._free(workers.deques);
+    pthread_mutex_destroy(&workers.lock);
+}
+
+static void parallel_sweep(Heap *heap)
+{
+    Workers workers = {.heap = heap, .threads = config.gc_threads, .totals = {0}};
+    pthread_mutex_init(&workers.lock, NULL);
+    atomic_init(&workers.next_region, heap->sweep_region);
+
+    run_workers(&workers, sweep_worker);
+
+    pthread_mutex_destroy(&workers.lock);
+    add_sweep_totals(heap, &workers.totals);
+    heap->sweep_region = HEAP_REGIONS;
+    finish_sweep(heap);
+}
+
+// The snapshot of the marking is taken with an empty nursery, so the roots and the old generation hold every reference.
+static void start_marking(Heap *heap, HeapRootEnumerator roots, void *context)
+{
+    scavenge(heap, roots, context, true);
+    heap->stats.minor_collections++;
+
+    for (size_t i = 0; i < heap->roots->length; i++)
+    {
+        mark_slot(heap, ((void ***)heap->roots->elements)[i]);
+    }
+    roots(heap, mark_slot, context);
+
+    heap->marking = true;
+}
+
+// Perform one increment of the current cycle, a zero budget finishes the whole cycle and may use several threads.
+static void collect_increment(Heap *heap, size_t budget)
+{
+    bool parallel = budget == 0 && config.gc_threads > 1;
+    heap->increment_countdown = config.gc_increment_interval;
+
+    if (heap->marking)
+    {
+        uint64_t start = now_ns();
+        bool marked = true;
+        if (parallel)
+        {
+            parallel_trace(heap);
+        }
+        else
+        {
+            marked = trace(heap, budget);
+        }
+        heap->stats.mark_ns += now_ns() - start;
+
+        if (!marked)
+        {
+            return;
+        }
+
+        start_sweep(heap);
+
+        if (budget != 0)
+        {
+            return;
+        }
+    }
+
+    uint64_t start = now_ns();
+    if (parallel)
+    {
+        parallel_sweep(heap);
+    }
+    else
+    {
+        sweep(heap, budget);
+    }
+    heap->stats.sweep_ns += now_ns() - start;
+}
+
+static void record_pause(Heap *heap, uint64_t pause)
+{
+    heap->stats.last_pause_ns = pause;
+    heap->stats.total_pause_ns += pause;
+    if (pause > heap->stats.max_pause_ns)
+    {
+        heap->stats.max_pause_ns = pause;
+    }
+
+    // Bucket i counts the pauses shorter than 2^i but at least 2^(i-1) microseconds, the last bucket counts everything longer.
+    size_t bucket = 0;
+    for (uint64_t us = pause / 1000; us > 0 && bucket < HEAP_PAUSE_BUCKETS - 1; us >>= 1)
+    {
+        bucket++;
+    }
+    heap->stats.pause_histogram[bucket]++;
+}
+
+void heap_collect(Heap *heap, HeapRootEnumerator roots, void *context, bool full)
+{
+    if (heap->arena)
+    {
+        return;
+    }
+
+    uint64_t start = now_ns();
+
+    // Running over the heap limit calls for everything that can be freed to be freed.
+    full = full || heap->over_limit;
+
+    if (full)
+    {
+        // Finish the cycle in progress, the snapshot it took may be stale so a new cycle is run as well.
+        if (heap->marking || heap->sweeping)
+        {
+            collect_increment(heap, 0);
+        }
+        start_marking(heap, roots, context);
+        collect_increment(heap, 0);
+    }
+    else
+    {
+        // A collection only due to an increment leaves the nursery alone.
+        bool collecting = heap->marking || heap->sweeping;
+
+        if (heap->nursery_full || !collecting)
+        {
+            if (!collecting && config.gc_threshold != 0 && heap->old_bytes >= heap->next_collection)
+            {
+                start_marking(heap, roots, context);
+                collecting = true;
+            }
+            else
+            {
+                scavenge(heap, roots, context, false);
+                heap->stats.minor_collections++;
+            }
+        }
+
+        // A zero increment size finishes the cycle at once, which makes the collector stop-the-world again.
+        if (collecting)
+        {
+            collect_increment(heap, config.gc_increment_size);
+        }
+    }
+
+    if (heap->limit)
+    {
+        heap_check_limit(heap);
+    }
+
+    record_pause(heap, now_ns() - start);
+}
+
+size_t heap_live_bytes(Heap *heap)
+{
+    // In arena mode call frames are allocated in the arena too.
+    if (heap->arena)
+    {
+        return heap->arena->bytes_allocated;
+    }
+    return (size_t)(heap->nursery_top - heap->from_space) + heap->old_bytes + heap->external_bytes;
+}
+
+size_t heap_allocated_bytes(Heap *heap)
+{
+    return heap->stats.bytes_allocated + (size_t)(heap->nursery_top - heap->nursery_mark);
+}
+
+void heap_check_limit(Heap *heap)
+{
+    heap->over_limit = heap_live_bytes(heap) > heap->limit;
+}
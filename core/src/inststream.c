@@ -1,4 +1,5 @@
 #include "config.h"
+#include "pages.h"
 #include "inststream.h"
 
 InstructionStream *inststream_new(uint32_t length)
@@ -6,13 +7,35 @@ InstructionStream *inststream_new(uint32_t length)
     InstructionStream *inststream = (InstructionStream *)config._malloc(sizeof(InstructionStream));
     inststream->length = length;
     inststream->current = 0;
-    inststream->instructions = (Instruction *)config._malloc(length * sizeof(Instruction));
+    inststream->mapped = false;
+    // Only code that spans at least a huge page is worth backing with huge pages.
+    inststream->huge_pages = config.huge_pages && length * sizeof(Instruction) >= PAGES_HUGE_SIZE;
+    inststream->instructions = inststream->huge_pages ? pages_alloc(length * sizeof(Instruction)) : (Instruction *)config._malloc(length * sizeof(Instruction));
+    return inststream;
+}
+
+// The instructions are owned by the caller, typically a mapped program file.
+InstructionStream *inststream_new_mapped(Instruction *instructions, uint32_t length)
+{
+    InstructionStream *inststream = (InstructionStream *)config._malloc(sizeof(InstructionStream));
+    inststream->length = length;
+    inststream->current = 0;
+    inststream->huge_pages = false;
+    inststream->mapped = true;
+    inststream->instructions = instructions;
     return inststream;
 }
 
 void inststream_free(InstructionStream *inststream)
 {
-    config._free(inststream->instructions);
+    if (inststream->huge_pages)
+    {
+        pages_free(inststream->instructions, inststream->length * sizeof(Instruction));
+    }
+    else if (!inststream->mapped)
+    {
+        config._free(inststream->instructions);
+    }
     inststream->instructions = NULL;
     config._free(inststream);
 }
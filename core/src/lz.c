@@ -0,0 +1,260 @@
+#include <string.h>
+
+#include "lz.h"
+
+#define HASH_BITS 14
+#define MAX_OFFSET 65535
+
+// Sequences start with a token, the literal length in its upper half and the match length in its lower half. Lengths of
+// 15 or more continue in the following bytes, each adding up to 255.
+#define TOKEN_LENGTH_MAX 15
+
+static uint32_t load_uint32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(uint32_t));
+    return value;
+}
+
+static void store_uint32_little_endian(uint8_t *data, uint32_t value)
+{
+    data[0] = value;
+    data[1] = value >> 8;
+    data[2] = value >> 16;
+    data[3] = value >> 24;
+}
+
+static uint32_t hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *write_length(uint8_t *out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        *out++ = 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+static uint8_t *write_sequence(uint8_t *out, const uint8_t *literals, size_t literal_length, size_t match_length)
+{
+    uint8_t *token = out++;
+    *token = (literal_length < TOKEN_LENGTH_MAX ? literal_length : TOKEN_LENGTH_MAX) << 4;
+    if (literal_length >= TOKEN_LENGTH_MAX)
+    {
+        out = write_length(out, literal_length - TOKEN_LENGTH_MAX);
+    }
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+
+    if (match_length >= TOKEN_LENGTH_MAX)
+    {
+        *token |= TOKEN_LENGTH_MAX;
+    }
+    else
+    {
+        *token |= match_length;
+    }
+    return out;
+}
+
+// Greedy matching against the last position of every hashed 4-byte sequence. Returns 0 once the output would not be
+// smaller than the block, which is then stored.
+static size_t compress_block(const uint8_t *source, size_t size, uint8_t *destination)
+{
+    uint32_t table[1 << HASH_BITS] = {0};
+    uint8_t *out = destination;
+    uint8_t *limit = destination + size;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    while (i + LZ_MIN_MATCH <= size)
+    {
+        uint32_t sequence = load_uint32(source + i);
+        uint32_t *slot = &table[hash(sequence)];
+        size_t candidate = *slot;
+        *slot = i + 1;
+
+        if (candidate == 0 || load_uint32(source + candidate - 1) != sequence)
+        {
+            i++;
+            continue;
+        }
+        candidate--;
+
+        size_t length = LZ_MIN_MATCH;
+        while (i + length < size && source[candidate + length] == source[i + length])
+        {
+            length++;
+        }
+
+        // The token, the length bytes and the offset take at most this much besides the literals.
+        size_t literals = i - anchor;
+        if ((size_t)(limit - out) < literals + literals / 255 + (length - LZ_MIN_MATCH) / 255 + 8)
+        {
+            return 0;
+        }
+        out = write_sequence(out, source + anchor, literals, length - LZ_MIN_MATCH);
+        *out++ = (i - candidate) & 0xFF;
+        *out++ = (i - candidate) >> 8;
+        if (length - LZ_MIN_MATCH >= TOKEN_LENGTH_MAX)
+        {
+            out = write_length(out, length - LZ_MIN_MATCH - TOKEN_LENGTH_MAX);
+        }
+
+        i += length;
+        anchor = i;
+    }
+
+    // The last sequence only has literals, the end of the block tells it apart.
+    size_t literals = size - anchor;
+    if ((size_t)(limit - out) < literals + literals / 255 + 2)
+    {
+        return 0;
+    }
+    out = write_sequence(out, source + anchor, literals, 0);
+    return out - destination;
+}
+
+static bool read_length(const uint8_t **in, const uint8_t *end, size_t *length)
+{
+    uint8_t byte;
+    do
+    {
+        if (*in == end)
+        {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+static bool decompress_block(const uint8_t *in, size_t in_size, uint8_t *destination, size_t size)
+{
+    const uint8_t *end = in + in_size;
+    uint8_t *out = destination;
+    uint8_t *out_end = destination + size;
+
+    while (in < end)
+    {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (literals == TOKEN_LENGTH_MAX && !read_length(&in, end, &literals))
+        {
+            return false;
+        }
+        if (literals > (size_t)(end - in) || literals > (size_t)(out_end - out))
+        {
+            return false;
+        }
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+
+        if (in == end)
+        {
+            return out == out_end;
+        }
+
+        if (end - in < 2)
+        {
+            return false;
+        }
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t length = token & TOKEN_LENGTH_MAX;
+        if (length == TOKEN_LENGTH_MAX && !read_length(&in, end, &length))
+        {
+            return false;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - destination) || length > (size_t)(out_end - out))
+        {
+            return false;
+        }
+
+        // Overlapping matches repeat the bytes they have just written, so they are copied one byte at a time.
+        const uint8_t *match = out - offset;
+        if (offset >= length)
+        {
+            memcpy(out, match, length);
+            out += length;
+        }
+        else
+        {
+            for (size_t i = 0; i < length; i++)
+            {
+                *out++ = match[i];
+            }
+        }
+    }
+    return false;
+}
+
+size_t lz_bound(size_t size)
+{
+    return size + (size / LZ_BLOCK_SIZE + 1) * sizeof(uint32_t);
+}
+
+size_t lz_compress(const char *source, size_t size, char *destination)
+{
+    uint8_t *out = (uint8_t *)destination;
+    for (size_t offset = 0; offset < size; offset += LZ_BLOCK_SIZE)
+    {
+        size_t block = size - offset < LZ_BLOCK_SIZE ? size - offset : LZ_BLOCK_SIZE;
+        size_t compressed = compress_block((const uint8_t *)source + offset, block, out + sizeof(uint32_t));
+        if (compressed == 0)
+        {
+            memcpy(out + sizeof(uint32_t), source + offset, block);
+            store_uint32_little_endian(out, block | LZ_BLOCK_STORED);
+            compressed = block;
+        }
+        else
+        {
+            store_uint32_little_endian(out, compressed);
+        }
+        out += sizeof(uint32_t) + compressed;
+    }
+    return out - (uint8_t *)destination;
+}
+
+bool lz_decompress(const char *source, size_t source_size, char *destination, size_t size)
+{
+    const uint8_t *in = (const uint8_t *)source;
+    const uint8_t *end = in + source_size;
+    for (size_t offset = 0; offset < size; offset += LZ_BLOCK_SIZE)
+    {
+        size_t block = size - offset < LZ_BLOCK_SIZE ? size - offset : LZ_BLOCK_SIZE;
+        if ((size_t)(end - in) < sizeof(uint32_t))
+        {
+            return false;
+        }
+        uint32_t header = in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+        size_t compressed = header & ~LZ_BLOCK_STORED;
+        in += sizeof(uint32_t);
+        if (compressed > (size_t)(end - in))
+        {
+            return false;
+        }
+
+        if (header & LZ_BLOCK_STORED)
+        {
+            if (compressed != block)
+            {
+                return false;
+            }
+            memcpy(destination + offset, in, block);
+        }
+        else if (!decompress_block(in, compressed, (uint8_t *)destination + offset, block))
+        {
+            return false;
+        }
+        in += compressed;
+    }
+    return in == end;
+}
\ No newline at end of file
@@ -1,38 +1,94 @@
+#include <string.h>
+
 #include "config.h"
-#include "constantpool.h"
-#include "string_class.h"
-#include "string_builder_class.h"
 #include "object.h"
 
-void *object_new(uint32_t constpool_class, uint32_t fields_length)
+// Fields are untagged, so every object carries a bitmap after its fields that records which of them hold references.
+static uint8_t *reference_map(void *object)
 {
-    uint32_t *object = (uint32_t *)config._malloc(sizeof(uint32_t) + fields_length * sizeof(EvalStackElement));
-    *object = constpool_class;
+    ConstantPoolEntryClass *_class = ((Object *)object)->_class;
+
+    if (_class->field_offsets)
+    {
+        return (uint8_t *)object + _class->map_offset;
+    }
+    return (uint8_t *)&((Object *)object)->fields[heap_get_header(object)->fields];
+}
+
+void *object_new(Heap *heap, ConstantPoolEntryClass *_class)
+{
+    Object *object = heap_alloc(heap, _class->instance_size, _class->instance_fields);
+    object->_class = _class;
+    memset(reference_map(object), 0, (_class->instance_fields + 7) / 8);
     return object;
 }
 
-void object_free(void *object)
+void object_free(Heap *heap, void *object)
 {
-    switch (object_get_class(object))
-    {
-    case CONSTPOOL_CLASS_STRING:
-        string_free(object);
-        break;
-    case CONSTPOOL_CLASS_STRING_BUILDER:
-        string_builder_free(object);
-        break;
-    default:
-        config._free(object);
-        break;
-    }
+    // Objects do not own any memory outside the heap, so releasing the object itself is enough.
+    heap_release(heap, object);
 }
 
 uint32_t object_get_class(void *object)
 {
-    return *(uint32_t *)object;
+    return ((Object *)object)->_class->index;
+}
+
+ConstantPoolEntryClass *object_get_runtime_class(void *object)
+{
+    return ((Object *)object)->_class;
 }
 
 EvalStackElement *object_get_field(void *object, uint32_t index)
 {
-    return (EvalStackElement *)((char *)object + sizeof(uint32_t) + index * sizeof(EvalStackElement));
-}
\ No newline at end of file
+    // Packed fields are narrower than an EvalStackElement, only the member that matches their type may be accessed.
+    ConstantPoolEntryClass *_class = ((Object *)object)->_class;
+
+    if (_class->field_offsets)
+    {
+        return (EvalStackElement *)((char *)object + _class->field_offsets[index]);
+    }
+    return &((Object *)object)->fields[index];
+}
+
+void object_set_field(Heap *heap, void *object, uint32_t index, EvalStackElement value, bool reference)
+{
+    ConstantPoolEntryClass *_class = ((Object *)object)->_class;
+
+    // Integer and boolean fields never hold references, so they need neither barriers nor the reference map.
+    if (_class->field_offsets && _class->field_types[index] != FIELD_TYPE_ANY)
+    {
+        char *field = (char *)object + _class->field_offsets[index];
+        if (_class->field_types[index] == FIELD_TYPE_INT)
+        {
+            *(int32_t *)field = value.integer;
+        }
+        else
+        {
+            *(uint8_t *)field = value.integer != 0;
+        }
+        return;
+    }
+
+    if (object_is_reference(object, index))
+    {
+        heap_deletion_barrier(heap, object_get_field(object, index)->pointer);
+    }
+
+    *object_get_field(object, index) = value;
+
+    if (reference)
+    {
+        reference_map(object)[index / 8] |= 1 << (index % 8);
+        heap_write_barrier(heap, object, value.pointer);
+    }
+    else
+    {
+        reference_map(object)[index / 8] &= ~(1 << (index % 8));
+    }
+}
+
+bool object_is_reference(void *object, uint32_t index)
+{
+    return reference_map(object)[index / 8] & (1 << (index % 8));
+}
@@ -0,0 +1,84 @@
+#include "config.h"
+#include "pages.h"
+#include "pagepool.h"
+
+// The head of the free list packs a page index (plus one, zero means empty) with a tag that changes on every update,
+// so that a page that is taken and given back between the load and the compare-and-swap is noticed.
+#define HEAD_INDEX(head) ((uint32_t)(head))
+#define HEAD(tag, index) (((uint_least64_t)(tag) << 32) | (index))
+
+PagePool *pagepool_new(size_t page_size, size_t capacity)
+{
+    PagePool *pool = (PagePool *)config._malloc(sizeof(PagePool));
+    pool->page_size = (page_size + 7) & ~(size_t)7;
+    pool->capacity = capacity < UINT32_MAX ? capacity : UINT32_MAX - 1;
+    pool->huge_pages = config.huge_pages;
+    pool->pages = pool->huge_pages ? pages_alloc(pool->capacity * pool->page_size) : config._malloc(pool->capacity * pool->page_size);
+    pool->next = config._malloc(pool->capacity * sizeof(_Atomic uint32_t));
+    atomic_init(&pool->cursor, 0);
+    atomic_init(&pool->free_head, 0);
+    atomic_init(&pool->pages_in_use, 0);
+    return pool;
+}
+
+void pagepool_free(PagePool *pool)
+{
+    config._free((void *)pool->next);
+    pool->next = NULL;
+    if (pool->huge_pages)
+    {
+        pages_free(pool->pages, pool->capacity * pool->page_size);
+    }
+    else
+    {
+        config._free(pool->pages);
+    }
+    pool->pages = NULL;
+    config._free(pool);
+}
+
+void *pagepool_get(PagePool *pool)
+{
+    uint_least64_t head = atomic_load_explicit(&pool->free_head, memory_order_acquire);
+
+    // Reuse a page that was given back before handing out one that has never been used.
+    while (HEAD_INDEX(head) != 0)
+    {
+        uint32_t index = HEAD_INDEX(head) - 1;
+        uint32_t next = atomic_load_explicit(&pool->next[index], memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&pool->free_head, &head, HEAD((head >> 32) + 1, next), memory_order_acquire, memory_order_acquire))
+        {
+            atomic_fetch_add_explicit(&pool->pages_in_use, 1, memory_order_relaxed);
+            return pool->pages + index * pool->page_size;
+        }
+    }
+
+    size_t index = atomic_fetch_add_explicit(&pool->cursor, 1, memory_order_relaxed);
+    if (index >= pool->capacity)
+    {
+        // The pool is exhausted, the cursor is put back so that it cannot overflow.
+        atomic_fetch_sub_explicit(&pool->cursor, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    atomic_fetch_add_explicit(&pool->pages_in_use, 1, memory_order_relaxed);
+    return pool->pages + index * pool->page_size;
+}
+
+void pagepool_put(PagePool *pool, void *page)
+{
+    uint32_t index = (uint32_t)(((char *)page - pool->pages) / pool->page_size);
+    uint_least64_t head = atomic_load_explicit(&pool->free_head, memory_order_relaxed);
+
+    do
+    {
+        atomic_store_explicit(&pool->next[index], HEAD_INDEX(head), memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &head, HEAD((head >> 32) + 1, index + 1), memory_order_release, memory_order_relaxed));
+
+    atomic_fetch_sub_explicit(&pool->pages_in_use, 1, memory_order_relaxed);
+}
+
+bool pagepool_contains(PagePool *pool, void *block)
+{
+    return (char *)block >= pool->pages && (char *)block < pool->pages + pool->capacity * pool->page_size;
+}
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "pages.h"
+
+static atomic_size_t hugetlb_bytes;
+static atomic_size_t advised_bytes;
+
+static size_t round_up(size_t size)
+{
+    return (size + PAGES_HUGE_SIZE - 1) & ~(size_t)(PAGES_HUGE_SIZE - 1);
+}
+
+void *pages_alloc(size_t size)
+{
+    size = round_up(size);
+
+#ifdef MAP_HUGETLB
+    // Reserved huge pages are only available if the administrator set some aside, otherwise this fails right away.
+    void *pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pages != MAP_FAILED)
+    {
+        atomic_fetch_add_explicit(&hugetlb_bytes, size, memory_order_relaxed);
+        return pages;
+    }
+#endif
+
+    // Transparent huge pages need a 2 MB aligned range, so one huge page more is mapped and the ends are trimmed off.
+    char *mapping = mmap(NULL, size + PAGES_HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    char *aligned = (char *)round_up((uintptr_t)mapping);
+    if (aligned > mapping)
+    {
+        munmap(mapping, aligned - mapping);
+    }
+    munmap(aligned + size, mapping + PAGES_HUGE_SIZE - aligned);
+
+    pages_advise(aligned, size);
+    return aligned;
+}
+
+void pages_free(void *pages, size_t size)
+{
+    munmap(pages, round_up(size));
+}
+
+void pages_advise(void *pages, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    // Fails harmlessly when transparent huge pages are disabled, the range then keeps using regular pages.
+    if (madvise(pages, size, MADV_HUGEPAGE) == 0)
+    {
+        atomic_fetch_add_explicit(&advised_bytes, size, memory_order_relaxed);
+    }
+#endif
+}
+
+PagesStats pages_stats()
+{
+    return (PagesStats){.hugetlb_bytes = atomic_load_explicit(&hugetlb_bytes, memory_order_relaxed),
+                        .advised_bytes = atomic_load_explicit(&advised_bytes, memory_order_relaxed)};
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "parallel.h"
+
+typedef struct
+{
+    size_t count;
+    size_t chunk;
+    ParallelBody body;
+    void *context;
+    atomic_size_t next;
+} ParallelLoop;
+
+static void *run_chunks(void *argument)
+{
+    ParallelLoop *loop = argument;
+    for (size_t start = atomic_fetch_add(&loop->next, loop->chunk); start < loop->count; start = atomic_fetch_add(&loop->next, loop->chunk))
+    {
+        loop->body(loop->context, start, start + loop->chunk < loop->count ? start + loop->chunk : loop->count);
+    }
+    return NULL;
+}
+
+void parallel_for(uint32_t threads, size_t count, size_t chunk, ParallelBody body, void *context)
+{
+    ParallelLoop loop = {.count = count, .chunk = chunk, .body = body, .context = context};
+    atomic_init(&loop.next, 0);
+
+    size_t chunks = (count + chunk - 1) / chunk;
+    uint32_t helpers = threads > chunks ? (uint32_t)chunks : threads;
+    if (helpers <= 1)
+    {
+        run_chunks(&loop);
+        return;
+    }
+
+    pthread_t *ids = config._malloc(helpers * sizeof(pthread_t));
+    for (uint32_t i = 1; i < helpers; i++)
+    {
+        pthread_create(&ids[i], NULL, run_chunks, &loop);
+    }
+    run_chunks(&loop);
+    for (uint32_t i = 1; i < helpers; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    config._free(ids);
+}
\ No newline at end of file
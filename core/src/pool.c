@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "pool.h"
+
+// Every block starts with an 8 byte prefix that holds its size class, so that freeing a block does not need a lookup.
+#define PREFIX_SIZE 8
+#define LARGE_BLOCK UINT32_MAX
+
+typedef struct PoolPage
+{
+    struct PoolPage *next;
+} PoolPage;
+
+const uint32_t pool_class_sizes[POOL_SIZE_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1536, 2048, 3072, 4096};
+
+PoolStats pool_stats = {0};
+
+static uint8_t class_lookup[POOL_MAX_BLOCK_SIZE / 16 + 1];
+static bool class_lookup_ready = false;
+
+static void *free_lists[POOL_SIZE_CLASSES];
+static char *bump[POOL_SIZE_CLASSES];
+static char *bump_limit[POOL_SIZE_CLASSES];
+static PoolPage *pages = NULL;
+
+static uint32_t size_class(size_t total)
+{
+    // Sizes are looked up in 16 byte steps, every class size is a multiple of 16.
+    if (!class_lookup_ready)
+    {
+        uint32_t class = 0;
+        for (size_t i = 0; i <= POOL_MAX_BLOCK_SIZE / 16; i++)
+        {
+            while (pool_class_sizes[class] < i * 16)
+            {
+                class++;
+            }
+            class_lookup[i] = (uint8_t)class;
+        }
+        class_lookup_ready = true;
+    }
+
+    return class_lookup[(total + 15) / 16];
+}
+
+// Slab pages are carved up lazily, a new page only gives the size class that ran out a fresh range to bump allocate from.
+static bool new_page(uint32_t class)
+{
+    PoolPage *page = malloc(POOL_PAGE_SIZE);
+    if (!page)
+    {
+        return false;
+    }
+    page->next = pages;
+    pages = page;
+    pool_stats.pages++;
+
+    bump[class] = (char *)(page + 1);
+    bump_limit[class] = (char *)page + POOL_PAGE_SIZE;
+    return true;
+}
+
+static uint32_t *prefix(void *block)
+{
+    return (uint32_t *)((char *)block - PREFIX_SIZE);
+}
+
+void *pool_malloc(size_t size)
+{
+    size_t total = size + PREFIX_SIZE;
+
+    if (total > POOL_MAX_BLOCK_SIZE)
+    {
+        uint32_t *large = malloc(total);
+        if (!large)
+        {
+            return NULL;
+        }
+        *large = LARGE_BLOCK;
+        pool_stats.large_allocations++;
+        return (char *)large + PREFIX_SIZE;
+    }
+
+    uint32_t class = size_class(total);
+    char *block = free_lists[class];
+
+    if (block)
+    {
+        free_lists[class] = *(void **)(block + PREFIX_SIZE);
+    }
+    else
+    {
+        if ((size_t)(bump_limit[class] - bump[class]) < pool_class_sizes[class] && !new_page(class))
+        {
+            return NULL;
+        }
+        block = bump[class];
+        bump[class] += pool_class_sizes[class];
+    }
+
+    *(uint32_t *)block = class;
+    pool_stats.classes[class].allocations++;
+    pool_stats.classes[class].live_blocks++;
+    pool_stats.bytes_in_use += pool_class_sizes[class];
+    return block + PREFIX_SIZE;
+}
+
+void *pool_calloc(size_t nitems, size_t size)
+{
+    void *block = pool_malloc(nitems * size);
+    if (block)
+    {
+        memset(block, 0, nitems * size);
+    }
+    return block;
+}
+
+void *pool_realloc(void *block, size_t size)
+{
+    if (!block)
+    {
+        return pool_malloc(size);
+    }
+
+    uint32_t class = *prefix(block);
+
+    // Large blocks stay large, the system allocator does not need to know their size to resize them.
+    if (class == LARGE_BLOCK && size + PREFIX_SIZE > POOL_MAX_BLOCK_SIZE)
+    {
+        uint32_t *large = realloc(prefix(block), size + PREFIX_SIZE);
+        return large ? (char *)large + PREFIX_SIZE : NULL;
+    }
+
+    if (class != LARGE_BLOCK && size + PREFIX_SIZE <= POOL_MAX_BLOCK_SIZE && size_class(size + PREFIX_SIZE) == class)
+    {
+        return block;
+    }
+
+    void *new_block = pool_malloc(size);
+    if (new_block)
+    {
+        // The usable size of a large block is unknown, but it is larger than any pooled block it is moved to.
+        size_t old_size = class == LARGE_BLOCK ? size : pool_class_sizes[class] - PREFIX_SIZE;
+        memcpy(new_block, block, old_size < size ? old_size : size);
+        pool_free(block);
+    }
+    return new_block;
+}
+
+void pool_free(void *block)
+{
+    if (!block)
+    {
+        return;
+    }
+
+    uint32_t class = *prefix(block);
+
+    if (class == LARGE_BLOCK)
+    {
+        pool_stats.large_frees++;
+        free(prefix(block));
+        return;
+    }
+
+    // The link of the free list is kept in the payload, which is at least 8 bytes large.
+    *(void **)block = free_lists[class];
+    free_lists[class] = prefix(block);
+    pool_stats.classes[class].frees++;
+    pool_stats.classes[class].live_blocks--;
+    pool_stats.bytes_in_use -= pool_class_sizes[class];
+}
+
+void pool_release()
+{
+    // Every pooled block must have been freed, since the pages that hold them are returned to the system.
+    while (pages)
+    {
+        PoolPage *page = pages;
+        pages = page->next;
+        free(page);
+    }
+
+    for (uint32_t i = 0; i < POOL_SIZE_CLASSES; i++)
+    {
+        free_lists[i] = NULL;
+        bump[i] = NULL;
+        bump_limit[i] = NULL;
+    }
+    pool_stats = (PoolStats){0};
+}
@@ -0,0 +1,536 @@
+#include <string.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "object.h"
+#include "string_class.h"
+#include "binary_format.h"
+#include "snapshot.h"
+
+// References to constant strings are tagged, objects in the snapshot are 8-byte aligned so their offsets never are.
+#define REFERENCE_CONSTANT 0x1
+#define REFERENCE_TAG_MASK 0x7
+#define REFERENCE_TAG_BITS 3
+
+// Maps the objects that have been given a place in the snapshot to the reference that stands for them.
+typedef struct
+{
+    void **keys;
+    uint64_t *values;
+    size_t capacity;
+    size_t length;
+} ObjectTable;
+
+typedef struct
+{
+    ObjectTable table;
+    Stack *objects;
+    uint64_t objects_size;
+    bool failed;
+} SnapshotWriter;
+
+// Objects are stored as they are laid out in memory, so the snapshot is tied to the object layout and the byte order.
+static uint32_t snapshot_abi()
+{
+    uint32_t one = 1;
+    return (uint32_t)sizeof(ObjectHeader) << 24 | (uint32_t)sizeof(Object) << 16 | (uint32_t)sizeof(EvalStackElement) << 8 | (uint32_t)offsetof(String, value) << 1 |
+           *(uint8_t *)&one;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ ((const uint8_t *)data)[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+static uint64_t hash_uint32(uint64_t hash, uint32_t value)
+{
+    return hash_bytes(hash, &value, sizeof(uint32_t));
+}
+
+static uint64_t hash_string(uint64_t hash, const char *string)
+{
+    return hash_bytes(hash, string, strlen(string) + 1);
+}
+
+uint64_t snapshot_program_checksum(ConstantPool *constpool, InstructionStream *inststream)
+{
+    // The layouts are part of the checksum since the objects in a snapshot are stored in them.
+    uint64_t hash = hash_uint32(0xcbf29ce484222325, constpool->length);
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        hash = hash_uint32(hash, entry->type);
+
+        switch (entry->type)
+        {
+        case TYPE_CLASS:
+            // Classes of a lazy constant pool get their instance size when they are linked.
+            constantpool_link_class(constpool, &entry->data._class);
+            hash = hash_string(hash, entry->data._class.name);
+            hash = hash_uint32(hash, entry->data._class.parent);
+            hash = hash_uint32(hash, entry->data._class.fields);
+            hash = hash_uint32(hash, entry->data._class.methods);
+            hash = hash_uint32(hash, entry->data._class.instance_fields);
+            hash = hash_uint32(hash, entry->data._class.instance_size);
+            break;
+        case TYPE_FIELD:
+            hash = hash_string(hash, entry->data.field.name);
+            hash = hash_uint32(hash, entry->data.field._class);
+            hash = hash_uint32(hash, entry->data.field.index);
+            hash = hash_uint32(hash, entry->data.field.offset);
+            break;
+        case TYPE_METHOD:
+            hash = hash_string(hash, entry->data.method.name);
+            hash = hash_uint32(hash, entry->data.method._class);
+            hash = hash_uint32(hash, entry->data.method.address);
+            hash = hash_uint32(hash, entry->data.method.args);
+            hash = hash_uint32(hash, entry->data.method.locals);
+            break;
+        case TYPE_STRING:
+            hash = hash_string(hash, entry->data.string.value);
+            break;
+        }
+    }
+
+    hash = hash_uint32(hash, inststream->length);
+    for (size_t i = 0; i < inststream->length; i++)
+    {
+        hash = hash_uint32(hash, inststream->instructions[i].opcode);
+        hash = hash_uint32(hash, inststream->instructions[i].operand);
+    }
+    return hash;
+}
+
+static size_t table_slot(ObjectTable *table, void *key)
+{
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15) >> 32) & (table->capacity - 1);
+
+    while (table->keys[slot] && table->keys[slot] != key)
+    {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return slot;
+}
+
+static void table_insert(ObjectTable *table, void *key, uint64_t value)
+{
+    // Keep the table at most half full so that probe sequences stay short.
+    if (2 * (table->length + 1) > table->capacity)
+    {
+        ObjectTable grown = {.capacity = 2 * table->capacity, .length = table->length};
+        grown.keys = config._calloc(grown.capacity, sizeof(void *));
+        grown.values = config._malloc(grown.capacity * sizeof(uint64_t));
+        for (size_t i = 0; i < table->capacity; i++)
+        {
+            if (table->keys[i])
+            {
+                size_t slot = table_slot(&grown, table->keys[i]);
+                grown.keys[slot] = table->keys[i];
+                grown.values[slot] = table->values[i];
+            }
+        }
+        config._free(table->keys);
+        config._free(table->values);
+        *table = grown;
+    }
+
+    size_t slot = table_slot(table, key);
+    table->keys[slot] = key;
+    table->values[slot] = value;
+    table->length++;
+}
+
+// Returns the reference that stands for the object in the snapshot, objects seen for the first time are placed after the others.
+static uint64_t writer_reference(SnapshotWriter *writer, void *object)
+{
+    if (!object)
+    {
+        return 0;
+    }
+
+    size_t slot = table_slot(&writer->table, object);
+    if (writer->table.keys[slot])
+    {
+        return writer->table.values[slot];
+    }
+
+    // Constant strings are the only immortal objects a program can reach and are entered in the table up front.
+    ObjectHeader *header = heap_get_header(object);
+    if (header->flags & OBJECT_FLAG_IMMORTAL)
+    {
+        writer->failed = true;
+        return 0;
+    }
+
+    uint64_t reference = writer->objects_size + sizeof(ObjectHeader);
+    writer->objects_size += header->size;
+    stack_push(writer->objects, &object);
+    table_insert(&writer->table, object, reference);
+    return reference;
+}
+
+static void writer_visit_fields(SnapshotWriter *writer, void *object, char *copy)
+{
+    for (uint32_t i = 0; i < heap_get_header(object)->fields; i++)
+    {
+        if (object_is_reference(object, i))
+        {
+            EvalStackElement *field = object_get_field(object, i);
+            uint64_t reference = writer_reference(writer, field->pointer);
+            if (copy)
+            {
+                memcpy(copy + ((char *)field - (char *)object), &reference, sizeof(uint64_t));
+            }
+        }
+    }
+}
+
+static void write_values(SnapshotWriter *writer, FILE *file, EvalStackElement *values, bool *refs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        EvalStackElement value = values[i];
+        if (refs[i])
+        {
+            value.pointer = (void *)(uintptr_t)writer_reference(writer, value.pointer);
+        }
+        fwrite(&value, sizeof(EvalStackElement), 1, file);
+    }
+
+    uint8_t padding[8] = {0};
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t reference = refs[i];
+        fwrite(&reference, sizeof(uint8_t), 1, file);
+    }
+    fwrite(padding, (8 - count % 8) % 8, 1, file);
+}
+
+bool snapshot_write(Executor *executor, FILE *file)
+{
+    SnapshotWriter writer = {.table = {.capacity = 1024, .length = 0}, .objects = stack_new(sizeof(void *)), .objects_size = 0, .failed = false};
+    writer.table.keys = config._calloc(writer.table.capacity, sizeof(void *));
+    writer.table.values = config._malloc(writer.table.capacity * sizeof(uint64_t));
+    ConstantPool *constpool = executor->constpool;
+
+    for (uint32_t i = 1; i <= constpool->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(constpool, i);
+        if (entry->type == TYPE_STRING && entry->data.string.object)
+        {
+            table_insert(&writer.table, entry->data.string.object, (uint64_t)i << REFERENCE_TAG_BITS | REFERENCE_CONSTANT);
+        }
+    }
+
+    // Give every reachable object its place breadth first, the list of placed objects doubles as the queue.
+    EvalStackElement *elements = executor->evalstack->elements;
+    bool *refs = executor->evalrefs->elements;
+    for (size_t i = 0; i < executor->evalstack->length; i++)
+    {
+        if (refs[i])
+        {
+            writer_reference(&writer, elements[i].pointer);
+        }
+    }
+    CallStackFrame *frames = executor->callstack->elements;
+    for (size_t i = 0; i < executor->callstack->length; i++)
+    {
+        for (size_t j = 0; j < frames[i].vars_count; j++)
+        {
+            if (frames[i].refs[j])
+            {
+                writer_reference(&writer, frames[i].vars[j].pointer);
+            }
+        }
+    }
+    for (size_t i = 0; i < writer.objects->length; i++)
+    {
+        writer_visit_fields(&writer, ((void **)writer.objects->elements)[i], NULL);
+    }
+
+    if (!writer.failed)
+    {
+        SnapshotHeader header = {.magic = SNAPSHOT_MAGIC,
+                                 .abi = snapshot_abi(),
+                                 .program = snapshot_program_checksum(constpool, executor->inststream),
+                                 .objects_size = writer.objects_size,
+                                 .current = executor->inststream->current,
+                                 .evalstack = executor->evalstack->length,
+                                 .frames = executor->callstack->length,
+                                 .reserved = 0};
+        fwrite(&header, sizeof(SnapshotHeader), 1, file);
+
+        char *copy = NULL;
+        size_t copy_capacity = 0;
+        for (size_t i = 0; i < writer.objects->length; i++)
+        {
+            void *object = ((void **)writer.objects->elements)[i];
+            ObjectHeader *object_header = heap_get_header(object);
+            if (object_header->size > copy_capacity)
+            {
+                copy_capacity = object_header->size;
+                copy = config._realloc(copy, copy_capacity);
+            }
+
+            // The collector's flags mean nothing to the process that restores the object.
+            *(ObjectHeader *)copy = (ObjectHeader){.size = object_header->size, .fields = object_header->fields, .flags = 0, .age = 0};
+            memcpy(copy + sizeof(ObjectHeader), object, object_header->size - sizeof(ObjectHeader));
+            uint64_t class_index = ((Object *)object)->_class->index;
+            memcpy(copy + sizeof(ObjectHeader), &class_index, sizeof(uint64_t));
+            writer_visit_fields(&writer, object, copy + sizeof(ObjectHeader));
+            fwrite(copy, object_header->size, 1, file);
+        }
+        config._free(copy);
+
+        write_values(&writer, file, elements, refs, executor->evalstack->length);
+        for (size_t i = 0; i < executor->callstack->length; i++)
+        {
+            SnapshotFrame frame = {.vars_count = frames[i].vars_count, .return_address = frames[i].return_address, .reserved = 0};
+            fwrite(&frame, sizeof(SnapshotFrame), 1, file);
+            write_values(&writer, file, frames[i].vars, frames[i].refs, frames[i].vars_count);
+        }
+    }
+
+    config._free(writer.table.keys);
+    config._free(writer.table.values);
+    stack_free(writer.objects);
+    return !writer.failed && !ferror(file);
+}
+
+typedef struct
+{
+    Executor *executor;
+    char *objects;
+    uint64_t objects_size;
+    uint8_t *starts;
+} SnapshotReader;
+
+static ConstantPoolEntryClass *find_class(ConstantPool *constpool, uint64_t index)
+{
+    if (index > UINT32_MAX || index == 0 || (index > constpool->length && index < CONSTPOOL_CLASS_STRING))
+    {
+        return NULL;
+    }
+
+    ConstantPoolEntry *entry = constantpool_get(constpool, index);
+    return entry->type == TYPE_CLASS ? &entry->data._class : NULL;
+}
+
+// Every restored object has left its new address in the class pointer of its copy in the mapping.
+static bool reader_resolve(SnapshotReader *reader, uint64_t reference, void **pointer)
+{
+    ConstantPool *constpool = reader->executor->constpool;
+
+    if (reference == 0)
+    {
+        *pointer = NULL;
+        return true;
+    }
+
+    if ((reference & REFERENCE_TAG_MASK) == REFERENCE_CONSTANT)
+    {
+        uint64_t index = reference >> REFERENCE_TAG_BITS;
+        if (index == 0 || index > constpool->length || constantpool_get(constpool, index)->type != TYPE_STRING)
+        {
+            return false;
+        }
+        *pointer = constantpool_get(constpool, index)->data.string.object;
+        return *pointer != NULL;
+    }
+
+    if ((reference & REFERENCE_TAG_MASK) != 0 || reference >= reader->objects_size || !(reader->starts[reference / 64] & (1 << (reference / 8 % 8))))
+    {
+        return false;
+    }
+    memcpy(pointer, reader->objects + reference, sizeof(void *));
+    return true;
+}
+
+// Allocates a copy of every object in the heap and leaves its address behind in the mapping, which is copy-on-write.
+static bool restore_objects(SnapshotReader *reader)
+{
+    Heap *heap = reader->executor->heap;
+    uint64_t offset = 0;
+
+    while (offset < reader->objects_size)
+    {
+        ObjectHeader header;
+        uint64_t class_index;
+        memcpy(&header, reader->objects + offset, sizeof(ObjectHeader));
+        if (header.size < sizeof(ObjectHeader) + sizeof(Object) || header.size % 8 != 0 || header.size > reader->objects_size - offset)
+        {
+            return false;
+        }
+        char *record = reader->objects + offset + sizeof(ObjectHeader);
+        memcpy(&class_index, record, sizeof(uint64_t));
+
+        ConstantPoolEntryClass *_class = find_class(reader->executor->constpool, class_index);
+        size_t size = header.size - sizeof(ObjectHeader);
+        if (!_class)
+        {
+            return false;
+        }
+        if (_class == &class_string_entry.data._class)
+        {
+            uint32_t length;
+            memcpy(&length, record + offsetof(String, length), sizeof(uint32_t));
+            if (header.fields != 0 || size < offsetof(String, value) || length >= size - offsetof(String, value))
+            {
+                return false;
+            }
+        }
+        else if (header.fields != _class->instance_fields || size < _class->instance_size)
+        {
+            return false;
+        }
+
+        Object *object = heap_alloc_old(heap, size, header.fields);
+        memcpy(object, record, size);
+        object->_class = _class;
+        memcpy(record, &object, sizeof(void *));
+        reader->starts[(offset + sizeof(ObjectHeader)) / 64] |= 1 << ((offset + sizeof(ObjectHeader)) / 8 % 8);
+        offset += header.size;
+    }
+    return true;
+}
+
+// Restored objects are old and only point to each other or to constant strings, so they need no write barriers.
+static bool fix_references(SnapshotReader *reader)
+{
+    for (uint64_t offset = 0; offset < reader->objects_size;)
+    {
+        ObjectHeader header;
+        void *object;
+        memcpy(&header, reader->objects + offset, sizeof(ObjectHeader));
+        memcpy(&object, reader->objects + offset + sizeof(ObjectHeader), sizeof(void *));
+
+        for (uint32_t i = 0; i < header.fields; i++)
+        {
+            if (object_is_reference(object, i))
+            {
+                EvalStackElement *field = object_get_field(object, i);
+                if (!reader_resolve(reader, (uint64_t)(uintptr_t)field->pointer, &field->pointer))
+                {
+                    return false;
+                }
+            }
+        }
+        offset += header.size;
+    }
+    return true;
+}
+
+// Reads count values followed by their reference tags, returns the position after them or NULL if they do not fit.
+static char *restore_values(SnapshotReader *reader, char *data, char *end, EvalStackElement *values, bool *refs, size_t count)
+{
+    size_t size = count * sizeof(EvalStackElement) + (count + 7) / 8 * 8;
+    if (count > (size_t)(end - data) / sizeof(EvalStackElement) || size > (size_t)(end - data))
+    {
+        return NULL;
+    }
+
+    uint8_t *tags = (uint8_t *)data + count * sizeof(EvalStackElement);
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(&values[i], data + i * sizeof(EvalStackElement), sizeof(EvalStackElement));
+        refs[i] = tags[i] != 0;
+        if (refs[i] && !reader_resolve(reader, (uint64_t)(uintptr_t)values[i].pointer, &values[i].pointer))
+        {
+            return NULL;
+        }
+    }
+    return data + size;
+}
+
+static uint32_t restore(Executor *executor, char *data, size_t size)
+{
+    SnapshotHeader header;
+
+    if (size < sizeof(SnapshotHeader))
+    {
+        return SNAPSHOT_INVALID;
+    }
+    memcpy(&header, data, sizeof(SnapshotHeader));
+    if (header.magic != SNAPSHOT_MAGIC || header.abi != snapshot_abi() || header.objects_size % 8 != 0 || header.objects_size > size - sizeof(SnapshotHeader))
+    {
+        return SNAPSHOT_INVALID;
+    }
+    if (header.program != snapshot_program_checksum(executor->constpool, executor->inststream))
+    {
+        return SNAPSHOT_WRONG_PROGRAM;
+    }
+    // The stacks of the executor cannot grow, pushing past their capacity would fault.
+    if (header.current >= executor->inststream->length || header.evalstack > executor->evalstack->capacity || header.frames > executor->callstack->capacity)
+    {
+        return SNAPSHOT_INVALID;
+    }
+
+    SnapshotReader reader = {.executor = executor,
+                             .objects = data + sizeof(SnapshotHeader),
+                             .objects_size = header.objects_size,
+                             .starts = config._calloc(header.objects_size / 64 + 1, sizeof(uint8_t))};
+    char *end = data + size;
+    char *position = reader.objects + header.objects_size;
+    bool restored = false;
+
+    executor_reset(executor);
+
+    if (restore_objects(&reader) && fix_references(&reader))
+    {
+        Stack *evalstack = executor->evalstack;
+        position = restore_values(&reader, position, end, evalstack->elements, executor->evalrefs->elements, header.evalstack);
+        evalstack->length = header.evalstack;
+        executor->evalrefs->length = header.evalstack;
+
+        for (uint32_t i = 0; position && i < header.frames; i++)
+        {
+            SnapshotFrame frame;
+            if ((size_t)(end - position) < sizeof(SnapshotFrame))
+            {
+                position = NULL;
+                break;
+            }
+            memcpy(&frame, position, sizeof(SnapshotFrame));
+            position += sizeof(SnapshotFrame);
+            if (frame.vars_count > (size_t)(end - position) / sizeof(EvalStackElement) || frame.return_address > executor->inststream->length)
+            {
+                position = NULL;
+                break;
+            }
+            CallStackFrame *restored_frame = executor_push_frame(executor, frame.vars_count, frame.return_address);
+            position = restore_values(&reader, position, end, restored_frame->vars, restored_frame->refs, frame.vars_count);
+        }
+        restored = position != NULL;
+    }
+    config._free(reader.starts);
+
+    if (!restored)
+    {
+        executor_reset(executor);
+        return SNAPSHOT_INVALID;
+    }
+
+    // Everything that was restored is live, so the next collection is scheduled as if one had just finished.
+    heap_reschedule(executor->heap);
+    executor->inststream->current = header.current;
+    return SNAPSHOT_OK;
+}
+
+uint32_t snapshot_restore(Executor *executor, const char *filename)
+{
+    MappedFile *file = binform_map_file(filename);
+
+    if (!file)
+    {
+        return SNAPSHOT_CANNOT_OPEN;
+    }
+
+    uint32_t result = restore(executor, file->data, file->size);
+    binform_unmap_file(file);
+    return result;
+}
\ No newline at end of file
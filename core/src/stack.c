@@ -1,6 +1,9 @@
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "config.h"
+#include "pages.h"
 #include "stack.h"
 
 static void resize(Stack *stack, size_t new_capacity)
@@ -21,19 +24,64 @@ Stack *stack_new(size_t elemsize)
     stack->length = 0;
     stack->elemsize = elemsize;
     stack->elements = config._malloc(config.min_stack_capacity * elemsize);
+    stack->mapping = NULL;
+    stack->mapping_size = 0;
     return stack;
 }
 
+Stack *stack_new_reserved(size_t elemsize, size_t max_length)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t usable = (max_length * elemsize + page_size - 1) & ~(page_size - 1);
+
+    // Pages are only backed by memory once they are touched, so a deep stack costs address space until it is used.
+    char *mapping = mmap(NULL, usable + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+    mprotect(mapping + usable, page_size, PROT_NONE);
+    if (config.huge_pages)
+    {
+        pages_advise(mapping, usable);
+    }
+
+    Stack *stack = (Stack *)config._malloc(sizeof(Stack));
+    stack->capacity = max_length;
+    stack->length = 0;
+    stack->elemsize = elemsize;
+    // The elements end right at the guard page, so pushing one element too many is the first write to touch it.
+    stack->elements = mapping + usable - max_length * elemsize;
+    stack->mapping = mapping;
+    stack->mapping_size = usable + page_size;
+    return stack;
+}
+
+bool stack_in_guard(Stack *stack, void *address)
+{
+    char *guard = (char *)stack->elements + stack->capacity * stack->elemsize;
+    return stack->mapping && (char *)address >= guard && (char *)address < stack->mapping + stack->mapping_size;
+}
+
 void stack_free(Stack *stack)
 {
-    config._free(stack->elements);
+    if (stack->mapping)
+    {
+        munmap(stack->mapping, stack->mapping_size);
+        stack->mapping = NULL;
+    }
+    else
+    {
+        config._free(stack->elements);
+    }
     stack->elements = NULL;
     config._free(stack);
 }
 
 void stack_push(Stack *stack, void *element)
 {
-    if (stack->length == stack->capacity)
+    // Reserved stacks are never resized, they rely on the guard page instead of a bounds check.
+    if (!stack->mapping && stack->length == stack->capacity)
     {
         resize(stack, stack->capacity * 2);
     }
@@ -52,8 +100,8 @@ void stack_pop(Stack *stack)
 {
     stack->length--;
 
-    if (stack->length > 0 && stack->length >= config.min_stack_capacity / 2 && stack->length == stack->capacity / 4)
+    if (!stack->mapping && stack->length > 0 && stack->length >= config.min_stack_capacity / 2 && stack->length == stack->capacity / 4)
     {
         resize(stack, stack->capacity / 2);
     }
-}
+}
\ No newline at end of file
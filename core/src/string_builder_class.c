@@ -7,61 +7,87 @@
 #include "string_class.h"
 #include "string_builder_class.h"
 
-void *string_builder_new()
+#define FIELD_BUFFER 0
+#define FIELD_CAPACITY 1
+#define FIELD_SHARED 2
+
+void *string_builder_new(Heap *heap)
 {
-    void *string_builder_object = object_new(CONSTPOOL_CLASS_STRING_BUILDER, 1);
-    *object_get_field(string_builder_object, 0) = (EvalStackElement){.pointer = string_new("")};
-    return string_builder_object;
+    return string_builder_new_with_capacity(heap, STRING_BUILDER_DEFAULT_CAPACITY);
 }
 
-void *string_builder_free(void *string_builder_object)
+void *string_builder_new_with_capacity(Heap *heap, uint32_t capacity)
 {
-    string_free(object_get_field(string_builder_object, 0)->pointer);
-    config._free(string_builder_object);
+    // The buffer is a string with room to grow, toString hands it out as it is.
+    void *string_builder_object = object_new(heap, &class_string_builder_entry.data._class);
+    object_set_field(heap, string_builder_object, FIELD_BUFFER, (EvalStackElement){.pointer = string_alloc(heap, capacity)}, true);
+    object_set_field(heap, string_builder_object, FIELD_CAPACITY, (EvalStackElement){.integer = capacity}, false);
+    object_set_field(heap, string_builder_object, FIELD_SHARED, (EvalStackElement){.integer = false}, false);
+    return string_builder_object;
 }
 
-static void *concat_string(const char *str1, const char *str2)
+static void append(Heap *heap, void *string_builder_object, const char *value, uint32_t value_length)
 {
-    size_t str1_len = strlen(str1);
-    size_t str2_len = strlen(str2);
-    char *result = config._malloc(str1_len + str2_len + 1);
-    strcpy(result, str1);
-    strcat(result, str2);
-    void *string_object = string_new(result);
-    config._free(result);
-    return string_object;
+    String *buffer = object_get_field(string_builder_object, FIELD_BUFFER)->pointer;
+    uint32_t capacity = object_get_field(string_builder_object, FIELD_CAPACITY)->integer;
+    bool shared = object_get_field(string_builder_object, FIELD_SHARED)->integer;
+    uint32_t length = buffer->length;
+
+    // The buffer grows geometrically, so building a string of N characters takes O(N) time. A buffer that was
+    // returned by toString is copied before it is written to.
+    if (length + value_length > capacity || shared)
+    {
+        while (length + value_length > capacity)
+        {
+            capacity = capacity < STRING_BUILDER_DEFAULT_CAPACITY ? STRING_BUILDER_DEFAULT_CAPACITY : capacity * 2;
+        }
+        String *new_buffer = string_alloc(heap, capacity);
+        memcpy(new_buffer->value, buffer->value, length);
+        new_buffer->length = length;
+        buffer = new_buffer;
+        object_set_field(heap, string_builder_object, FIELD_BUFFER, (EvalStackElement){.pointer = buffer}, true);
+        object_set_field(heap, string_builder_object, FIELD_CAPACITY, (EvalStackElement){.integer = capacity}, false);
+        object_set_field(heap, string_builder_object, FIELD_SHARED, (EvalStackElement){.integer = false}, false);
+    }
+
+    memcpy(buffer->value + length, value, value_length);
+    buffer->length = length + value_length;
+    buffer->value[buffer->length] = '\0';
 }
 
-void *string_builder_append_string(void *string_builder_object, void *string_object)
+void *string_builder_append_string(Heap *heap, void *string_builder_object, void *string_object)
 {
-    void *new_string_object = concat_string(string_get_value(object_get_field(string_builder_object, 0)->pointer), string_get_value(string_object));
-    // Free the previous string object.
-    string_free(object_get_field(string_builder_object, 0)->pointer);
-    // Set the new string object.
-    *object_get_field(string_builder_object, 0) = (EvalStackElement){.pointer = new_string_object};
+    append(heap, string_builder_object, string_get_value(string_object), string_length(string_object));
+    return string_builder_object;
 }
 
-void *string_builder_append_int(void *string_builder_object, int32_t int_value)
+void *string_builder_append_int(Heap *heap, void *string_builder_object, int32_t int_value)
 {
     char buffer[32];
-    snprintf(buffer, 32, "%d", int_value);
-    void *new_string_object = concat_string(string_get_value(object_get_field(string_builder_object, 0)->pointer), buffer);
-    // Free the previous string object.
-    string_free(object_get_field(string_builder_object, 0)->pointer);
-    // Set the new string object.
-    *object_get_field(string_builder_object, 0) = (EvalStackElement){.pointer = new_string_object};
+    int length = snprintf(buffer, 32, "%d", int_value);
+    append(heap, string_builder_object, buffer, length);
+    return string_builder_object;
 }
 
-void *string_builder_append_bool(void *string_builder_object, int32_t bool_value)
+void *string_builder_append_bool(Heap *heap, void *string_builder_object, int32_t bool_value)
 {
-    void *new_string_object = concat_string(string_get_value(object_get_field(string_builder_object, 0)->pointer), bool_value ? "true" : "false");
-    // Free the previous string object.
-    string_free(object_get_field(string_builder_object, 0)->pointer);
-    // Set the new string object.
-    *object_get_field(string_builder_object, 0) = (EvalStackElement){.pointer = new_string_object};
+    append(heap, string_builder_object, bool_value ? "true" : "false", bool_value ? 4 : 5);
+    return string_builder_object;
 }
 
 void *string_builder_to_string(void *string_builder_object)
 {
-    return object_get_field(string_builder_object, 0)->pointer;
+    // The buffer becomes the string, the next append copies it so that the string never changes.
+    object_get_field(string_builder_object, FIELD_SHARED)->integer = true;
+    return object_get_field(string_builder_object, FIELD_BUFFER)->pointer;
+}
+
+uint32_t string_builder_length(void *string_builder_object)
+{
+    return string_length(object_get_field(string_builder_object, FIELD_BUFFER)->pointer);
+}
+
+uint32_t string_builder_capacity(void *string_builder_object)
+{
+    return object_get_field(string_builder_object, FIELD_CAPACITY)->integer;
 }
\ No newline at end of file
@@ -1,25 +1,63 @@
 #include <string.h>
+#include <stddef.h>
 
-#include "config.h"
 #include "constantpool.h"
-#include "object.h"
 #include "string_class.h"
 
-void *string_new(const char *value)
+static String *init(String *string, const char *value, uint32_t length)
 {
-    void *string_object = object_new(CONSTPOOL_CLASS_STRING, 1);
-    *object_get_field(string_object, 0) = (EvalStackElement){.pointer = config._malloc(strlen(value) + 1)};
-    strcpy(object_get_field(string_object, 0)->pointer, value);
-    return string_object;
+    string->_class = &class_string_entry.data._class;
+    string->length = length;
+    memcpy(string->value, value, length);
+    string->value[length] = '\0';
+    return string;
 }
 
-void *string_free(void *string_object)
+void *string_new(Heap *heap, const char *value)
 {
-    config._free(object_get_field(string_object, 0)->pointer);
-    config._free(string_object);
+    return string_new_with_length(heap, value, strlen(value));
+}
+
+void *string_new_with_length(Heap *heap, const char *value, uint32_t length)
+{
+    return init(heap_alloc(heap, offsetof(String, value) + length + 1, 0), value, length);
+}
+
+void *string_alloc(Heap *heap, uint32_t capacity)
+{
+    // Leaves room for capacity characters and the terminating null character, the string starts out empty.
+    return init(heap_alloc(heap, offsetof(String, value) + capacity + 1, 0), "", 0);
+}
+
+void *string_new_immortal(const char *value)
+{
+    uint32_t length = strlen(value);
+    return init(heap_alloc_immortal(offsetof(String, value) + length + 1, 0), value, length);
+}
+
+void string_free_immortal(void *string_object)
+{
+    heap_free_immortal(string_object);
 }
 
 const char *string_get_value(void *string_object)
 {
-    return (char *)object_get_field(string_object, 0)->pointer;
+    return ((String *)string_object)->value;
+}
+
+uint32_t string_length(void *string_object)
+{
+    return ((String *)string_object)->length;
+}
+
+uint32_t string_hash(void *string_object)
+{
+    // FNV-1a over the characters, the length makes it independent of null characters.
+    String *string = string_object;
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < string->length; i++)
+    {
+        hash = (hash ^ (uint8_t)string->value[i]) * 16777619u;
+    }
+    return hash;
 }
\ No newline at end of file
@@ -73,7 +73,8 @@ uint32_t vtable_get(VTable *vtable, const char *method_name)
         {
             return 0;
         }
-        else if (strcmp(vtable->table[index].method_name, method_name) == 0)
+        // Names from a linked image are interned, so overriding methods usually share the very same string.
+        else if (vtable->table[index].method_name == method_name || strcmp(vtable->table[index].method_name, method_name) == 0)
         {
             return vtable->table[index].const_index;
         }
@@ -0,0 +1,97 @@
+#include "config.h"
+#include "workdeque.h"
+
+WorkDeque *workdeque_new(size_t capacity)
+{
+    // The capacity is rounded up to a power of two so that indices can be wrapped with a mask.
+    size_t rounded = 1;
+    while (rounded < capacity)
+    {
+        rounded *= 2;
+    }
+
+    WorkDeque *deque = (WorkDeque *)config._malloc(sizeof(WorkDeque));
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    deque->mask = (int64_t)rounded - 1;
+    deque->elements = config._malloc(rounded * sizeof(_Atomic(void *)));
+    return deque;
+}
+
+void workdeque_free(WorkDeque *deque)
+{
+    config._free((void *)deque->elements);
+    deque->elements = NULL;
+    config._free(deque);
+}
+
+bool workdeque_push(WorkDeque *deque, void *element)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    // The caller has to find another place for the element when the deque is full.
+    if (bottom - top > deque->mask)
+    {
+        return false;
+    }
+
+    atomic_store_explicit(&deque->elements[bottom & deque->mask], element, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+void *workdeque_pop(WorkDeque *deque)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void *element = atomic_load_explicit(&deque->elements[bottom & deque->mask], memory_order_relaxed);
+
+    // The last element may be stolen at the same time, whoever increments the top first gets it.
+    if (top == bottom)
+    {
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        {
+            element = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return element;
+}
+
+void *workdeque_steal(WorkDeque *deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+
+    void *element = atomic_load_explicit(&deque->elements[top & deque->mask], memory_order_relaxed);
+
+    // Another thief or the owner got the element first.
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+        return NULL;
+    }
+
+    return element;
+}
+
+bool workdeque_empty(WorkDeque *deque)
+{
+    return atomic_load_explicit(&deque->top, memory_order_acquire) >= atomic_load_explicit(&deque->bottom, memory_order_acquire);
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "arena.h"
+
+#define STACK_INITIAL_CAPACITY 8
+
+void arena_new_test(void **state)
+{
+    Arena *arena = arena_new(100);
+    assert_int_equal(104, arena->chunk_size);
+    assert_null(arena->chunks);
+    assert_int_equal(0, arena->chunks_count);
+    assert_int_equal(0, arena->bytes_allocated);
+    arena_free(arena);
+}
+
+void arena_alloc_test(void **state)
+{
+    Arena *arena = arena_new(64);
+    char *first = arena_alloc(arena, 3);
+    char *second = arena_alloc(arena, 8);
+    assert_int_equal(0, (uintptr_t)first % 8);
+    assert_ptr_equal(first + 8, second);
+    assert_int_equal(1, arena->chunks_count);
+    assert_int_equal(16, arena->bytes_allocated);
+    // The rest of the chunk is too small, so a new chunk is started.
+    arena_alloc(arena, 56);
+    assert_int_equal(2, arena->chunks_count);
+    arena_free(arena);
+}
+
+void arena_large_alloc_test(void **state)
+{
+    Arena *arena = arena_new(64);
+    char *small = arena_alloc(arena, 8);
+    char *large = arena_alloc(arena, 1000);
+    large[999] = 1;
+    assert_int_equal(2, arena->chunks_count);
+    // The large block got its own chunk, so small blocks keep filling the current one.
+    assert_ptr_equal(small + 8, arena_alloc(arena, 8));
+    arena_free(arena);
+}
+
+void arena_release_test(void **state)
+{
+    Arena *arena = arena_new(64);
+    char *first = arena_alloc(arena, 8);
+    char *second = arena_alloc(arena, 16);
+    arena_release(arena, first, 8);
+    assert_int_equal(24, arena->bytes_allocated);
+    arena_release(arena, second, 16);
+    assert_int_equal(8, arena->bytes_allocated);
+    assert_ptr_equal(second, arena_alloc(arena, 16));
+    arena_free(arena);
+}
+
+void arena_reset_test(void **state)
+{
+    Arena *arena = arena_new(64);
+    for (int i = 0; i < 100; i++)
+    {
+        arena_alloc(arena, 24);
+    }
+    arena_alloc(arena, 1000);
+    char *top = arena_alloc(arena, 8);
+    assert_true(arena->chunks_count > 2);
+    arena_reset(arena);
+    assert_int_equal(1, arena->chunks_count);
+    assert_int_equal(0, arena->bytes_allocated);
+    // The current chunk is kept and reused from its start, it held two 24 byte blocks before the last one.
+    assert_ptr_equal(top - 48, arena_alloc(arena, 8));
+    arena_free(arena);
+}
+
+void arena_page_pool_test(void **state)
+{
+    config.page_pool = pagepool_new(64 + sizeof(ArenaChunk), 2);
+    Arena *arena = arena_new(0);
+    assert_int_equal(64, arena->chunk_size);
+    char *first = arena_alloc(arena, 64);
+    char *second = arena_alloc(arena, 64);
+    assert_true(pagepool_contains(config.page_pool, first));
+    assert_true(pagepool_contains(config.page_pool, second));
+    // Once the pool is exhausted chunks come from the system allocator.
+    assert_false(pagepool_contains(config.page_pool, arena_alloc(arena, 64)));
+    assert_int_equal(2, config.page_pool->pages_in_use);
+    arena_reset(arena);
+    assert_int_equal(1, arena->chunks_count);
+    assert_int_equal(0, config.page_pool->pages_in_use);
+    // The kept chunk is filled up first.
+    assert_false(pagepool_contains(config.page_pool, arena_alloc(arena, 64)));
+    assert_true(pagepool_contains(config.page_pool, arena_alloc(arena, 64)));
+    assert_int_equal(1, config.page_pool->pages_in_use);
+    arena_free(arena);
+    assert_int_equal(0, config.page_pool->pages_in_use);
+    pagepool_free(config.page_pool);
+    config.page_pool = NULL;
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test(arena_new_test),
+            cmocka_unit_test(arena_alloc_test),
+            cmocka_unit_test(arena_large_alloc_test),
+            cmocka_unit_test(arena_release_test),
+            cmocka_unit_test(arena_reset_test),
+            cmocka_unit_test(arena_page_pool_test),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
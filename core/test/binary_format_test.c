@@ -1,3 +1,6 @@
+#include <string.h>
+#include <unistd.h>
+
 #include "unit_testing.h"
 
 #include "config.h"
@@ -87,6 +90,965 @@ void binary_format_read_test(void **state)
     inststream_free(inststream);
 }
 
+static bool in_mapping(MappedFile *file, const char *name)
+{
+    return name >= file->data && name < file->data + file->size;
+}
+
+void binary_format_map_test(void **state)
+{
+    MappedFile *file = binform_map_file(FILE_NAME);
+    assert_non_null(file);
+    ConstantPool *constpool = binform_map_constantpool(file);
+    assert_non_null(constpool);
+
+    assert_int_equal(4, constpool->length);
+
+    ConstantPoolEntry *entry = constantpool_get(constpool, 1);
+    assert_int_equal(TYPE_CLASS, entry->type);
+    assert_string_equal("Animal", entry->data._class.name);
+    assert_true(in_mapping(file, entry->data._class.name));
+    assert_int_equal(1, entry->data._class.parent);
+    assert_int_equal(2, entry->data._class.fields);
+    assert_int_equal(3, entry->data._class.methods);
+
+    entry = constantpool_get(constpool, 2);
+    assert_int_equal(TYPE_METHOD, entry->type);
+    assert_string_equal("sound", entry->data.method.name);
+    assert_true(in_mapping(file, entry->data.method.name));
+    assert_int_equal(2, entry->data.method.address);
+    assert_int_equal(4, entry->data.method.locals);
+
+    entry = constantpool_get(constpool, 3);
+    assert_int_equal(TYPE_FIELD, entry->type);
+    assert_string_equal("age", entry->data.field.name);
+    assert_true(in_mapping(file, entry->data.field.name));
+
+    entry = constantpool_get(constpool, 4);
+    assert_int_equal(TYPE_STRING, entry->type);
+    assert_string_equal("This is a long string", entry->data.string.value);
+    assert_true(in_mapping(file, entry->data.string.value));
+
+    InstructionStream *inststream = binform_map_instructions(file);
+    assert_non_null(inststream);
+
+    assert_int_equal(4, inststream->length);
+
+    assert_int_equal(PUSH, inststream->instructions[0].opcode);
+    assert_int_equal(1, inststream->instructions[0].operand);
+    assert_int_equal(NEW, inststream->instructions[2].opcode);
+    assert_int_equal(120, inststream->instructions[2].operand);
+    assert_int_equal(JUMP_EQ, inststream->instructions[3].opcode);
+    assert_int_equal(50, inststream->instructions[3].operand);
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+}
+
+// Every prefix of the file must be rejected without reading past the end of the mapping.
+static void assert_prefixes_rejected(const char *filename)
+{
+    // The size of the file itself, a compressed program is larger once mapped.
+    FILE *whole = fopen(filename, "rb");
+    fseek(whole, 0, SEEK_END);
+    size_t size = ftell(whole);
+    fclose(whole);
+
+    for (size_t length = 1; length < size; length++)
+    {
+        FILE *in = fopen(filename, "rb");
+        FILE *out = fopen("truncated.lvm", "wb");
+        for (size_t i = 0; i < length; i++)
+        {
+            fputc(fgetc(in), out);
+        }
+        fclose(in);
+        fclose(out);
+
+        MappedFile *file = binform_map_file("truncated.lvm");
+        assert_non_null(file);
+        ConstantPool *constpool = binform_map_constantpool(file);
+        InstructionStream *inststream = constpool ? binform_map_instructions(file) : NULL;
+        assert_null(inststream);
+        if (constpool)
+        {
+            constantpool_free(constpool);
+        }
+        binform_unmap_file(file);
+    }
+
+    remove("truncated.lvm");
+}
+
+void binary_format_map_truncated_test(void **state)
+{
+    assert_prefixes_rejected(FILE_NAME);
+}
+
+static void free_names(ConstantPool *constpool)
+{
+    config._free(constantpool_get(constpool, 1)->data._class.name);
+    config._free(constantpool_get(constpool, 2)->data.method.name);
+    config._free(constantpool_get(constpool, 3)->data.field.name);
+    config._free(constantpool_get(constpool, 4)->data.string.value);
+}
+
+// Converts the version 1 test program to version 2, with a typed field that only version 2 can store.
+static void write_v2(const char *filename)
+{
+    FILE *file = fopen(FILE_NAME, "rb");
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    assert_true(binform_read_program(file, &constpool, &inststream));
+    fclose(file);
+
+    constantpool_get(constpool, 3)->data.field.type = FIELD_TYPE_INT;
+    file = fopen(filename, "wb");
+    binform_write_program(file, constpool, inststream, BINFORM_VERSION_2);
+    fclose(file);
+
+    free_names(constpool);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+void binary_format_v2_map_test(void **state)
+{
+    write_v2("test2.lvm");
+    MappedFile *file = binform_map_file("test2.lvm");
+    assert_non_null(file);
+    assert_int_equal(BINFORM_VERSION_2, binform_version(file));
+
+    ConstantPool *constpool = binform_map_constantpool(file);
+    assert_non_null(constpool);
+    assert_int_equal(4, constpool->length);
+
+    ConstantPoolEntry *entry = constantpool_get(constpool, 1);
+    assert_int_equal(TYPE_CLASS, entry->type);
+    assert_string_equal("Animal", entry->data._class.name);
+    assert_true(in_mapping(file, entry->data._class.name));
+    assert_int_equal(1, entry->data._class.parent);
+    assert_int_equal(2, entry->data._class.fields);
+    assert_int_equal(3, entry->data._class.methods);
+
+    entry = constantpool_get(constpool, 2);
+    assert_int_equal(TYPE_METHOD, entry->type);
+    assert_string_equal("sound", entry->data.method.name);
+    assert_int_equal(1, entry->data.method._class);
+    assert_int_equal(2, entry->data.method.address);
+    assert_int_equal(3, entry->data.method.args);
+    assert_int_equal(4, entry->data.method.locals);
+
+    entry = constantpool_get(constpool, 3);
+    assert_int_equal(TYPE_FIELD, entry->type);
+    assert_string_equal("age", entry->data.field.name);
+    assert_int_equal(1, entry->data.field._class);
+    assert_int_equal(0, entry->data.field.index);
+    assert_int_equal(FIELD_TYPE_INT, entry->data.field.type);
+
+    entry = constantpool_get(constpool, 4);
+    assert_int_equal(TYPE_STRING, entry->type);
+    assert_string_equal("This is a long string", entry->data.string.value);
+
+    InstructionStream *inststream = binform_map_instructions(file);
+    assert_non_null(inststream);
+    assert_int_equal(4, inststream->length);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    assert_true(in_mapping(file, (char *)inststream->instructions));
+#endif
+    assert_int_equal(PUSH, inststream->instructions[0].opcode);
+    assert_int_equal(1, inststream->instructions[0].operand);
+    assert_int_equal(POP, inststream->instructions[1].opcode);
+    assert_int_equal(NEW, inststream->instructions[2].opcode);
+    assert_int_equal(120, inststream->instructions[2].operand);
+    assert_int_equal(JUMP_EQ, inststream->instructions[3].opcode);
+    assert_int_equal(50, inststream->instructions[3].operand);
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    binform_unmap_file(file);
+    remove("test2.lvm");
+}
+
+void binary_format_v2_read_test(void **state)
+{
+    write_v2("test2.lvm");
+    FILE *file = fopen("test2.lvm", "rb");
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    assert_true(binform_read_program(file, &constpool, &inststream));
+    fclose(file);
+
+    assert_int_equal(4, constpool->length);
+    assert_string_equal("Animal", constantpool_get(constpool, 1)->data._class.name);
+    assert_string_equal("sound", constantpool_get(constpool, 2)->data.method.name);
+    assert_int_equal(FIELD_TYPE_INT, constantpool_get(constpool, 3)->data.field.type);
+    assert_string_equal("This is a long string", constantpool_get(constpool, 4)->data.string.value);
+    assert_int_equal(4, inststream->length);
+    assert_int_equal(JUMP_EQ, inststream->instructions[3].opcode);
+    assert_int_equal(50, inststream->instructions[3].operand);
+
+    free_names(constpool);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    remove("test2.lvm");
+}
+
+void binary_format_v2_truncated_test(void **state)
+{
+    write_v2("test2.lvm");
+    assert_prefixes_rejected("test2.lvm");
+    remove("test2.lvm");
+}
+
+static void read_test_program(ConstantPool **constpool, InstructionStream **inststream)
+{
+    FILE *file = fopen(FILE_NAME, "rb");
+    assert_true(binform_read_program(file, constpool, inststream));
+    fclose(file);
+}
+
+static void assert_test_program(ConstantPool *constpool, InstructionStream *inststream)
+{
+    assert_int_equal(4, constpool->length);
+    assert_string_equal("Animal", constantpool_get(constpool, 1)->data._class.name);
+    assert_int_equal(3, constantpool_get(constpool, 1)->data._class.methods);
+    assert_string_equal("sound", constantpool_get(constpool, 2)->data.method.name);
+    assert_int_equal(4, constantpool_get(constpool, 2)->data.method.locals);
+    assert_string_equal("age", constantpool_get(constpool, 3)->data.field.name);
+    assert_string_equal("This is a long string", constantpool_get(constpool, 4)->data.string.value);
+    assert_int_equal(4, inststream->length);
+    assert_int_equal(NEW, inststream->instructions[2].opcode);
+    assert_int_equal(120, inststream->instructions[2].operand);
+    assert_int_equal(JUMP_EQ, inststream->instructions[3].opcode);
+    assert_int_equal(50, inststream->instructions[3].operand);
+}
+
+static void free_test_program(ConstantPool *constpool, InstructionStream *inststream)
+{
+    free_names(constpool);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+void binary_format_buffer_test(void **state)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    read_test_program(&constpool, &inststream);
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+
+    for (uint32_t version = BINFORM_VERSION_1; version <= BINFORM_VERSION_2; version++)
+    {
+        assert_int_equal(BINFORM_OK, binform_write_to_buffer(&buffer, constpool, inststream, version));
+        ConstantPool *decoded;
+        InstructionStream *decoded_code;
+        assert_int_equal(BINFORM_OK, binform_read_from_buffer(buffer.data, buffer.size, &decoded, &decoded_code));
+        // Nothing points into the buffer, it can be reused right away.
+        memset(buffer.data, 0, buffer.size);
+        assert_test_program(decoded, decoded_code);
+        free_test_program(decoded, decoded_code);
+    }
+
+    // Version 1 in a buffer is byte for byte what binform_write_program writes to a file.
+    binform_write_to_buffer(&buffer, constpool, inststream, BINFORM_VERSION_1);
+    FILE *file = fopen(FILE_NAME, "rb");
+    char data[256];
+    assert_int_equal(buffer.size, fread(data, 1, sizeof(data), file));
+    fclose(file);
+    assert_memory_equal(data, buffer.data, buffer.size);
+
+    assert_int_equal(BINFORM_ERROR_VERSION, binform_write_to_buffer(&buffer, constpool, inststream, 3));
+    binform_buffer_free(&buffer);
+    free_test_program(constpool, inststream);
+}
+
+void binary_format_buffer_errors_test(void **state)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    read_test_program(&constpool, &inststream);
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    ConstantPool *decoded;
+    InstructionStream *decoded_code;
+
+    for (uint32_t version = BINFORM_VERSION_1; version <= BINFORM_VERSION_2; version++)
+    {
+        binform_write_to_buffer(&buffer, constpool, inststream, version);
+        for (size_t length = 0; length < buffer.size; length++)
+        {
+            assert_int_equal(BINFORM_ERROR_TRUNCATED, binform_read_from_buffer(buffer.data, length, &decoded, &decoded_code));
+            assert_null(decoded);
+            assert_null(decoded_code);
+        }
+    }
+
+    // The first constant of a version 2 program is its first section.
+    uint32_t constants;
+    memcpy(&constants, buffer.data + sizeof(BinformHeader) + offsetof(BinformSection, offset), sizeof(uint32_t));
+    buffer.data[constants + offsetof(BinformConstant, type)] = 9;
+    assert_int_equal(BINFORM_ERROR_MALFORMED, binform_read_from_buffer(buffer.data, buffer.size, &decoded, &decoded_code));
+    buffer.data[offsetof(BinformHeader, version)] = 3;
+    assert_int_equal(BINFORM_ERROR_VERSION, binform_read_from_buffer(buffer.data, buffer.size, &decoded, &decoded_code));
+
+    // The type of the first entry of a version 1 program follows the length of the constant pool.
+    binform_write_to_buffer(&buffer, constpool, inststream, BINFORM_VERSION_1);
+    buffer.data[sizeof(uint32_t)] = 9;
+    assert_int_equal(BINFORM_ERROR_MALFORMED, binform_read_from_buffer(buffer.data, buffer.size, &decoded, &decoded_code));
+    assert_null(decoded);
+
+    binform_buffer_free(&buffer);
+    free_test_program(constpool, inststream);
+}
+
+void binary_format_descriptor_test(void **state)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    read_test_program(&constpool, &inststream);
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    int pipe_descriptors[2];
+    assert_int_equal(0, pipe(pipe_descriptors));
+
+    assert_int_equal(BINFORM_OK, binform_write_to_descriptor(pipe_descriptors[1], &buffer, constpool, inststream, BINFORM_VERSION_2));
+    close(pipe_descriptors[1]);
+    ConstantPool *decoded;
+    InstructionStream *decoded_code;
+    assert_int_equal(BINFORM_OK, binform_read_from_descriptor(pipe_descriptors[0], &buffer, &decoded, &decoded_code));
+    close(pipe_descriptors[0]);
+    assert_test_program(decoded, decoded_code);
+    free_test_program(decoded, decoded_code);
+
+    assert_int_equal(BINFORM_ERROR_IO, binform_read_from_descriptor(pipe_descriptors[0], &buffer, &decoded, &decoded_code));
+    assert_null(decoded);
+
+    binform_buffer_free(&buffer);
+    free_test_program(constpool, inststream);
+}
+
+void binary_format_compact_test(void **state)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    read_test_program(&constpool, &inststream);
+    inststream->instructions[0].operand = 70000;
+    inststream->instructions[3].operand = 300;
+    FILE *file = fopen("compact.lvm", "wb");
+    binform_write_compact(file, constpool, inststream);
+    fclose(file);
+    free_test_program(constpool, inststream);
+
+    // Every operand takes only the bytes it needs and POP takes none.
+    MappedFile *mapped = binform_map_file("compact.lvm");
+    assert_non_null(mapped);
+    assert_int_equal(BINFORM_VERSION_2, binform_version(mapped));
+    constpool = binform_map_constantpool(mapped);
+    assert_non_null(constpool);
+    inststream = binform_map_instructions(mapped);
+    assert_non_null(inststream);
+    assert_false(in_mapping(mapped, (char *)inststream->instructions));
+    assert_int_equal(4, inststream->length);
+    assert_int_equal(PUSH, inststream->instructions[0].opcode);
+    assert_int_equal(70000, inststream->instructions[0].operand);
+    assert_int_equal(POP, inststream->instructions[1].opcode);
+    assert_int_equal(0, inststream->instructions[1].operand);
+    assert_int_equal(NEW, inststream->instructions[2].opcode);
+    assert_int_equal(120, inststream->instructions[2].operand);
+    assert_int_equal(JUMP_EQ, inststream->instructions[3].opcode);
+    assert_int_equal(300, inststream->instructions[3].operand);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+
+    uint32_t code;
+    memcpy(&code, mapped->data + sizeof(BinformHeader) + 2 * sizeof(BinformSection) + offsetof(BinformSection, size), sizeof(uint32_t));
+    assert_int_equal(4 + 4 + 1 + 2, code);
+    binform_unmap_file(mapped);
+
+    assert_prefixes_rejected("compact.lvm");
+    remove("compact.lvm");
+}
+
+void binary_format_compact_malformed_test(void **state)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    read_test_program(&constpool, &inststream);
+    FILE *file = fopen("compact.lvm", "wb");
+    binform_write_compact(file, constpool, inststream);
+    fclose(file);
+    free_test_program(constpool, inststream);
+
+    file = fopen("compact.lvm", "rb");
+    char data[256];
+    size_t size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+    remove("compact.lvm");
+
+    // Widening or narrowing the operand of the first instruction leaves the operands out of step with the section.
+    uint32_t code;
+    memcpy(&code, data + sizeof(BinformHeader) + 2 * sizeof(BinformSection) + offsetof(BinformSection, offset), sizeof(uint32_t));
+    ConstantPool *decoded;
+    InstructionStream *decoded_code;
+    for (uint8_t width = 0; width < 4; width++)
+    {
+        data[code] = (char)(PUSH | width << BINFORM_COMPACT_WIDTH_SHIFT);
+        uint32_t expected = width == 1 ? BINFORM_OK : BINFORM_ERROR_MALFORMED;
+        assert_int_equal(expected, binform_read_from_buffer(data, size, &decoded, &decoded_code));
+        if (decoded)
+        {
+            assert_int_equal(1, decoded_code->instructions[0].operand);
+            free_test_program(decoded, decoded_code);
+        }
+    }
+}
+
+static ConstantPool *new_linked_program(InstructionStream **inststream)
+{
+    ConstantPool *constpool = constantpool_new(9);
+    constantpool_add(constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Node", .fields = 2, .methods = 2, .parent = 0}});
+    constantpool_add(constpool, 2, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "value", ._class = 1, .index = 0, .type = FIELD_TYPE_INT}});
+    constantpool_add(constpool, 3, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "next", ._class = 1, .index = 1}});
+    constantpool_add(constpool, 4, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "visit", ._class = 1, .address = 0, .args = 1, .locals = 0}});
+    constantpool_add(constpool, 5, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "size", ._class = 1, .address = 1, .args = 1, .locals = 0}});
+    constantpool_add(constpool, 6, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Leaf", .fields = 1, .methods = 1, .parent = 1}});
+    constantpool_add(constpool, 7, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "visited", ._class = 6, .index = 2, .type = FIELD_TYPE_BOOL}});
+    constantpool_add(constpool, 8, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "visit", ._class = 6, .address = 2, .args = 1, .locals = 0}});
+    constantpool_add(constpool, 9, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "next"}});
+    *inststream = inststream_new(3);
+    (*inststream)->instructions[0] = (Instruction){.opcode = RETURN, .operand = 0};
+    (*inststream)->instructions[1] = (Instruction){.opcode = RETURN, .operand = 0};
+    (*inststream)->instructions[2] = (Instruction){.opcode = RETURN, .operand = 0};
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, *inststream);
+    return constpool;
+}
+
+static void assert_same_linking(ConstantPool *expected, ConstantPool *actual)
+{
+    assert_true(actual->linked);
+    for (uint32_t i = 1; i <= expected->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(expected, i);
+        ConstantPoolEntry *loaded = constantpool_get(actual, i);
+        if (entry->type == TYPE_CLASS)
+        {
+            assert_int_equal(entry->data._class.index, loaded->data._class.index);
+            assert_int_equal(entry->data._class.flags, loaded->data._class.flags);
+            assert_int_equal(entry->data._class.instance_fields, loaded->data._class.instance_fields);
+            assert_int_equal(entry->data._class.instance_size, loaded->data._class.instance_size);
+            assert_int_equal(entry->data._class.map_offset, loaded->data._class.map_offset);
+            assert_int_equal(entry->data._class.vtable->length, loaded->data._class.vtable->length);
+            for (uint32_t j = 0; j < entry->data._class.vtable->length; j++)
+            {
+                assert_int_equal(entry->data._class.vtable->table[j].const_index, loaded->data._class.vtable->table[j].const_index);
+            }
+            assert_int_equal(entry->data._class.field_offsets == NULL, loaded->data._class.field_offsets == NULL);
+            for (uint32_t j = 0; entry->data._class.field_offsets && j < entry->data._class.instance_fields; j++)
+            {
+                assert_int_equal(entry->data._class.field_offsets[j], loaded->data._class.field_offsets[j]);
+                assert_int_equal(entry->data._class.field_types[j], loaded->data._class.field_types[j]);
+            }
+        }
+        else if (entry->type == TYPE_FIELD)
+        {
+            assert_int_equal(entry->data.field.storage, loaded->data.field.storage);
+            assert_int_equal(entry->data.field.offset, loaded->data.field.offset);
+        }
+    }
+
+    VTable *leaf = constantpool_get(actual, 6)->data._class.vtable;
+    assert_int_equal(8, vtable_get(leaf, "visit"));
+    assert_int_equal(5, vtable_get(leaf, "size"));
+}
+
+void binary_format_lazy_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+
+    for (uint32_t version = BINFORM_VERSION_1; version <= BINFORM_VERSION_2; version++)
+    {
+        FILE *out = fopen("lazy.lvm", "wb");
+        binform_write_program(out, constpool, inststream, version);
+        fclose(out);
+
+        MappedFile *file = binform_map_file("lazy.lvm");
+        ConstantPool *lazy = binform_map_constantpool_lazy(file);
+        assert_non_null(lazy);
+        assert_non_null(lazy->lazy);
+        assert_int_equal(9, lazy->length);
+        for (uint32_t i = 1; i <= lazy->length; i++)
+        {
+            assert_false(lazy->lazy->loaded[i]);
+        }
+
+        // Only Leaf, its parent and their methods are decoded when Leaf is linked.
+        ConstantPoolEntryClass *leaf = &constantpool_get(lazy, 6)->data._class;
+        assert_string_equal("Leaf", leaf->name);
+        assert_true(in_mapping(file, leaf->name));
+        constantpool_link_class(lazy, leaf);
+        bool loaded[] = {false, true, false, false, true, true, true, false, true, false};
+        for (uint32_t i = 1; i <= lazy->length; i++)
+        {
+            assert_int_equal(loaded[i], lazy->lazy->loaded[i]);
+        }
+        assert_int_equal(8, vtable_get(leaf->vtable, "visit"));
+        assert_int_equal(5, vtable_get(leaf->vtable, "size"));
+        assert_int_equal(3, leaf->instance_fields);
+
+        assert_int_equal(2, constantpool_get(lazy, 7)->data.field.index);
+        assert_string_equal("next", constantpool_get(lazy, 9)->data.string.value);
+        assert_non_null(constantpool_get(lazy, 9)->data.string.object);
+
+        constantpool_free(lazy);
+        binform_unmap_file(file);
+        remove("lazy.lvm");
+    }
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+void binary_format_lazy_truncated_test(void **state)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    read_test_program(&constpool, &inststream);
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+
+    // The index pass checks every entry, so a truncated constant pool is rejected before anything is decoded.
+    for (uint32_t version = BINFORM_VERSION_1; version <= BINFORM_VERSION_2; version++)
+    {
+        binform_write_to_buffer(&buffer, constpool, inststream, version);
+        for (size_t length = 0; length < buffer.size; length++)
+        {
+            MappedFile file = {.data = buffer.data, .size = length, .offset = 0, .error = BINFORM_OK};
+            ConstantPool *lazy = binform_map_constantpool_lazy(&file);
+            InstructionStream *code = lazy ? binform_map_instructions(&file) : NULL;
+            assert_null(code);
+            assert_int_equal(BINFORM_ERROR_TRUNCATED, file.error);
+            if (lazy)
+            {
+                constantpool_free(lazy);
+            }
+        }
+    }
+
+    binform_buffer_free(&buffer);
+    free_test_program(constpool, inststream);
+}
+
+void binary_format_image_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    FILE *out = fopen("image.lvm", "wb");
+    binform_write_image(out, constpool, inststream);
+    fclose(out);
+
+    MappedFile *file = binform_map_file("image.lvm");
+    ConstantPool *loaded = binform_map_constantpool(file);
+    assert_non_null(loaded);
+    assert_same_linking(constpool, loaded);
+
+    // Equal names are stored once, so an overriding method shares the name of the method it overrides.
+    assert_ptr_equal(constantpool_get(loaded, 4)->data.method.name, constantpool_get(loaded, 8)->data.method.name);
+    assert_ptr_equal(constantpool_get(loaded, 3)->data.field.name, constantpool_get(loaded, 9)->data.string.value);
+
+    // Linking a loaded image again changes nothing.
+    VTable *vtable = constantpool_get(loaded, 1)->data._class.vtable;
+    constantpool_compute_vtables(loaded);
+    constantpool_compute_layouts(loaded, NULL);
+    assert_ptr_equal(vtable, constantpool_get(loaded, 1)->data._class.vtable);
+
+    InstructionStream *instructions = binform_map_instructions(file);
+    assert_int_equal(3, instructions->length);
+    assert_int_equal(RETURN, instructions->instructions[2].opcode);
+
+    constantpool_free(loaded);
+    inststream_free(instructions);
+    binform_unmap_file(file);
+
+    FILE *in = fopen("image.lvm", "rb");
+    ConstantPool *read;
+    assert_true(binform_read_program(in, &read, &instructions));
+    fclose(in);
+    assert_same_linking(constpool, read);
+    for (uint32_t i = 1; i <= read->length; i++)
+    {
+        config._free(constantpool_get(read, i)->type == TYPE_STRING ? constantpool_get(read, i)->data.string.value : constantpool_get(read, i)->data._class.name);
+    }
+    constantpool_free(read);
+    inststream_free(instructions);
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    remove("image.lvm");
+}
+
+void binary_format_image_checksum_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    FILE *out = fopen("image.lvm", "wb");
+    binform_write_image(out, constpool, inststream);
+    fclose(out);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+
+    MappedFile *file = binform_map_file("image.lvm");
+    size_t size = file->size;
+    binform_unmap_file(file);
+
+    // Changing any byte before the checksum must be noticed before anything in the image is used.
+    for (size_t i = 0; i < size - sizeof(BinformLink); i += 7)
+    {
+        file = binform_map_file("image.lvm");
+        file->data[i] ^= 0x10;
+        constpool = binform_map_constantpool(file);
+        if (constpool)
+        {
+            // Only bytes that do not take part in the image, like the version 1 fallback for a broken magic, may load.
+            assert_int_not_equal(BINFORM_VERSION_2, binform_version(file));
+            constantpool_free(constpool);
+        }
+        binform_unmap_file(file);
+    }
+
+    remove("image.lvm");
+}
+
+// The tests run on little-endian machines, so the records of an image can be changed through the structs.
+static char *image_section(char *data, uint32_t kind)
+{
+    BinformHeader header;
+    memcpy(&header, data, sizeof(BinformHeader));
+    for (uint32_t i = 0; i < header.sections; i++)
+    {
+        BinformSection section;
+        memcpy(&section, data + sizeof(BinformHeader) + i * sizeof(BinformSection), sizeof(BinformSection));
+        if (section.kind == kind)
+        {
+            return data + section.offset;
+        }
+    }
+    return NULL;
+}
+
+// Changed records get a new checksum, so only the checks of the linked values can reject the image.
+static void assert_image_rejected(const char *original, size_t size, uint32_t kind, size_t record, size_t member, uint32_t value, size_t width)
+{
+    char *data = test_malloc(size);
+    memcpy(data, original, size);
+    memcpy(image_section(data, kind) + record + member, &value, width);
+    char *link = image_section(data, BINFORM_SECTION_LINK);
+    uint64_t checksum = binform_checksum(data, link - data);
+    memcpy(link + offsetof(BinformLink, checksum), &checksum, sizeof(uint64_t));
+
+    FILE *out = fopen("image.lvm", "wb");
+    fwrite(data, size, 1, out);
+    fclose(out);
+    MappedFile *file = binform_map_file("image.lvm");
+    assert_null(binform_map_constantpool(file));
+    assert_int_equal(BINFORM_ERROR_MALFORMED, file->error);
+    binform_unmap_file(file);
+    test_free(data);
+}
+
+void binary_format_image_layout_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    FILE *out = fopen("image.lvm", "wb");
+    binform_write_image(out, constpool, inststream);
+    fclose(out);
+    FILE *in = fopen("image.lvm", "rb");
+    char data[2048];
+    size_t size = fread(data, 1, sizeof(data), in);
+    fclose(in);
+
+    // Node is packed with a pointer and an integer, its subclass Leaf adds a boolean.
+    ConstantPoolEntryClass *node = &constantpool_get(constpool, 1)->data._class;
+    ConstantPoolEntryClass *leaf = &constantpool_get(constpool, 6)->data._class;
+    assert_non_null(node->field_offsets);
+    assert_int_equal(FIELD_TYPE_INT, node->field_types[0]);
+    size_t leaf_record = sizeof(BinformClass);
+    size_t leaf_layout = node->instance_fields * sizeof(BinformLayoutField);
+
+    // The reference map must end within the instance and every field must end before the map.
+    assert_image_rejected(data, size, BINFORM_SECTION_CLASSES, 0, offsetof(BinformClass, instance_size), node->instance_size - 1, sizeof(uint32_t));
+    assert_image_rejected(data, size, BINFORM_SECTION_CLASSES, 0, offsetof(BinformClass, map_offset), node->field_offsets[0] + 1, sizeof(uint32_t));
+    assert_image_rejected(data, size, BINFORM_SECTION_CLASSES, leaf_record, offsetof(BinformClass, instance_size), leaf->instance_size - 1, sizeof(uint32_t));
+
+    // Fields may not overlap the header, wrap around or have an unknown type.
+    assert_image_rejected(data, size, BINFORM_SECTION_LAYOUTS, 0, offsetof(BinformLayoutField, offset), 0, sizeof(uint32_t));
+    assert_image_rejected(data, size, BINFORM_SECTION_LAYOUTS, 0, offsetof(BinformLayoutField, offset), UINT32_MAX - 3, sizeof(uint32_t));
+    assert_image_rejected(data, size, BINFORM_SECTION_LAYOUTS, 0, offsetof(BinformLayoutField, type), FIELD_TYPE_BOOL + 1, sizeof(uint8_t));
+
+    // A subclass keeps the slots of the fields it inherits, even where another slot would fit.
+    assert_image_rejected(data, size, BINFORM_SECTION_LAYOUTS, leaf_layout, offsetof(BinformLayoutField, type), FIELD_TYPE_BOOL, sizeof(uint8_t));
+
+    // Resolved fields must match the layout of their class.
+    ConstantPoolEntryField *value = &constantpool_get(constpool, 2)->data.field;
+    assert_image_rejected(data, size, BINFORM_SECTION_FIELDS, 0, offsetof(BinformField, offset), value->offset + 8, sizeof(uint32_t));
+    assert_image_rejected(data, size, BINFORM_SECTION_FIELDS, 0, offsetof(BinformField, storage), FIELD_TYPE_BOOL, sizeof(uint8_t));
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    remove("image.lvm");
+}
+
+void binary_format_compressed_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    FILE *out = fopen("image.lvm", "wb");
+    binform_write_image(out, constpool, inststream);
+    fclose(out);
+    FILE *in = fopen("image.lvm", "rb");
+    char data[2048];
+    size_t size = fread(data, 1, sizeof(data), in);
+    fclose(in);
+    assert_true(size < sizeof(data));
+
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    assert_int_equal(BINFORM_OK, binform_compress(&buffer, data, size));
+    assert_true(buffer.size < size);
+    out = fopen("compressed.lvm", "wb");
+    fwrite(buffer.data, buffer.size, 1, out);
+    fclose(out);
+
+    // Mapping restores the image byte for byte, so its checksum still holds.
+    MappedFile *file = binform_map_file("compressed.lvm");
+    assert_int_equal(size, file->size);
+    assert_memory_equal(data, file->data, size);
+    ConstantPool *loaded = binform_map_constantpool(file);
+    assert_non_null(loaded);
+    assert_same_linking(constpool, loaded);
+    InstructionStream *instructions = binform_map_instructions(file);
+    assert_true(in_mapping(file, (char *)instructions->instructions));
+    assert_int_equal(RETURN, instructions->instructions[2].opcode);
+    constantpool_free(loaded);
+    inststream_free(instructions);
+    binform_unmap_file(file);
+
+    ConstantPool *read;
+    assert_int_equal(BINFORM_OK, binform_read_from_buffer(buffer.data, buffer.size, &read, &instructions));
+    assert_same_linking(constpool, read);
+    for (uint32_t i = 1; i <= read->length; i++)
+    {
+        config._free(constantpool_get(read, i)->type == TYPE_STRING ? constantpool_get(read, i)->data.string.value : constantpool_get(read, i)->data._class.name);
+    }
+    constantpool_free(read);
+    inststream_free(instructions);
+
+    // Only uncompressed version 2 programs can be compressed.
+    memcpy(data, buffer.data, buffer.size);
+    assert_int_equal(BINFORM_ERROR_VERSION, binform_compress(&buffer, data, buffer.size));
+    binform_write_to_buffer(&buffer, constpool, inststream, BINFORM_VERSION_1);
+    memcpy(data, buffer.data, buffer.size);
+    assert_int_equal(BINFORM_ERROR_VERSION, binform_compress(&buffer, data, buffer.size));
+
+    binform_buffer_free(&buffer);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    assert_prefixes_rejected("compressed.lvm");
+    remove("compressed.lvm");
+    remove("image.lvm");
+}
+
+void binary_format_compressed_errors_test(void **state)
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    read_test_program(&constpool, &inststream);
+    BinformBuffer program = {.data = NULL, .size = 0, .capacity = 0};
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    binform_write_to_buffer(&program, constpool, inststream, BINFORM_VERSION_2);
+    assert_int_equal(BINFORM_OK, binform_compress(&buffer, program.data, program.size));
+    free_test_program(constpool, inststream);
+
+    ConstantPool *decoded;
+    InstructionStream *decoded_code;
+    assert_int_equal(BINFORM_OK, binform_read_from_buffer(buffer.data, buffer.size, &decoded, &decoded_code));
+    assert_test_program(decoded, decoded_code);
+    free_test_program(decoded, decoded_code);
+    for (size_t length = 0; length < buffer.size; length++)
+    {
+        assert_int_equal(BINFORM_ERROR_TRUNCATED, binform_read_from_buffer(buffer.data, length, &decoded, &decoded_code));
+        assert_null(decoded);
+    }
+
+    // Every section must be compressed, and its data must expand to exactly the size it had.
+    char *kind = buffer.data + sizeof(BinformHeader) + offsetof(BinformSection, kind);
+    kind[3] ^= 0x80;
+    assert_int_equal(BINFORM_ERROR_MALFORMED, binform_read_from_buffer(buffer.data, buffer.size, &decoded, &decoded_code));
+    kind[3] ^= 0x80;
+    uint32_t constants;
+    memcpy(&constants, buffer.data + sizeof(BinformHeader) + offsetof(BinformSection, offset), sizeof(uint32_t));
+    buffer.data[constants + offsetof(BinformCompressed, size)]++;
+    assert_int_equal(BINFORM_ERROR_MALFORMED, binform_read_from_buffer(buffer.data, buffer.size, &decoded, &decoded_code));
+    assert_null(decoded);
+
+    binform_buffer_free(&program);
+    binform_buffer_free(&buffer);
+}
+
+// More entries and instructions than fit in one chunk of the parallel decoder, with names of varying length.
+static void write_large_program(const char *filename, int format)
+{
+    static char *names[] = {"a", "name", "a longer name"};
+    uint32_t length = 50000;
+    ConstantPool *constpool = constantpool_new(length);
+    InstructionStream *inststream = inststream_new(length);
+    for (uint32_t i = 1; i <= length; i++)
+    {
+        switch (i % 4)
+        {
+        case 0:
+            constantpool_add(constpool, i, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = names[i % 3], .fields = i, .methods = 1, .parent = 0}});
+            break;
+        case 1:
+            constantpool_add(constpool, i, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = names[i % 3], ._class = i - 1, .index = i % 7}});
+            break;
+        case 2:
+            constantpool_add(constpool, i, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = names[i % 3], ._class = i - 2, .address = i, .args = 1, .locals = i % 5}});
+            break;
+        default:
+            constantpool_add(constpool, i, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = names[i % 3]}});
+        }
+        inststream->instructions[i - 1] = (Instruction){.opcode = i % 14, .operand = i % 3 == 0 ? 0 : i * (i % 5 == 0 ? 70000 : 1)};
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (format == 3)
+    {
+        binform_write_compact(file, constpool, inststream);
+    }
+    else
+    {
+        binform_write_program(file, constpool, inststream, format);
+    }
+    fclose(file);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+}
+
+static void assert_same_entry(ConstantPoolEntry *expected, ConstantPoolEntry *actual)
+{
+    assert_int_equal(expected->type, actual->type);
+    switch (expected->type)
+    {
+    case TYPE_CLASS:
+        assert_string_equal(expected->data._class.name, actual->data._class.name);
+        assert_int_equal(expected->data._class.fields, actual->data._class.fields);
+        break;
+    case TYPE_FIELD:
+        assert_string_equal(expected->data.field.name, actual->data.field.name);
+        assert_int_equal(expected->data.field._class, actual->data.field._class);
+        assert_int_equal(expected->data.field.index, actual->data.field.index);
+        break;
+    case TYPE_METHOD:
+        assert_string_equal(expected->data.method.name, actual->data.method.name);
+        assert_int_equal(expected->data.method.address, actual->data.method.address);
+        assert_int_equal(expected->data.method.locals, actual->data.method.locals);
+        break;
+    default:
+        assert_string_equal(expected->data.string.value, actual->data.string.value);
+    }
+}
+
+static void map_program(const char *filename, uint32_t threads, ConstantPool **constpool, InstructionStream **inststream, MappedFile **file)
+{
+    config.load_threads = threads;
+    *file = binform_map_file(filename);
+    *constpool = binform_map_constantpool(*file);
+    *inststream = *constpool ? binform_map_instructions(*file) : NULL;
+    config.load_threads = 1;
+}
+
+void binary_format_parallel_test(void **state)
+{
+    for (int format = 1; format <= 3; format++)
+    {
+        write_large_program("parallel.lvm", format);
+        ConstantPool *expected, *actual;
+        InstructionStream *expected_code, *actual_code;
+        MappedFile *expected_file, *actual_file;
+        map_program("parallel.lvm", 1, &expected, &expected_code, &expected_file);
+        map_program("parallel.lvm", 4, &actual, &actual_code, &actual_file);
+        assert_non_null(actual_code);
+
+        assert_int_equal(expected->length, actual->length);
+        for (uint32_t i = 1; i <= expected->length; i++)
+        {
+            assert_same_entry(constantpool_get(expected, i), constantpool_get(actual, i));
+        }
+        assert_int_equal(expected_code->length, actual_code->length);
+        for (uint32_t i = 0; i < expected_code->length; i++)
+        {
+            assert_int_equal(expected_code->instructions[i].opcode, actual_code->instructions[i].opcode);
+            assert_int_equal(expected_code->instructions[i].operand, actual_code->instructions[i].operand);
+        }
+
+        constantpool_free(expected);
+        constantpool_free(actual);
+        inststream_free(expected_code);
+        inststream_free(actual_code);
+        binform_unmap_file(expected_file);
+        binform_unmap_file(actual_file);
+    }
+    remove("parallel.lvm");
+}
+
+void binary_format_parallel_errors_test(void **state)
+{
+    BinformBuffer buffer = {.data = NULL, .size = 0, .capacity = 0};
+    for (int format = 1; format <= 3; format++)
+    {
+        write_large_program("parallel.lvm", format);
+        FILE *file = fopen("parallel.lvm", "rb");
+        fseek(file, 0, SEEK_END);
+        buffer.size = ftell(file);
+        buffer.data = config._realloc(buffer.data, buffer.size);
+        rewind(file);
+        assert_int_equal(buffer.size, fread(buffer.data, 1, buffer.size, file));
+        fclose(file);
+
+        // Cut in the middle of the constant pool and of the code, and with a damaged operand count of compact code.
+        size_t lengths[] = {buffer.size / 3, buffer.size - 3};
+        for (int i = 0; i < 2; i++)
+        {
+            ConstantPool *decoded;
+            InstructionStream *decoded_code;
+            uint32_t expected = binform_read_from_buffer(buffer.data, lengths[i], &decoded, &decoded_code);
+            assert_int_not_equal(BINFORM_OK, expected);
+            config.load_threads = 4;
+            assert_int_equal(expected, binform_read_from_buffer(buffer.data, lengths[i], &decoded, &decoded_code));
+            config.load_threads = 1;
+            assert_null(decoded);
+        }
+    }
+
+    // An invalid record far into a version 2 constant pool.
+    ConstantPool *decoded;
+    InstructionStream *decoded_code;
+    write_large_program("parallel.lvm", BINFORM_VERSION_2);
+    MappedFile *file = binform_map_file("parallel.lvm");
+    uint32_t constants;
+    memcpy(&constants, file->data + sizeof(BinformHeader) + offsetof(BinformSection, offset), sizeof(uint32_t));
+    file->data[constants + 40000 * sizeof(BinformConstant) + offsetof(BinformConstant, type)] = 9;
+    config.load_threads = 4;
+    assert_int_equal(BINFORM_ERROR_MALFORMED, binform_read_from_buffer(file->data, file->size, &decoded, &decoded_code));
+    config.load_threads = 1;
+    assert_null(decoded);
+    binform_unmap_file(file);
+
+    binform_buffer_free(&buffer);
+    remove("parallel.lvm");
+}
+
 int main()
 {
     set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
@@ -94,6 +1056,25 @@ int main()
     const struct CMUnitTest tests[] =
         {
             cmocka_unit_test(binary_format_read_test),
+            cmocka_unit_test(binary_format_map_test),
+            cmocka_unit_test(binary_format_map_truncated_test),
+            cmocka_unit_test(binary_format_v2_map_test),
+            cmocka_unit_test(binary_format_v2_read_test),
+            cmocka_unit_test(binary_format_v2_truncated_test),
+            cmocka_unit_test(binary_format_buffer_test),
+            cmocka_unit_test(binary_format_buffer_errors_test),
+            cmocka_unit_test(binary_format_descriptor_test),
+            cmocka_unit_test(binary_format_compact_test),
+            cmocka_unit_test(binary_format_compact_malformed_test),
+            cmocka_unit_test(binary_format_lazy_test),
+            cmocka_unit_test(binary_format_lazy_truncated_test),
+            cmocka_unit_test(binary_format_image_test),
+            cmocka_unit_test(binary_format_image_checksum_test),
+            cmocka_unit_test(binary_format_image_layout_test),
+            cmocka_unit_test(binary_format_compressed_test),
+            cmocka_unit_test(binary_format_compressed_errors_test),
+            cmocka_unit_test(binary_format_parallel_test),
+            cmocka_unit_test(binary_format_parallel_errors_test),
         };
 
     return cmocka_run_group_tests(tests, setup, teardown);
@@ -4,11 +4,12 @@
 #include "callstack.h"
 
 #define STACK_INITIAL_CAPACITY 8
+#define STACK_MAX_DEPTH 1024
 
 void callstack_new_test(void **state)
 {
-    CallStack *callstack = callstack_new();
-    assert_int_equal(STACK_INITIAL_CAPACITY, callstack->capacity);
+    CallStack *callstack = callstack_new(STACK_MAX_DEPTH);
+    assert_int_equal(STACK_MAX_DEPTH, callstack->capacity);
     assert_int_equal(0, callstack->length);
     assert_int_equal(sizeof(CallStackFrame), callstack->elemsize);
     callstack_free(callstack);
@@ -16,17 +17,17 @@ void callstack_new_test(void **state)
 
 void callstack_single_push_pop_test(void **state)
 {
-    CallStack *callstack = callstack_new();
+    CallStack *callstack = callstack_new(STACK_MAX_DEPTH);
     CallStackFrame frame = {.vars_count = 0, .vars = NULL, .return_address = 100};
     callstack_push(callstack, frame);
-    assert_int_equal(STACK_INITIAL_CAPACITY, callstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, callstack->capacity);
     assert_int_equal(1, callstack->length);
     assert_int_equal(sizeof(CallStackFrame), callstack->elemsize);
     assert_int_equal(0, callstack_top(callstack).vars_count);
     assert_null(callstack_top(callstack).vars);
     assert_int_equal(100, callstack_top(callstack).return_address);
     callstack_pop(callstack);
-    assert_int_equal(STACK_INITIAL_CAPACITY, callstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, callstack->capacity);
     assert_int_equal(0, callstack->length);
     assert_int_equal(sizeof(CallStackFrame), callstack->elemsize);
     callstack_free(callstack);
@@ -34,7 +35,8 @@ void callstack_single_push_pop_test(void **state)
 
 void callstack_multiple_push_pop_test(void **state)
 {
-    CallStack *callstack = callstack_new();
+    CallStack *callstack = callstack_new(STACK_MAX_DEPTH);
+    void *elements = callstack->elements;
 
     for (int i = 0; i <= 500; i++)
     {
@@ -42,7 +44,8 @@ void callstack_multiple_push_pop_test(void **state)
         callstack_push(callstack, (CallStackFrame){.return_address = i, .vars_count = 0, .vars = NULL});
     }
 
-    assert_int_equal(512, callstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, callstack->capacity);
+    assert_ptr_equal(elements, callstack->elements);
 
     for (int i = 500; i >= 0; i--)
     {
@@ -51,7 +54,7 @@ void callstack_multiple_push_pop_test(void **state)
         assert_int_equal(i, callstack->length);
     }
 
-    assert_int_equal(STACK_INITIAL_CAPACITY, callstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, callstack->capacity);
 
     callstack_free(callstack);
 }
@@ -0,0 +1,343 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "codecache.h"
+
+#define STACK_INITIAL_CAPACITY 8
+
+#define DIRECTORY "codecache_test"
+#define STORING_THREADS 4
+#define STORES_PER_THREAD 25
+
+static void remove_directory()
+{
+    DIR *directory = opendir(DIRECTORY);
+    if (directory)
+    {
+        for (struct dirent *entry = readdir(directory); entry; entry = readdir(directory))
+        {
+            if (entry->d_name[0] != '.')
+            {
+                unlinkat(dirfd(directory), entry->d_name, 0);
+            }
+        }
+        closedir(directory);
+    }
+    rmdir(DIRECTORY);
+}
+
+static int setup()
+{
+    remove_directory();
+    return 0;
+}
+
+static int teardown()
+{
+    remove_directory();
+    return 0;
+}
+
+static size_t count_files(const char *suffix)
+{
+    DIR *directory = opendir(DIRECTORY);
+    size_t count = 0;
+    for (struct dirent *entry = readdir(directory); entry; entry = readdir(directory))
+    {
+        size_t length = strlen(entry->d_name);
+        count += length > strlen(suffix) && strcmp(entry->d_name + length - strlen(suffix), suffix) == 0;
+    }
+    closedir(directory);
+    return count;
+}
+
+static void image_path(uint64_t key, char *path, size_t length)
+{
+    snprintf(path, length, "%s/%016llx%s", DIRECTORY, (unsigned long long)key, CODECACHE_EXTENSION);
+}
+
+static bool is_cached(uint64_t key)
+{
+    char path[256];
+    image_path(key, path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+static void set_used(uint64_t key, time_t seconds)
+{
+    char path[256];
+    image_path(key, path, sizeof(path));
+    struct timespec times[2] = {{.tv_sec = seconds}, {.tv_sec = seconds}};
+    assert_int_equal(0, utimensat(AT_FDCWD, path, times, 0));
+}
+
+static ConstantPool *new_linked_program(InstructionStream **inststream)
+{
+    ConstantPool *constpool = constantpool_new(6);
+    constantpool_add(constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Animal", .fields = 1, .methods = 1, .parent = 0}});
+    constantpool_add(constpool, 2, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "age", ._class = 1, .index = 0, .type = FIELD_TYPE_INT}});
+    constantpool_add(constpool, 3, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "sound", ._class = 1, .address = 0, .args = 1, .locals = 0}});
+    constantpool_add(constpool, 4, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Dog", .fields = 0, .methods = 1, .parent = 1}});
+    constantpool_add(constpool, 5, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "sound", ._class = 4, .address = 1, .args = 1, .locals = 0}});
+    constantpool_add(constpool, 6, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "woof"}});
+    *inststream = inststream_new(2);
+    (*inststream)->instructions[0] = (Instruction){.opcode = RETURN, .operand = 0};
+    (*inststream)->instructions[1] = (Instruction){.opcode = RETURN, .operand = 0};
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, *inststream);
+    return constpool;
+}
+
+void codecache_key_test(void **state)
+{
+    CodeCache *cache = codecache_new(DIRECTORY, "1.0", 1 << 20);
+    CodeCache *other = codecache_new(DIRECTORY, "1.1", 1 << 20);
+    assert_non_null(cache);
+
+    uint64_t key = codecache_key(cache, "program", 7, 0);
+    assert_int_equal(key, codecache_key(cache, "program", 7, 0));
+    assert_int_not_equal(key, codecache_key(cache, "Program", 7, 0));
+    assert_int_not_equal(key, codecache_key(cache, "program", 6, 0));
+    assert_int_not_equal(key, codecache_key(cache, "program", 7, 1));
+    assert_int_not_equal(key, codecache_key(other, "program", 7, 0));
+
+    codecache_free(other);
+    codecache_free(cache);
+}
+
+void codecache_store_and_load_test(void **state)
+{
+    CodeCache *cache = codecache_new(DIRECTORY, "1.0", 1 << 20);
+    uint64_t key = codecache_key(cache, "program", 7, 0);
+    MappedFile *file;
+    ConstantPool *loaded;
+    InstructionStream *instructions;
+    assert_false(codecache_load(cache, key, &file, &loaded, &instructions));
+    assert_null(file);
+
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    assert_true(codecache_store(cache, key, constpool, inststream));
+    assert_int_equal(1, count_files(CODECACHE_EXTENSION));
+    assert_int_equal(0, count_files(".tmp"));
+
+    assert_true(codecache_load(cache, key, &file, &loaded, &instructions));
+    assert_true(loaded->linked);
+    assert_int_equal(constpool->length, loaded->length);
+    VTable *expected = constantpool_get(constpool, 4)->data._class.vtable;
+    VTable *vtable = constantpool_get(loaded, 4)->data._class.vtable;
+    assert_int_equal(expected->length, vtable->length);
+    for (uint32_t i = 0; i < expected->length; i++)
+    {
+        assert_int_equal(expected->table[i].const_index, vtable->table[i].const_index);
+    }
+    assert_int_equal(2, instructions->length);
+    assert_string_equal("woof", constantpool_get(loaded, 6)->data.string.value);
+
+    constantpool_free(loaded);
+    inststream_free(instructions);
+    binform_unmap_file(file);
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    codecache_free(cache);
+}
+
+void codecache_eviction_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    CodeCache *cache = codecache_new(DIRECTORY, "1.0", 1 << 20);
+    uint64_t first = codecache_key(cache, "first", 5, 0);
+    uint64_t second = codecache_key(cache, "second", 6, 0);
+    uint64_t third = codecache_key(cache, "third", 5, 0);
+    assert_true(codecache_store(cache, first, constpool, inststream));
+
+    // Room for two images but not for three.
+    char path[256];
+    struct stat status;
+    image_path(first, path, sizeof(path));
+    assert_int_equal(0, stat(path, &status));
+    cache->max_size = 2 * status.st_size + status.st_size / 2;
+
+    assert_true(codecache_store(cache, second, constpool, inststream));
+    set_used(first, 1000);
+    set_used(second, 2000);
+
+    // Loading the first image makes the second the least recently used.
+    MappedFile *file;
+    ConstantPool *loaded;
+    InstructionStream *instructions;
+    assert_true(codecache_load(cache, first, &file, &loaded, &instructions));
+    constantpool_free(loaded);
+    inststream_free(instructions);
+    binform_unmap_file(file);
+
+    assert_true(codecache_store(cache, third, constpool, inststream));
+    assert_true(is_cached(first));
+    assert_false(is_cached(second));
+    assert_true(is_cached(third));
+    assert_int_equal(2, count_files(CODECACHE_EXTENSION));
+
+    // An image larger than the whole cache does not stay either.
+    cache->max_size = 0;
+    assert_true(codecache_store(cache, second, constpool, inststream));
+    assert_int_equal(0, count_files(CODECACHE_EXTENSION));
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    codecache_free(cache);
+}
+
+void codecache_broken_image_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    CodeCache *cache = codecache_new(DIRECTORY, "1.0", 1 << 20);
+    uint64_t key = codecache_key(cache, "program", 7, 0);
+    assert_true(codecache_store(cache, key, constpool, inststream));
+
+    // A changed byte fails the checksum, the image is removed and the next load is a plain miss.
+    char path[256];
+    image_path(key, path, sizeof(path));
+    struct stat status;
+    assert_int_equal(0, stat(path, &status));
+    FILE *out = fopen(path, "r+b");
+    fseek(out, status.st_size / 2, SEEK_SET);
+    int byte = fgetc(out);
+    fseek(out, status.st_size / 2, SEEK_SET);
+    fputc(byte ^ 0x10, out);
+    fclose(out);
+
+    MappedFile *file;
+    ConstantPool *loaded;
+    InstructionStream *instructions;
+    assert_false(codecache_load(cache, key, &file, &loaded, &instructions));
+    assert_null(file);
+    assert_null(loaded);
+    assert_null(instructions);
+    assert_false(is_cached(key));
+
+    // So is a program that was never linked.
+    out = fopen(path, "wb");
+    binform_write_program(out, constpool, inststream, BINFORM_VERSION_2);
+    fclose(out);
+    assert_false(codecache_load(cache, key, &file, &loaded, &instructions));
+    assert_false(is_cached(key));
+
+    // And a file cut short.
+    out = fopen(path, "wb");
+    fputs("LVM", out);
+    fclose(out);
+    assert_false(codecache_load(cache, key, &file, &loaded, &instructions));
+    assert_false(is_cached(key));
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    codecache_free(cache);
+}
+
+void codecache_stale_temporary_test(void **state)
+{
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    CodeCache *cache = codecache_new(DIRECTORY, "1.0", 1 << 20);
+
+    // Left behind by a writer that crashed long ago, and by one that is still writing.
+    FILE *out = fopen(DIRECTORY "/0000000000000001.1.0" CODECACHE_TEMPORARY_EXTENSION, "wb");
+    fclose(out);
+    out = fopen(DIRECTORY "/0000000000000002.1.0" CODECACHE_TEMPORARY_EXTENSION, "wb");
+    fclose(out);
+    struct timespec times[2] = {{.tv_sec = time(NULL) - 2 * CODECACHE_TEMPORARY_MAX_AGE}, {.tv_sec = time(NULL) - 2 * CODECACHE_TEMPORARY_MAX_AGE}};
+    assert_int_equal(0, utimensat(AT_FDCWD, DIRECTORY "/0000000000000001.1.0" CODECACHE_TEMPORARY_EXTENSION, times, 0));
+
+    assert_true(codecache_store(cache, codecache_key(cache, "program", 7, 0), constpool, inststream));
+    assert_int_equal(1, count_files(CODECACHE_TEMPORARY_EXTENSION));
+    assert_int_equal(0, access(DIRECTORY "/0000000000000002.1.0" CODECACHE_TEMPORARY_EXTENSION, F_OK));
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    codecache_free(cache);
+}
+
+typedef struct
+{
+    CodeCache *cache;
+    uint64_t key;
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+    uint32_t stored;
+} Storer;
+
+static void *store_repeatedly(void *context)
+{
+    Storer *storer = context;
+    for (uint32_t i = 0; i < STORES_PER_THREAD; i++)
+    {
+        storer->stored += codecache_store(storer->cache, storer->key, storer->constpool, storer->inststream);
+    }
+    return NULL;
+}
+
+void codecache_concurrent_store_test(void **state)
+{
+    // The allocator of the tests is not thread safe.
+    set_config(malloc, calloc, realloc, free, STACK_INITIAL_CAPACITY);
+    InstructionStream *inststream;
+    ConstantPool *constpool = new_linked_program(&inststream);
+    CodeCache *cache = codecache_new(DIRECTORY, "1.0", 1 << 20);
+    uint64_t key = codecache_key(cache, "program", 7, 0);
+
+    // Threads storing the same key write to temporary files of their own, so every image renamed into place is whole.
+    pthread_t threads[STORING_THREADS];
+    Storer storers[STORING_THREADS];
+    for (uint32_t i = 0; i < STORING_THREADS; i++)
+    {
+        storers[i] = (Storer){.cache = cache, .key = key, .constpool = constpool, .inststream = inststream, .stored = 0};
+        pthread_create(&threads[i], NULL, store_repeatedly, &storers[i]);
+    }
+    for (uint32_t i = 0; i < STORING_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        assert_int_equal(STORES_PER_THREAD, storers[i].stored);
+    }
+    assert_int_equal(0, count_files(CODECACHE_TEMPORARY_EXTENSION));
+
+    MappedFile *file;
+    ConstantPool *loaded;
+    InstructionStream *instructions;
+    assert_true(codecache_load(cache, key, &file, &loaded, &instructions));
+    constantpool_free(loaded);
+    inststream_free(instructions);
+    binform_unmap_file(file);
+
+    constantpool_free(constpool);
+    inststream_free(inststream);
+    codecache_free(cache);
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test_setup_teardown(codecache_key_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(codecache_store_and_load_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(codecache_eviction_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(codecache_broken_image_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(codecache_stale_temporary_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(codecache_concurrent_store_test, setup, teardown),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
\ No newline at end of file
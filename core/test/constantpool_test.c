@@ -1,6 +1,9 @@
+#include <string.h>
+
 #include "unit_testing.h"
 
 #include "config.h"
+#include "object.h"
 #include "constantpool.h"
 
 #define STACK_INITIAL_CAPACITY 8
@@ -72,6 +75,84 @@ void constantpool_compute_vtables_test(void **state)
     constantpool_free(constpool);
 }
 
+void constantpool_instance_size_test(void **state)
+{
+    ConstantPool *constpool = constantpool_new(3);
+    constantpool_add(constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Animal", .fields = 2, .methods = 0, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, 2, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Dog", .fields = 1, .methods = 0, .parent = 1, .vtable = NULL}});
+    constantpool_add(constpool, 3, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Puppy", .fields = 3, .methods = 0, .parent = 2, .vtable = NULL}});
+
+    constantpool_compute_vtables(constpool);
+
+    // Instances hold the fields of every ancestor.
+    ConstantPoolEntryClass *puppy = &constantpool_get(constpool, 3)->data._class;
+    assert_int_equal(2, constantpool_get(constpool, 1)->data._class.instance_fields);
+    assert_int_equal(3, constantpool_get(constpool, 2)->data._class.instance_fields);
+    assert_int_equal(6, puppy->instance_fields);
+    assert_int_equal(OBJECT_INSTANCE_SIZE(6), puppy->instance_size);
+    assert_int_equal(3, puppy->index);
+    assert_true(puppy->flags & CLASS_FLAG_LINKED);
+
+    constantpool_free(constpool);
+}
+
+void constantpool_compute_layouts_test(void **state)
+{
+    ConstantPool *constpool = constantpool_new(9);
+    constantpool_add(constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Node", .fields = 4, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, 2, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "value", ._class = 1, .index = 0}});
+    constantpool_add(constpool, 3, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "next", ._class = 1, .index = 1}});
+    constantpool_add(constpool, 4, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "visited", ._class = 1, .index = 2, .type = FIELD_TYPE_BOOL}});
+    constantpool_add(constpool, 5, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "other", ._class = 1, .index = 3}});
+    constantpool_add(constpool, 6, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Leaf", .fields = 2, .methods = 0, .parent = 1, .vtable = NULL}});
+    constantpool_add(constpool, 7, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "count", ._class = 6, .index = 4}});
+    constantpool_add(constpool, 8, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "copy", ._class = 6, .index = 5}});
+    constantpool_add(constpool, 9, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "main", ._class = 1, .address = 0, .args = 1, .locals = 1}});
+
+    InstructionStream *inststream = inststream_new(20);
+    Instruction program[] = {
+        {PUSH_VAR, 0}, {PUSH, 1}, {POP_FIELD, 2},                        // value = 1
+        {PUSH_VAR, 0}, {NEW, 1}, {POP_FIELD, 3},                         // next = new Node
+        {PUSH_VAR, 0}, {PUSH_VAR, 0}, {PUSH_FIELD, 7}, {PUSH, 1}, {ADD, 0}, {POP_FIELD, 7}, // count = count + 1
+        {PUSH_VAR, 0}, {PUSH_VAR, 0}, {PUSH_FIELD, 2}, {POP_FIELD, 8},   // copy = value
+        {PUSH_VAR, 0}, {PUSH, 1}, {JUMP, 19}, {POP_FIELD, 5},            // other is stored after a jump target
+    };
+    memcpy(inststream->instructions, program, sizeof(program));
+
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+
+    // References and untyped fields come first, then integers and then booleans.
+    ConstantPoolEntryClass *node = &constantpool_get(constpool, 1)->data._class;
+    assert_int_equal(FIELD_TYPE_INT, constantpool_get(constpool, 2)->data.field.storage);
+    assert_int_equal(FIELD_TYPE_ANY, constantpool_get(constpool, 3)->data.field.storage);
+    assert_int_equal(FIELD_TYPE_BOOL, constantpool_get(constpool, 4)->data.field.storage);
+    assert_int_equal(FIELD_TYPE_ANY, constantpool_get(constpool, 5)->data.field.storage);
+    assert_int_equal(8, node->field_offsets[1]);
+    assert_int_equal(16, node->field_offsets[3]);
+    assert_int_equal(24, node->field_offsets[0]);
+    assert_int_equal(28, node->field_offsets[2]);
+    assert_int_equal(29, node->map_offset);
+    assert_int_equal(30, node->instance_size);
+    assert_int_equal(24, constantpool_get(constpool, 2)->data.field.offset);
+
+    // Subclasses keep the layout of their parent and append their own fields.
+    ConstantPoolEntryClass *leaf = &constantpool_get(constpool, 6)->data._class;
+    assert_int_equal(FIELD_TYPE_INT, constantpool_get(constpool, 7)->data.field.storage);
+    assert_int_equal(FIELD_TYPE_INT, constantpool_get(constpool, 8)->data.field.storage);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        assert_int_equal(node->field_offsets[i], leaf->field_offsets[i]);
+    }
+    assert_int_equal(32, leaf->field_offsets[4]);
+    assert_int_equal(36, leaf->field_offsets[5]);
+    assert_int_equal(41, leaf->instance_size);
+    assert_true(leaf->instance_size < OBJECT_INSTANCE_SIZE(6));
+
+    inststream_free(inststream);
+    constantpool_free(constpool);
+}
+
 void constantpool_compute_vtables_depth_three_test(void **state)
 {
     ConstantPool *constpool = constantpool_new(10);
@@ -115,6 +196,170 @@ void constantpool_compute_vtables_depth_three_test(void **state)
     constantpool_free(constpool);
 }
 
+// The same hierarchy as constantpool_compute_vtables_test, decoded one entry at a time.
+static ConstantPoolEntry lazy_entries[] = {
+    {.type = TYPE_CLASS, .data._class = {.name = "Animal", .fields = 1, .methods = 3, .parent = 0}},
+    {.type = TYPE_METHOD, .data.method = {.name = "makeSound", ._class = 1, .address = 20, .args = 0, .locals = 0}},
+    {.type = TYPE_METHOD, .data.method = {.name = "jump", ._class = 1, .address = 25, .args = 0, .locals = 0}},
+    {.type = TYPE_METHOD, .data.method = {.name = "isAnimal", ._class = 1, .address = 30, .args = 0, .locals = 0}},
+    {.type = TYPE_CLASS, .data._class = {.name = "Dog", .fields = 1, .methods = 4, .parent = 1}},
+    {.type = TYPE_METHOD, .data.method = {.name = "makeSound", ._class = 5, .address = 40, .args = 0, .locals = 0}},
+    {.type = TYPE_CLASS, .data._class = {.name = "Cat", .fields = 0, .methods = 5, .parent = 1}},
+    {.type = TYPE_METHOD, .data.method = {.name = "makeSound", ._class = 7, .address = 50, .args = 0, .locals = 0}},
+    {.type = TYPE_METHOD, .data.method = {.name = "jump", ._class = 7, .address = 70, .args = 0, .locals = 0}},
+    {.type = TYPE_FIELD, .data.field = {.name = "age", ._class = 5, .index = 1}},
+    {.type = TYPE_METHOD, .data.method = {.name = "jump", ._class = 5, .address = 80, .args = 0, .locals = 0}},
+};
+
+static void load_lazy_entry(void *source, uint32_t index, ConstantPoolEntry *entry)
+{
+    (*(uint32_t *)source)++;
+    *entry = lazy_entries[index - 1];
+}
+
+void constantpool_lazy_test(void **state)
+{
+    uint32_t length = sizeof(lazy_entries) / sizeof(ConstantPoolEntry);
+    uint32_t *method_classes = test_malloc((length + 1) * sizeof(uint32_t));
+    for (uint32_t i = 1; i <= length; i++)
+    {
+        method_classes[i] = lazy_entries[i - 1].type == TYPE_METHOD ? lazy_entries[i - 1].data.method._class : 0;
+    }
+    uint32_t *loads = test_malloc(sizeof(uint32_t));
+    *loads = 0;
+    ConstantPool *constpool = constantpool_new_lazy(length, load_lazy_entry, loads, method_classes);
+
+    // Linking up front does nothing, everything happens on first use.
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, NULL);
+    constantpool_create_strings(constpool);
+    assert_int_equal(0, *loads);
+
+    ConstantPoolEntryClass *dog = &constantpool_get(constpool, 5)->data._class;
+    assert_int_equal(1, *loads);
+    assert_string_equal("Dog", dog->name);
+    assert_int_equal(5, dog->index);
+    assert_false(dog->flags & CLASS_FLAG_LINKED);
+
+    // Linking Dog loads Animal and the methods of both, but not Cat or the field.
+    constantpool_link_class(constpool, dog);
+    assert_int_equal(1 + 1 + 3 + 2, *loads);
+    assert_true(dog->flags & CLASS_FLAG_LINKED);
+    assert_true(constantpool_get(constpool, 1)->data._class.flags & CLASS_FLAG_LINKED);
+    assert_int_equal(6, vtable_get(dog->vtable, "makeSound"));
+    assert_int_equal(11, vtable_get(dog->vtable, "jump"));
+    assert_int_equal(4, vtable_get(dog->vtable, "isAnimal"));
+    assert_int_equal(2, dog->instance_fields);
+    assert_int_equal(OBJECT_INSTANCE_SIZE(2), dog->instance_size);
+
+    // Fields get the default layout when they are loaded.
+    ConstantPoolEntryField *age = &constantpool_get(constpool, 10)->data.field;
+    assert_int_equal(FIELD_TYPE_ANY, age->storage);
+    assert_int_equal(sizeof(Object) + sizeof(EvalStackElement), age->offset);
+
+    // Loaded entries and linked classes are kept.
+    constantpool_link_class(constpool, dog);
+    constantpool_get(constpool, 5);
+    assert_int_equal(1 + 1 + 3 + 2 + 1, *loads);
+
+    ConstantPoolEntryClass *cat = &constantpool_get(constpool, 7)->data._class;
+    constantpool_link_class(constpool, cat);
+    assert_int_equal(8, vtable_get(cat->vtable, "makeSound"));
+    assert_int_equal(9, vtable_get(cat->vtable, "jump"));
+    assert_int_equal(4, vtable_get(cat->vtable, "isAnimal"));
+
+    constantpool_free(constpool);
+}
+
+// Copies of the lazy hierarchy, enough of them to link the classes in parallel.
+static ConstantPool *new_large_pool(uint32_t copies, bool late_method)
+{
+    uint32_t size = sizeof(lazy_entries) / sizeof(ConstantPoolEntry);
+    ConstantPool *constpool = constantpool_new(copies * size);
+    for (uint32_t copy = 0; copy < copies; copy++)
+    {
+        for (uint32_t i = 0; i < size; i++)
+        {
+            ConstantPoolEntry entry = lazy_entries[i];
+            uint32_t base = copy * size;
+            if (entry.type == TYPE_CLASS && entry.data._class.parent)
+            {
+                entry.data._class.parent += base;
+            }
+            else if (entry.type == TYPE_METHOD)
+            {
+                entry.data.method._class += base;
+            }
+            else if (entry.type == TYPE_FIELD)
+            {
+                entry.data.field._class += base;
+            }
+            constantpool_add(constpool, base + i + 1, entry);
+        }
+    }
+    // A method of Animal after Dog and Cat have copied its vtable, which they must not see.
+    if (late_method)
+    {
+        constantpool_get(constpool, size)->data.method._class = 1;
+    }
+    return constpool;
+}
+
+static void assert_same_vtables(ConstantPool *expected, ConstantPool *actual)
+{
+    for (uint32_t i = 1; i <= expected->length; i++)
+    {
+        ConstantPoolEntry *entry = constantpool_get(expected, i);
+        if (entry->type == TYPE_CLASS)
+        {
+            ConstantPoolEntryClass *_class = &constantpool_get(actual, i)->data._class;
+            assert_int_equal(entry->data._class.instance_size, _class->instance_size);
+            assert_int_equal(i, _class->index);
+            assert_true(_class->flags & CLASS_FLAG_LINKED);
+            assert_int_equal(entry->data._class.vtable->length, _class->vtable->length);
+            for (uint32_t j = 0; j < _class->vtable->length; j++)
+            {
+                assert_int_equal(entry->data._class.vtable->table[j].const_index, _class->vtable->table[j].const_index);
+            }
+        }
+        else if (entry->type == TYPE_FIELD)
+        {
+            assert_int_equal(entry->data.field.offset, constantpool_get(actual, i)->data.field.offset);
+        }
+    }
+}
+
+void constantpool_parallel_vtables_test(void **state)
+{
+    // Worker threads allocate vtables concurrently, which the cmocka allocators do not support.
+    Config saved = config;
+    config._malloc = malloc;
+    config._calloc = calloc;
+    config._realloc = realloc;
+    config._free = free;
+
+    for (int late_method = 0; late_method <= 1; late_method++)
+    {
+        ConstantPool *sequential = new_large_pool(8000, late_method);
+        constantpool_compute_vtables(sequential);
+        config.load_threads = 4;
+        ConstantPool *parallel = new_large_pool(8000, late_method);
+        constantpool_compute_vtables(parallel);
+        config.load_threads = 1;
+
+        assert_same_vtables(sequential, parallel);
+        VTable *animal = constantpool_get(parallel, 1)->data._class.vtable;
+        VTable *dog = constantpool_get(parallel, 5)->data._class.vtable;
+        assert_int_equal(late_method ? 11 : 3, vtable_get(animal, "jump"));
+        assert_int_equal(late_method ? 3 : 11, vtable_get(dog, "jump"));
+        assert_int_equal(6, vtable_get(dog, "makeSound"));
+        constantpool_free(sequential);
+        constantpool_free(parallel);
+    }
+
+    config = saved;
+}
+
 int main()
 {
     set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
@@ -125,6 +370,10 @@ int main()
             cmocka_unit_test(constantpool_add_get_test),
             cmocka_unit_test(constantpool_compute_vtables_test),
             cmocka_unit_test(constantpool_compute_vtables_depth_three_test),
+            cmocka_unit_test(constantpool_instance_size_test),
+            cmocka_unit_test(constantpool_compute_layouts_test),
+            cmocka_unit_test(constantpool_lazy_test),
+            cmocka_unit_test(constantpool_parallel_vtables_test),
         };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -4,11 +4,12 @@
 #include "evalstack.h"
 
 #define STACK_INITIAL_CAPACITY 8
+#define STACK_MAX_DEPTH 1024
 
 void evalstack_new_test(void **state)
 {
-    EvalStack *evalstack = evalstack_new();
-    assert_int_equal(STACK_INITIAL_CAPACITY, evalstack->capacity);
+    EvalStack *evalstack = evalstack_new(STACK_MAX_DEPTH);
+    assert_int_equal(STACK_MAX_DEPTH, evalstack->capacity);
     assert_int_equal(0, evalstack->length);
     assert_int_equal(sizeof(EvalStackElement), evalstack->elemsize);
     evalstack_free(evalstack);
@@ -16,15 +17,15 @@ void evalstack_new_test(void **state)
 
 void evalstack_single_push_pop_test(void **state)
 {
-    EvalStack *evalstack = evalstack_new();
+    EvalStack *evalstack = evalstack_new(STACK_MAX_DEPTH);
     EvalStackElement element = {.integer = 100};
     evalstack_push(evalstack, element);
-    assert_int_equal(STACK_INITIAL_CAPACITY, evalstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, evalstack->capacity);
     assert_int_equal(1, evalstack->length);
     assert_int_equal(sizeof(EvalStackElement), evalstack->elemsize);
     assert_int_equal(100, evalstack_top(evalstack).integer);
     evalstack_pop(evalstack);
-    assert_int_equal(STACK_INITIAL_CAPACITY, evalstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, evalstack->capacity);
     assert_int_equal(0, evalstack->length);
     assert_int_equal(sizeof(EvalStackElement), evalstack->elemsize);
     evalstack_free(evalstack);
@@ -32,7 +33,8 @@ void evalstack_single_push_pop_test(void **state)
 
 void evalstack_multiple_push_pop_test(void **state)
 {
-    EvalStack *evalstack = evalstack_new();
+    EvalStack *evalstack = evalstack_new(STACK_MAX_DEPTH);
+    void *elements = evalstack->elements;
 
     for (int i = 0; i <= 500; i++)
     {
@@ -40,7 +42,8 @@ void evalstack_multiple_push_pop_test(void **state)
         evalstack_push(evalstack, (EvalStackElement){.integer = i});
     }
 
-    assert_int_equal(512, evalstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, evalstack->capacity);
+    assert_ptr_equal(elements, evalstack->elements);
 
     for (int i = 500; i >= 0; i--)
     {
@@ -49,7 +52,7 @@ void evalstack_multiple_push_pop_test(void **state)
         assert_int_equal(i, evalstack->length);
     }
 
-    assert_int_equal(STACK_INITIAL_CAPACITY, evalstack->capacity);
+    assert_int_equal(STACK_MAX_DEPTH, evalstack->capacity);
 
     evalstack_free(evalstack);
 }
@@ -1,8 +1,11 @@
+#include <string.h>
+
 #include "unit_testing.h"
 
 #include "config.h"
 #include "object.h"
 #include "string_class.h"
+#include "string_builder_class.h"
 #include "executor.h"
 
 #define STACK_INITIAL_CAPACITY 8
@@ -49,6 +52,7 @@ static int executor_with_main_method_setup(void **state)
     constantpool_add(constpool, 19, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "Bye bye!"}});
 
     constantpool_compute_vtables(constpool);
+    constantpool_create_strings(constpool);
     // Should be enough instruction space to perform all the tests we want.
     InstructionStream *inststream = inststream_new(100);
     inststream->instructions[0] = (Instruction){.opcode = NEW, .operand = 1};
@@ -85,7 +89,7 @@ void executor_main_method_test(void **state)
     assert_false(executor_step(executor)); // RETURN
     assert_int_equal(0, executor->callstack->length);
     assert_int_equal(0, executor->evalstack->length);
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -103,7 +107,7 @@ void executor_push_test(void **state)
     assert_int_equal(1, executor->evalstack->length);
     assert_int_equal(123, evalstack_top(executor->evalstack).integer);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -124,7 +128,7 @@ void executor_push_and_pop_test(void **state)
     assert_true(executor_step(executor)); // POP
     assert_int_equal(0, executor->evalstack->length);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -150,7 +154,7 @@ void executor_arithmetic_test(void **state, int32_t first, int32_t second, uint8
     assert_int_equal(1, executor->evalstack->length);
     assert_int_equal(result, evalstack_top(executor->evalstack).integer);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -196,7 +200,7 @@ void executor_jump_skip_test(void **state)
     assert_int_equal(1, executor->evalstack->length);
     assert_int_equal(25, evalstack_top(executor->evalstack).integer);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -220,7 +224,7 @@ void executor_jump_no_effect_test(void **state)
     assert_int_equal(2, executor->evalstack->length);
     assert_int_equal(25, evalstack_top(executor->evalstack).integer);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -246,7 +250,7 @@ void executor_cond_jump_true_test(void **state, int32_t first, int32_t second, u
     assert_false(executor_step(executor)); // RETURN
     assert_int_equal(1, executor->evalstack->length);
     assert_int_equal(1, evalstack_top(executor->evalstack).integer);
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -273,7 +277,7 @@ void executor_cond_jump_false_test(void **state, int32_t first, int32_t second,
     assert_false(executor_step(executor)); // RETURN
     assert_int_equal(1, executor->evalstack->length);
     assert_int_equal(0, evalstack_top(executor->evalstack).integer);
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -375,7 +379,7 @@ void executor_dup_test(void **state)
     assert_int_equal(2, executor->evalstack->length);
     assert_int_equal(123, evalstack_top(executor->evalstack).integer);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -391,11 +395,16 @@ void executor_new_object_test(void **state)
     assert_true(executor_step(executor)); // CALL <main>
     assert_true(executor_step(executor)); // NEW 2
     assert_int_equal(1, executor->evalstack->length);
-    assert_int_equal(3, *(uint32_t *)evalstack_top(executor->evalstack).pointer);
+    void *object = evalstack_top(executor->evalstack).pointer;
+    assert_int_equal(3, object_get_class(object));
+    // The object points to its class entry and its fields are aligned.
+    assert_ptr_equal(&constantpool_get(cmocka_state->constpool, 3)->data._class, object_get_runtime_class(object));
+    assert_int_equal(0, (uintptr_t)object_get_field(object, 0) % sizeof(EvalStackElement));
+    assert_int_equal(3, heap_get_header(object)->fields);
     // Free the allocated object.
-    config._free(evalstack_top(executor->evalstack).pointer);
+    object_free(executor->heap, evalstack_top(executor->evalstack).pointer);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -455,11 +464,11 @@ void executor_push_and_pop_fields_test(void **state)
     assert_int_equal(0, executor->evalstack->length);
 
     // Free the allocated object.
-    object_free(object);
+    object_free(executor->heap, object);
 
     assert_false(executor_step(executor)); // RETURN
 
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
 
     executor_free(executor);
 }
@@ -484,7 +493,7 @@ void executor_push_and_pop_var_test(void **state)
     assert_int_equal(100, evalstack_top(executor->evalstack).integer);
     assert_int_equal(100, callstack_top(executor->callstack).vars[0].integer);
     assert_false(executor_step(executor)); // RETURN
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -529,10 +538,10 @@ void executor_call_max_test(void **state, int32_t a, int32_t b)
     assert_int_equal(a > b ? a : b, evalstack_top(executor->evalstack).integer);
 
     // Free the allocated object.
-    object_free(object);
+    object_free(executor->heap, object);
     assert_false(executor_step(executor)); // RETURN
 
-    object_free(main_obj);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -593,8 +602,8 @@ void executor_call_fac_test(void **state, int32_t n, int32_t fac_of_n)
     assert_int_equal(fac_of_n, evalstack_top(executor->evalstack).integer);
 
     // Free the allocated object.
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -670,8 +679,8 @@ void executor_polymorphism_test(void **state, uint32_t class_type, uint32_t soun
     assert_int_equal(executor->inststream->current, jump_addr);
     assert_true(executor_step(executor));  // RETURN
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -708,10 +717,45 @@ void executor_string_test(void **state)
     void *string_object_2 = evalstack_top(executor->evalstack).pointer;
     assert_string_equal("Bye bye!", string_get_value(string_object_2));
     assert_false(executor_step(executor)); // RETURN
-    object_free(string_object);
-    object_free(string_object_2);
-    object_free(main_obj);
+    object_free(executor->heap, string_object);
+    object_free(executor->heap, string_object_2);
+    object_free(executor->heap, main_obj);
+    executor_free(executor);
+}
+
+void executor_shared_string_constants_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    Instruction *instructions = executor->inststream->instructions;
+    instructions[2] = (Instruction){.opcode = PUSH_STRING, .operand = 18};
+    instructions[3] = (Instruction){.opcode = PUSH_STRING, .operand = 18};
+    instructions[4] = (Instruction){.opcode = RETURN, .operand = 0};
+    // The program counter lives in the instruction stream, so the second executor runs the same program from a copy.
+    InstructionStream *inststream_2 = inststream_new(5);
+    memcpy(inststream_2->instructions, instructions, 5 * sizeof(Instruction));
+    Executor *executor_2 = executor_new(cmocka_state->constpool, inststream_2);
+    executor_step(executor);  // NEW <Main>
+    executor_step(executor);  // CALL <main>
+    executor_step(executor);  // PUSH_STRING 18
+    void *string_object = evalstack_top(executor->evalstack).pointer;
+    executor_step(executor);  // PUSH_STRING 18
+    // Executing the same PUSH_STRING again does not allocate, it pushes the constant created when the program was loaded.
+    assert_ptr_equal(string_object, evalstack_top(executor->evalstack).pointer);
+    assert_ptr_equal(constantpool_get(cmocka_state->constpool, 18)->data.string.object, string_object);
+    assert_true(heap_get_header(string_object)->flags & OBJECT_FLAG_IMMORTAL);
+    executor_step(executor_2); // NEW <Main>
+    executor_step(executor_2); // CALL <main>
+    executor_step(executor_2); // PUSH_STRING 18
+    assert_ptr_equal(string_object, evalstack_top(executor_2->evalstack).pointer);
+    // Full collections neither move nor free the constant.
+    executor_collect_garbage(executor);
+    executor_collect_garbage(executor_2);
+    assert_string_equal("Hello!", string_get_value(string_object));
     executor_free(executor);
+    executor_free(executor_2);
+    inststream_free(inststream_2);
+    assert_string_equal("Hello!", string_get_value(string_object));
 }
 
 void executor_new_console_test(void **state)
@@ -728,8 +772,8 @@ void executor_new_console_test(void **state)
     void *object = evalstack_top(executor->evalstack).pointer;
     assert_int_equal(CONSTPOOL_CLASS_CONSOLE, object_get_class(object));
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -756,9 +800,9 @@ void executor_call_console_println_test(void **state)
     assert_true(executor_step(executor)); // PUSH 123
     assert_int_equal(1, executor->evalstack->length);
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(string_object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, string_object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -776,8 +820,8 @@ void executor_new_string_builder_test(void **state)
     void *object = evalstack_top(executor->evalstack).pointer;
     assert_int_equal(CONSTPOOL_CLASS_STRING_BUILDER, object_get_class(object));
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -799,8 +843,8 @@ void executor_string_builder_to_string_test(void **state)
     assert_int_equal(1, executor->evalstack->length);
     assert_string_equal("", string_get_value(string_object));
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -826,12 +870,58 @@ void executor_string_builder_append_string_test(void **state)
     assert_true(executor_step(executor)); // CALL Stringbuilder.toString()
     assert_string_equal("Hello!", string_get_value(evalstack_top(executor->evalstack).pointer));
     assert_false(executor_step(executor)); // RETURN
-    object_free(string_object);
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, string_object);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
+void executor_string_inline_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *string_object = string_new(heap, "Hello!");
+    void *string_object_2 = string_new_with_length(heap, "Hello! Bye bye!", 6);
+    void *string_object_3 = string_new_immortal("Hello!");
+    // The characters are stored right after the length.
+    assert_ptr_equal((char *)string_object + offsetof(String, value), string_get_value(string_object));
+    assert_int_equal(6, string_length(string_object));
+    assert_string_equal("Hello!", string_get_value(string_object_2));
+    assert_int_equal(CONSTPOOL_CLASS_STRING, object_get_class(string_object_2));
+    assert_int_equal(0, heap_get_header(string_object)->fields);
+    assert_int_equal(string_hash(string_object), string_hash(string_object_2));
+    assert_int_equal(string_hash(string_object), string_hash(string_object_3));
+    assert_true(string_hash(string_object) != string_hash(string_new(heap, "Bye bye!")));
+    string_free_immortal(string_object_3);
+    heap_free(heap);
+}
+
+void executor_string_builder_copy_on_write_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *string_builder = string_builder_new_with_capacity(heap, 4);
+    assert_int_equal(4, string_builder_capacity(string_builder));
+    string_builder_append_bool(heap, string_builder, true);
+    assert_int_equal(4, string_builder_capacity(string_builder));
+    string_builder_append_int(heap, string_builder, 42);
+    // A full buffer grows to at least the default capacity.
+    assert_int_equal(STRING_BUILDER_DEFAULT_CAPACITY, string_builder_capacity(string_builder));
+    assert_int_equal(6, string_builder_length(string_builder));
+    void *string_object = string_builder_to_string(string_builder);
+    assert_string_equal("true42", string_get_value(string_object));
+    // Until the next append, toString returns the same string, which shares the characters of the builder.
+    assert_ptr_equal(string_object, string_builder_to_string(string_builder));
+    assert_ptr_equal(object_get_field(string_builder, 0)->pointer, string_object);
+    string_builder_append_bool(heap, string_builder, false);
+    assert_string_equal("true42", string_get_value(string_object));
+    assert_string_equal("true42false", string_get_value(string_builder_to_string(string_builder)));
+    assert_int_equal(STRING_BUILDER_DEFAULT_CAPACITY, string_builder_capacity(string_builder));
+    // After that, the capacity doubles whenever the buffer is full.
+    string_builder_append_int(heap, string_builder, 123456789);
+    assert_int_equal(2 * STRING_BUILDER_DEFAULT_CAPACITY, string_builder_capacity(string_builder));
+    assert_string_equal("true42false123456789", string_get_value(string_builder_to_string(string_builder)));
+    heap_free(heap);
+}
+
 void executor_string_builder_append_string_twice_test(void **state)
 {
     CMockaState *cmocka_state = *state;
@@ -858,10 +948,10 @@ void executor_string_builder_append_string_twice_test(void **state)
     assert_true(executor_step(executor)); // CALL Stringbuilder.toString()
     assert_string_equal("Hello!Bye bye!", string_get_value(evalstack_top(executor->evalstack).pointer));
     assert_false(executor_step(executor)); // RETURN
-    object_free(string_object);
-    object_free(string_object_2);
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, string_object);
+    object_free(executor->heap, string_object_2);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -886,8 +976,8 @@ void executor_string_builder_append_bool_test(void **state, bool bool_value, con
     assert_true(executor_step(executor)); // CALL Stringbuilder.toString()
     assert_string_equal(result, string_get_value(evalstack_top(executor->evalstack).pointer));
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -917,8 +1007,8 @@ void executor_string_builder_append_bool_twice_test(void **state, bool first_boo
     assert_true(executor_step(executor)); // CALL Stringbuilder.toString()
     assert_string_equal(result, string_get_value(evalstack_top(executor->evalstack).pointer));
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -973,8 +1063,8 @@ void executor_string_builder_append_int_test(void **state, int value, const char
     assert_true(executor_step(executor)); // CALL Stringbuilder.toString()
     assert_string_equal(result, string_get_value(evalstack_top(executor->evalstack).pointer));
     assert_false(executor_step(executor)); // RETURN
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
     executor_free(executor);
 }
 
@@ -1027,9 +1117,239 @@ void executor_string_builder_append_string_bool_int_test(void **state)
     assert_true(executor_step(executor)); // CALL Stringbuilder.toString()
     assert_string_equal("Hello!true123", string_get_value(evalstack_top(executor->evalstack).pointer));
     assert_false(executor_step(executor)); // RETURN
-    object_free(string_object);
-    object_free(object);
-    object_free(main_obj);
+    object_free(executor->heap, string_object);
+    object_free(executor->heap, object);
+    object_free(executor->heap, main_obj);
+    executor_free(executor);
+}
+
+void executor_garbage_collection_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    size_t gc_threshold = config.gc_threshold;
+    size_t nursery_size = config.nursery_size;
+    config.gc_threshold = 1024;
+    config.nursery_size = 4096;
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    Instruction *instructions = executor->inststream->instructions;
+    instructions[2] = (Instruction){.opcode = NEW, .operand = CONSTPOOL_CLASS_STRING_BUILDER};
+    instructions[3] = (Instruction){.opcode = POP_VAR, .operand = 1};
+    instructions[4] = (Instruction){.opcode = PUSH, .operand = 0};
+    instructions[5] = (Instruction){.opcode = PUSH_STRING, .operand = 18};
+    instructions[6] = (Instruction){.opcode = POP, .operand = 0};
+    instructions[7] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[8] = (Instruction){.opcode = PUSH_STRING, .operand = 19};
+    instructions[9] = (Instruction){.opcode = CALL, .operand = CONSTPOOL_METHOD_STRING_BUILDER_APPEND_STRING};
+    instructions[10] = (Instruction){.opcode = POP, .operand = 0};
+    instructions[11] = (Instruction){.opcode = PUSH, .operand = 1};
+    instructions[12] = (Instruction){.opcode = ADD, .operand = 0};
+    instructions[13] = (Instruction){.opcode = DUP, .operand = 0};
+    instructions[14] = (Instruction){.opcode = PUSH, .operand = 200};
+    instructions[15] = (Instruction){.opcode = JUMP_LT, .operand = 5};
+    instructions[16] = (Instruction){.opcode = POP, .operand = 0};
+    instructions[17] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[18] = (Instruction){.opcode = CALL, .operand = CONSTPOOL_METHOD_STRING_BUILDER_TO_STRING};
+    instructions[19] = (Instruction){.opcode = RETURN, .operand = 0};
+    executor_step_all(executor);
+    // The string builder lives in a local variable, so it and its current string must survive every collection.
+    const char *value = string_get_value(evalstack_top(executor->evalstack).pointer);
+    assert_int_equal(200 * strlen("Bye bye!"), strlen(value));
+    assert_string_equal("Bye bye!", value + 199 * strlen("Bye bye!"));
+    assert_true(executor->heap->stats.minor_collections > 0);
+    assert_true(executor->heap->stats.collections > 0);
+    assert_true(executor->heap->stats.objects_freed > 0);
+    executor_free(executor);
+    config.gc_threshold = gc_threshold;
+    config.nursery_size = nursery_size;
+}
+
+void executor_packed_fields_test(void **state)
+{
+    ConstantPool *constpool = constantpool_new(7);
+    constantpool_add(constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, 2, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = 1, .address = 2, .args = 1, .locals = 0}});
+    constantpool_add(constpool, 3, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Pair", .fields = 3, .methods = 0, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, 4, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "count", ._class = 3, .index = 0}});
+    constantpool_add(constpool, 5, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "name", ._class = 3, .index = 1}});
+    constantpool_add(constpool, 6, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "done", ._class = 3, .index = 2, .type = FIELD_TYPE_BOOL}});
+    constantpool_add(constpool, 7, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "Hello!"}});
+    Instruction program[] = {
+        {NEW, 1}, {CALL, 2},
+        {NEW, 3},
+        {DUP, 0}, {PUSH, -7}, {POP_FIELD, 4},
+        {DUP, 0}, {NEW, CONSTPOOL_CLASS_STRING_BUILDER}, {POP_FIELD, 5},
+        {DUP, 0}, {PUSH, 2}, {POP_FIELD, 6},
+        {DUP, 0}, {PUSH_FIELD, 4},
+        {RETURN, 0},
+    };
+    InstructionStream *inststream = inststream_new(sizeof(program) / sizeof(Instruction));
+    memcpy(inststream->instructions, program, sizeof(program));
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    constantpool_create_strings(constpool);
+
+    Executor *executor = executor_new(constpool, inststream);
+    for (int i = 0; i < 14; i++)
+    {
+        assert_true(executor_step(executor));
+    }
+    assert_int_equal(-7, evalstack_top(executor->evalstack).integer);
+
+    // The integer and the boolean are packed behind the reference, and the collector only follows the reference.
+    executor_collect_garbage(executor);
+    void *pair = ((EvalStackElement *)executor->evalstack->elements)[executor->evalstack->length - 2].pointer;
+    ConstantPoolEntryClass *_class = object_get_runtime_class(pair);
+    assert_int_equal(OBJECT_INSTANCE_SIZE(0) + 8 + 4 + 1 + 1, _class->instance_size);
+    assert_int_equal(-7, object_get_field(pair, 0)->integer);
+    assert_int_equal(CONSTPOOL_CLASS_STRING_BUILDER, object_get_class(object_get_field(pair, 1)->pointer));
+    assert_true(object_is_reference(pair, 1));
+    assert_false(object_is_reference(pair, 0));
+    assert_int_equal(1, *(uint8_t *)object_get_field(pair, 2));
+    object_set_field(executor->heap, pair, 0, (EvalStackElement){.integer = 42}, false);
+    assert_int_equal(42, object_get_field(pair, 0)->integer);
+    assert_int_equal(1, *(uint8_t *)object_get_field(pair, 2));
+
+    executor_free(executor);
+    inststream_free(inststream);
+    constantpool_free(constpool);
+}
+
+void executor_call_stack_overflow_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    Executor *executor = executor_new_with_depth(cmocka_state->constpool, cmocka_state->inststream, 100);
+    Instruction *instructions = executor->inststream->instructions;
+    instructions[2] = (Instruction){.opcode = NEW, .operand = 9};
+    instructions[3] = (Instruction){.opcode = PUSH, .operand = 1};
+    instructions[4] = (Instruction){.opcode = CALL, .operand = 10};
+    instructions[5] = (Instruction){.opcode = RETURN, .operand = 0};
+
+    // Factorial.fac(n) without a base case.
+    instructions[30] = (Instruction){.opcode = PUSH_VAR, .operand = 0};
+    instructions[31] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[32] = (Instruction){.opcode = CALL, .operand = 10};
+    instructions[33] = (Instruction){.opcode = RETURN, .operand = 0};
+
+    executor_step_all(executor);
+    assert_int_equal(EXECUTOR_STACK_OVERFLOW, executor->error);
+    assert_int_equal(100, executor->callstack->length);
+    assert_int_equal(32, executor->inststream->current);
+    assert_false(executor_step(executor));
+
+    // The executor can run again after a reset.
+    executor_reset(executor);
+    assert_int_equal(EXECUTOR_OK, executor->error);
+    assert_int_equal(0, executor->callstack->length);
+    executor_free(executor);
+}
+
+void executor_eval_stack_overflow_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    Executor *executor = executor_new_with_depth(cmocka_state->constpool, cmocka_state->inststream, 100);
+    Instruction *instructions = executor->inststream->instructions;
+    instructions[2] = (Instruction){.opcode = PUSH, .operand = 1};
+    instructions[3] = (Instruction){.opcode = JUMP, .operand = 2};
+
+    executor_step_all(executor);
+    assert_int_equal(EXECUTOR_STACK_OVERFLOW, executor->error);
+    assert_int_equal(100, executor->evalstack->length);
+    assert_int_equal(100, executor->evalrefs->length);
+    assert_int_equal(1, evalstack_top(executor->evalstack).integer);
+    executor_free(executor);
+}
+
+void executor_stacks_not_reserved_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    // The evaluation and call stacks do not fit in the address space at this depth, the reference stack may and is released.
+    Executor *executor = executor_new_with_depth(cmocka_state->constpool, cmocka_state->inststream, (size_t)1 << 43);
+    assert_null(executor);
+}
+
+void executor_heap_limit_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    config.heap_limit = 64 * 1024;
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    config.heap_limit = 0;
+    Instruction *instructions = executor->inststream->instructions;
+    // Keeps every object alive in a linked list.
+    instructions[2] = (Instruction){.opcode = NEW, .operand = 3};
+    instructions[3] = (Instruction){.opcode = DUP, .operand = 0};
+    instructions[4] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[5] = (Instruction){.opcode = POP_FIELD, .operand = 4};
+    instructions[6] = (Instruction){.opcode = POP_VAR, .operand = 1};
+    instructions[7] = (Instruction){.opcode = JUMP, .operand = 2};
+    executor_step_all(executor);
+    assert_int_equal(EXECUTOR_OUT_OF_MEMORY, executor->error);
+    assert_true(executor_live_bytes(executor) > 64 * 1024);
+    assert_true(executor_allocated_bytes(executor) > 64 * 1024);
+    assert_true(executor->heap->stats.collections > 0);
+    executor_free(executor);
+}
+
+void executor_heap_limit_garbage_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    config.heap_limit = 64 * 1024;
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    config.heap_limit = 0;
+    Instruction *instructions = executor->inststream->instructions;
+    // Allocates far more than the limit, but only ever keeps one object alive.
+    instructions[2] = (Instruction){.opcode = PUSH, .operand = 0};
+    instructions[3] = (Instruction){.opcode = NEW, .operand = 3};
+    instructions[4] = (Instruction){.opcode = POP, .operand = 0};
+    instructions[5] = (Instruction){.opcode = PUSH, .operand = 1};
+    instructions[6] = (Instruction){.opcode = ADD, .operand = 0};
+    instructions[7] = (Instruction){.opcode = DUP, .operand = 0};
+    instructions[8] = (Instruction){.opcode = PUSH, .operand = 10000};
+    instructions[9] = (Instruction){.opcode = JUMP_LT, .operand = 3};
+    instructions[10] = (Instruction){.opcode = RETURN, .operand = 0};
+    executor_step_all(executor);
+    assert_int_equal(EXECUTOR_OK, executor->error);
+    assert_int_equal(10000, evalstack_top(executor->evalstack).integer);
+    assert_true(executor_allocated_bytes(executor) > 10000 * OBJECT_INSTANCE_SIZE(3));
+    assert_true(executor_live_bytes(executor) <= 64 * 1024);
+    executor_free(executor);
+}
+
+void executor_arena_reset_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    config.arena_chunk_size = 1024;
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    config.arena_chunk_size = 0;
+    Instruction *instructions = executor->inststream->instructions;
+    instructions[2] = (Instruction){.opcode = NEW, .operand = CONSTPOOL_CLASS_STRING_BUILDER};
+    instructions[3] = (Instruction){.opcode = POP_VAR, .operand = 1};
+    instructions[4] = (Instruction){.opcode = PUSH, .operand = 0};
+    instructions[5] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[6] = (Instruction){.opcode = PUSH_STRING, .operand = 19};
+    instructions[7] = (Instruction){.opcode = CALL, .operand = CONSTPOOL_METHOD_STRING_BUILDER_APPEND_STRING};
+    instructions[8] = (Instruction){.opcode = POP, .operand = 0};
+    instructions[9] = (Instruction){.opcode = PUSH, .operand = 1};
+    instructions[10] = (Instruction){.opcode = ADD, .operand = 0};
+    instructions[11] = (Instruction){.opcode = DUP, .operand = 0};
+    instructions[12] = (Instruction){.opcode = PUSH, .operand = 50};
+    instructions[13] = (Instruction){.opcode = JUMP_LT, .operand = 5};
+    instructions[14] = (Instruction){.opcode = POP, .operand = 0};
+    instructions[15] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[16] = (Instruction){.opcode = CALL, .operand = CONSTPOOL_METHOD_STRING_BUILDER_TO_STRING};
+    instructions[17] = (Instruction){.opcode = RETURN, .operand = 0};
+    executor_step_all(executor);
+    assert_int_equal(50 * strlen("Bye bye!"), strlen(string_get_value(evalstack_top(executor->evalstack).pointer)));
+    Arena *arena = executor->heap->arena;
+    size_t bytes_allocated = arena->bytes_allocated;
+    assert_true(arena->chunks_count > 1);
+    assert_int_equal(0, executor->heap->stats.minor_collections);
+    // Everything the first run allocated is released and the second run allocates exactly the same.
+    executor_reset(executor);
+    assert_int_equal(1, arena->chunks_count);
+    assert_int_equal(0, executor->evalstack->length);
+    executor_step_all(executor);
+    assert_int_equal(50 * strlen("Bye bye!"), strlen(string_get_value(evalstack_top(executor->evalstack).pointer)));
+    assert_int_equal(bytes_allocated, arena->bytes_allocated);
     executor_free(executor);
 }
 
@@ -1086,11 +1406,14 @@ int main()
             cmocka_unit_test_setup_teardown(executor_polymorphism_dog_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_polymorphism_cat_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_string_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test_setup_teardown(executor_shared_string_constants_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_new_console_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_call_console_println_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_new_string_builder_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_string_builder_to_string_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_string_builder_append_string_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test(executor_string_inline_test),
+            cmocka_unit_test(executor_string_builder_copy_on_write_test),
             cmocka_unit_test_setup_teardown(executor_string_builder_append_string_twice_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_string_builder_append_bool_true_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_string_builder_append_bool_false_test, executor_with_main_method_setup, executor_with_main_method_teardown),
@@ -1103,6 +1426,14 @@ int main()
             cmocka_unit_test_setup_teardown(executor_string_builder_append_int_123456789_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_string_builder_append_int_minus_123456789_test, executor_with_main_method_setup, executor_with_main_method_teardown),
             cmocka_unit_test_setup_teardown(executor_string_builder_append_string_bool_int_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test_setup_teardown(executor_garbage_collection_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test(executor_packed_fields_test),
+            cmocka_unit_test_setup_teardown(executor_call_stack_overflow_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test_setup_teardown(executor_eval_stack_overflow_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test_setup_teardown(executor_stacks_not_reserved_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test_setup_teardown(executor_heap_limit_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test_setup_teardown(executor_heap_limit_garbage_test, executor_with_main_method_setup, executor_with_main_method_teardown),
+            cmocka_unit_test_setup_teardown(executor_arena_reset_test, executor_with_main_method_setup, executor_with_main_method_teardown),
         };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,467 @@
+#include <string.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "object.h"
+#include "string_class.h"
+#include "heap.h"
+
+#define STACK_INITIAL_CAPACITY 8
+
+static size_t count_old_objects(Heap *heap)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < HEAP_REGIONS; i++)
+    {
+        for (HeapBlock *block = heap->old[i].next; block != &heap->old[i]; block = block->next)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+// The collector only looks at the field count, so the tests use one class per field count.
+static void *new_object(Heap *heap, uint32_t fields)
+{
+    static ConstantPoolEntryClass classes[HEAP_LARGE_OBJECT_SIZE / sizeof(EvalStackElement) + 1];
+    classes[fields] = (ConstantPoolEntryClass){.index = 1, .instance_fields = fields, .instance_size = OBJECT_INSTANCE_SIZE(fields)};
+    return object_new(heap, &classes[fields]);
+}
+
+static void no_roots(Heap *heap, HeapSlotVisitor visit, void *context)
+{
+}
+
+static void context_root(Heap *heap, HeapSlotVisitor visit, void *context)
+{
+    visit(heap, context);
+}
+
+void heap_alloc_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *object = new_object(heap, 2);
+    assert_true(heap_in_nursery(heap, object));
+    assert_int_equal(1, object_get_class(object));
+    assert_int_equal(2, heap_get_header(object)->fields);
+    assert_false(object_is_reference(object, 0));
+    assert_false(object_is_reference(object, 1));
+    void *large_object = new_object(heap, HEAP_LARGE_OBJECT_SIZE / sizeof(EvalStackElement));
+    assert_false(heap_in_nursery(heap, large_object));
+    assert_true(heap_get_header(large_object)->flags & OBJECT_FLAG_OLD);
+    assert_int_equal(1, count_old_objects(heap));
+    heap_free(heap);
+}
+
+void heap_minor_collection_test(void **state)
+{
+    Heap *heap = heap_new();
+    new_object(heap, 2);
+    void *object = new_object(heap, 2);
+    void *string_object = string_new(heap, "Hello!");
+    object_set_field(heap, object, 0, (EvalStackElement){.pointer = string_object}, true);
+    object_set_field(heap, object, 1, (EvalStackElement){.integer = 7}, false);
+    void *old_address = object;
+    heap_collect(heap, context_root, &object, false);
+    assert_true(object != old_address);
+    assert_true(heap_in_nursery(heap, object));
+    assert_int_equal(1, heap_get_header(object)->age);
+    assert_string_equal("Hello!", string_get_value(object_get_field(object, 0)->pointer));
+    assert_int_equal(7, object_get_field(object, 1)->integer);
+    assert_int_equal(1, heap->stats.minor_collections);
+    assert_int_equal(0, heap->stats.collections);
+    // Only the object and the string survive, the characters are stored inline in the string.
+    size_t survivors = 0;
+    for (char *top = heap->from_space; top < heap->nursery_top; top += ((ObjectHeader *)top)->size)
+    {
+        survivors++;
+    }
+    assert_int_equal(2, survivors);
+    heap_free(heap);
+}
+
+void heap_promotion_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *object = new_object(heap, 0);
+    for (uint32_t i = 1; i < config.gc_promotion_age; i++)
+    {
+        heap_collect(heap, context_root, &object, false);
+        assert_true(heap_in_nursery(heap, object));
+    }
+    heap_collect(heap, context_root, &object, false);
+    assert_false(heap_in_nursery(heap, object));
+    assert_true(heap_get_header(object)->flags & OBJECT_FLAG_OLD);
+    assert_int_equal(1, count_old_objects(heap));
+    assert_true(heap->stats.bytes_promoted > 0);
+    heap_free(heap);
+}
+
+void heap_write_barrier_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *object = new_object(heap, 1);
+    heap_collect(heap, context_root, &object, true);
+    assert_true(heap_get_header(object)->flags & OBJECT_FLAG_OLD);
+    assert_false(heap_get_header(object)->flags & OBJECT_FLAG_REMEMBERED);
+    object_set_field(heap, object, 0, (EvalStackElement){.pointer = string_new(heap, "Hello!")}, true);
+    assert_true(heap_get_header(object)->flags & OBJECT_FLAG_REMEMBERED);
+    assert_int_equal(1, heap->remembered->length);
+    // The old object is not a root, but the remembered set must keep the young string alive and update the field.
+    void *old_object = object;
+    heap_collect(heap, no_roots, NULL, false);
+    assert_string_equal("Hello!", string_get_value(object_get_field(old_object, 0)->pointer));
+    assert_true(heap_in_nursery(heap, object_get_field(old_object, 0)->pointer));
+    assert_int_equal(1, heap->remembered->length);
+    heap_free(heap);
+}
+
+void heap_full_collection_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *first = new_object(heap, 1);
+    void *second = new_object(heap, 1);
+    object_set_field(heap, first, 0, (EvalStackElement){.pointer = second}, true);
+    object_set_field(heap, second, 0, (EvalStackElement){.pointer = first}, true);
+    string_new(heap, "Garbage");
+    heap_collect(heap, context_root, &first, true);
+    assert_int_equal(2, count_old_objects(heap));
+    assert_int_equal(heap->from_space, heap->nursery_top);
+    assert_ptr_equal(first, object_get_field(object_get_field(first, 0)->pointer, 0)->pointer);
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(0, count_old_objects(heap));
+    assert_int_equal(0, heap->old_bytes);
+    assert_int_equal(2, heap->stats.collections);
+    assert_int_equal(2, heap->stats.objects_freed);
+    assert_true(heap->stats.bytes_freed > 0);
+    heap_free(heap);
+}
+
+void heap_non_reference_field_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *object = new_object(heap, 1);
+    object_set_field(heap, object, 0, (EvalStackElement){.pointer = new_object(heap, 0)}, true);
+    // Overwriting the field with an integer must drop the reference.
+    object_set_field(heap, object, 0, (EvalStackElement){.integer = 5}, false);
+    heap_collect(heap, context_root, &object, true);
+    assert_int_equal(1, count_old_objects(heap));
+    assert_int_equal(5, object_get_field(object, 0)->integer);
+    heap_free(heap);
+}
+
+void heap_push_pop_root_test(void **state)
+{
+    Heap *heap = heap_new();
+    void *object = new_object(heap, 0);
+    heap_push_root(heap, &object);
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(1, count_old_objects(heap));
+    heap_pop_root(heap);
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(0, count_old_objects(heap));
+    heap_free(heap);
+}
+
+void heap_should_collect_test(void **state)
+{
+    size_t nursery_size = config.nursery_size;
+    config.nursery_size = 1024;
+    Heap *heap = heap_new();
+    assert_false(heap_should_collect(heap));
+    while (!heap_should_collect(heap))
+    {
+        new_object(heap, 4);
+    }
+    assert_true(heap->nursery_full);
+    heap_collect(heap, no_roots, NULL, false);
+    assert_false(heap_should_collect(heap));
+    heap_free(heap);
+    config.nursery_size = nursery_size;
+}
+
+void heap_incremental_marking_test(void **state)
+{
+    size_t mark_increment = config.gc_increment_size;
+    config.gc_increment_size = 10;
+    Heap *heap = heap_new();
+    void *list = NULL;
+    heap_push_root(heap, &list);
+    for (int i = 0; i < 100; i++)
+    {
+        void *node = new_object(heap, 1);
+        object_set_field(heap, node, 0, (EvalStackElement){.pointer = list}, true);
+        list = node;
+    }
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(100, count_old_objects(heap));
+    heap->next_collection = 0;
+    heap_collect(heap, no_roots, NULL, false);
+    assert_true(heap->marking);
+    size_t increments = 1;
+    while (heap->marking || heap->sweeping)
+    {
+        heap_collect(heap, no_roots, NULL, false);
+        increments++;
+    }
+    assert_true(increments >= 10);
+    assert_int_equal(100, count_old_objects(heap));
+    assert_int_equal(2, heap->stats.collections);
+    size_t pauses = 0;
+    for (int i = 0; i < HEAP_PAUSE_BUCKETS; i++)
+    {
+        pauses += heap->stats.pause_histogram[i];
+    }
+    assert_int_equal(increments + 1, pauses);
+    heap_pop_root(heap);
+    heap_free(heap);
+    config.gc_increment_size = mark_increment;
+}
+
+void heap_deletion_barrier_test(void **state)
+{
+    size_t mark_increment = config.gc_increment_size;
+    config.gc_increment_size = 1;
+    Heap *heap = heap_new();
+    void *first = new_object(heap, 2);
+    void *second = new_object(heap, 1);
+    void *third = new_object(heap, 0);
+    object_set_field(heap, first, 0, (EvalStackElement){.pointer = second}, true);
+    object_set_field(heap, second, 0, (EvalStackElement){.pointer = third}, true);
+    heap_push_root(heap, &first);
+    heap_collect(heap, no_roots, NULL, true);
+    heap->next_collection = 0;
+    heap_collect(heap, no_roots, NULL, false);
+    // The first object has been traced but the second one has not, so moving the third object behind the first one hides it from the marker.
+    second = object_get_field(first, 0)->pointer;
+    third = object_get_field(second, 0)->pointer;
+    object_set_field(heap, first, 1, (EvalStackElement){.pointer = third}, true);
+    object_set_field(heap, second, 0, (EvalStackElement){.integer = 0}, false);
+    object_set_field(heap, first, 0, (EvalStackElement){.integer = 0}, false);
+    while (heap->marking || heap->sweeping)
+    {
+        heap_collect(heap, no_roots, NULL, false);
+    }
+    // The second object was still reachable when marking started, it is only freed by the next cycle.
+    assert_int_equal(3, count_old_objects(heap));
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(2, count_old_objects(heap));
+    assert_ptr_equal(third, object_get_field(first, 1)->pointer);
+    heap_pop_root(heap);
+    heap_free(heap);
+    config.gc_increment_size = mark_increment;
+}
+
+void heap_allocate_black_test(void **state)
+{
+    size_t mark_increment = config.gc_increment_size;
+    config.gc_increment_size = 1;
+    Heap *heap = heap_new();
+    void *list = new_object(heap, 1);
+    object_set_field(heap, list, 0, (EvalStackElement){.pointer = new_object(heap, 0)}, true);
+    void *object = NULL;
+    heap_push_root(heap, &list);
+    heap_push_root(heap, &object);
+    heap_collect(heap, no_roots, NULL, true);
+    heap->next_collection = 0;
+    heap_collect(heap, no_roots, NULL, false);
+    assert_true(heap->marking);
+    object = new_object(heap, HEAP_LARGE_OBJECT_SIZE / sizeof(EvalStackElement));
+    assert_true(heap_get_header(object)->flags & OBJECT_FLAG_MARKED);
+    while (heap->marking || heap->sweeping)
+    {
+        heap_collect(heap, no_roots, NULL, false);
+    }
+    assert_int_equal(3, count_old_objects(heap));
+    assert_false(heap_get_header(object)->flags & OBJECT_FLAG_MARKED);
+    heap_pop_root(heap);
+    heap_pop_root(heap);
+    heap_free(heap);
+    config.gc_increment_size = mark_increment;
+}
+
+void heap_parallel_collection_test(void **state)
+{
+    // Worker threads free memory concurrently, which the cmocka allocators do not support.
+    Config saved = config;
+    config._malloc = malloc;
+    config._calloc = calloc;
+    config._realloc = realloc;
+    config._free = free;
+    config.nursery_size = 0;
+    config.gc_threads = 4;
+    Heap *heap = heap_new();
+    void *list = NULL;
+    heap_push_root(heap, &list);
+    for (int i = 0; i < 5000; i++)
+    {
+        void *node = new_object(heap, 2);
+        object_set_field(heap, node, 0, (EvalStackElement){.pointer = list}, true);
+        object_set_field(heap, node, 1, (EvalStackElement){.pointer = new_object(heap, 0)}, true);
+        new_object(heap, 1);
+        list = node;
+    }
+    assert_int_equal(15000, count_old_objects(heap));
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(10000, count_old_objects(heap));
+    assert_int_equal(5000, heap->stats.objects_freed);
+    list = object_get_field(list, 0)->pointer;
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(9998, count_old_objects(heap));
+    size_t old_bytes = heap->old_bytes;
+    config.gc_threads = 1;
+    heap_collect(heap, no_roots, NULL, true);
+    assert_int_equal(9998, count_old_objects(heap));
+    assert_int_equal(old_bytes, heap->old_bytes);
+    heap_pop_root(heap);
+    heap_free(heap);
+    config = saved;
+}
+
+void heap_accounting_test(void **state)
+{
+    Heap *heap = heap_new();
+    size_t size = (sizeof(ObjectHeader) + OBJECT_INSTANCE_SIZE(2) + 7) & ~(size_t)7;
+    void *object = NULL;
+    for (int i = 0; i < 10; i++)
+    {
+        object = new_object(heap, 2);
+    }
+    assert_int_equal(10 * size, heap_allocated_bytes(heap));
+    assert_int_equal(10 * size, heap_live_bytes(heap));
+    heap_account(heap, 100);
+    assert_int_equal(10 * size + 100, heap_live_bytes(heap));
+    heap_unaccount(heap, 100);
+    // Only the live bytes go down after a collection.
+    heap_collect(heap, context_root, &object, false);
+    assert_int_equal(size, heap_live_bytes(heap));
+    assert_int_equal(10 * size + 100, heap_allocated_bytes(heap));
+    assert_int_equal(10 * size + 100, heap->stats.bytes_allocated);
+    new_object(heap, 2);
+    assert_int_equal(11 * size + 100, heap_allocated_bytes(heap));
+    heap_free(heap);
+}
+
+void heap_limit_test(void **state)
+{
+    Config saved = config;
+    config.heap_limit = 16 * 1024;
+    Heap *heap = heap_new();
+    // The nursery takes at most half of the limit.
+    assert_int_equal(4 * 1024, heap->semispace_size);
+    void *list = NULL;
+    heap_push_root(heap, &list);
+    while (!heap->over_limit)
+    {
+        void *node = new_object(heap, 2);
+        object_set_field(heap, node, 0, (EvalStackElement){.pointer = list}, true);
+        list = node;
+        if (heap_should_collect(heap) && !heap->over_limit)
+        {
+            heap_collect(heap, no_roots, NULL, false);
+        }
+    }
+    assert_true(heap_should_collect(heap));
+    assert_true(heap_live_bytes(heap) > 16 * 1024);
+    // A collection that cannot free anything leaves the heap over the limit, dropping the list gets it back under.
+    heap_collect(heap, no_roots, NULL, false);
+    assert_true(heap->over_limit);
+    list = NULL;
+    heap_collect(heap, no_roots, NULL, false);
+    assert_false(heap->over_limit);
+    assert_int_equal(0, heap_live_bytes(heap));
+    heap_pop_root(heap);
+    heap_free(heap);
+    config = saved;
+}
+
+void heap_release_test(void **state)
+{
+    size_t mark_increment = config.gc_increment_size;
+    config.gc_increment_size = 1;
+    Heap *heap = heap_new();
+    void *object = new_object(heap, HEAP_LARGE_OBJECT_SIZE / sizeof(EvalStackElement));
+    size_t live_bytes = heap_live_bytes(heap);
+    object_free(heap, object);
+    assert_int_equal(live_bytes - sizeof(HeapBlock) - sizeof(ObjectHeader) - OBJECT_INSTANCE_SIZE(HEAP_LARGE_OBJECT_SIZE / sizeof(EvalStackElement)), heap_live_bytes(heap));
+    assert_int_equal(0, count_old_objects(heap));
+
+    // While sweeping, the object is left to the sweep instead.
+    void *list = NULL;
+    heap_push_root(heap, &list);
+    for (int i = 0; i < 100; i++)
+    {
+        void *node = new_object(heap, 1);
+        object_set_field(heap, node, 0, (EvalStackElement){.pointer = list}, true);
+        list = node;
+    }
+    object = new_object(heap, HEAP_LARGE_OBJECT_SIZE / sizeof(EvalStackElement));
+    heap_collect(heap, context_root, &object, true);
+    assert_int_equal(101, count_old_objects(heap));
+    heap->next_collection = 0;
+    while (!heap->sweeping)
+    {
+        heap_collect(heap, no_roots, NULL, false);
+    }
+    live_bytes = heap_live_bytes(heap);
+    object_free(heap, object);
+    assert_int_equal(live_bytes, heap_live_bytes(heap));
+    while (heap->sweeping)
+    {
+        heap_collect(heap, no_roots, NULL, false);
+    }
+    assert_int_equal(100, count_old_objects(heap));
+    heap_pop_root(heap);
+    heap_free(heap);
+    config.gc_increment_size = mark_increment;
+}
+
+void heap_page_pool_test(void **state)
+{
+    // A page pool only serves arenas, so it is rejected for a collected heap.
+    config.page_pool = pagepool_new(4096, 2);
+    assert_null(heap_new());
+
+    config.arena_chunk_size = 1024;
+    Heap *heap = heap_new();
+    assert_non_null(heap->arena);
+    assert_true(pagepool_contains(config.page_pool, new_object(heap, 2)));
+    heap_free(heap);
+    config.arena_chunk_size = 0;
+    pagepool_free(config.page_pool);
+    config.page_pool = NULL;
+
+    // Without a pool, only the chunk size turns on arena mode.
+    heap = heap_new();
+    assert_null(heap->arena);
+    heap_free(heap);
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test(heap_alloc_test),
+            cmocka_unit_test(heap_minor_collection_test),
+            cmocka_unit_test(heap_promotion_test),
+            cmocka_unit_test(heap_write_barrier_test),
+            cmocka_unit_test(heap_full_collection_test),
+            cmocka_unit_test(heap_non_reference_field_test),
+            cmocka_unit_test(heap_push_pop_root_test),
+            cmocka_unit_test(heap_should_collect_test),
+            cmocka_unit_test(heap_incremental_marking_test),
+            cmocka_unit_test(heap_deletion_barrier_test),
+            cmocka_unit_test(heap_allocate_black_test),
+            cmocka_unit_test(heap_parallel_collection_test),
+            cmocka_unit_test(heap_accounting_test),
+            cmocka_unit_test(heap_limit_test),
+            cmocka_unit_test(heap_release_test),
+            cmocka_unit_test(heap_page_pool_test),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "lz.h"
+
+#define STACK_INITIAL_CAPACITY 8
+
+static void assert_round_trip(const char *data, size_t size, size_t max_compressed)
+{
+    char *compressed = test_malloc(lz_bound(size));
+    size_t compressed_size = lz_compress(data, size, compressed);
+    assert_true(compressed_size <= lz_bound(size));
+    assert_true(compressed_size <= max_compressed);
+
+    char *decompressed = test_malloc(size + 1);
+    assert_true(lz_decompress(compressed, compressed_size, decompressed, size));
+    assert_memory_equal(data, decompressed, size);
+
+    // The size must match exactly, in both directions.
+    assert_false(lz_decompress(compressed, compressed_size, decompressed, size + 1));
+    if (size > 0)
+    {
+        assert_false(lz_decompress(compressed, compressed_size, decompressed, size - 1));
+    }
+
+    test_free(decompressed);
+    test_free(compressed);
+}
+
+void lz_empty_test(void **state)
+{
+    assert_round_trip("", 0, 0);
+}
+
+void lz_short_test(void **state)
+{
+    assert_round_trip("a", 1, 1 + 4);
+    assert_round_trip("abcabcabcabcabcabcabcabc", 24, 24 + 4);
+}
+
+void lz_repetitive_test(void **state)
+{
+    // Several blocks of 5-byte instructions with repeating opcodes, the shape of version 1 code.
+    size_t size = 3 * LZ_BLOCK_SIZE + 123;
+    char *data = test_malloc(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = i % 5 == 0 ? (char)(i / 5 % 7) : i % 5 == 4 ? (char)(i / 35) : 0;
+    }
+    assert_round_trip(data, size, size / 3);
+    test_free(data);
+}
+
+void lz_long_runs_test(void **state)
+{
+    // Literal and match lengths well beyond what fits in a token.
+    size_t size = 2 * LZ_BLOCK_SIZE;
+    char *data = test_malloc(size);
+    uint32_t random = 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        random = random * 1103515245 + 12345;
+        data[i] = i < 1000 || (i > 40000 && i < 41000) ? (char)(random >> 16) : 'x';
+    }
+    assert_round_trip(data, size, size / 10);
+    test_free(data);
+}
+
+void lz_incompressible_test(void **state)
+{
+    // Random bytes are stored, so they only grow by the block headers.
+    size_t size = LZ_BLOCK_SIZE + 1000;
+    char *data = test_malloc(size);
+    uint32_t random = 7;
+    for (size_t i = 0; i < size; i++)
+    {
+        random = random * 1103515245 + 12345;
+        data[i] = (char)(random >> 16);
+    }
+    assert_round_trip(data, size, size + 8);
+
+    char *compressed = test_malloc(lz_bound(size));
+    lz_compress(data, size, compressed);
+    assert_true(compressed[3] & 0x80);
+    test_free(compressed);
+    test_free(data);
+}
+
+void lz_corrupted_test(void **state)
+{
+    size_t size = 2 * LZ_BLOCK_SIZE;
+    char *data = test_malloc(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = (char)(i % 251 < 100 ? i % 7 : i % 13);
+    }
+    char *compressed = test_malloc(lz_bound(size));
+    size_t compressed_size = lz_compress(data, size, compressed);
+    char *decompressed = test_malloc(size);
+
+    // Every prefix is rejected.
+    for (size_t length = 0; length < compressed_size; length++)
+    {
+        assert_false(lz_decompress(compressed, length, decompressed, size));
+    }
+
+    // Changed bytes never make it write outside the destination, which the allocator of the tests would notice.
+    for (size_t i = 0; i < compressed_size; i += 3)
+    {
+        char original = compressed[i];
+        compressed[i] ^= 0x5A;
+        lz_decompress(compressed, compressed_size, decompressed, size);
+        compressed[i] = original;
+    }
+    assert_true(lz_decompress(compressed, compressed_size, decompressed, size));
+    assert_memory_equal(data, decompressed, size);
+
+    test_free(decompressed);
+    test_free(compressed);
+    test_free(data);
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test(lz_empty_test),
+            cmocka_unit_test(lz_short_test),
+            cmocka_unit_test(lz_repetitive_test),
+            cmocka_unit_test(lz_long_runs_test),
+            cmocka_unit_test(lz_incompressible_test),
+            cmocka_unit_test(lz_corrupted_test),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
\ No newline at end of file
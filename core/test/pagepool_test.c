@@ -0,0 +1,107 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "pagepool.h"
+
+#define STACK_INITIAL_CAPACITY 8
+#define THREADS 4
+#define ROUNDS 20000
+
+typedef struct
+{
+    PagePool *pool;
+    uintptr_t id;
+    atomic_size_t *errors;
+} Owner;
+
+void pagepool_new_test(void **state)
+{
+    PagePool *pool = pagepool_new(100, 4);
+    assert_int_equal(104, pool->page_size);
+    assert_int_equal(4, pool->capacity);
+    assert_int_equal(0, pool->pages_in_use);
+    pagepool_free(pool);
+}
+
+void pagepool_get_put_test(void **state)
+{
+    PagePool *pool = pagepool_new(64, 3);
+    char *first = pagepool_get(pool);
+    char *second = pagepool_get(pool);
+    char *third = pagepool_get(pool);
+    assert_ptr_equal(first + 64, second);
+    assert_ptr_equal(second + 64, third);
+    assert_null(pagepool_get(pool));
+    assert_int_equal(3, pool->pages_in_use);
+    assert_true(pagepool_contains(pool, third + 63));
+    assert_false(pagepool_contains(pool, third + 64));
+    // Pages that are given back are handed out again, the most recent one first.
+    pagepool_put(pool, first);
+    pagepool_put(pool, third);
+    assert_int_equal(1, pool->pages_in_use);
+    assert_ptr_equal(third, pagepool_get(pool));
+    assert_ptr_equal(first, pagepool_get(pool));
+    assert_null(pagepool_get(pool));
+    pagepool_free(pool);
+}
+
+static void *own_pages(void *argument)
+{
+    Owner *owner = argument;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        uintptr_t *page = pagepool_get(owner->pool);
+        if (!page)
+        {
+            continue;
+        }
+        // No other thread may get hold of the page until it is given back.
+        *page = owner->id;
+        for (int j = 0; j < 10; j++)
+        {
+            if (*(volatile uintptr_t *)page != owner->id)
+            {
+                atomic_fetch_add(owner->errors, 1);
+            }
+        }
+        pagepool_put(owner->pool, page);
+    }
+    return NULL;
+}
+
+void pagepool_concurrent_test(void **state)
+{
+    PagePool *pool = pagepool_new(64, THREADS / 2);
+    atomic_size_t errors = 0;
+    pthread_t threads[THREADS];
+    Owner owners[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+        owners[i] = (Owner){.pool = pool, .id = i + 1, .errors = &errors};
+        pthread_create(&threads[i], NULL, own_pages, &owners[i]);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    assert_int_equal(0, errors);
+    assert_int_equal(0, pool->pages_in_use);
+    pagepool_free(pool);
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test(pagepool_new_test),
+            cmocka_unit_test(pagepool_get_put_test),
+            cmocka_unit_test(pagepool_concurrent_test),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "pages.h"
+#include "arena.h"
+#include "inststream.h"
+
+#define STACK_INITIAL_CAPACITY 8
+
+void pages_alloc_test(void **state)
+{
+    PagesStats before = pages_stats();
+    char *pages = pages_alloc(3 * 1024 * 1024);
+    assert_non_null(pages);
+    assert_int_equal(0, (uintptr_t)pages % PAGES_HUGE_SIZE);
+    memset(pages, 1, 3 * 1024 * 1024);
+    assert_int_equal(1, pages[3 * 1024 * 1024 - 1]);
+    // Whether huge pages are actually used depends on the system, the range is rounded up to two of them either way.
+    PagesStats after = pages_stats();
+    size_t backed = after.hugetlb_bytes + after.advised_bytes - before.hugetlb_bytes - before.advised_bytes;
+    assert_true(backed == 0 || backed == 2 * PAGES_HUGE_SIZE);
+    pages_free(pages, 3 * 1024 * 1024);
+}
+
+void pages_arena_test(void **state)
+{
+    config.huge_pages = true;
+    Arena *arena = arena_new(PAGES_HUGE_SIZE - 64);
+    config.huge_pages = false;
+    assert_true(arena->huge_pages);
+    assert_int_equal(PAGES_HUGE_SIZE - sizeof(ArenaChunk), arena->chunk_size);
+    char *block = arena_alloc(arena, 1024);
+    assert_int_equal(0, ((uintptr_t)block - sizeof(ArenaChunk)) % PAGES_HUGE_SIZE);
+    // Blocks larger than a chunk still get a chunk of their own from the system allocator.
+    char *large = arena_alloc(arena, 2 * PAGES_HUGE_SIZE);
+    large[2 * PAGES_HUGE_SIZE - 1] = 1;
+    assert_int_equal(2, arena->chunks_count);
+    arena_free(arena);
+}
+
+void pages_small_arena_test(void **state)
+{
+    config.huge_pages = true;
+    Arena *arena = arena_new(1024);
+    config.huge_pages = false;
+    assert_false(arena->huge_pages);
+    assert_int_equal(1024, arena->chunk_size);
+    arena_free(arena);
+}
+
+void pages_inststream_test(void **state)
+{
+    config.huge_pages = true;
+    InstructionStream *small = inststream_new(100);
+    InstructionStream *large = inststream_new(PAGES_HUGE_SIZE / sizeof(Instruction));
+    config.huge_pages = false;
+    assert_false(small->huge_pages);
+    assert_true(large->huge_pages);
+    assert_int_equal(0, (uintptr_t)large->instructions % PAGES_HUGE_SIZE);
+    large->instructions[large->length - 1] = (Instruction){.opcode = RETURN, .operand = 0};
+    inststream_free(small);
+    inststream_free(large);
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test(pages_alloc_test),
+            cmocka_unit_test(pages_arena_test),
+            cmocka_unit_test(pages_small_arena_test),
+            cmocka_unit_test(pages_inststream_test),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include <stdatomic.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "parallel.h"
+
+#define STACK_INITIAL_CAPACITY 8
+#define ITEMS 100000
+#define CHUNK 1000
+
+typedef struct
+{
+    size_t count;
+    atomic_uint visits[ITEMS];
+    atomic_bool aligned;
+} Visits;
+
+static void visit(void *context, size_t start, size_t end)
+{
+    Visits *visits = context;
+    if (start % CHUNK != 0 || (end - start != CHUNK && end != visits->count))
+    {
+        atomic_store(&visits->aligned, false);
+    }
+    for (size_t i = start; i < end; i++)
+    {
+        atomic_fetch_add(&visits->visits[i], 1);
+    }
+}
+
+static void assert_visited_once(uint32_t threads, size_t count)
+{
+    static Visits visits;
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        atomic_init(&visits.visits[i], 0);
+    }
+    atomic_init(&visits.aligned, true);
+    visits.count = count;
+
+    parallel_for(threads, count, CHUNK, visit, &visits);
+
+    assert_true(atomic_load(&visits.aligned));
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        assert_int_equal(i < count ? 1 : 0, atomic_load(&visits.visits[i]));
+    }
+}
+
+void parallel_for_test(void **state)
+{
+    // The threads are only allocated by the calling thread.
+    assert_visited_once(1, ITEMS);
+    assert_visited_once(4, ITEMS);
+    assert_visited_once(4, ITEMS - CHUNK / 2);
+    assert_visited_once(200, 3 * CHUNK);
+}
+
+void parallel_for_empty_test(void **state)
+{
+    assert_visited_once(4, 0);
+    assert_visited_once(4, 1);
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test(parallel_for_test),
+            cmocka_unit_test(parallel_for_empty_test),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "pool.h"
+#include "object.h"
+#include "heap.h"
+
+#define STACK_INITIAL_CAPACITY 8
+
+static void no_roots(Heap *heap, HeapSlotVisitor visit, void *context)
+{
+}
+
+static int release_pool(void **state)
+{
+    pool_release();
+    return 0;
+}
+
+void pool_malloc_free_test(void **state)
+{
+    char *first = pool_malloc(20);
+    char *second = pool_malloc(20);
+    assert_int_equal(0, (uintptr_t)first % 8);
+    assert_ptr_equal(first + 32, second);
+    assert_int_equal(2, pool_stats.classes[1].allocations);
+    assert_int_equal(2, pool_stats.classes[1].live_blocks);
+    assert_int_equal(64, pool_stats.bytes_in_use);
+    assert_int_equal(1, pool_stats.pages);
+    pool_free(first);
+    assert_int_equal(1, pool_stats.classes[1].frees);
+    assert_int_equal(1, pool_stats.classes[1].live_blocks);
+    // Freed blocks are reused before the page is bumped any further.
+    assert_ptr_equal(first, pool_malloc(24));
+    assert_ptr_equal(second + 32, pool_malloc(17));
+    pool_free(NULL);
+}
+
+void pool_size_classes_test(void **state)
+{
+    size_t sizes[] = {0, 8, 9, 120, 121, 500, 1000, 4088};
+    uint32_t classes[] = {0, 0, 1, 7, 8, 15, 19, 23};
+    for (int i = 0; i < 8; i++)
+    {
+        void *block = pool_malloc(sizes[i]);
+        memset(block, 0xff, sizes[i]);
+        assert_int_equal(1, pool_stats.classes[classes[i]].live_blocks);
+        pool_free(block);
+    }
+}
+
+void pool_large_block_test(void **state)
+{
+    char *block = pool_malloc(POOL_MAX_BLOCK_SIZE);
+    memset(block, 1, POOL_MAX_BLOCK_SIZE);
+    assert_int_equal(1, pool_stats.large_allocations);
+    assert_int_equal(0, pool_stats.pages);
+    pool_free(block);
+    assert_int_equal(1, pool_stats.large_frees);
+}
+
+void pool_realloc_test(void **state)
+{
+    char *block = pool_realloc(NULL, 10);
+    strcpy(block, "LitenVM");
+    // Growing within the size class keeps the block where it is.
+    assert_ptr_equal(block, pool_realloc(block, 20));
+    block = pool_realloc(block, 100);
+    assert_string_equal("LitenVM", block);
+    block = pool_realloc(block, 10000);
+    assert_string_equal("LitenVM", block);
+    block = pool_realloc(block, 20000);
+    assert_string_equal("LitenVM", block);
+    block = pool_realloc(block, 8);
+    assert_memory_equal("LitenVM", block, 8);
+    assert_int_equal(1, pool_stats.classes[0].live_blocks);
+    assert_int_equal(1, pool_stats.large_allocations);
+    assert_int_equal(1, pool_stats.large_frees);
+    pool_free(block);
+    assert_int_equal(0, pool_stats.bytes_in_use);
+}
+
+void pool_calloc_test(void **state)
+{
+    int *block = pool_malloc(64 * sizeof(int));
+    memset(block, 0xff, 64 * sizeof(int));
+    pool_free(block);
+    block = pool_calloc(64, sizeof(int));
+    for (int i = 0; i < 64; i++)
+    {
+        assert_int_equal(0, block[i]);
+    }
+}
+
+void pool_config_test(void **state)
+{
+    // Installed as the allocator of the VM, every heap block, frame and stack goes through the pool.
+    Config saved = config;
+    set_config(pool_malloc, pool_calloc, pool_realloc, pool_free, STACK_INITIAL_CAPACITY);
+    config.nursery_size = 0;
+    Heap *heap = heap_new();
+    ConstantPoolEntryClass _class = {.index = 1, .instance_fields = 4, .instance_size = OBJECT_INSTANCE_SIZE(4)};
+    for (int i = 0; i < 1000; i++)
+    {
+        object_new(heap, &_class);
+    }
+    size_t live_blocks = 0;
+    for (int i = 0; i < POOL_SIZE_CLASSES; i++)
+    {
+        live_blocks += pool_stats.classes[i].live_blocks;
+    }
+    assert_true(live_blocks >= 1000);
+    heap_collect(heap, no_roots, NULL, true);
+    heap_free(heap);
+    assert_int_equal(0, pool_stats.bytes_in_use);
+    config = saved;
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test_teardown(pool_malloc_free_test, release_pool),
+            cmocka_unit_test_teardown(pool_size_classes_test, release_pool),
+            cmocka_unit_test_teardown(pool_large_block_test, release_pool),
+            cmocka_unit_test_teardown(pool_realloc_test, release_pool),
+            cmocka_unit_test_teardown(pool_calloc_test, release_pool),
+            cmocka_unit_test_teardown(pool_config_test, release_pool),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
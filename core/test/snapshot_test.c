@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "object.h"
+#include "string_class.h"
+#include "snapshot.h"
+
+#define STACK_INITIAL_CAPACITY 8
+
+// The instruction where the snapshot is taken, everything before it builds the state that is restored.
+#define SNAPSHOT_ADDRESS 17
+
+typedef struct
+{
+    ConstantPool *constpool;
+    InstructionStream *inststream;
+} CMockaState;
+
+static int setup(void **state)
+{
+    ConstantPool *constpool = constantpool_new(7);
+    constantpool_add(constpool, 1, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "<Main>", .fields = 0, .methods = 1, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, 2, (ConstantPoolEntry){.type = TYPE_METHOD, .data.method = {.name = "<main>", ._class = 1, .address = 2, .args = 1, .locals = 1}});
+    constantpool_add(constpool, 3, (ConstantPoolEntry){.type = TYPE_CLASS, .data._class = {.name = "Node", .fields = 3, .methods = 0, .parent = 0, .vtable = NULL}});
+    constantpool_add(constpool, 4, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "value", ._class = 3, .index = 0}});
+    constantpool_add(constpool, 5, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "name", ._class = 3, .index = 1}});
+    constantpool_add(constpool, 6, (ConstantPoolEntry){.type = TYPE_FIELD, .data.field = {.name = "next", ._class = 3, .index = 2}});
+    constantpool_add(constpool, 7, (ConstantPoolEntry){.type = TYPE_STRING, .data.string = {.value = "Hello!"}});
+
+    InstructionStream *inststream = inststream_new(24);
+    Instruction *instructions = inststream->instructions;
+    instructions[0] = (Instruction){.opcode = NEW, .operand = 1};
+    instructions[1] = (Instruction){.opcode = CALL, .operand = 2};
+    instructions[2] = (Instruction){.opcode = NEW, .operand = 3};
+    instructions[3] = (Instruction){.opcode = DUP, .operand = 0};
+    instructions[4] = (Instruction){.opcode = PUSH, .operand = 42};
+    instructions[5] = (Instruction){.opcode = POP_FIELD, .operand = 4};
+    instructions[6] = (Instruction){.opcode = DUP, .operand = 0};
+    instructions[7] = (Instruction){.opcode = NEW, .operand = CONSTPOOL_CLASS_STRING_BUILDER};
+    instructions[8] = (Instruction){.opcode = PUSH_STRING, .operand = 7};
+    instructions[9] = (Instruction){.opcode = CALL, .operand = CONSTPOOL_METHOD_STRING_BUILDER_APPEND_STRING};
+    instructions[10] = (Instruction){.opcode = CALL, .operand = CONSTPOOL_METHOD_STRING_BUILDER_TO_STRING};
+    instructions[11] = (Instruction){.opcode = POP_FIELD, .operand = 5};
+    instructions[12] = (Instruction){.opcode = POP_VAR, .operand = 1};
+    instructions[13] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[14] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[15] = (Instruction){.opcode = POP_FIELD, .operand = 6};
+    instructions[16] = (Instruction){.opcode = PUSH_STRING, .operand = 7};
+    instructions[17] = (Instruction){.opcode = POP, .operand = 0};
+    instructions[18] = (Instruction){.opcode = PUSH_VAR, .operand = 1};
+    instructions[19] = (Instruction){.opcode = PUSH_FIELD, .operand = 6};
+    instructions[20] = (Instruction){.opcode = PUSH_FIELD, .operand = 4};
+    instructions[21] = (Instruction){.opcode = PUSH, .operand = 1};
+    instructions[22] = (Instruction){.opcode = ADD, .operand = 0};
+    instructions[23] = (Instruction){.opcode = RETURN, .operand = 0};
+
+    constantpool_compute_vtables(constpool);
+    constantpool_compute_layouts(constpool, inststream);
+    constantpool_create_strings(constpool);
+
+    CMockaState *cmocka_state = config._malloc(sizeof(CMockaState));
+    cmocka_state->constpool = constpool;
+    cmocka_state->inststream = inststream;
+    *state = cmocka_state;
+    return 0;
+}
+
+static int teardown(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    constantpool_free(cmocka_state->constpool);
+    inststream_free(cmocka_state->inststream);
+    config._free(cmocka_state);
+    return 0;
+}
+
+static void write_snapshot(CMockaState *cmocka_state, const char *filename)
+{
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    assert_true(executor_step_until(executor, SNAPSHOT_ADDRESS));
+    FILE *file = fopen(filename, "wb");
+    assert_true(snapshot_write(executor, file));
+    fclose(file);
+    executor_free(executor);
+}
+
+static void assert_restored(CMockaState *cmocka_state)
+{
+    write_snapshot(cmocka_state, "snapshot.lvms");
+
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    assert_int_equal(SNAPSHOT_OK, snapshot_restore(executor, "snapshot.lvms"));
+    assert_int_equal(SNAPSHOT_ADDRESS, executor->inststream->current);
+
+    // The constant string on the evaluation stack is the one of the constant pool, not a copy.
+    assert_int_equal(1, executor->evalstack->length);
+    assert_ptr_equal(constantpool_get(cmocka_state->constpool, 7)->data.string.object, evalstack_top(executor->evalstack).pointer);
+    assert_true(*(bool *)stack_top(executor->evalrefs));
+
+    assert_int_equal(1, executor->callstack->length);
+    CallStackFrame frame = callstack_top(executor->callstack);
+    assert_int_equal(2, frame.vars_count);
+    assert_true(frame.refs[0]);
+    assert_int_equal(1, object_get_class(frame.vars[0].pointer));
+    assert_true(frame.refs[1]);
+    void *node = frame.vars[1].pointer;
+    assert_int_equal(3, object_get_class(node));
+    assert_int_equal(42, object_get_field(node, 0)->integer);
+    assert_string_equal("Hello!", string_get_value(object_get_field(node, 1)->pointer));
+    assert_ptr_equal(node, object_get_field(node, 2)->pointer);
+
+    executor_step_all(executor);
+    assert_int_equal(EXECUTOR_OK, executor->error);
+    assert_int_equal(43, evalstack_top(executor->evalstack).integer);
+    executor_free(executor);
+    remove("snapshot.lvms");
+}
+
+void snapshot_restore_test(void **state)
+{
+    assert_restored(*state);
+}
+
+void snapshot_restore_arena_test(void **state)
+{
+    config.arena_chunk_size = 4096;
+    assert_restored(*state);
+    config.arena_chunk_size = 0;
+}
+
+void snapshot_restore_collect_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    write_snapshot(cmocka_state, "snapshot.lvms");
+
+    // The restored objects belong to the heap like any other, a full collection keeps them alive.
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    assert_int_equal(SNAPSHOT_OK, snapshot_restore(executor, "snapshot.lvms"));
+    executor_collect_garbage(executor);
+    assert_true(executor_live_bytes(executor) > 0);
+    void *node = callstack_top(executor->callstack).vars[1].pointer;
+    assert_string_equal("Hello!", string_get_value(object_get_field(node, 1)->pointer));
+    executor_step_all(executor);
+    assert_int_equal(43, evalstack_top(executor->evalstack).integer);
+    executor_free(executor);
+    remove("snapshot.lvms");
+}
+
+void snapshot_wrong_program_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    write_snapshot(cmocka_state, "snapshot.lvms");
+
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    cmocka_state->inststream->instructions[21].operand = 2;
+    assert_int_equal(SNAPSHOT_WRONG_PROGRAM, snapshot_restore(executor, "snapshot.lvms"));
+    cmocka_state->inststream->instructions[21].operand = 1;
+    assert_int_equal(SNAPSHOT_CANNOT_OPEN, snapshot_restore(executor, "missing.lvms"));
+    executor_free(executor);
+    remove("snapshot.lvms");
+}
+
+void snapshot_truncated_test(void **state)
+{
+    CMockaState *cmocka_state = *state;
+    write_snapshot(cmocka_state, "snapshot.lvms");
+
+    FILE *file = fopen("snapshot.lvms", "rb");
+    char data[4096];
+    size_t size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+
+    // Every prefix of the snapshot is rejected and leaves the executor empty.
+    Executor *executor = executor_new(cmocka_state->constpool, cmocka_state->inststream);
+    for (size_t length = 1; length < size; length++)
+    {
+        file = fopen("truncated.lvms", "wb");
+        fwrite(data, 1, length, file);
+        fclose(file);
+        assert_int_equal(SNAPSHOT_INVALID, snapshot_restore(executor, "truncated.lvms"));
+        assert_int_equal(0, executor->evalstack->length);
+        assert_int_equal(0, executor->callstack->length);
+    }
+    executor_free(executor);
+    remove("truncated.lvms");
+    remove("snapshot.lvms");
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test_setup_teardown(snapshot_restore_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(snapshot_restore_arena_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(snapshot_restore_collect_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(snapshot_wrong_program_test, setup, teardown),
+            cmocka_unit_test_setup_teardown(snapshot_truncated_test, setup, teardown),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
\ No newline at end of file
@@ -54,6 +54,34 @@ void stack_multiple_push_pop_test(void **state)
     stack_free(stack);
 }
 
+void stack_reserved_test(void **state)
+{
+    Stack *stack = stack_new_reserved(sizeof(int), 1000);
+    void *elements = stack->elements;
+    assert_int_equal(1000, stack->capacity);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        stack_push(stack, &i);
+    }
+
+    assert_ptr_equal(elements, stack->elements);
+    assert_int_equal(999, *(int *)stack_top(stack));
+
+    // The next push would land on the guard page.
+    assert_false(stack_in_guard(stack, stack_top(stack)));
+    assert_true(stack_in_guard(stack, (int *)stack_top(stack) + 1));
+
+    for (int i = 999; i >= 0; i--)
+    {
+        assert_int_equal(i, *(int *)stack_top(stack));
+        stack_pop(stack);
+    }
+
+    assert_int_equal(1000, stack->capacity);
+    stack_free(stack);
+}
+
 int main()
 {
     set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
@@ -63,6 +91,7 @@ int main()
             cmocka_unit_test(stack_new_test),
             cmocka_unit_test(stack_single_push_pop_test),
             cmocka_unit_test(stack_multiple_push_pop_test),
+            cmocka_unit_test(stack_reserved_test),
         };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,133 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "unit_testing.h"
+
+#include "config.h"
+#include "workdeque.h"
+
+#define STACK_INITIAL_CAPACITY 8
+#define THIEVES 3
+#define ELEMENTS 100000
+
+typedef struct
+{
+    WorkDeque *deque;
+    atomic_bool *done;
+} Thief;
+
+void workdeque_new_test(void **state)
+{
+    WorkDeque *deque = workdeque_new(5);
+    assert_int_equal(7, deque->mask);
+    assert_true(workdeque_empty(deque));
+    assert_null(workdeque_pop(deque));
+    assert_null(workdeque_steal(deque));
+    workdeque_free(deque);
+}
+
+void workdeque_push_pop_test(void **state)
+{
+    WorkDeque *deque = workdeque_new(8);
+    int elements[8];
+    for (int i = 0; i < 8; i++)
+    {
+        assert_true(workdeque_push(deque, &elements[i]));
+    }
+    assert_false(workdeque_push(deque, &elements[0]));
+    assert_false(workdeque_empty(deque));
+    // The owner works in LIFO order, thieves take the oldest element.
+    assert_ptr_equal(&elements[7], workdeque_pop(deque));
+    assert_ptr_equal(&elements[0], workdeque_steal(deque));
+    for (int i = 6; i >= 1; i--)
+    {
+        assert_ptr_equal(&elements[i], workdeque_pop(deque));
+    }
+    assert_null(workdeque_pop(deque));
+    assert_true(workdeque_empty(deque));
+    workdeque_free(deque);
+}
+
+void workdeque_wrap_around_test(void **state)
+{
+    WorkDeque *deque = workdeque_new(4);
+    int elements[3];
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            assert_true(workdeque_push(deque, &elements[i]));
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            assert_ptr_equal(&elements[i], workdeque_steal(deque));
+        }
+    }
+    assert_true(workdeque_empty(deque));
+    workdeque_free(deque);
+}
+
+static void *steal(void *argument)
+{
+    Thief *thief = argument;
+    while (!atomic_load(thief->done) || !workdeque_empty(thief->deque))
+    {
+        uint8_t *element = workdeque_steal(thief->deque);
+        if (element)
+        {
+            (*element)++;
+        }
+    }
+    return NULL;
+}
+
+void workdeque_concurrent_steal_test(void **state)
+{
+    WorkDeque *deque = workdeque_new(64);
+    uint8_t *taken = test_calloc(ELEMENTS, sizeof(uint8_t));
+    atomic_bool done = false;
+    pthread_t threads[THIEVES];
+    Thief thief = {.deque = deque, .done = &done};
+    for (int i = 0; i < THIEVES; i++)
+    {
+        pthread_create(&threads[i], NULL, steal, &thief);
+    }
+    // Every element must be taken exactly once, either by the owner or by one of the thieves.
+    for (int i = 0; i < ELEMENTS; i++)
+    {
+        while (!workdeque_push(deque, &taken[i]))
+        {
+            uint8_t *element = workdeque_pop(deque);
+            if (element)
+            {
+                (*element)++;
+            }
+        }
+    }
+    atomic_store(&done, true);
+    for (int i = 0; i < THIEVES; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < ELEMENTS; i++)
+    {
+        assert_int_equal(1, taken[i]);
+    }
+    test_free(taken);
+    workdeque_free(deque);
+}
+
+int main()
+{
+    set_config(test_malloc_func, test_calloc_func, test_realloc_func, test_free_func, STACK_INITIAL_CAPACITY);
+
+    const struct CMUnitTest tests[] =
+        {
+            cmocka_unit_test(workdeque_new_test),
+            cmocka_unit_test(workdeque_push_pop_test),
+            cmocka_unit_test(workdeque_wrap_around_test),
+            cmocka_unit_test(workdeque_concurrent_steal_test),
+        };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}